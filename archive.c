@@ -0,0 +1,591 @@
+/* Rolling archive of the bit stream, see archive.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/stat.h>
+#include "common.h"
+#include "archive.h"
+
+#define LOAD(p)       __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE(p, v)   __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/* Index records a buffer can carry */
+#define INDEX_RECORDS 4096
+
+/* Alignment of the buffers, a page */
+#define BUFFER_ALIGN 4096
+
+struct archive_buffer {
+    unsigned char *data;
+    int len;
+    unsigned char *index;   // records of the frames that start in data
+    int index_len;
+    uint32_t segment;
+    int end_segment;        // the last buffer of the segment
+    uint64_t start_us;      // when the encoder began to fill it
+};
+
+struct archive {
+    char *prefix;
+    double seconds;         // 0 for no limit
+    uint64_t bytes;         // 0 for no limit
+    int index_fd;
+
+    pthread_t thread;
+    sem_t ready;
+    int stop;
+
+    /* The encoder fills the buffer at head, the thread writes the one at
+     * tail. Both count up forever */
+    struct archive_buffer buffers[ARCHIVE_BUFFERS];
+    uint64_t head;
+    uint64_t tail;
+
+    /* the encoder: the segment being filled, and the frame being read */
+    uint32_t segment;
+    uint64_t segment_bytes;
+    double segment_seconds;
+    int segment_frames;
+    unsigned char header[3];
+    int header_len;
+    int frame_len;
+    int frame_left;
+    int frame_lost;         // the rest of the frame is skipped
+
+    /* the records of the dropped frames, which wait for a buffer */
+    uint64_t lost;
+    uint64_t lost_us;
+    uint64_t lost_step_us;
+    uint64_t lost_offset;
+    uint32_t lost_segment;
+
+    /* the thread: the segment being written */
+    int fd;
+    uint32_t fd_segment;
+    int fd_open;
+    uint64_t synced_us;
+};
+
+static uint64_t wall_clock_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void put_le(unsigned char *p, uint64_t v, int bytes)
+{
+    int i;
+
+    for (i = 0; i < bytes; i++)
+        p[i] = v >> (8 * i);
+}
+
+static uint64_t get_le(const unsigned char *p, int bytes)
+{
+    uint64_t v = 0;
+    int i;
+
+    for (i = bytes - 1; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+/* Length of the Layer II frame of header, or 0 if it is not one */
+static int frame_length(const unsigned char *h, double *seconds)
+{
+    int version, index, freq, pad;
+
+    /* the sync word, and layer II */
+    if (h[0] != 0xff || (h[1] & 0xf6) != 0xf4)
+        return 0;
+
+    version = (h[1] >> 3) & 1;
+    index = h[2] >> 4;
+    freq = (h[2] >> 2) & 3;
+    pad = (h[2] >> 1) & 1;
+    if (index == 0 || index == 15 || freq == 3)
+        return 0;
+
+    *seconds = 1152 / (s_freq[version][freq] * 1000);
+    return 144 * bitrate[version][index] / s_freq[version][freq] + pad;
+}
+
+static char *segment_name(const char *prefix, uint32_t segment)
+{
+    int size = strlen(prefix) + 16;
+    char *name = malloc(size);
+
+    if (name)
+        snprintf(name, size, "%s-%06u.mp2", prefix, segment);
+    return name;
+}
+
+static int write_all(int fd, const unsigned char *p, int len,
+        const char *name)
+{
+    while (len > 0) {
+        ssize_t ret = write(fd, p, len);
+
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0) {
+            fprintf(stderr, "Could not write to \"%s\": %s\n", name,
+                    strerror(errno));
+            return -1;
+        }
+        p += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+/*
+ * The writer thread
+ */
+
+static void close_segment(struct archive *a)
+{
+    if (!a->fd_open)
+        return;
+
+    if (a->fd != -1) {
+        fdatasync(a->fd);
+        close(a->fd);
+        a->fd = -1;
+    }
+    fdatasync(a->index_fd);
+    a->synced_us = wall_clock_us();
+    a->fd_open = 0;
+}
+
+static void open_segment(struct archive *a, uint32_t segment)
+{
+    char *name = segment_name(a->prefix, segment);
+
+    a->fd_segment = segment;
+    a->fd_open = 1;
+    a->fd = name ? open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+    if (a->fd == -1)
+        fprintf(stderr, "Could not create the archive segment \"%s\": %s\n",
+                name ? name : a->prefix, strerror(errno));
+    free(name);
+}
+
+static void write_buffer(struct archive *a, struct archive_buffer *b)
+{
+    if (!a->fd_open || a->fd_segment != b->segment) {
+        close_segment(a);
+        open_segment(a, b->segment);
+    }
+
+    if (a->fd != -1 && write_all(a->fd, b->data, b->len, a->prefix) != 0) {
+        /* the rest of the segment is lost */
+        close(a->fd);
+        a->fd = -1;
+    }
+
+    /* the frames are on their way to the disk before their records */
+    write_all(a->index_fd, b->index, b->index_len, a->prefix);
+
+    if (b->end_segment)
+        close_segment(a);
+    else if (wall_clock_us() - a->synced_us >=
+            ARCHIVE_SYNC_SECONDS * 1000000ULL) {
+        if (a->fd != -1)
+            fdatasync(a->fd);
+        fdatasync(a->index_fd);
+        a->synced_us = wall_clock_us();
+    }
+}
+
+static void *writer_thread(void *arg)
+{
+    struct archive *a = arg;
+
+    for (;;) {
+        uint64_t tail = a->tail;
+        struct archive_buffer *b;
+
+        sem_wait(&a->ready);
+        if (tail == LOAD(&a->head)) {
+            if (LOAD(&a->stop))
+                break;
+            continue;
+        }
+
+        b = &a->buffers[tail % ARCHIVE_BUFFERS];
+        write_buffer(a, b);
+        b->len = 0;
+        b->index_len = 0;
+        STORE(&a->tail, tail + 1);
+    }
+
+    close_segment(a);
+    return NULL;
+}
+
+/*
+ * The encoder
+ */
+
+/* The buffer being filled, or NULL if they all wait to be written */
+static struct archive_buffer *filling(struct archive *a)
+{
+    struct archive_buffer *b;
+
+    if (a->head - LOAD(&a->tail) >= ARCHIVE_BUFFERS)
+        return NULL;
+
+    b = &a->buffers[a->head % ARCHIVE_BUFFERS];
+    if (b->len == 0 && b->index_len == 0) {
+        b->segment = a->segment;
+        b->end_segment = 0;
+        b->start_us = wall_clock_us();
+    }
+    return b;
+}
+
+static void submit(struct archive *a, int end_segment)
+{
+    a->buffers[a->head % ARCHIVE_BUFFERS].end_segment = end_segment;
+    STORE(&a->head, a->head + 1);
+    sem_post(&a->ready);
+}
+
+/* The buffer being filled, with room for len bytes of stream and records
+ * index records. It is handed to the thread first if they do not fit, so
+ * that a frame is never split. NULL if the buffers all wait to be
+ * written */
+static struct archive_buffer *reserve(struct archive *a, int len,
+        int records)
+{
+    struct archive_buffer *b = filling(a);
+
+    if (b && (b->len + len > ARCHIVE_BUFFER_SIZE ||
+                b->index_len + records * ARCHIVE_INDEX_RECORD >
+                INDEX_RECORDS * ARCHIVE_INDEX_RECORD)) {
+        submit(a, 0);
+        b = filling(a);
+    }
+    return b;
+}
+
+/* Copy to the space that was reserved */
+static void append(struct archive *a, struct archive_buffer *b,
+        const unsigned char *data, int len)
+{
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    a->segment_bytes += len;
+}
+
+static void add_record(struct archive_buffer *b, uint64_t time_us,
+        uint64_t offset, uint32_t segment, int len)
+{
+    unsigned char *record = b->index + b->index_len;
+
+    put_le(record, time_us, 8);
+    put_le(record + 8, offset, 8);
+    put_le(record + 16, segment, 4);
+    put_le(record + 20, len, 4);
+    b->index_len += ARCHIVE_INDEX_RECORD;
+}
+
+/* Write the records of the dropped frames, which come before the next
+ * one. Returns -1 if the buffers all wait to be written */
+static int add_lost_records(struct archive *a)
+{
+    while (a->lost > 0) {
+        struct archive_buffer *b = reserve(a, 0, 1);
+
+        if (b == NULL)
+            return -1;
+        add_record(b, a->lost_us, a->lost_offset, a->lost_segment, 0);
+        a->lost_us += a->lost_step_us;
+        a->lost--;
+    }
+    return 0;
+}
+
+/* Start the next segment, before a frame */
+static int rotate(struct archive *a)
+{
+    if (filling(a) == NULL)
+        return -1;
+
+    submit(a, 1);
+    a->segment++;
+    a->segment_bytes = 0;
+    a->segment_seconds = 0;
+    a->segment_frames = 0;
+    return 0;
+}
+
+/* Lose the frame that starts, its record waits for a buffer */
+static void drop(struct archive *a, uint64_t now, double seconds)
+{
+    if (a->lost == 0) {
+        a->lost_us = now;
+        a->lost_step_us = seconds * 1000000;
+        a->lost_offset = a->segment_bytes;
+        a->lost_segment = a->segment;
+    }
+    a->lost++;
+    a->frame_lost = 1;
+}
+
+int archive_write(struct archive *a, const unsigned char *data, int len)
+{
+    uint64_t now = wall_clock_us();
+    struct archive_buffer *b;
+    int ret = 0;
+
+    while (len > 0) {
+        double seconds;
+
+        if (a->frame_left > 0) {
+            int n = len < a->frame_left ? len : a->frame_left;
+
+            if (!a->frame_lost)
+                append(a, filling(a), data, n);
+            data += n;
+            len -= n;
+            a->frame_left -= n;
+            continue;
+        }
+
+        a->header[a->header_len++] = *data++;
+        len--;
+        if (a->header_len < 3)
+            continue;
+
+        a->frame_len = frame_length(a->header, &seconds);
+        if (a->frame_len == 0) {
+            /* out of sync: keep the byte, and look a byte further */
+            if ((b = reserve(a, 1, 0)) != NULL)
+                append(a, b, a->header, 1);
+            else
+                ret = -1;
+            memmove(a->header, a->header + 1, 2);
+            a->header_len = 2;
+            continue;
+        }
+
+        a->header_len = 0;
+        a->frame_left = a->frame_len - 3;
+        a->frame_lost = 0;
+
+        /* at a low bit rate too, the thread gets the stream every
+           ARCHIVE_SYNC_SECONDS, and not when a buffer is full */
+        b = filling(a);
+        if (b != NULL && (b->len > 0 || b->index_len > 0) &&
+                now - b->start_us >= ARCHIVE_SYNC_SECONDS * 1000000ULL)
+            submit(a, 0);
+
+        /* the frame is archived whole, or gets a record of length 0 */
+        if (add_lost_records(a) != 0 ||
+                (a->segment_frames > 0 &&
+                 ((a->seconds > 0 && a->segment_seconds >= a->seconds) ||
+                  (a->bytes > 0 &&
+                   a->segment_bytes + a->frame_len > a->bytes)) &&
+                 rotate(a) != 0) ||
+                (b = reserve(a, a->frame_len, 1)) == NULL) {
+            drop(a, now, seconds);
+            ret = -1;
+            continue;
+        }
+
+        add_record(b, now, a->segment_bytes, a->segment, a->frame_len);
+        append(a, b, a->header, 3);
+        a->segment_seconds += seconds;
+        a->segment_frames++;
+    }
+
+    return ret;
+}
+
+/* Open the index, or continue it */
+static int open_index(struct archive *a)
+{
+    unsigned char header[ARCHIVE_INDEX_HEADER];
+    unsigned char record[ARCHIVE_INDEX_RECORD];
+    char *name = malloc(strlen(a->prefix) + 5);
+    struct stat st;
+    off_t records;
+
+    if (name == NULL)
+        return -1;
+    sprintf(name, "%s.idx", a->prefix);
+
+    a->index_fd = open(name, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (a->index_fd == -1 || fstat(a->index_fd, &st) != 0) {
+        fprintf(stderr, "Could not open the archive index \"%s\": %s\n",
+                name, strerror(errno));
+        free(name);
+        return -1;
+    }
+
+    if (st.st_size == 0) {
+        memset(header, 0, sizeof(header));
+        memcpy(header, "TLAX", 4);
+        put_le(header + 4, ARCHIVE_INDEX_VERSION, 4);
+        put_le(header + 8, ARCHIVE_INDEX_RECORD, 4);
+        free(name);
+        return write_all(a->index_fd, header, sizeof(header), a->prefix);
+    }
+
+    if (pread(a->index_fd, header, sizeof(header), 0) != sizeof(header) ||
+            memcmp(header, "TLAX", 4) != 0 ||
+            get_le(header + 4, 4) != ARCHIVE_INDEX_VERSION ||
+            get_le(header + 8, 4) != ARCHIVE_INDEX_RECORD) {
+        fprintf(stderr, "\"%s\" is not the index of an archive\n", name);
+        free(name);
+        return -1;
+    }
+    free(name);
+
+    /* a record the encoder did not finish is dropped, and the segments
+       continue after the last one */
+    records = (st.st_size - ARCHIVE_INDEX_HEADER) / ARCHIVE_INDEX_RECORD;
+    if (ftruncate(a->index_fd,
+                ARCHIVE_INDEX_HEADER + records * ARCHIVE_INDEX_RECORD) != 0 ||
+            (records > 0 && pread(a->index_fd, record, sizeof(record),
+                ARCHIVE_INDEX_HEADER + (records - 1) * ARCHIVE_INDEX_RECORD) !=
+             sizeof(record))) {
+        fprintf(stderr, "Could not continue the archive index of \"%s\": %s\n",
+                a->prefix, strerror(errno));
+        return -1;
+    }
+    if (records > 0)
+        a->segment = get_le(record + 16, 4) + 1;
+    return 0;
+}
+
+/* prefix[:seconds[:megabytes]] */
+static int parse_spec(struct archive *a, const char *spec)
+{
+    long values[2];
+    int count = 0;
+    char *p;
+
+    a->prefix = strdup(spec);
+    if (a->prefix == NULL)
+        return -1;
+
+    while (count < 2 && (p = strrchr(a->prefix, ':')) != NULL) {
+        char *end;
+
+        values[count] = strtol(p + 1, &end, 10);
+        if (p[1] == '\0' || *end != '\0' || values[count] < 0)
+            break;
+        *p = '\0';
+        count++;
+    }
+
+    a->seconds = ARCHIVE_SECONDS;
+    if (count == 2) {
+        a->seconds = values[1];
+        a->bytes = (uint64_t)values[0] << 20;
+    }
+    else if (count == 1)
+        a->seconds = values[0];
+
+    if (a->prefix[0] == '\0') {
+        fprintf(stderr, "The archive needs a prefix, not \"%s\"\n", spec);
+        return -1;
+    }
+    return 0;
+}
+
+struct archive *archive_open(const char *spec)
+{
+    struct archive *a = calloc(1, sizeof(*a));
+    int i;
+
+    if (a == NULL) {
+        fprintf(stderr, "Unable to allocate the archive\n");
+        return NULL;
+    }
+    a->index_fd = -1;
+    a->fd = -1;
+
+    if (parse_spec(a, spec) != 0 || open_index(a) != 0)
+        goto fail;
+
+    for (i = 0; i < ARCHIVE_BUFFERS; i++) {
+        struct archive_buffer *b = &a->buffers[i];
+
+        if (posix_memalign((void **)&b->data, BUFFER_ALIGN,
+                    ARCHIVE_BUFFER_SIZE) != 0 ||
+                (b->index = malloc(INDEX_RECORDS *
+                                   ARCHIVE_INDEX_RECORD)) == NULL) {
+            fprintf(stderr, "Unable to allocate the archive buffers\n");
+            goto fail;
+        }
+    }
+
+    a->synced_us = wall_clock_us();
+    sem_init(&a->ready, 0, 0);
+    if (pthread_create(&a->thread, NULL, writer_thread, a) != 0) {
+        fprintf(stderr, "Unable to start the archive writer thread\n");
+        sem_destroy(&a->ready);
+        goto fail;
+    }
+
+    return a;
+
+fail:
+    for (i = 0; i < ARCHIVE_BUFFERS; i++) {
+        free(a->buffers[i].data);
+        free(a->buffers[i].index);
+    }
+    if (a->index_fd != -1)
+        close(a->index_fd);
+    free(a->prefix);
+    free(a);
+    return NULL;
+}
+
+void archive_close(struct archive *a)
+{
+    struct archive_buffer *b;
+    int i;
+
+    /* a frame the stream stopped in gets a record of length 0 */
+    if (a->frame_left > 0 && !a->frame_lost) {
+        b = filling(a);
+        b->len -= a->frame_len - a->frame_left;
+        put_le(b->index + b->index_len - ARCHIVE_INDEX_RECORD + 20, 0, 4);
+    }
+
+    /* the thread makes room for the records of the dropped frames */
+    while (add_lost_records(a) != 0)
+        usleep(1000);
+
+    b = filling(a);
+    if (b && (b->len > 0 || b->index_len > 0))
+        submit(a, 1);
+
+    STORE(&a->stop, 1);
+    sem_post(&a->ready);
+    pthread_join(a->thread, NULL);
+    sem_destroy(&a->ready);
+
+    close(a->index_fd);
+    for (i = 0; i < ARCHIVE_BUFFERS; i++) {
+        free(a->buffers[i].data);
+        free(a->buffers[i].index);
+    }
+    free(a->prefix);
+    free(a);
+}
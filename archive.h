@@ -0,0 +1,66 @@
+#ifndef _ARCHIVE_H_
+#define _ARCHIVE_H_
+
+#include <stdint.h>
+
+/* Rolling archive of the bit stream, for compliance logging
+ *
+ * The output given as archive://prefix[:seconds[:megabytes]] writes the
+ * stream to a series of segment files prefix-000000.mp2,
+ * prefix-000001.mp2, ... A new segment is started at the first Layer II
+ * frame once the segment holds seconds of audio (dflt 3600), or
+ * megabytes of stream (dflt 0, no limit), so every segment can be
+ * decoded on its own. Nothing has to be restarted for that.
+ *
+ * The encoder copies the frames into ARCHIVE_BUFFERS buffers of
+ * ARCHIVE_BUFFER_SIZE bytes, which a thread of its own writes out. A
+ * buffer is handed to the thread when the next frame does not fit, or
+ * ARCHIVE_SYNC_SECONDS after it was started, and the thread calls
+ * fdatasync() on the segment and the index every ARCHIVE_SYNC_SECONDS
+ * seconds, and when a segment is done. A frame is never split between
+ * buffers. When all buffers wait to be written, frames are dropped
+ * whole instead of holding up the encoder.
+ *
+ * Every Layer II frame gets a record in the index prefix.idx, so that
+ * the record of frame n is at ARCHIVE_INDEX_HEADER + n *
+ * ARCHIVE_INDEX_RECORD bytes: it gives the segment of the frame, where
+ * the frame starts in it, and the wall-clock time at which it was
+ * written. The index starts with "TLAX", then the version and the size
+ * of a record, 32-bit little-endian, and 4 bytes of zeros. A record is,
+ * little-endian:
+ *   0  uint64  CLOCK_REALTIME in microseconds
+ *   8  uint64  offset of the frame in its segment
+ *   16 uint32  number of the segment
+ *   20 uint32  length of the frame
+ * A frame that was dropped has a record of length 0, at the offset it
+ * would have had. When the encoder is started again with the same
+ * prefix, the index is continued, and so are the frame and segment
+ * numbers.
+ */
+
+#define ARCHIVE_BUFFERS       8
+#define ARCHIVE_BUFFER_SIZE   (1 << 20)
+#define ARCHIVE_SYNC_SECONDS  10
+#define ARCHIVE_SECONDS       3600
+
+#define ARCHIVE_INDEX_VERSION 1
+#define ARCHIVE_INDEX_HEADER  16
+#define ARCHIVE_INDEX_RECORD  24
+
+struct archive;
+
+/* Open the archive of spec, prefix[:seconds[:megabytes]], and start its
+ * writer thread. Returns NULL on failure */
+struct archive *archive_open(const char *spec);
+
+/* Copy len bytes of the stream to the archive, never blocks.
+ * returns 0  on success
+ *         -1 if a frame was dropped
+ */
+int archive_write(struct archive *archive, const unsigned char *data,
+        int len);
+
+/* Write out what was given, stop the thread and close the files */
+void archive_close(struct archive *archive);
+
+#endif
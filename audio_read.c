@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <fcntl.h>
 #include "common.h"
 #include "encoder.h"
 #include "options.h"
@@ -11,7 +14,10 @@
 #include <jack/ringbuffer.h>
 #endif
 #include "audio_read.h"
+#include "pcm_ring.h"
 #include "vlc_input.h"
+#include "shm_input.h"
+#include "timing.h"
 
 #if defined(JACK_INPUT)
 jack_port_t *input_port_left;
@@ -31,6 +37,9 @@ const size_t sample_size = sizeof(jack_default_audio_sample_t);
 #define DEFAULT_RB_SIZE 16384       /* ringbuffer size in frames */
 jack_ringbuffer_t *rb;
 
+/* samples per channel that did not fit into the ringbuffer */
+volatile unsigned long jack_dropped_samples = 0;
+
 /* setup_jack()
  *
  * PURPOSE:  connect to jack, setup the ports, the ringbuffer
@@ -140,6 +149,10 @@ int process(jack_nframes_t nframes, void *arg) {
     /* Sndfile requires interleaved data.  It is simpler here to
      * just queue interleaved samples to a single ringbuffer. */
     //fprintf(stderr, "process()\n");
+    if (jack_ringbuffer_write_space(rb) < 4 * nframes) {
+        jack_dropped_samples += nframes - jack_ringbuffer_write_space(rb) / 4;
+    }
+
     for (i = 0; i < nframes; i++) {
         /*
            jack_ringbuffer_write(rb, (void *)(in_left + i), sample_size);
@@ -175,6 +188,52 @@ void jack_shutdown(void *arg)
 }
 #endif // defined(JACK_INPUT)
 
+/************************************************************************
+ *
+ * input_buffer_fill()
+ *
+ * PURPOSE:  tells how much audio is waiting in the buffer of the
+ *   JACK, VLC or shared-memory input, in samples per channel
+ *
+ ************************************************************************/
+
+int input_buffer_fill (unsigned long *fill, unsigned long *capacity)
+{
+    if (0) { }
+#if defined(JACK_INPUT)
+    else if (glopts.input_select == INPUT_SELECT_JACK) {
+        /* process() writes interleaved stereo shorts */
+        size_t rd = jack_ringbuffer_read_space(rb);
+        *fill = rd / 4;
+        *capacity = (rd + jack_ringbuffer_write_space(rb)) / 4;
+        return 0;
+    }
+#endif
+    else if (glopts.input_select == INPUT_SELECT_SHM) {
+        shm_in_buffer_fill(fill, capacity);
+        return 0;
+    }
+#if defined(VLC_INPUT)
+    else if (glopts.input_select == INPUT_SELECT_VLC) {
+        size_t vlc_fill, vlc_capacity;
+        vlc_in_buffer_fill(&vlc_fill, &vlc_capacity);
+        *fill = vlc_fill;
+        *capacity = vlc_capacity;
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+unsigned long input_dropped_samples (void)
+{
+#if defined(JACK_INPUT)
+    return jack_dropped_samples;
+#else
+    return 0;
+#endif
+}
+
 /************************************************************************
  *
  * read_samples()
@@ -188,10 +247,10 @@ void jack_shutdown(void *arg)
  ************************************************************************/
 
 unsigned long read_samples (music_in_t* musicin, short sample_buffer[2304],
-        unsigned long num_samples, unsigned long frame_size)
+        uint64_t num_samples, unsigned long frame_size)
 {
     unsigned long samples_read;
-    static unsigned long samples_to_read;
+    static uint64_t samples_to_read;
     static char init = TRUE;
 
     void* jack_sample_buffer;
@@ -258,6 +317,40 @@ unsigned long read_samples (music_in_t* musicin, short sample_buffer[2304],
 #endif
     }
 
+    /* The byte order is fixed in condition_audio() */
+
+    if (num_samples != MAX_U_64_NUM)
+        samples_to_read -= samples_read;
+
+    if (samples_read < frame_size && samples_read > 0) {
+        /* fill out frame with zeros */
+        for (; samples_read < frame_size; sample_buffer[samples_read++] = 0);
+        samples_to_read = 0;
+        samples_read = frame_size;
+    }
+    return (samples_read);
+}
+
+/************************************************************************
+ *
+ * get_audio()
+ *
+ * PURPOSE:  reads a frame of audio data from a file into the
+ *   sample ring (see pcm_ring.h), separating the left and right
+ *   channels
+ *
+ *
+ ************************************************************************/
+    unsigned long
+get_audio (music_in_t* musicin, struct audio_levels *levels,
+        uint64_t num_samples, int nch, frame_header *header)
+{
+    short insamp[2304];
+    unsigned long samples_read;
+    int in_nch = (nch == 2 || glopts.downmix == TRUE) ? 2 : 1;
+    int swap;
+    TIMING_START(t_audio);
+
     /*
        Samples are big-endian. If this is a little-endian machine
        we must swap
@@ -269,68 +362,168 @@ unsigned long read_samples (music_in_t* musicin, short sample_buffer[2304],
             exit (1);
         }
     }
-    if (NativeByteOrder != order_littleEndian || (glopts.byteswap == TRUE))
-        SwapBytesInWords (sample_buffer, samples_read);
+    swap = NativeByteOrder != order_littleEndian || (glopts.byteswap == TRUE);
+
+    if (glopts.input_select == INPUT_SELECT_SHM) {
+        /* converted in place, without going through insamp */
+        double *fbuffer[2];
+
+        pcm_ring_advance ();
+        fbuffer[0] = pcm_ring_frame (0);
+        fbuffer[1] = pcm_ring_frame (1);
+        samples_read = shm_in_read (nch, swap, fbuffer, levels);
+        if (samples_read > 0)
+            pcm_ring_commit ();
+    }
+    else {
+        samples_read =
+            read_samples (musicin, insamp, num_samples, (unsigned long) 1152 * in_nch);
 
-    if (num_samples != MAX_U_32_NUM)
-        samples_to_read -= samples_read;
+        if (samples_read > 0) {
+            double *fbuffer[2];
 
-    if (samples_read < frame_size && samples_read > 0) {
-        /* fill out frame with zeros */
-        for (; samples_read < frame_size; sample_buffer[samples_read++] = 0);
-        samples_to_read = 0;
-        samples_read = frame_size;
+            pcm_ring_advance ();
+            fbuffer[0] = pcm_ring_frame (0);
+            fbuffer[1] = pcm_ring_frame (1);
+            condition_audio (insamp, in_nch, nch, swap, fbuffer, levels);
+            pcm_ring_commit ();
+        }
     }
+
+    TIMING_STOP(TIMING_GET_AUDIO, t_audio);
     return (samples_read);
 }
 
 /************************************************************************
  *
- * get_audio()
+ * condition_audio()
+ *
+ * PURPOSE:  prepares one frame of interleaved PCM for the encoder
  *
- * PURPOSE:  reads a frame of audio data from a file to the buffer,
- *   aligns the data for future processing, and separates the
- *   left and right channels
+ * SEMANTICS:
+ * In a single pass over #insamp#, swaps the bytes if #swap# is set (-x),
+ * swaps the channels (-g) or mixes them down to mono (-a), splits the
+ * channels, and converts them to the [-1, 1) range used by the filterbank
+ * and the psy models into #fbuffer#. The absolute
+ * peak and the RMS of each channel are returned in #levels#, and are 0
+ * for the second channel of a mono frame. #levels# also tells whether
+ * the frame is constant, digital silence or a DC offset, for the
+ * silence fast path (see silence.h).
  *
+ * A byte-swapped input is swapped first into a buffer of its own, and
+ * -g only swaps where the channels go, so that the stereo, downmix and
+ * mono loops have no branches nor dependencies between iterations, and
+ * gcc vectorizes them at -O2.
  *
  ************************************************************************/
-    unsigned long
-get_audio (music_in_t* musicin, short buffer[2][1152], unsigned long num_samples,
-        int nch, frame_header *header)
+
+static inline int16_t swap16 (int16_t s)
 {
+    return (int16_t)(((uint16_t)s >> 8) | ((uint16_t)s << 8));
+}
+
+/* The stereo loop. The outputs must be restrict parameters of a call,
+ * and the levels local, for gcc to vectorize it */
+static __attribute__ ((noinline)) void condition_stereo (const short *insamp,
+        double *restrict out_l, double *restrict out_r, int peak[2],
+        int64_t sum_sq[2], int first[2], int diff[2])
+{
+    const double norm = 1.0 / SCALE;
+    int peak_l = 0, peak_r = 0, diff_l = 0, diff_r = 0;
+    int64_t sum_l = 0, sum_r = 0;
     int j;
-    short insamp[2304];
-    unsigned long samples_read;
+
+    first[0] = insamp[0];
+    first[1] = insamp[1];
+    for (j = 0; j < 1152; j++) {
+        int l = insamp[2 * j];
+        int r = insamp[2 * j + 1];
+        int al = l < 0 ? -l : l;
+        int ar = r < 0 ? -r : r;
+        out_l[j] = l * norm;
+        out_r[j] = r * norm;
+        peak_l = al > peak_l ? al : peak_l;
+        peak_r = ar > peak_r ? ar : peak_r;
+        sum_l += l * l;
+        sum_r += r * r;
+        diff_l |= l ^ first[0];
+        diff_r |= r ^ first[1];
+    }
+    peak[0] = peak_l;
+    peak[1] = peak_r;
+    sum_sq[0] = sum_l;
+    sum_sq[1] = sum_r;
+    diff[0] = diff_l;
+    diff[1] = diff_r;
+}
+
+void condition_audio (const short *insamp, int in_nch, int nch, int swap,
+        double *fbuffer[2], struct audio_levels *levels)
+{
+    double *restrict out_l = fbuffer[0];
+    double *restrict out_r = fbuffer[1];
+    const double norm = 1.0 / SCALE;
+    int j, ch;
+    int peak[2] = { 0, 0 };
+    int64_t sum_sq[2] = { 0, 0 };
+    /* the bits in which a sample differs from the first one */
+    int first[2] = { 0, 0 };
+    int diff[2] = { 0, 0 };
+    static short swapped[2 * 1152];
+
+    if (swap) {
+        for (j = 0; j < in_nch * 1152; j++)
+            swapped[j] = swap16 (insamp[j]);
+        insamp = swapped;
+    }
 
     if (nch == 2) {     /* stereo */
-        samples_read =
-            read_samples (musicin, insamp, num_samples, (unsigned long) 2304);
         if (glopts.channelswap == TRUE) {
-            for (j = 0; j < 1152; j++) {
-                buffer[1][j] = insamp[2 * j];
-                buffer[0][j] = insamp[2 * j + 1];
-            }
-        } else {
-            for (j = 0; j < 1152; j++) {
-                buffer[0][j] = insamp[2 * j];
-                buffer[1][j] = insamp[2 * j + 1];
-            }
+            int t;
+            int64_t t64;
+
+            condition_stereo (insamp, out_r, out_l, peak, sum_sq, first,
+                    diff);
+            t = peak[0]; peak[0] = peak[1]; peak[1] = t;
+            t = first[0]; first[0] = first[1]; first[1] = t;
+            t = diff[0]; diff[0] = diff[1]; diff[1] = t;
+            t64 = sum_sq[0]; sum_sq[0] = sum_sq[1]; sum_sq[1] = t64;
         }
-    } else if (glopts.downmix == TRUE) {
-        samples_read =
-            read_samples (musicin, insamp, num_samples, (unsigned long) 2304);
+        else
+            condition_stereo (insamp, out_l, out_r, peak, sum_sq, first,
+                    diff);
+    } else if (in_nch == 2) {   /* downmix */
+        first[0] = (insamp[0] + insamp[1]) / 2;
         for (j = 0; j < 1152; j++) {
-            buffer[0][j] = 0.5 * (insamp[2 * j] + insamp[2 * j + 1]);
+            int l = insamp[2 * j];
+            int r = insamp[2 * j + 1];
+            int m = (l + r) / 2;
+            int am = m < 0 ? -m : m;
+            out_l[j] = m * norm;
+            peak[0] = am > peak[0] ? am : peak[0];
+            sum_sq[0] += m * m;
+            diff[0] |= m ^ first[0];
         }
     } else {            /* mono */
-        samples_read =
-            read_samples (musicin, insamp, num_samples, (unsigned long) 1152);
+        first[0] = insamp[0];
         for (j = 0; j < 1152; j++) {
-            buffer[0][j] = insamp[j];
-            /* buffer[1][j] = 0;  don't bother zeroing this buffer. MFC Nov 99 */
+            int m = insamp[j];
+            int am = m < 0 ? -m : m;
+            out_l[j] = m * norm;
+            peak[0] = am > peak[0] ? am : peak[0];
+            sum_sq[0] += m * m;
+            diff[0] |= m ^ first[0];
+            /* the second channel is not used in mono, leave it alone */
         }
     }
-    return (samples_read);
+
+    for (ch = 0; ch < 2; ch++) {
+        /* -32768 would not fit the int16 level fields of the ZMQ output */
+        levels->peak[ch] = peak[ch] > INT16_MAX ? INT16_MAX : peak[ch];
+        levels->rms[ch] = sqrt ((double) sum_sq[ch] / 1152);
+        levels->value[ch] = first[ch];
+    }
+    levels->constant = (diff[0] | diff[1]) == 0;
 }
 
 
@@ -381,7 +574,9 @@ void SwapBytesInWords (short *loc, int words)
 
 int aiff_read_headers (FILE * file_ptr, IFF_AIFF * aiff_ptr)
 {
-    int chunkSize, subSize, sound_position;
+    /* the sizes are unsigned 32-bit, files can be up to 4 GB */
+    int64_t chunkSize, subSize;
+    int sound_position;
 
     if (fseek (file_ptr, 0, SEEK_SET) != 0)
         return -1;
@@ -389,7 +584,7 @@ int aiff_read_headers (FILE * file_ptr, IFF_AIFF * aiff_ptr)
     if (Read32BitsHighLow (file_ptr) != IFF_ID_FORM)
         return -1;
 
-    chunkSize = Read32BitsHighLow (file_ptr);
+    chunkSize = (uint32_t) Read32BitsHighLow (file_ptr);
 
     if (Read32BitsHighLow (file_ptr) != IFF_ID_AIFF)
         return -1;
@@ -400,7 +595,7 @@ int aiff_read_headers (FILE * file_ptr, IFF_AIFF * aiff_ptr)
         switch (Read32BitsHighLow (file_ptr)) {
 
             case IFF_ID_COMM:
-                chunkSize -= subSize = Read32BitsHighLow (file_ptr);
+                chunkSize -= subSize = (uint32_t) Read32BitsHighLow (file_ptr);
                 aiff_ptr->numChannels = Read16BitsHighLow (file_ptr);
                 subSize -= 2;
                 aiff_ptr->numSampleFrames = Read32BitsHighLow (file_ptr);
@@ -416,29 +611,120 @@ int aiff_read_headers (FILE * file_ptr, IFF_AIFF * aiff_ptr)
                 break;
 
             case IFF_ID_SSND:
-                chunkSize -= subSize = Read32BitsHighLow (file_ptr);
+                chunkSize -= subSize = (uint32_t) Read32BitsHighLow (file_ptr);
                 aiff_ptr->blkAlgn.offset = Read32BitsHighLow (file_ptr);
                 subSize -= 4;
                 aiff_ptr->blkAlgn.blockSize = Read32BitsHighLow (file_ptr);
                 subSize -= 4;
                 sound_position = ftell (file_ptr) + aiff_ptr->blkAlgn.offset;
-                if (fseek (file_ptr, (long) subSize, SEEK_CUR) != 0)
+                if (fseeko (file_ptr, (off_t) subSize, SEEK_CUR) != 0)
                     return -1;
                 aiff_ptr->sampleType = IFF_ID_SSND;
                 break;
 
             default:
-                chunkSize -= subSize = Read32BitsHighLow (file_ptr);
-                while (subSize > 0) {
-                    getc (file_ptr);
-                    subSize -= 1;
-                }
+                chunkSize -= subSize = (uint32_t) Read32BitsHighLow (file_ptr);
+                if (fseeko (file_ptr, (off_t) subSize, SEEK_CUR) != 0)
+                    return -1;
                 break;
         }
     }
     return sound_position;
 }
 
+/*****************************************************************************
+ *
+ *  Read the headers of a WAVE file up to its sound data: RIFF, or RF64 and
+ *  BW64 with 64-bit sizes for files of more than 4 GB. Returns the
+ *  position of the sound data, -1 if this is not a WAVE file, and -2 if
+ *  it has no fmt or data chunk.
+ *
+ *****************************************************************************/
+
+static uint64_t get_le (const unsigned char *p, int bytes)
+{
+    uint64_t v = 0;
+    int i;
+
+    for (i = bytes - 1; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+off_t wave_read_headers (FILE * file_ptr, RIFF_WAVE * wave_ptr)
+{
+    /* the SubFormat GUID of PCM, after its first two bytes */
+    static const unsigned char pcm_guid[14] = {
+        0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00,
+        0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71
+    };
+    unsigned char buf[40];
+    uint64_t ds64_data_size = MAX_U_64_NUM;
+    int is64, have_fmt = 0;
+
+    if (fseeko (file_ptr, 0, SEEK_SET) != 0 || fread (buf, 1, 12, file_ptr) != 12
+            || memcmp (buf + 8, "WAVE", 4) != 0)
+        return -1;
+    if (memcmp (buf, "RIFF", 4) == 0)
+        is64 = FALSE;
+    else if (memcmp (buf, "RF64", 4) == 0 || memcmp (buf, "BW64", 4) == 0)
+        is64 = TRUE;
+    else
+        return -1;
+
+    memset (wave_ptr, 0, sizeof (*wave_ptr));
+    for (;;) {
+        uint64_t size, pad;
+
+        if (fread (buf, 1, 8, file_ptr) != 8)
+            return -2;
+        size = get_le (buf + 4, 4);
+        /* chunks are padded to an even length */
+        pad = size & 1;
+
+        if (memcmp (buf, "data", 4) == 0) {
+            if (!have_fmt)
+                return -2;
+            if (is64 && size == 0xFFFFFFFF)
+                size = ds64_data_size;
+            else if (size == 0 || size == 0xFFFFFFFF)
+                size = MAX_U_64_NUM;	/* written while it was recorded */
+            wave_ptr->dataSize = size;
+            return ftello (file_ptr);
+        }
+
+        if (is64 && memcmp (buf, "ds64", 4) == 0 && size >= 24) {
+            /* the 64-bit sizes of the RIFF, of the data and the sample
+               count, followed by a table for other chunks */
+            if (fread (buf, 1, 24, file_ptr) != 24)
+                return -2;
+            ds64_data_size = get_le (buf + 8, 8);
+            size -= 24;
+        }
+        else if (memcmp (buf, "fmt ", 4) == 0 && size >= 16) {
+            size_t n = size < sizeof (buf) ? size : sizeof (buf);
+
+            if (fread (buf, 1, n, file_ptr) != n)
+                return -2;
+            wave_ptr->formatTag = get_le (buf, 2);
+            wave_ptr->numChannels = get_le (buf + 2, 2);
+            wave_ptr->sampleRate = get_le (buf + 4, 4);
+            wave_ptr->bitsPerSample = get_le (buf + 14, 2);
+            if (wave_ptr->formatTag == WAVE_FORMAT_EXTENSIBLE) {
+                if (n == sizeof (buf) && memcmp (buf + 26, pcm_guid, 14) == 0)
+                    wave_ptr->formatTag = get_le (buf + 24, 2);
+                else
+                    wave_ptr->formatTag = 0;
+            }
+            have_fmt = 1;
+            size -= n;
+        }
+
+        if (fseeko (file_ptr, (off_t) (size + pad), SEEK_CUR) != 0)
+            return -2;
+    }
+}
+
 /*****************************************************************************
  *
  *  Seek past some Audio Interchange File Format (AIFF) headers to sound data.
@@ -470,18 +756,17 @@ int aiff_seek_to_sound_data (FILE * file_ptr)
  **************************************************************/
     void
 parse_input_file (FILE * musicin, char inPath[MAX_NAME_SIZE], frame_header *header,
-        unsigned long *num_samples)
+        uint64_t *num_samples)
 {
 
     IFF_AIFF pcm_aiff_data;
-    long soundPosition;
-
-    unsigned char wave_header_buffer[40]; //HH fixed
-    int wave_header_read = 0;
-    int wave_header_stereo = -1;
-    int wave_header_16bit = -1;
+    RIFF_WAVE pcm_wave_data;
+    off_t soundPosition;
     unsigned long samplerate;
 
+    /* large reads for inputs of hours, before the first one */
+    setvbuf (musicin, NULL, _IOFBF, INPUT_READ_SIZE);
+
     /*************************** STDIN ********************************/
     /* check if we're reading from stdin. Assume it's a raw PCM file. */
     /* Of course, you could be piping a WAV file into stdin. Not done in this code */
@@ -489,16 +774,17 @@ parse_input_file (FILE * musicin, char inPath[MAX_NAME_SIZE], frame_header *head
     if ((strcmp (inPath, "/dev/stdin") == 0)) {
         fprintf (stderr, "Reading from stdin\n");
         fprintf (stderr, "Remember to set samplerate with '-s'.\n");
-        *num_samples = MAX_U_32_NUM;    /* huge sound file */
+        *num_samples = MAX_U_64_NUM;    /* huge sound file */
         return;
     }
 
     if (fseek (musicin, 0L, SEEK_SET) == -1) {
         fprintf (stderr, "Input is not seekable, assuming pipe with raw PCM\n");
         fprintf (stderr, "Remember to set samplerate with '-s'.\n");
-        *num_samples = MAX_U_32_NUM;    /* huge sound file */
+        *num_samples = MAX_U_64_NUM;    /* huge sound file */
         return;
     }
+    posix_fadvise (fileno (musicin), 0, 0, POSIX_FADV_SEQUENTIAL);
 
     /****************************  AIFF ********************************/
     if ((soundPosition = aiff_read_headers (musicin, &pcm_aiff_data)) != -1) {
@@ -516,7 +802,8 @@ parse_input_file (FILE * musicin, char inPath[MAX_NAME_SIZE], frame_header *head
                 pcm_aiff_data.sampleRate);
 
         /* Determine number of samples in sound file */
-        *num_samples = pcm_aiff_data.numChannels * pcm_aiff_data.numSampleFrames;
+        *num_samples = (uint64_t) pcm_aiff_data.numChannels *
+            pcm_aiff_data.numSampleFrames;
 
         if (pcm_aiff_data.numChannels == 1) {
             header->mode = MPG_MD_MONO;
@@ -526,46 +813,18 @@ parse_input_file (FILE * musicin, char inPath[MAX_NAME_SIZE], frame_header *head
     }
 
     /**************************** WAVE *********************************/
-    /*   Nick Burch <The_Leveller@newmail.net> */
-    /*********************************/
-    /* Wave File Headers:   (Dec)    */
-    /* 8-11 = "WAVE"                 */
-    /* 22 = Stereo / Mono            */
-    /*       01 = mono, 02 = stereo  */
-    /* 24 = Sampling Frequency       */
-    /* 32 = Data Rate                */
-    /*       01 = x1 (8bit Mono)     */
-    /*       02 = x2 (8bit Stereo or */
-    /*                16bit Mono)    */
-    /*       04 = x4 (16bit Stereo)  */
-    /*********************************/
-
-    fseek (musicin, 0, SEEK_SET);
-    fread (wave_header_buffer, 1, 40, musicin);
-
-    if (wave_header_buffer[8] == 'W' && wave_header_buffer[9] == 'A'
-            && wave_header_buffer[10] == 'V' && wave_header_buffer[11] == 'E') {
+    /*   Nick Burch <The_Leveller@newmail.net>, RF64 and BW64 for        */
+    /*   files of more than 4 GB, WAVE_FORMAT_EXTENSIBLE                */
+    /********************************************************************/
+    if ((soundPosition = wave_read_headers (musicin, &pcm_wave_data)) != -1) {
         fprintf (stderr, "Parsing Wave File Header\n");
-        if (NativeByteOrder == order_unknown) {
-            NativeByteOrder = DetermineByteOrder ();
-            if (NativeByteOrder == order_unknown) {
-                fprintf (stderr, "byte order not determined\n");
-                exit (1);
-            }
-        }
-        if (NativeByteOrder == order_littleEndian) {
-            samplerate = wave_header_buffer[24] +
-                (wave_header_buffer[25] << 8) +
-                (wave_header_buffer[26] << 16) +
-                (wave_header_buffer[27] << 24);
-        } else {
-            samplerate = wave_header_buffer[27] +
-                (wave_header_buffer[26] << 8) +
-                (wave_header_buffer[25] << 16) +
-                (wave_header_buffer[24] << 24);
+        if (soundPosition < 0 || fseeko (musicin, soundPosition, SEEK_SET) != 0) {
+            fprintf (stderr, "Could not seek to PCM sound data in \"%s\".\n",
+                    inPath);
+            exit (1);
         }
-        /* Wave File */
-        wave_header_read = 1;
+
+        samplerate = pcm_wave_data.sampleRate;
         switch (samplerate) {
             case 44100:
             case 48000:
@@ -589,45 +848,36 @@ parse_input_file (FILE * musicin, char inPath[MAX_NAME_SIZE], frame_header *head
             exit (0);
         }
 
-        if ((long) wave_header_buffer[22] == 1) {
+        if (pcm_wave_data.numChannels == 1) {
             fprintf (stderr, ">>> Input Wave File is Mono\n");
-            wave_header_stereo = 0;
             header->mode = MPG_MD_MONO;
             header->mode_ext = 0;
         }
-        if ((long) wave_header_buffer[22] == 2) {
+        else if (pcm_wave_data.numChannels == 2)
             fprintf (stderr, ">>> Input Wave File is Stereo\n");
-            wave_header_stereo = 1;
-        }
-        if ((long) wave_header_buffer[32] == 1) {
-            fprintf (stderr, ">>> Input Wave File is 8 Bit\n");
-            wave_header_16bit = 0;
-            fprintf (stderr, "Input File must be 16 Bit! Please Re-sample");
+        else {
+            fprintf (stderr, "Sound data is not mono or stereo in \"%s\".\n",
+                    inPath);
             exit (1);
         }
-        if ((long) wave_header_buffer[32] == 2) {
-            if (wave_header_stereo == 1) {
-                fprintf (stderr, ">>> Input Wave File is 8 Bit\n");
-                wave_header_16bit = 0;
-                fprintf (stderr, "Input File must be 16 Bit! Please Re-sample");
-                exit (1);
-            } else {
-                /* fprintf(stderr,  ">>> Input Wave File is 16 Bit\n" ); */
-                wave_header_16bit = 1;
-            }
-        }
-        if ((long) wave_header_buffer[32] == 4) {
-            /* fprintf(stderr,  ">>> Input Wave File is 16 Bit\n" ); */
-            wave_header_16bit = 1;
+
+        if (pcm_wave_data.formatTag != WAVE_FORMAT_PCM) {
+            fprintf (stderr, "Sound data is not PCM in \"%s\".\n", inPath);
+            exit (1);
         }
-        /* should probably use the wave header to determine size here FIXME MFC Feb 2003 */
-        *num_samples = MAX_U_32_NUM;
-        if (fseek (musicin, 44, SEEK_SET) != 0) {   /* there's a way of calculating the size of the
-                                                       wave header. i'll just jump 44 to start with */
-            fprintf (stderr, "Could not seek to PCM sound data in \"%s\".\n",
-                    inPath);
+        if (pcm_wave_data.bitsPerSample != 16) {
+            fprintf (stderr, ">>> Input Wave File is %d Bit\n",
+                    pcm_wave_data.bitsPerSample);
+            fprintf (stderr, "Input File must be 16 Bit! Please Re-sample\n");
             exit (1);
         }
+
+        /* Determine number of samples in sound file, or read up to its
+           end if the size was not written */
+        if (pcm_wave_data.dataSize == MAX_U_64_NUM)
+            *num_samples = MAX_U_64_NUM;
+        else
+            *num_samples = pcm_wave_data.dataSize / sizeof (short);
         return;
     }
 
@@ -637,7 +887,7 @@ parse_input_file (FILE * musicin, char inPath[MAX_NAME_SIZE], frame_header *head
     fseek (musicin, 0, SEEK_SET);
     /* Assume it is a huge sound file since there's no real info available */
     /* FIXME: Could always fstat the file? Probably not worth it. MFC Feb 2003 */
-    *num_samples = MAX_U_32_NUM;
+    *num_samples = MAX_U_64_NUM;
 }
 
 
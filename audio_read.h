@@ -1,3 +1,6 @@
+#include <stdint.h>
+#include <sys/types.h>
+
 /* AIFF Definitions */
 
 #define IFF_ID_FORM 0x464f524d	/* "FORM" */
@@ -9,6 +12,23 @@
 #define AIFF_FORM_HEADER_SIZE 12
 #define AIFF_SSND_HEADER_SIZE 16
 
+/* WAVE Definitions */
+
+#define WAVE_FORMAT_PCM        0x0001
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+/* Bytes read from a file input at a time, so that hours of PCM stream
+ * through in few large reads */
+#define INPUT_READ_SIZE (1 << 20)
+
+
+/* Levels of one frame of audio, measured by condition_audio() */
+struct audio_levels {
+    int peak[2];     /* largest absolute sample value, 0 to 32767 */
+    double rms[2];   /* root mean square, on the same scale */
+    int constant;    /* every sample of a channel has the same value */
+    int value[2];    /* that value, when constant */
+};
 
 typedef struct blockAlign_struct
 {
@@ -28,21 +48,44 @@ typedef struct IFF_AIFF_struct
 }
 IFF_AIFF;
 
+/* The fmt and data chunks of a RIFF, RF64 or BW64 WAVE file */
+typedef struct RIFF_WAVE_struct
+{
+  int formatTag;		/* the SubFormat of WAVE_FORMAT_EXTENSIBLE */
+  int numChannels;
+  unsigned long sampleRate;
+  int bitsPerSample;
+  uint64_t dataSize;		/* MAX_U_64_NUM if not known */
+}
+RIFF_WAVE;
+
 #if defined(JACK_INPUT)
 void setup_jack(frame_header *header, const char* jackname);
 int process(jack_nframes_t nframes, void *arg);
 #endif
 void jack_shutdown(void *arg);
 
-void parse_input_file (FILE *musicin, char *, frame_header *header, unsigned long *num_samples);
+void parse_input_file (FILE *musicin, char *, frame_header *header, uint64_t *num_samples);
 void aiff_check (char *file_name, IFF_AIFF * pcm_aiff_data, int *version);
 
 int aiff_read_headers (FILE *, IFF_AIFF *);
+off_t wave_read_headers (FILE *, RIFF_WAVE *);
 int aiff_seek_to_sound_data (FILE *);
 enum byte_order DetermineByteOrder (void);
 void SwapBytesInWords (short *loc, int words);
- unsigned long read_samples (music_in_t*, short[2304], unsigned long,
+ unsigned long read_samples (music_in_t*, short[2304], uint64_t,
 				   unsigned long);
- unsigned long get_audio (music_in_t*, short[2][1152], unsigned long,
+ unsigned long get_audio (music_in_t*, struct audio_levels *, uint64_t,
 				int, frame_header *header);
+void condition_audio (const short *insamp, int in_nch, int nch, int swap,
+        double *fbuffer[2], struct audio_levels *levels);
+
+/* Get the number of samples per channel waiting in the buffer of a
+ * live input (JACK, VLC or shared memory), and the size of that buffer.
+ * Returns 0 on success, -1 if the input is not buffered */
+int input_buffer_fill (unsigned long *fill, unsigned long *capacity);
+
+/* Number of samples per channel the JACK input had to drop
+ * because its ringbuffer was full */
+unsigned long input_dropped_samples (void);
 
@@ -0,0 +1,1546 @@
+/*
+ * toolame-bench - benchmarks for the toolame-dab encoder
+ *
+ * Measures the speed of the encoder kernels on a set of prepared frames
+ * (microbenchmarks), and the end-to-end encoding speed of the toolame-dab
+ * executable for every psy model and a set of bitrates.
+ *
+ * The input is either a synthetic signal or a 16-bit PCM WAV file given
+ * with -i. Every benchmark runs in its own process, so that the static
+ * state that the kernels keep between frames always starts fresh.
+ *
+ * The results are written to stdout, one tab-separated line per benchmark:
+ *
+ *   name  config  ns_per_frame  frames_per_second  realtime_factor
+ *
+ * Lines starting with # are comments. The format is kept stable so that
+ * the output of two commits can be compared with diff or a spreadsheet.
+ *
+ * With -g, it instead encodes a matrix of generated signals with
+ * toolame-dab and prints a hash of every output bitstream, and its SNR
+ * against the signal once decoded by the decoder of the loopback check:
+ *
+ *   golden  config  hash  bytes  snr
+ *
+ * With -c reference, the hashes are compared to a file written by -g
+ * before a change, and the exit status tells if all outputs are
+ * identical. As toolame-dab is built with -march=native, the reference
+ * must come from the same machine.
+ *
+ * With -f floors, the SNR of every output must reach the floor of its
+ * configuration in floors, lines of
+ *
+ *   floor  config  snr
+ *
+ * This does not depend on the compiler nor the machine, golden-snr.txt
+ * holds the floors of the matrix and is run by make check and ctest.
+ *
+ * With -l, a few signals are encoded both by toolame-dab and through
+ * libtoolame, pushed in chunks of odd sizes, and the two bitstreams
+ * must be identical. make check and ctest run it too:
+ *
+ *   library  config  hash  hash_of_libtoolame
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "common.h"
+#include "encoder.h"
+#include "options.h"
+#include "bitstream.h"
+#include "availbits.h"
+#include "subband.h"
+#include "encode_new.h"
+#include "crc.h"
+#include "psycho_n1.h"
+#include "psycho_0.h"
+#include "psycho_1.h"
+#include "psycho_2.h"
+#include "psycho_3.h"
+#include "psycho_4.h"
+#include "musicin.h"
+#include "audio_read.h"
+#include "pcm_ring.h"
+#include "loopback.h"
+#include "libtoolame.h"
+
+#define BENCH_FORMAT_VERSION 1
+
+/* Default number of frames prepared for the microbenchmarks */
+#define DFLT_BENCH_FRAMES 64
+
+/* Default length of the end-to-end input, in seconds */
+#define DFLT_E2E_SECONDS 10
+
+/* Default length of the golden signals, in seconds */
+#define DFLT_GOLDEN_SECONDS 3
+
+/* SNR of a stream that is the signal, or silence for silence, in dB */
+#define GOLDEN_SNR_MAX 120.0
+
+/* SNR of a stream that could not be decoded */
+#define GOLDEN_SNR_NONE -999.0
+
+#define FPAD_LENGTH 2
+
+/************************************************************************
+ *
+ * Signal generation
+ *
+ ************************************************************************/
+
+enum signal_type {
+    SIGNAL_MUSIC = 0,
+    SIGNAL_SWEEP,
+    SIGNAL_NOISE,
+    SIGNAL_TRANSIENTS,
+    SIGNAL_SILENCE
+};
+
+static unsigned int noise_state;
+
+/* Deterministic white noise in [-1, 1) */
+static double noise(void)
+{
+    noise_state = noise_state * 1103515245 + 12345;
+    return (double)((noise_state >> 8) & 0xFFFF) / 32768.0 - 1.0;
+}
+
+static short clip(double x)
+{
+    long v = lrint(x * 32767.0);
+    if (v > 32767) v = 32767;
+    if (v < -32768) v = -32768;
+    return (short)v;
+}
+
+/* Fill out with nsamples interleaved samples per channel */
+static void generate_signal(enum signal_type type, long rate, int nch,
+        long nsamples, short *out)
+{
+    long n;
+    int ch;
+
+    noise_state = 1;
+
+    for (n = 0; n < nsamples; n++) {
+        double t = (double)n / rate;
+
+        for (ch = 0; ch < nch; ch++) {
+            double x = 0;
+
+            switch (type) {
+                case SIGNAL_MUSIC:
+                    {
+                        /* a chord with some harmonics, a slow envelope,
+                           a bit of noise and a drum hit every 500ms */
+                        static const double notes[] = { 220.0, 277.2, 329.6, 440.0 };
+                        double env = 0.6 + 0.4 * sin(2 * PI * 0.7 * t + ch);
+                        double beat = fmod(t, 0.5);
+                        int k, h;
+
+                        for (k = 0; k < 4; k++) {
+                            double f = notes[k] * (1.0 + 0.002 * ch);
+                            for (h = 1; h <= 4; h++) {
+                                x += 0.08 / h * sin(2 * PI * f * h * t + k);
+                            }
+                        }
+                        x *= env;
+                        x += 0.01 * noise();
+                        if (beat < 0.05) {
+                            x += 0.4 * noise() * exp(-beat * 80.0);
+                        }
+                    }
+                    break;
+                case SIGNAL_SWEEP:
+                    {
+                        /* logarithmic sweep from 20Hz to rate/2, repeated
+                           every 4 seconds */
+                        const double len = 4.0;
+                        const double f0 = 20.0, f1 = rate / 2.0;
+                        double ts = fmod(t, len);
+                        double k = log(f1 / f0);
+                        double phase = 2 * PI * f0 * len / k * (exp(ts / len * k) - 1);
+                        x = 0.5 * sin(phase + ch * PI / 2);
+                    }
+                    break;
+                case SIGNAL_NOISE:
+                    x = 0.3 * noise();
+                    break;
+                case SIGNAL_TRANSIENTS:
+                    {
+                        /* clicks every 100ms, short noise bursts every 370ms */
+                        long period_click = rate / 10;
+                        long period_burst = rate * 37 / 100;
+                        if (n % period_click == 0)
+                            x = 0.9;
+                        if (n % period_burst < rate / 500)
+                            x += 0.5 * noise();
+                    }
+                    break;
+                case SIGNAL_SILENCE:
+                    break;
+            }
+            out[n * nch + ch] = clip(x);
+        }
+    }
+}
+
+/* Write a WAV file with the canonical 44 byte header */
+static int write_wav(const char *path, const short *samples, long rate,
+        int nch, long nsamples)
+{
+    unsigned char hdr[44];
+    unsigned long datalen = nsamples * nch * 2;
+    FILE *fd;
+    long i;
+
+#define PUT16(p, v) do { (p)[0] = (v) & 0xFF; (p)[1] = ((v) >> 8) & 0xFF; } while (0)
+#define PUT32(p, v) do { PUT16(p, (v) & 0xFFFF); PUT16((p) + 2, ((v) >> 16) & 0xFFFF); } while (0)
+    memcpy(hdr, "RIFF", 4);
+    PUT32(hdr + 4, 36 + datalen);
+    memcpy(hdr + 8, "WAVEfmt ", 8);
+    PUT32(hdr + 16, 16);
+    PUT16(hdr + 20, 1);
+    PUT16(hdr + 22, nch);
+    PUT32(hdr + 24, rate);
+    PUT32(hdr + 28, rate * nch * 2);
+    PUT16(hdr + 32, nch * 2);
+    PUT16(hdr + 34, 16);
+    memcpy(hdr + 36, "data", 4);
+    PUT32(hdr + 40, datalen);
+
+    fd = fopen(path, "wb");
+    if (fd == NULL) {
+        perror(path);
+        return -1;
+    }
+    fwrite(hdr, 1, sizeof(hdr), fd);
+    for (i = 0; i < nsamples * nch; i++) {
+        unsigned char s[2];
+        PUT16(s, (unsigned short)samples[i]);
+        fwrite(s, 1, 2, fd);
+    }
+#undef PUT16
+#undef PUT32
+    return fclose(fd);
+}
+
+/* Read a 16-bit PCM WAV file. Returns the interleaved samples, or NULL */
+static short *read_wav(const char *path, long *rate, int *nch, long *nsamples)
+{
+    unsigned char hdr[12], chunk[8], fmt[16];
+    short *samples = NULL;
+    int have_fmt = 0;
+    FILE *fd = fopen(path, "rb");
+
+    if (fd == NULL) {
+        perror(path);
+        return NULL;
+    }
+
+#define GET16(p) ((p)[0] | ((p)[1] << 8))
+#define GET32(p) ((unsigned long)GET16(p) | ((unsigned long)GET16((p) + 2) << 16))
+    if (fread(hdr, 1, 12, fd) != 12 ||
+            memcmp(hdr, "RIFF", 4) != 0 || memcmp(hdr + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "%s: not a WAV file\n", path);
+        goto out;
+    }
+
+    while (fread(chunk, 1, 8, fd) == 8) {
+        unsigned long len = GET32(chunk + 4);
+
+        if (memcmp(chunk, "fmt ", 4) == 0 && len >= 16) {
+            if (fread(fmt, 1, 16, fd) != 16)
+                break;
+            fseek(fd, len - 16 + (len & 1), SEEK_CUR);
+            if (GET16(fmt) != 1 || GET16(fmt + 14) != 16 ||
+                    GET16(fmt + 2) < 1 || GET16(fmt + 2) > 2) {
+                fprintf(stderr, "%s: only 16-bit mono or stereo PCM is supported\n", path);
+                goto out;
+            }
+            *nch = GET16(fmt + 2);
+            *rate = GET32(fmt + 4);
+            have_fmt = 1;
+        }
+        else if (memcmp(chunk, "data", 4) == 0 && have_fmt) {
+            unsigned long i, count = len / 2;
+            unsigned char *raw = malloc(len);
+            samples = malloc(count * sizeof(short));
+            count = fread(raw, 2, count, fd);
+            for (i = 0; i < count; i++)
+                samples[i] = (short)GET16(raw + 2 * i);
+            free(raw);
+            *nsamples = count / *nch;
+            break;
+        }
+        else {
+            fseek(fd, len + (len & 1), SEEK_CUR);
+        }
+    }
+#undef GET16
+#undef GET32
+
+    if (samples == NULL)
+        fprintf(stderr, "%s: no audio data found\n", path);
+out:
+    fclose(fd);
+    return samples;
+}
+
+/************************************************************************
+ *
+ * Encoder setup, mirrors parse_args and the main loop of toolame.c
+ *
+ ************************************************************************/
+
+struct bench_config {
+    char name[32];
+    long rate;
+    int nch;
+    char mode;      /* s/d/j/m like the -m option */
+    int brate;
+    int vbr;
+};
+
+static frame_info frame;
+static frame_header header;
+
+static void setup_encoder(const struct bench_config *cfg)
+{
+    memset(&glopts, 0, sizeof(glopts));
+    glopts.usepsy = TRUE;
+    glopts.usepadbit = TRUE;
+    glopts.quickcount = 10;
+    glopts.verbosity = 2;
+    glopts.input_select = INPUT_SELECT_WAV;
+    glopts.dab = TRUE;
+
+    memset(&header, 0, sizeof(header));
+    header.lay = 2;
+    header.sampling_frequency = SmpFrqIndex(cfg->rate, &header.version);
+    header.bitrate_index = BitrateIndex(cfg->brate, header.version);
+    header.error_protection = TRUE;
+    header.dab_extension = 4;
+    if (header.version == MPEG_AUDIO_ID &&
+            cfg->brate / (cfg->mode == 'm' ? 1 : 2) < 56)
+        header.dab_extension = 2;
+
+    switch (cfg->mode) {
+        case 's': header.mode = MPG_MD_STEREO; break;
+        case 'd': header.mode = MPG_MD_DUAL_CHANNEL; break;
+        case 'm': header.mode = MPG_MD_MONO; break;
+        default:
+            header.mode = MPG_MD_JOINT_STEREO;
+            header.mode_ext = 2;
+            break;
+    }
+
+    if (cfg->vbr) {
+        glopts.vbr = TRUE;
+        glopts.usepadbit = FALSE;
+        header.mode = MPG_MD_STEREO;
+        header.mode_ext = 0;
+    }
+
+    memset(&frame, 0, sizeof(frame));
+    frame.header = &header;
+    frame.tab_num = -1;
+    hdr_to_frps(&frame);
+}
+
+static double sampling_rate(void)
+{
+    return s_freq[header.version][header.sampling_frequency] * 1000;
+}
+
+/* Per-frame header fields decided by the bit allocation */
+struct frame_params {
+    int mode, mode_ext, jsbound, bitrate_index, padding;
+    int adb;
+};
+
+typedef double SBS[2][3][SCALE_BLOCK][SBLIMIT];
+typedef double JSBS[3][SCALE_BLOCK][SBLIMIT];
+typedef unsigned int SUB[2][3][SCALE_BLOCK][SBLIMIT];
+
+/* The prepared frames: input and the results of every stage */
+static int nframes;
+static short (*ipcm)[2304];
+/* normalized samples of every frame, preceded by the end of the previous
+ * one like in the sample ring of the encoder */
+static double (*fpcm)[2][PCM_RING_HISTORY + 1152];
+static SBS *sb_sample;
+static JSBS *j_sample;
+static unsigned int (*scalar)[2][3][SBLIMIT];
+static unsigned int (*j_scale)[3][SBLIMIT];
+static double (*max_sc)[2][SBLIMIT];
+static double (*smr)[2][SBLIMIT];
+static unsigned int (*scfsi)[2][SBLIMIT];
+static unsigned int (*bit_alloc)[2][SBLIMIT];
+static SUB *subband;
+static struct frame_params *params;
+
+/* Scratch outputs of the kernels */
+static SBS scratch_sb;
+static double scratch_fpcm[2][1152];
+static struct audio_levels scratch_levels;
+static unsigned int scratch_scalar[2][3][SBLIMIT];
+static double scratch_smr[2][SBLIMIT];
+static unsigned int scratch_bit_alloc[2][SBLIMIT];
+static SUB scratch_subband;
+static unsigned int crc;
+
+static Bit_stream_struc bs;
+
+static void *bench_alloc(size_t size)
+{
+    void *p = calloc(1, size);
+    if (p == NULL) {
+        fprintf(stderr, "Unable to allocate %zu bytes\n", size);
+        exit(1);
+    }
+    return p;
+}
+
+static void reset_bitstream(void)
+{
+    if (bs.buf == NULL)
+        alloc_buffer(&bs, BUFFER_SIZE);
+    bs.pt = NULL;
+    bs.num_sinks = 0;
+    bs.minimum = MINIMUM;
+    bs.buf_byte_idx = BUFFER_SIZE - 1;
+    bs.buf_bit_idx = 8;
+    bs.buf[bs.buf_byte_idx] = 0;
+    bs.totbit = 0;
+    bs.mode = WRITE_MODE;
+}
+
+static void apply_params(int f)
+{
+    header.mode = params[f].mode;
+    header.mode_ext = params[f].mode_ext;
+    header.bitrate_index = params[f].bitrate_index;
+    header.padding = params[f].padding;
+    frame.jsbound = params[f].jsbound;
+}
+
+/* Get the pointers to the first sample of a prepared frame */
+static void frame_samples(int f, double *samples[2])
+{
+    samples[0] = &fpcm[f][0][PCM_RING_HISTORY];
+    samples[1] = &fpcm[f][1][PCM_RING_HISTORY];
+}
+
+static void filterbank(double *in[2], SBS out)
+{
+    int gr, bl, ch;
+    for (gr = 0; gr < 3; gr++)
+        for (bl = 0; bl < SCALE_BLOCK; bl++)
+            for (ch = 0; ch < frame.nch; ch++)
+                WindowFilterSubband(&in[ch][gr * 12 * 32 + 32 * bl], ch,
+                        &out[ch][gr][bl][0], frame.sblimit);
+}
+
+/* Split the interleaved input into frames, and run every stage of the
+ * encoder on it once, keeping all intermediate results */
+static void prepare_frames(const short *samples, int nch, long nsamples,
+        int count)
+{
+    int f, ch, j;
+    int bitrate_index = header.bitrate_index;
+    int nframes_in = nsamples / 1152;
+    double *fbuf[2];
+
+    nframes = count;
+    ipcm = bench_alloc(nframes * sizeof(*ipcm));
+    fpcm = bench_alloc(nframes * sizeof(*fpcm));
+    sb_sample = bench_alloc(nframes * sizeof(*sb_sample));
+    j_sample = bench_alloc(nframes * sizeof(*j_sample));
+    scalar = bench_alloc(nframes * sizeof(*scalar));
+    j_scale = bench_alloc(nframes * sizeof(*j_scale));
+    max_sc = bench_alloc(nframes * sizeof(*max_sc));
+    smr = bench_alloc(nframes * sizeof(*smr));
+    scfsi = bench_alloc(nframes * sizeof(*scfsi));
+    bit_alloc = bench_alloc(nframes * sizeof(*bit_alloc));
+    subband = bench_alloc(nframes * sizeof(*subband));
+    params = bench_alloc(nframes * sizeof(*params));
+
+    for (f = 0; f < nframes; f++) {
+        /* loop over the input if it is shorter than requested */
+        const short *in = samples + (long)(f % nframes_in) * 1152 * nch;
+        for (j = 0; j < 1152; j++) {
+            for (ch = 0; ch < frame.nch; ch++) {
+                ipcm[f][j * frame.nch + ch] = in[j * nch + (ch < nch ? ch : 0)];
+            }
+        }
+        frame_samples(f, fbuf);
+        condition_audio(ipcm[f], frame.nch, frame.nch, 0, fbuf,
+                &scratch_levels);
+        if (f > 0) {
+            for (ch = 0; ch < frame.nch; ch++)
+                memcpy(&fpcm[f][ch][0], &fpcm[f - 1][ch][1152],
+                        PCM_RING_HISTORY * sizeof(double));
+        }
+    }
+
+    for (f = 0; f < nframes; f++) {
+        int adb;
+
+        frame_samples(f, fbuf);
+        filterbank(fbuf, sb_sample[f]);
+        scalefactor_calc_new(sb_sample[f], scalar[f], frame.nch, frame.sblimit);
+        find_sf_max(scalar[f], &frame, max_sc[f]);
+
+        psycho_1(fbuf, max_sc[f], smr[f], &frame);
+
+        header.bitrate_index = bitrate_index;
+        adb = available_bits(&header, &glopts);
+        adb -= header.dab_extension * 8 + FPAD_LENGTH * 8;
+        params[f].adb = adb;
+
+        sf_transmission_pattern(scalar[f], scfsi[f], &frame);
+        main_bit_allocation_new(smr[f], scfsi[f], bit_alloc[f], &adb, &frame, &glopts);
+        if (frame.actual_mode == MPG_MD_JOINT_STEREO)
+            joint_stereo_new(sb_sample[f], &j_sample[f], &j_scale[f], &frame);
+        subband_quantization_new(scalar[f], sb_sample[f], j_scale[f], j_sample[f],
+                bit_alloc[f], subband[f], &frame);
+
+        params[f].mode = header.mode;
+        params[f].mode_ext = header.mode_ext;
+        params[f].jsbound = frame.jsbound;
+        params[f].bitrate_index = header.bitrate_index;
+        params[f].padding = header.padding;
+    }
+
+    header.bitrate_index = bitrate_index;
+    reset_bitstream();
+}
+
+/************************************************************************
+ *
+ * Kernels, each processes one prepared frame
+ *
+ ************************************************************************/
+
+static int bench_psy;
+
+static void k_conditioning(int f)
+{
+    double *out[2] = { scratch_fpcm[0], scratch_fpcm[1] };
+    condition_audio(ipcm[f], frame.nch, frame.nch, 0, out, &scratch_levels);
+}
+
+static void k_filterbank(int f)
+{
+    double *in[2];
+    frame_samples(f, in);
+    filterbank(in, scratch_sb);
+}
+
+static void k_scalefactor(int f)
+{
+    scalefactor_calc_new(sb_sample[f], scratch_scalar, frame.nch, frame.sblimit);
+}
+
+static void k_psy(int f)
+{
+    double sfreq = sampling_rate();
+    double *in[2];
+    int ch;
+
+    frame_samples(f, in);
+    switch (bench_psy) {
+        case -1:
+            psycho_n1(scratch_smr, frame.nch);
+            break;
+        case 0:
+            psycho_0(scratch_smr, frame.nch, scalar[f], sfreq);
+            break;
+        case 1:
+            psycho_1(in, max_sc[f], scratch_smr, &frame);
+            break;
+        case 2:
+            for (ch = 0; ch < frame.nch; ch++)
+                psycho_2(in[ch], ch, &scratch_smr[ch][0],
+                        sfreq, &glopts);
+            break;
+        case 3:
+            psycho_3(in, max_sc[f], scratch_smr, &frame, &glopts);
+            break;
+        case 4:
+            for (ch = 0; ch < frame.nch; ch++)
+                psycho_4(in[ch], ch, &scratch_smr[ch][0],
+                        sfreq, &glopts);
+            break;
+    }
+}
+
+static void k_bit_alloc(int f)
+{
+    int adb = params[f].adb;
+    header.bitrate_index = params[f].bitrate_index;
+    main_bit_allocation_new(smr[f], scfsi[f], scratch_bit_alloc, &adb,
+            &frame, &glopts);
+}
+
+static void k_quantization(int f)
+{
+    apply_params(f);
+    subband_quantization_new(scalar[f], sb_sample[f], j_scale[f], j_sample[f],
+            bit_alloc[f], scratch_subband, &frame);
+}
+
+static void k_write_samples(int f)
+{
+    apply_params(f);
+    reset_bitstream();
+    write_samples_new(subband[f], bit_alloc[f], &frame, &bs);
+}
+
+static void k_bitpacking(int f)
+{
+    int i;
+
+    apply_params(f);
+    reset_bitstream();
+    write_header(&frame, &bs);
+    putbits(&bs, 0, 16);
+    write_bit_alloc(bit_alloc[f], &frame, &bs);
+    write_scalefactors(bit_alloc[f], scfsi[f], scalar[f], &frame, &bs);
+    write_samples_new(subband[f], bit_alloc[f], &frame, &bs);
+    for (i = sstell(&bs); i < params[f].adb; i += 8)
+        putbits(&bs, 0, 8);
+}
+
+static void k_crc(int f)
+{
+    int i;
+
+    apply_params(f);
+    CRC_calc(&frame, bit_alloc[f], scfsi[f], &crc);
+    for (i = header.dab_extension - 1; i >= 0; i--)
+        CRC_calcDAB(&frame, bit_alloc[f], scfsi[f], scalar[f], &crc, i);
+}
+
+struct kernel {
+    const char *name;
+    void (*run)(int f);
+    int psy;    /* psy model for k_psy */
+    int vbr;    /* prepare the frames in VBR mode */
+};
+
+static const struct kernel kernels[] = {
+    { "conditioning",    k_conditioning,  0, 0 },
+    { "filterbank",      k_filterbank,    0, 0 },
+    { "scalefactor",     k_scalefactor,   0, 0 },
+    { "psy-1",           k_psy,          -1, 0 },
+    { "psy0",            k_psy,           0, 0 },
+    { "psy1",            k_psy,           1, 0 },
+    { "psy2",            k_psy,           2, 0 },
+    { "psy3",            k_psy,           3, 0 },
+    { "psy4",            k_psy,           4, 0 },
+    { "bit_alloc_cbr",   k_bit_alloc,     0, 0 },
+    { "bit_alloc_vbr",   k_bit_alloc,     0, 1 },
+    { "quantization",    k_quantization,  0, 0 },
+    { "write_samples",   k_write_samples, 0, 0 },
+    { "bitpacking",      k_bitpacking,    0, 0 },
+    { "crc",             k_crc,           0, 0 },
+};
+
+/************************************************************************
+ *
+ * Measurement
+ *
+ ************************************************************************/
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Best of repeats runs over all prepared frames, each lasting at least
+ * min_time seconds. Returns nanoseconds per frame */
+static double time_kernel(void (*run)(int), double min_time, int repeats)
+{
+    double best = -1;
+    int f, r;
+
+    for (f = 0; f < nframes; f++)
+        run(f);
+
+    for (r = 0; r < repeats; r++) {
+        long iterations = 0;
+        double t0 = now_ns(), elapsed;
+
+        do {
+            for (f = 0; f < nframes; f++)
+                run(f);
+            iterations += nframes;
+            elapsed = now_ns() - t0;
+        } while (elapsed < min_time * 1e9);
+
+        if (best < 0 || elapsed / iterations < best)
+            best = elapsed / iterations;
+    }
+    return best;
+}
+
+/* Run fn in a child process, with stdout silenced because some of the
+ * encoder functions print to it. Returns the value it produced, or -1 */
+static double run_isolated(double (*fn)(const void *), const void *arg)
+{
+    int fds[2];
+    double result = -1;
+    pid_t pid;
+    int status;
+
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(1);
+    }
+    else if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        close(fds[0]);
+        if (devnull != -1)
+            dup2(devnull, STDOUT_FILENO);
+        result = fn(arg);
+        if (write(fds[1], &result, sizeof(result)) != sizeof(result))
+            _exit(1);
+        _exit(0);
+    }
+
+    close(fds[1]);
+    if (read(fds[0], &result, sizeof(result)) != sizeof(result))
+        result = -1;
+    close(fds[0]);
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        result = -1;
+    return result;
+}
+
+static void print_result(const char *name, const char *config,
+        double ns_per_frame, long rate)
+{
+    if (ns_per_frame <= 0) {
+        printf("%s\t%s\tfailed\n", name, config);
+    }
+    else {
+        double fps = 1e9 / ns_per_frame;
+        printf("%s\t%s\t%.1f\t%.1f\t%.2f\n", name, config,
+                ns_per_frame, fps, fps / (rate / 1152.0));
+    }
+    fflush(stdout);
+}
+
+/************************************************************************
+ *
+ * Benchmark runs
+ *
+ ************************************************************************/
+
+static const short *input_samples;
+static int input_nch;
+static long input_nsamples;
+
+static double opt_min_time = 0.2;
+static int opt_repeats = 3;
+static int opt_frames = DFLT_BENCH_FRAMES;
+
+struct micro_arg {
+    const struct kernel *kernel;
+    struct bench_config cfg;
+};
+
+static double micro_child(const void *p)
+{
+    const struct micro_arg *arg = p;
+
+    setup_encoder(&arg->cfg);
+    prepare_frames(input_samples, input_nch, input_nsamples, opt_frames);
+    bench_psy = arg->kernel->psy;
+    return time_kernel(arg->kernel->run, opt_min_time, opt_repeats);
+}
+
+struct e2e_arg {
+    const char *encoder;
+    const char *wav;
+    int psy;
+    struct bench_config cfg;
+};
+
+/* Run the encoder executable once, returns its exit status,
+ * or 128 + the signal number if it crashed */
+static int run_encoder(const char *encoder, char *const argv[])
+{
+    pid_t pid;
+    int status;
+
+    pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return -1;
+    }
+    else if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull != -1) {
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+        }
+        execv(encoder, argv);
+        _exit(127);
+    }
+
+    waitpid(pid, &status, 0);
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static double e2e_child(const void *p)
+{
+    const struct e2e_arg *arg = p;
+    char psy[8], brate[8], mode[2], vbr[] = "0";
+    char *argv[16];
+    int argc = 0, r;
+    double best = -1;
+    long frames = input_nsamples / 1152;
+
+    snprintf(psy, sizeof(psy), "%d", arg->psy);
+    snprintf(brate, sizeof(brate), "%d", arg->cfg.brate);
+    mode[0] = arg->cfg.mode;
+    mode[1] = '\0';
+
+    argv[argc++] = "toolame-dab";
+    argv[argc++] = "-y";
+    argv[argc++] = psy;
+    argv[argc++] = "-b";
+    argv[argc++] = brate;
+    argv[argc++] = "-m";
+    argv[argc++] = mode;
+    if (arg->cfg.vbr) {
+        argv[argc++] = "-v";
+        argv[argc++] = vbr;
+    }
+    argv[argc++] = (char*)arg->wav;
+    argv[argc++] = "/dev/null";
+    argv[argc] = NULL;
+
+    for (r = 0; r < opt_repeats; r++) {
+        double t0 = now_ns(), elapsed;
+        if (run_encoder(arg->encoder, argv) != 0)
+            return -1;
+        elapsed = now_ns() - t0;
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best / frames;
+}
+
+static int matches(const char *name, const char *filter)
+{
+    return filter == NULL || strstr(name, filter) != NULL;
+}
+
+/************************************************************************
+ *
+ * Golden bitstreams
+ *
+ ************************************************************************/
+
+static const char *signal_names[] = {
+    "music", "sweep", "noise", "transients", "silence"
+};
+#define NUM_SIGNALS (sizeof(signal_names) / sizeof(signal_names[0]))
+
+struct golden_ref {
+    char config[64];
+    char value[32];     // hash, or SNR floor
+    int seen;
+};
+
+struct golden_list {
+    struct golden_ref *refs;
+    int nrefs;
+};
+
+static struct golden_list golden_hashes, golden_floors;
+
+/* 64-bit FNV-1a of a file */
+static int hash_file(const char *path, char hash[32], long *size)
+{
+    unsigned char buf[4096];
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    size_t len, i;
+    FILE *fd = fopen(path, "rb");
+
+    *size = 0;
+    if (fd == NULL)
+        return -1;
+
+    while ((len = fread(buf, 1, sizeof(buf), fd)) > 0) {
+        for (i = 0; i < len; i++) {
+            h ^= buf[i];
+            h *= 0x100000001b3ULL;
+        }
+        *size += len;
+    }
+    fclose(fd);
+
+    snprintf(hash, 32, "%016llx", h);
+    return 0;
+}
+
+/* Read the lines of kind in the file at path into list */
+static int read_golden_refs(const char *path, const char *kind,
+        struct golden_list *list)
+{
+    char line[256];
+    FILE *fd = fopen(path, "r");
+
+    if (fd == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fd)) {
+        struct golden_ref ref;
+        char line_kind[16];
+
+        memset(&ref, 0, sizeof(ref));
+        if (line[0] == '#' ||
+                sscanf(line, "%15s %63s %31s", line_kind, ref.config, ref.value) != 3 ||
+                strcmp(line_kind, kind) != 0)
+            continue;
+
+        list->refs = realloc(list->refs, (list->nrefs + 1) * sizeof(ref));
+        list->refs[list->nrefs++] = ref;
+    }
+    fclose(fd);
+    return 0;
+}
+
+static struct golden_ref *find_golden_ref(struct golden_list *list,
+        const char *config)
+{
+    int i;
+    for (i = 0; i < list->nrefs; i++) {
+        if (strcmp(list->refs[i].config, config) == 0)
+            return &list->refs[i];
+    }
+    return NULL;
+}
+
+/* Count the references of list that filter selects and were not seen */
+static int missing_golden_refs(struct golden_list *list, const char *filter)
+{
+    int i, missing = 0;
+
+    for (i = 0; i < list->nrefs; i++) {
+        if (!list->refs[i].seen && matches(list->refs[i].config, filter)) {
+            fprintf(stderr, "MISSING  %s\n", list->refs[i].config);
+            missing++;
+        }
+    }
+    return missing;
+}
+
+/* Decode the stream at path with the decoder of the loopback check, and
+ * return its SNR against the nsamples of nch channels at samples, in dB.
+ * Silence is measured against full scale. GOLDEN_SNR_NONE if the stream
+ * does not decode, or has CRC errors */
+static double stream_snr(const char *path, const short *samples, int nch,
+        long nsamples)
+{
+    struct loopback_stats st;
+    unsigned char *data;
+    double *pcm[2], signal = 0, noise = 0, snr = GOLDEN_SNR_NONE;
+    long len, n, i;
+    int ch;
+    FILE *fd = fopen(path, "rb");
+
+    if (fd == NULL)
+        return GOLDEN_SNR_NONE;
+    fseek(fd, 0, SEEK_END);
+    len = ftell(fd);
+    rewind(fd);
+    data = bench_alloc(len > 0 ? len : 1);
+    if (fread(data, 1, len, fd) != (size_t)len)
+        len = 0;
+    fclose(fd);
+
+    pcm[0] = bench_alloc(nsamples * sizeof(double));
+    pcm[1] = bench_alloc(nsamples * sizeof(double));
+    n = loopback_decode(data, len, 1, pcm, nsamples, &st);
+
+    if (st.header_errors || st.crc_errors || st.scf_crc_errors) {
+        fprintf(stderr, "%s: %llu header errors, %llu CRC errors, "
+                "%llu ScF-CRC errors\n", path,
+                (unsigned long long)st.header_errors,
+                (unsigned long long)st.crc_errors,
+                (unsigned long long)st.scf_crc_errors);
+    }
+    else if (n >= nsamples - PCM_RING_FRAME) {
+        for (ch = 0; ch < nch; ch++)
+            for (i = 0; i < n; i++) {
+                double x = samples[i * nch + ch] / (double)SCALE;
+                double err = x - pcm[ch][i];
+
+                signal += x * x;
+                noise += err * err;
+            }
+        if (signal == 0)
+            signal = n * nch;
+        snr = GOLDEN_SNR_MAX;
+        if (noise > 0 && 10 * log10(signal / noise) < GOLDEN_SNR_MAX)
+            snr = 10 * log10(signal / noise);
+    }
+
+    free(data);
+    free(pcm[0]);
+    free(pcm[1]);
+    return snr;
+}
+
+/* Encode every signal in every configuration, print the hashes and the
+ * SNR, and compare them to the reference and the floors if there are.
+ * Returns the number of differences */
+static int run_golden(const char *encoder, const char *filter, int seconds)
+{
+    struct golden_cfg {
+        long rate;
+        int nch;
+        char mode;
+        int brate;
+        int vbr;
+    };
+    static const struct golden_cfg cfgs[] = {
+        { 48000, 2, 'j', 192, 0 },
+        { 48000, 2, 's', 192, 1 },
+        { 48000, 1, 'm',  96, 0 },
+        { 48000, 1, 'm',  96, 1 },
+        { 48000, 2, 'j',  64, 0 },  // sblimit 8
+        { 48000, 1, 'm',  48, 0 },  // sblimit 8
+        { 32000, 1, 'm',  48, 0 },  // sblimit 12
+        { 24000, 2, 'j',  96, 0 },
+        { 24000, 2, 's',  96, 1 },
+        { 24000, 1, 'm',  48, 0 },
+        { 24000, 1, 'm',  48, 1 },
+    };
+    static const int psy_models[] = { -1, 0, 1, 2, 3, 4 };
+    char wav_path[] = "/tmp/toolame-golden-XXXXXX";
+    char out_path[] = "/tmp/toolame-golden-XXXXXX";
+    int differences = 0;
+    size_t s, c, p;
+    int fd;
+
+    if ((fd = mkstemp(wav_path)) == -1 || close(fd) != 0 ||
+            (fd = mkstemp(out_path)) == -1 || close(fd) != 0) {
+        perror("mkstemp");
+        return 1;
+    }
+
+    printf("# toolame-bench %d golden\n", BENCH_FORMAT_VERSION);
+    printf("# kind\tconfig\thash\tbytes\n");
+
+    for (s = 0; s < NUM_SIGNALS; s++) {
+        for (c = 0; c < sizeof(cfgs) / sizeof(cfgs[0]); c++) {
+            const struct golden_cfg *cfg = &cfgs[c];
+            long nsamples = cfg->rate * seconds;
+            short *samples = NULL;
+
+            for (p = 0; p < sizeof(psy_models) / sizeof(psy_models[0]); p++) {
+                char config[64], psy[8], brate[8], mode[2] = { cfg->mode, '\0' };
+                char hash[32];
+                char *argv[16];
+                int argc = 0, status;
+                long size;
+                double snr = GOLDEN_SNR_NONE;
+                struct golden_ref *ref;
+
+                snprintf(config, sizeof(config), "%s-%ld-%c-%d%s-psy%d",
+                        signal_names[s], cfg->rate, cfg->mode, cfg->brate,
+                        cfg->vbr ? "-vbr" : "", psy_models[p]);
+                if (!matches(config, filter))
+                    continue;
+
+                if (samples == NULL) {
+                    samples = bench_alloc(nsamples * cfg->nch * sizeof(short));
+                    generate_signal(s, cfg->rate, cfg->nch, nsamples, samples);
+                    if (write_wav(wav_path, samples, cfg->rate, cfg->nch, nsamples) != 0)
+                        return 1;
+                }
+
+                snprintf(psy, sizeof(psy), "%d", psy_models[p]);
+                snprintf(brate, sizeof(brate), "%d", cfg->brate);
+                argv[argc++] = "toolame-dab";
+                argv[argc++] = "-y";
+                argv[argc++] = psy;
+                argv[argc++] = "-b";
+                argv[argc++] = brate;
+                argv[argc++] = "-m";
+                argv[argc++] = mode;
+                if (cfg->vbr) {
+                    argv[argc++] = "-v";
+                    argv[argc++] = "0";
+                }
+                argv[argc++] = wav_path;
+                argv[argc++] = out_path;
+                argv[argc] = NULL;
+
+                status = run_encoder(encoder, argv);
+
+                if (status == 0 && hash_file(out_path, hash, &size) == 0) {
+                    snr = stream_snr(out_path, samples, cfg->nch, nsamples);
+                    printf("golden\t%s\t%s\t%ld\t%.1f\n", config, hash, size,
+                            snr);
+                }
+                else {
+                    /* Keep failures in the reference, they must not change either */
+                    snprintf(hash, sizeof(hash), "exit-%d", status);
+                    size = 0;
+                    printf("golden\t%s\t%s\t0\t-\n", config, hash);
+                }
+
+                if (golden_hashes.refs) {
+                    ref = find_golden_ref(&golden_hashes, config);
+                    if (ref == NULL) {
+                        fprintf(stderr, "NEW      %s\n", config);
+                    }
+                    else {
+                        ref->seen = 1;
+                        if (strcmp(ref->value, hash) != 0) {
+                            fprintf(stderr, "MISMATCH %s: %s, reference %s\n",
+                                    config, hash, ref->value);
+                            differences++;
+                        }
+                    }
+                }
+
+                if (golden_floors.refs) {
+                    ref = find_golden_ref(&golden_floors, config);
+                    if (ref == NULL) {
+                        fprintf(stderr, "NEW      %s\n", config);
+                    }
+                    else {
+                        ref->seen = 1;
+                        if (snr < atof(ref->value)) {
+                            fprintf(stderr, "LOW      %s: SNR %.1f dB, floor %s dB\n",
+                                    config, snr, ref->value);
+                            differences++;
+                        }
+                    }
+                }
+                fflush(stdout);
+            }
+            free(samples);
+        }
+    }
+
+    differences += missing_golden_refs(&golden_hashes, filter);
+    differences += missing_golden_refs(&golden_floors, filter);
+
+    if (golden_hashes.refs || golden_floors.refs) {
+        fprintf(stderr, "%d difference%s to the reference\n",
+                differences, differences == 1 ? "" : "s");
+    }
+
+    unlink(wav_path);
+    unlink(out_path);
+    return differences;
+}
+
+/************************************************************************
+ *
+ * libtoolame against toolame-dab
+ *
+ ************************************************************************/
+
+struct library_cfg {
+    long rate;
+    int nch;
+    char mode;
+    int brate;
+    int psy;
+};
+
+struct library_arg {
+    const struct library_cfg *cfg;
+    const short *samples;
+    long nsamples;
+    const char *out;
+};
+
+/* Encode through libtoolame, in its own process as it can be opened only
+ * once. Returns 0, or -1 on failure */
+static double library_child(const void *p)
+{
+    /* none a multiple of another, nor of a frame */
+    static const int chunks[] = { 1, 1151, 7, 1153, 3001, 577, 2 };
+    const struct library_arg *arg = p;
+    struct toolame_config config;
+    struct toolame *enc;
+    uint8_t frame[4096];
+    long done = 0;
+    int c = 0, len;
+    FILE *out;
+
+    toolame_config_init(&config);
+    config.sample_rate = arg->cfg->rate;
+    config.channels = arg->cfg->nch;
+    config.mode = arg->cfg->mode;
+    config.bitrate = arg->cfg->brate;
+    config.psy_model = arg->cfg->psy;
+
+    if ((enc = toolame_open(&config)) == NULL)
+        return -1;
+    if ((out = fopen(arg->out, "wb")) == NULL) {
+        perror(arg->out);
+        return -1;
+    }
+
+    while (done < arg->nsamples) {
+        int n = chunks[c++ % (sizeof(chunks) / sizeof(chunks[0]))];
+
+        if (n > arg->nsamples - done)
+            n = arg->nsamples - done;
+        if (toolame_push(enc, arg->samples + done * arg->cfg->nch, n) != 0)
+            return -1;
+        done += n;
+        while ((len = toolame_pull(enc, frame, sizeof(frame))) > 0)
+            fwrite(frame, 1, len, out);
+    }
+    toolame_flush(enc);
+    while ((len = toolame_pull(enc, frame, sizeof(frame))) > 0)
+        fwrite(frame, 1, len, out);
+    toolame_close(enc);
+
+    return fclose(out) == 0 && len == 0 ? 0 : -1;
+}
+
+/* Encode every configuration with toolame-dab and libtoolame, print the
+ * hashes of both. Returns the number of differences */
+static int run_library(const char *encoder, int seconds)
+{
+    static const struct library_cfg cfgs[] = {
+        { 48000, 2, 'j', 192, 1 },
+        { 48000, 2, 's', 128, 2 },
+        { 48000, 2, 'm',  96, 1 },  // downmix
+        { 48000, 1, 'm',  64, 4 },
+        { 24000, 2, 'j',  96, 1 },
+        { 24000, 1, 'm',  48, 0 },
+    };
+    char wav_path[] = "/tmp/toolame-library-XXXXXX";
+    char out_path[] = "/tmp/toolame-library-XXXXXX";
+    char lib_path[] = "/tmp/toolame-library-XXXXXX";
+    int differences = 0;
+    size_t c;
+    int fd;
+
+    if ((fd = mkstemp(wav_path)) == -1 || close(fd) != 0 ||
+            (fd = mkstemp(out_path)) == -1 || close(fd) != 0 ||
+            (fd = mkstemp(lib_path)) == -1 || close(fd) != 0) {
+        perror("mkstemp");
+        return 1;
+    }
+
+    printf("# toolame-bench %d library\n", BENCH_FORMAT_VERSION);
+    printf("# kind\tconfig\thash\thash_of_libtoolame\n");
+
+    for (c = 0; c < sizeof(cfgs) / sizeof(cfgs[0]); c++) {
+        const struct library_cfg *cfg = &cfgs[c];
+        /* the last frame is partial */
+        long nsamples = cfg->rate * seconds + 100;
+        short *samples = bench_alloc(nsamples * cfg->nch * sizeof(short));
+        char config[64], psy[8], brate[8], mode[2] = { cfg->mode, '\0' };
+        char hash[32], lib_hash[32];
+        char *argv[16];
+        int argc = 0, status;
+        long size, lib_size;
+        struct library_arg arg;
+
+        snprintf(config, sizeof(config), "music-%ld-%d-%c-%d-psy%d",
+                cfg->rate, cfg->nch, cfg->mode, cfg->brate, cfg->psy);
+        generate_signal(SIGNAL_MUSIC, cfg->rate, cfg->nch, nsamples, samples);
+        if (write_wav(wav_path, samples, cfg->rate, cfg->nch, nsamples) != 0)
+            return 1;
+
+        snprintf(psy, sizeof(psy), "%d", cfg->psy);
+        snprintf(brate, sizeof(brate), "%d", cfg->brate);
+        argv[argc++] = "toolame-dab";
+        argv[argc++] = "-y";
+        argv[argc++] = psy;
+        argv[argc++] = "-b";
+        argv[argc++] = brate;
+        argv[argc++] = "-m";
+        argv[argc++] = mode;
+        if (cfg->nch == 2 && cfg->mode == 'm')
+            argv[argc++] = "-a";
+        argv[argc++] = wav_path;
+        argv[argc++] = out_path;
+        argv[argc] = NULL;
+
+        status = run_encoder(encoder, argv);
+        if (status != 0 || hash_file(out_path, hash, &size) != 0)
+            snprintf(hash, sizeof(hash), "exit-%d", status);
+
+        arg.cfg = cfg;
+        arg.samples = samples;
+        arg.nsamples = nsamples;
+        arg.out = lib_path;
+        if (run_isolated(library_child, &arg) != 0 ||
+                hash_file(lib_path, lib_hash, &lib_size) != 0)
+            snprintf(lib_hash, sizeof(lib_hash), "failed");
+
+        printf("library\t%s\t%s\t%s\n", config, hash, lib_hash);
+        if (status != 0 || strcmp(hash, lib_hash) != 0) {
+            fprintf(stderr, "MISMATCH %s: libtoolame %s, toolame-dab %s\n",
+                    config, lib_hash, hash);
+            differences++;
+        }
+        fflush(stdout);
+        free(samples);
+    }
+
+    fprintf(stderr, "%d difference%s to toolame-dab\n",
+            differences, differences == 1 ? "" : "s");
+
+    unlink(wav_path);
+    unlink(out_path);
+    unlink(lib_path);
+    return differences;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "\t-i file  16-bit PCM WAV input (dflt synthetic 48kHz stereo)\n"
+            "\t-k name  only run the benchmarks whose name contains name\n"
+            "\t-t sec   minimum duration of one measurement (dflt %.1f)\n"
+            "\t-r num   number of measurements, the best is kept (dflt %d)\n"
+            "\t-n num   number of frames for the kernel benchmarks (dflt %d)\n"
+            "\t-b kbps  bitrate for the kernel benchmarks (dflt 192 stereo,\n"
+            "\t         96 mono, half of that for 16, 22.05 and 24kHz)\n"
+            "\t-s sec   length of the synthetic end-to-end input (dflt %d)\n"
+            "\t-e path  toolame-dab executable for the end-to-end benchmarks\n"
+            "\t         (dflt: toolame-dab next to this program)\n"
+            "\t-E       skip the end-to-end benchmarks\n"
+            "\t-g       print the hashes of the golden bitstreams instead\n"
+            "\t-c file  compare the golden bitstreams to the reference\n"
+            "\t         file written by -g, fail if they differ\n"
+            "\t-f file  encode the golden bitstreams, fail if their SNR is\n"
+            "\t         below the floors in file (golden-snr.txt)\n"
+            "\t-l       fail if libtoolame, pushed chunks of odd sizes, does\n"
+            "\t         not give the bitstreams of toolame-dab\n",
+            prog, opt_min_time, opt_repeats, DFLT_BENCH_FRAMES, DFLT_E2E_SECONDS);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    const char *input_path = NULL;
+    const char *filter = NULL;
+    char encoder[1024];
+    char wav_path[] = "/tmp/toolame-bench-XXXXXX";
+    int e2e_seconds = 0;
+    int kernel_brate = 0;
+    int run_e2e = 1;
+    int golden = 0;
+    int library = 0;
+    const char *golden_ref_path = NULL;
+    const char *golden_floor_path = NULL;
+    long rate = 48000;
+    short *samples;
+    size_t k;
+    int c;
+
+    /* dflt encoder: next to us */
+    {
+        const char *slash = strrchr(argv[0], '/');
+        int dirlen = slash ? (int)(slash - argv[0]) : 1;
+        snprintf(encoder, sizeof(encoder), "%.*s/toolame-dab",
+                dirlen, slash ? argv[0] : ".");
+    }
+
+    while ((c = getopt(argc, argv, "i:k:t:r:n:b:s:e:Egc:f:lh")) != -1) {
+        switch (c) {
+            case 'i': input_path = optarg; break;
+            case 'k': filter = optarg; break;
+            case 't': opt_min_time = atof(optarg); break;
+            case 'r': opt_repeats = atoi(optarg); break;
+            case 'n': opt_frames = atoi(optarg); break;
+            case 'b': kernel_brate = atoi(optarg); break;
+            case 's': e2e_seconds = atoi(optarg); break;
+            case 'e': snprintf(encoder, sizeof(encoder), "%s", optarg); break;
+            case 'E': run_e2e = 0; break;
+            case 'g': golden = 1; break;
+            case 'c': golden = 1; golden_ref_path = optarg; break;
+            case 'f': golden = 1; golden_floor_path = optarg; break;
+            case 'l': library = 1; break;
+            default: usage(argv[0]);
+        }
+    }
+
+    if (opt_repeats < 1 || opt_frames < 1 || e2e_seconds < 0)
+        usage(argv[0]);
+
+    if ((golden || library) && access(encoder, X_OK) != 0) {
+        fprintf(stderr, "%s not found, use -e to give the path to toolame-dab\n",
+                encoder);
+        return 1;
+    }
+
+    if (library)
+        return run_library(encoder,
+                e2e_seconds ? e2e_seconds : DFLT_GOLDEN_SECONDS) ? 1 : 0;
+
+    if (golden) {
+        if (golden_ref_path && read_golden_refs(golden_ref_path, "golden",
+                    &golden_hashes) != 0)
+            return 1;
+        if (golden_floor_path && read_golden_refs(golden_floor_path, "floor",
+                    &golden_floors) != 0)
+            return 1;
+        return run_golden(encoder, filter,
+                e2e_seconds ? e2e_seconds : DFLT_GOLDEN_SECONDS) ? 1 : 0;
+    }
+
+    if (e2e_seconds == 0)
+        e2e_seconds = DFLT_E2E_SECONDS;
+
+    if (input_path) {
+        samples = read_wav(input_path, &rate, &input_nch, &input_nsamples);
+        if (samples == NULL)
+            return 1;
+        if (input_nsamples < 1152) {
+            fprintf(stderr, "%s: less than one frame of audio\n", input_path);
+            return 1;
+        }
+    }
+    else {
+        input_nch = 2;
+        input_nsamples = (long)e2e_seconds * rate;
+        samples = bench_alloc(input_nsamples * input_nch * sizeof(short));
+        generate_signal(SIGNAL_MUSIC, rate, input_nch, input_nsamples, samples);
+    }
+    input_samples = samples;
+
+    printf("# toolame-bench %d\n", BENCH_FORMAT_VERSION);
+    printf("# input %s, %ld Hz, %d channels, %ld samples\n",
+            input_path ? input_path : "synthetic", rate, input_nch, input_nsamples);
+    printf("# name\tconfig\tns_per_frame\tframes_per_s\trealtime_factor\n");
+
+    /* Kernels */
+    for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        struct micro_arg arg;
+
+        if (!matches(kernels[k].name, filter))
+            continue;
+
+        memset(&arg, 0, sizeof(arg));
+        arg.kernel = &kernels[k];
+        arg.cfg.rate = rate;
+        arg.cfg.nch = input_nch;
+        arg.cfg.vbr = kernels[k].vbr;
+        if (input_nch == 2) {
+            arg.cfg.mode = kernels[k].vbr ? 's' : 'j';
+            arg.cfg.brate = rate >= 32000 ? 192 : 96;
+        }
+        else {
+            arg.cfg.mode = 'm';
+            arg.cfg.brate = rate >= 32000 ? 96 : 48;
+        }
+        if (kernel_brate > 0)
+            arg.cfg.brate = kernel_brate;
+        snprintf(arg.cfg.name, sizeof(arg.cfg.name), "%ld-%c-%d%s",
+                rate, arg.cfg.mode, arg.cfg.brate, arg.cfg.vbr ? "-vbr" : "");
+
+        print_result(kernels[k].name, arg.cfg.name,
+                run_isolated(micro_child, &arg), rate);
+    }
+
+    /* End-to-end, every psy model at a set of bitrates */
+    if (run_e2e) {
+        static const int stereo_rates[] = { 64, 128, 192 };
+        static const int lsf_rates[] = { 32, 64, 96 };
+        static const int psy_models[] = { -1, 0, 1, 2, 3, 4 };
+        const int *brates = rate >= 32000 ? stereo_rates : lsf_rates;
+        size_t p, b;
+        int fd;
+
+        if (access(encoder, X_OK) != 0) {
+            fprintf(stderr, "%s not found, use -e to give the path to toolame-dab\n",
+                    encoder);
+            return 1;
+        }
+
+        if (input_path == NULL) {
+            fd = mkstemp(wav_path);
+            if (fd == -1) {
+                perror("mkstemp");
+                return 1;
+            }
+            close(fd);
+            if (write_wav(wav_path, samples, rate, input_nch, input_nsamples) != 0)
+                return 1;
+        }
+
+        for (p = 0; p < sizeof(psy_models) / sizeof(psy_models[0]); p++) {
+            for (b = 0; b < 4; b++) {
+                struct e2e_arg arg;
+                char name[16];
+
+                memset(&arg, 0, sizeof(arg));
+                arg.encoder = encoder;
+                arg.wav = input_path ? input_path : wav_path;
+                arg.psy = psy_models[p];
+                arg.cfg.rate = rate;
+                arg.cfg.nch = input_nch;
+                arg.cfg.mode = input_nch == 2 ? 'j' : 'm';
+                if (b < 3) {
+                    arg.cfg.brate = brates[b] / (input_nch == 2 ? 1 : 2);
+                }
+                else {
+                    /* VBR */
+                    arg.cfg.brate = brates[2];
+                    arg.cfg.mode = input_nch == 2 ? 's' : 'm';
+                    arg.cfg.vbr = 1;
+                }
+                snprintf(name, sizeof(name), "encode_psy%d", psy_models[p]);
+                snprintf(arg.cfg.name, sizeof(arg.cfg.name), "%ld-%c-%d%s",
+                        rate, arg.cfg.mode, arg.cfg.brate, arg.cfg.vbr ? "-vbr" : "");
+
+                if (!matches(name, filter))
+                    continue;
+
+                print_result(name, arg.cfg.name,
+                        run_isolated(e2e_child, &arg), rate);
+            }
+        }
+
+        if (input_path == NULL)
+            unlink(wav_path);
+    }
+
+    free(samples);
+    return 0;
+}
@@ -1,10 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "zmqoutput.h"
 #include "common.h"
 #include "mem.h"
 #include "bitstream.h"
+#include "sink.h"
+#include "loopback.h"
+#include "timing.h"
 
 /*****************************************************************************
  *
@@ -24,6 +26,8 @@
  ********************************************************************/
 
 /*open_bit_stream_w(); open the device to write the bit stream into it    */
+/*add_bit_stream_sink(); write the bit stream to one more device          */
+/*drain_bit_stream_w(); hand what is written to the devices right away     */
 /*close_bit_stream();  close the device containing the bit stream         */
 /*alloc_buffer();      open and initialize the buffer;                    */
 /*desalloc_buffer();   empty and close the buffer                         */
@@ -39,10 +43,6 @@
 
 /* refill the buffer from the input device when the buffer becomes empty    */
 
-/* You must have one frame in memory if you are in DAB mode                 */
-/* in conformity of the norme ETS 300 401 http://www.etsi.org               */
-/* see toollame.c                                                           */
-int minimum = MINIMUM;
 int refill_buffer (Bit_stream_struc * bs)
 {
     register int i = bs->buf_size - 2 - bs->buf_byte_idx;
@@ -101,20 +101,34 @@ int refill_buffer (Bit_stream_struc * bs)
     return 0;
 }
 
-/* empty the buffer to the output device when the buffer becomes full */
-void empty_buffer (Bit_stream_struc * bs, int minimum)
+/* hand the frame being filled to all the sinks */
+static void send_frame (Bit_stream_struc * bs)
 {
     int i;
 
-    if (bs->pt) {
-        for (i = bs->buf_size - 1; i >= minimum; i--)
-            fwrite (&bs->buf[i], sizeof (unsigned char), 1, bs->pt);
+    for (i = 0; i < bs->num_sinks; i++)
+        sink_write (bs->sinks[i], bs->frame);
+    if (bs->loopback)
+        loopback_bytes (bs->frame);
+    sink_frame_unref (bs->frame);
+    bs->frame = NULL;
+}
 
-        fflush (bs->pt);		/* NEW SS to assist in debugging */
-    }
-    else if (bs->zmq_sock) {
-        for (i = bs->buf_size - 1; i >= minimum; i--)
-            zmqoutput_write_byte(bs, bs->buf[i]);
+/* empty the buffer to the output device when the buffer becomes full */
+void empty_buffer (Bit_stream_struc * bs, int minimum)
+{
+    int i;
+    TIMING_START(t_output);
+
+    if (bs->num_sinks > 0) {
+        /* the bytes are stored backwards in the buffer */
+        for (i = bs->buf_size - 1; i >= minimum; i--) {
+            if (bs->frame == NULL)
+                bs->frame = sink_frame_new (bs->frame_size);
+            bs->frame->data[bs->frame->len++] = bs->buf[i];
+            if (bs->frame->len == bs->frame_size)
+                send_frame (bs);
+        }
     }
 
     for (i = minimum - 1; i >= 0; i--)
@@ -123,27 +137,26 @@ void empty_buffer (Bit_stream_struc * bs, int minimum)
     bs->buf_byte_idx = bs->buf_size - 1 - minimum;
     bs->buf_bit_idx = 8;
 
+    TIMING_STOP(TIMING_OUTPUT, t_output);
 }
 
 
 /* open the device to write the bit stream into it */
 void open_bit_stream_w (Bit_stream_struc * bs, char *bs_filenam, int size)
 {
-    bs->zmq_sock = NULL;
-
-    if (bs_filenam[0] == '-')
-        bs->pt = stdout;
-    else if (strncmp(bs_filenam, "tcp://", 4) == 0) {
-        if (zmqoutput_open(bs, bs_filenam) != 0) {
-            fprintf(stderr, "Could not initialise ZMQ\n");
-            exit(1);
-        }
-        bs->pt = NULL; // we're not using file output
-    }
-    else if ((bs->pt = fopen (bs_filenam, "wb")) == NULL) {
-        fprintf (stderr, "Could not create \"%s\".\n", bs_filenam);
-        exit (1);
-    }
+    bs->pt = NULL;
+    bs->num_sinks = 0;
+    bs->frame = NULL;
+    bs->loopback = 0;
+
+    /* You must have one frame in memory if you are in DAB mode             */
+    /* in conformity of the norme ETS 300 401 http://www.etsi.org           */
+    /* see toollame.c                                                       */
+    bs->minimum = MINIMUM;
+
+    /* libtoolame adds its own sink */
+    if (bs_filenam)
+        add_bit_stream_sink (bs, bs_filenam);
     alloc_buffer (bs, size);
     bs->buf_byte_idx = size - 1;
     bs->buf_bit_idx = 8;
@@ -153,13 +166,66 @@ void open_bit_stream_w (Bit_stream_struc * bs, char *bs_filenam, int size)
     bs->eobs = FALSE;
 }
 
+/* write the bit stream to one more device: a file, stdout as -, a named
+   pipe, or a list of ZMQ endpoints, see sink.h */
+void add_bit_stream_sink (Bit_stream_struc * bs, char *bs_filenam)
+{
+    if (bs->num_sinks == MAX_SINKS) {
+        fprintf (stderr, "At most %d outputs can be given\n", MAX_SINKS);
+        exit (1);
+    }
+
+    if ((bs->sinks[bs->num_sinks] =
+                sink_open (bs_filenam, bs->frame_size)) == NULL)
+        exit (1);
+    bs->num_sinks++;
+}
+
+/* hand all the bytes written to the sinks but the last #keep#, which the
+   next frame can still change, see encode_output(). Called at the end of
+   a frame, the buffer is otherwise only emptied once it is full. With
+   #keep# 0, the last frame goes out even if it is not a whole one */
+void drain_bit_stream_w (Bit_stream_struc * bs, int keep)
+{
+    int oldest = bs->buf_byte_idx + 1 + keep;
+    int i;
+
+    if (oldest >= bs->buf_size)
+        return;
+
+    if (bs->num_sinks > 0) {
+        for (i = bs->buf_size - 1; i >= oldest; i--) {
+            if (bs->frame == NULL)
+                bs->frame = sink_frame_new (bs->frame_size);
+            bs->frame->data[bs->frame->len++] = bs->buf[i];
+            if (bs->frame->len == bs->frame_size)
+                send_frame (bs);
+        }
+    }
+
+    for (i = keep - 1; i >= 0; i--)
+        bs->buf[bs->buf_size - keep + i] = bs->buf[bs->buf_byte_idx + 1 + i];
+
+    bs->buf_byte_idx = bs->buf_size - 1 - keep;
+    bs->buf[bs->buf_byte_idx] = 0;
+
+    if (keep == 0 && bs->frame)
+        send_frame (bs);
+}
+
 /*close the device containing the bit stream after a write process*/
 void close_bit_stream_w (Bit_stream_struc * bs)
 {
+    int i;
+
     putbits (bs, 0, 7);
     empty_buffer (bs, bs->buf_byte_idx + 1);
-    if (bs->pt) fclose(bs->pt);
-    zmqoutput_close(bs);
+    /* the end of the stream goes out even if it is not a whole frame */
+    if (bs->frame)
+        send_frame (bs);
+    for (i = 0; i < bs->num_sinks; i++)
+        sink_close (bs->sinks[i]);
+    bs->num_sinks = 0;
     desalloc_buffer (bs);
 }
 
@@ -212,7 +278,7 @@ void put1bit (Bit_stream_struc * bs, int bit)
         bs->buf_bit_idx = 8;
         bs->buf_byte_idx--;
         if (bs->buf_byte_idx < 0)
-            empty_buffer (bs, minimum);
+            empty_buffer (bs, bs->minimum);
         bs->buf[bs->buf_byte_idx] = 0;
     }
 }
@@ -236,7 +302,7 @@ INLINE void putbits (Bit_stream_struc * bs, unsigned int val, int N)
             bs->buf_bit_idx = 8;
             bs->buf_byte_idx--;
             if (bs->buf_byte_idx < 0)
-                empty_buffer (bs, minimum);
+                empty_buffer (bs, bs->minimum);
             bs->buf[bs->buf_byte_idx] = 0;
         }
         j -= k;
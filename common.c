@@ -92,6 +92,21 @@ void hdr_to_frps (frame_info * frame)
   /* alloc, tab_num set in pick_table */
 }
 
+int dab_scf_crc_count (frame_header * hdr)
+/* number of scalefactor CRCs at the end of a DAB frame */
+{
+  int brate = bitrate[hdr->version][hdr->bitrate_index];
+
+  /* in 48 kHz (= MPEG-1) */
+  /* if the bit rate per channel is less then 56 kbit/s, we have 2 scf-crc */
+  /* else we have 4 scf-crc */
+  /* in 24 kHz (= MPEG-2), we have 4 scf-crc */
+  if (hdr->version == MPEG_AUDIO_ID
+      && brate / (hdr->mode == MPG_MD_MONO ? 1 : 2) < 56)
+    return 2;
+  return 4;
+}
+
 int BitrateIndex (int bRate,	/* legal rates from 32 to 448 */
 		  int version /* MPEG-1 or MPEG-2 LSF */ )
 /* convert bitrate in kbps to index */
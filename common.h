@@ -22,6 +22,7 @@
 #define         NULL_CHAR               '\0'
 
 #define         MAX_U_32_NUM            0xFFFFFFFF
+#define         MAX_U_64_NUM            0xFFFFFFFFFFFFFFFFULL
 #ifndef PI
 #define         PI                      3.14159265358979
 #endif
@@ -77,6 +78,7 @@
 #define         ASCII           1
 
 #define         BUFFER_SIZE     4096
+#define         MAX_SINKS       8	/* destinations of one bit stream */
 
 #define FLOAT8 float
 #define         MIN(A, B)       ((A) < (B) ? (A) : (B))
@@ -141,11 +143,18 @@ typedef struct
 }
 frame_info;
 
+struct sink;
+struct sink_frame;
+
 typedef struct bit_stream_struc
 {
   FILE *pt;			/* pointer to bit stream device */
-  void *zmq_sock;   /* zmq socket */
-  int zmq_framesize; /* zmq frame size */
+  struct sink *sinks[MAX_SINKS];	/* destinations, see sink.h */
+  int num_sinks;
+  int frame_size;		/* bytes handed to the sinks at once (24ms) */
+  struct sink_frame *frame;	/* the frame being filled for the sinks */
+  int loopback;			/* also hand the frames to the loopback check */
+  int minimum;			/* bytes kept in the buffer when it is emptied */
   unsigned char *buf;		/* bit stream buffer */
   int buf_size;			/* size of buffer (in number of bytes) */
   long totbit;			/* bit counter of bit stream */
@@ -197,6 +206,7 @@ extern double multiple[64];
 
 int js_bound (int);
 void hdr_to_frps (frame_info *);
+int dab_scf_crc_count (frame_header *);
 int BitrateIndex (int, int);
 int SmpFrqIndex (long, int *);
 void new_ext (char *filename, char *extname, char *newname);
@@ -0,0 +1,239 @@
+/* Real-time deadline monitor, see deadline.h */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "deadline.h"
+
+/* Values below SUB_BUCKETS have their own bucket, larger values
+ * share a bucket with the ones that have the same SUB_BITS most
+ * significant bits.
+ */
+#define SUB_BITS    5
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define NUM_BUCKETS (SUB_BUCKETS * 40)
+
+struct deadline_hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t worst;
+    uint64_t buckets[NUM_BUCKETS];
+};
+
+static struct deadline_hist hists[DEADLINE_NUM_METRICS];
+
+static const char *metric_names[DEADLINE_NUM_METRICS] = {
+    "encode time",
+    "input buffer",
+};
+
+static long rate = 48000;
+static uint64_t budget_us = 24000;
+static int alarm_headroom = 0;
+
+static uint64_t frame_start_us = 0;
+static uint64_t frame_end_us = 0;
+static uint64_t frame_count = 0;
+static uint64_t overrun_count = 0;
+static uint64_t underrun_count = 0;
+static uint64_t alarm_count = 0;
+
+/* Alarms are logged at most once per second of audio */
+static uint64_t frames_per_second = 42;
+static uint64_t last_alarm_frame = 0;
+static uint64_t suppressed_alarms = 0;
+
+uint64_t deadline_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int bucket_index(uint64_t v)
+{
+    int msb, shift, ix;
+
+    if (v < SUB_BUCKETS)
+        return v;
+
+    msb = 63 - __builtin_clzll(v);
+    shift = msb - SUB_BITS;
+    ix = (shift + 1) * SUB_BUCKETS + (int)((v >> shift) - SUB_BUCKETS);
+
+    return ix < NUM_BUCKETS ? ix : NUM_BUCKETS - 1;
+}
+
+/* Smallest value that falls into the bucket after ix */
+static uint64_t bucket_upper(int ix)
+{
+    int shift;
+
+    if (ix + 1 < SUB_BUCKETS)
+        return ix + 1;
+
+    shift = (ix + 1) / SUB_BUCKETS - 1;
+    return (uint64_t)((ix + 1) % SUB_BUCKETS + SUB_BUCKETS) << shift;
+}
+
+static void hist_add(struct deadline_hist *h, uint64_t v)
+{
+    h->count++;
+    h->sum += v;
+    if (v > h->worst)
+        h->worst = v;
+    h->buckets[bucket_index(v)]++;
+}
+
+static void raise_alarm(const char *what, uint64_t value_us, uint64_t limit_us)
+{
+    alarm_count++;
+
+    if (last_alarm_frame != 0 &&
+            frame_count - last_alarm_frame < frames_per_second) {
+        suppressed_alarms++;
+        return;
+    }
+
+    fprintf(stderr, "DEADLINE ALARM at frame %llu: %s %.2fms, limit %.2fms "
+            "(encode time p99 %.2fms, worst %.2fms)",
+            (unsigned long long)frame_count, what,
+            value_us / 1000.0, limit_us / 1000.0,
+            deadline_percentile(DEADLINE_ENCODE, 99) / 1000.0,
+            deadline_worst(DEADLINE_ENCODE) / 1000.0);
+    if (suppressed_alarms) {
+        fprintf(stderr, " (%llu more alarms since last message)",
+                (unsigned long long)suppressed_alarms);
+    }
+    fprintf(stderr, "\n");
+
+    last_alarm_frame = frame_count;
+    suppressed_alarms = 0;
+}
+
+void deadline_init(long sample_rate, int headroom)
+{
+    memset(hists, 0, sizeof(hists));
+
+    rate = sample_rate;
+    budget_us = 1152 * (uint64_t)1000000 / sample_rate;
+    frames_per_second = sample_rate / 1152 + 1;
+    alarm_headroom = headroom;
+}
+
+void deadline_frame_start(void)
+{
+    frame_start_us = deadline_now_us();
+
+    if (frame_count > 0 && frame_start_us - frame_end_us > 2 * budget_us)
+        underrun_count++;
+}
+
+uint64_t deadline_frame_end(void)
+{
+    uint64_t encode_us;
+
+    frame_end_us = deadline_now_us();
+    encode_us = frame_end_us - frame_start_us;
+
+    frame_count++;
+    hist_add(&hists[DEADLINE_ENCODE], encode_us);
+
+    if (encode_us > budget_us)
+        overrun_count++;
+
+    if (alarm_headroom > 0) {
+        uint64_t limit = budget_us * (100 - alarm_headroom) / 100;
+        if (encode_us > limit)
+            raise_alarm("encode time", encode_us, limit);
+    }
+
+    return encode_us;
+}
+
+void deadline_input_fill(unsigned long fill, unsigned long capacity)
+{
+    uint64_t fill_us = (uint64_t)fill * 1000000 / rate;
+
+    hist_add(&hists[DEADLINE_INPUT_FILL], fill_us);
+
+    if (alarm_headroom > 0 && capacity > 0) {
+        uint64_t capacity_us = (uint64_t)capacity * 1000000 / rate;
+        uint64_t limit = capacity_us * (100 - alarm_headroom) / 100;
+        if (fill_us > limit)
+            raise_alarm("input buffer", fill_us, limit);
+    }
+}
+
+uint64_t deadline_overruns(void)
+{
+    return overrun_count;
+}
+
+uint64_t deadline_alarms(void)
+{
+    return alarm_count;
+}
+
+uint64_t deadline_underruns(void)
+{
+    return underrun_count;
+}
+
+uint64_t deadline_percentile(enum deadline_metric metric, double pct)
+{
+    const struct deadline_hist *h = &hists[metric];
+    uint64_t target, seen = 0;
+    int ix;
+
+    if (h->count == 0)
+        return 0;
+
+    target = (uint64_t)(h->count * pct / 100.0 + 0.5);
+    if (target == 0)
+        target = 1;
+
+    for (ix = 0; ix < NUM_BUCKETS; ix++) {
+        seen += h->buckets[ix];
+        if (seen >= target) {
+            uint64_t upper = bucket_upper(ix) - 1;
+            return upper < h->worst ? upper : h->worst;
+        }
+    }
+
+    return h->worst;
+}
+
+uint64_t deadline_worst(enum deadline_metric metric)
+{
+    return hists[metric].worst;
+}
+
+void deadline_report(FILE *fd)
+{
+    int m;
+
+    fprintf(fd, "Deadline: %llu frames, budget %.2fms per frame, "
+            "%llu over budget, %llu input underruns, %llu alarms\n",
+            (unsigned long long)frame_count, budget_us / 1000.0,
+            (unsigned long long)overrun_count,
+            (unsigned long long)underrun_count,
+            (unsigned long long)alarm_count);
+
+    for (m = 0; m < DEADLINE_NUM_METRICS; m++) {
+        const struct deadline_hist *h = &hists[m];
+        if (h->count == 0)
+            continue;
+
+        fprintf(fd, "  %-12s [ms] mean %7.2f  p50 %7.2f  p90 %7.2f  "
+                "p99 %7.2f  p99.9 %7.2f  worst %7.2f\n",
+                metric_names[m],
+                (double)h->sum / h->count / 1000.0,
+                deadline_percentile(m, 50) / 1000.0,
+                deadline_percentile(m, 90) / 1000.0,
+                deadline_percentile(m, 99) / 1000.0,
+                deadline_percentile(m, 99.9) / 1000.0,
+                h->worst / 1000.0);
+    }
+}
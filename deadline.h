@@ -0,0 +1,61 @@
+#ifndef _DEADLINE_H_
+#define _DEADLINE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Real-time deadline monitor
+ *
+ * Every frame of 1152 samples has to be encoded in less time than it
+ * takes to play it (24ms at 48kHz). The monitor measures the encode
+ * time of each frame against this budget, the amount of audio waiting
+ * in the input buffer (JACK ringbuffer or VLC buffer list). The ZMQ
+ * outputs measure their own latency, see zmqoutput.h.
+ *
+ * All durations are kept in microseconds in log-linear histograms
+ * with a resolution of about 3%, from which the percentiles are taken.
+ */
+
+enum deadline_metric {
+    DEADLINE_ENCODE = 0,  // encode time of one frame
+    DEADLINE_INPUT_FILL,  // audio waiting in the input buffer
+    DEADLINE_NUM_METRICS
+};
+
+/* Setup the monitor for the given sample rate.
+ *
+ * An alarm is logged whenever the headroom of a frame, i.e. the part of the
+ * budget that was left after encoding it, falls under alarm_headroom percent,
+ * or when the input buffer is filled to more than 100 - alarm_headroom
+ * percent. An alarm_headroom of 0 disables the alarms.
+ */
+void deadline_init(long sample_rate, int alarm_headroom);
+
+/* Call when a new frame of audio is available, and when it is encoded.
+ * deadline_frame_end returns the encode time of the frame */
+void deadline_frame_start(void);
+uint64_t deadline_frame_end(void);
+
+/* Sample the input buffer occupancy, in samples per channel */
+void deadline_input_fill(unsigned long fill, unsigned long capacity);
+
+/* Number of frames over budget, and number of alarms */
+uint64_t deadline_overruns(void);
+uint64_t deadline_alarms(void);
+
+/* Number of times the input did not deliver a frame within
+ * twice its duration after the previous one was encoded */
+uint64_t deadline_underruns(void);
+
+/* Get a percentile (0 to 100) and the worst case of a metric,
+ * in microseconds. Return 0 if nothing was recorded */
+uint64_t deadline_percentile(enum deadline_metric metric, double pct);
+uint64_t deadline_worst(enum deadline_metric metric);
+
+/* Print a summary of all metrics */
+void deadline_report(FILE *fd);
+
+/* Monotonic clock in microseconds */
+uint64_t deadline_now_us(void);
+
+#endif
@@ -6,6 +6,7 @@
 #include "bitstream.h"
 #include "availbits.h"
 #include "encode_new.h"
+#include "twopass.h"
 
 #define NUMTABLES 5
 int vbrstats_new[15] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
@@ -122,7 +123,8 @@ int encode_init(frame_info *frame) {
   } else {			/* MPEG-2 LSF */
     tablenum = 4;
   }
-  fprintf(stdout,"encode_init: using tablenum %i with sblimit %i\n",tablenum, table_sblimit[tablenum]);
+  if (glopts.verbosity > 2)
+    fprintf(stderr,"encode_init: using tablenum %i with sblimit %i\n",tablenum, table_sblimit[tablenum]);
 
 #define DUMPTABLESx
 #ifdef DUMPTABLES 
@@ -155,6 +157,14 @@ int encode_init(frame_info *frame) {
   return (table_sblimit[tablenum]);
 }
 
+/* Switch back to the allocation table of a frame set up by hdr_to_frps.
+   pick_table and encode_init follow the same rules, so tab_num is
+   the table number. Needed when several outputs are encoded in turn */
+void encode_select_table (frame_info *frame)
+{
+  tablenum = frame->tab_num;
+}
+
 /* 
    scale_factor_calc
    pick_scale
@@ -176,9 +186,9 @@ int encode_init(frame_info *frame) {
 */
 
 
-void scalefactor_calc_new (double sb_sample[][3][SCALE_BLOCK][SBLIMIT],
+static void scalefactor_calc_range (double sb_sample[][3][SCALE_BLOCK][SBLIMIT],
 			unsigned int sf_index[][3][SBLIMIT], int nch,
-			int sblimit)
+			int sbstart, int sblimit)
 {
   /* Optimized to use binary search instead of linear scan through the
      scalefactor table; guarantees to find scalefactor in only 5
@@ -192,7 +202,7 @@ void scalefactor_calc_new (double sb_sample[][3][SCALE_BLOCK][SBLIMIT],
   for (ch = nch; ch--;)
     for (gr = 3; gr--;) {
       int sb;
-      for (sb = sblimit; sb--;) {
+      for (sb = sblimit; sb-- > sbstart;) {
 	int j;
 	unsigned int l;
 	register double temp;
@@ -228,23 +238,49 @@ void scalefactor_calc_new (double sb_sample[][3][SCALE_BLOCK][SBLIMIT],
       }
     }
 }
+
+void scalefactor_calc_new (double sb_sample[][3][SCALE_BLOCK][SBLIMIT],
+			unsigned int sf_index[][3][SBLIMIT], int nch,
+			int sblimit)
+{
+  scalefactor_calc_range (sb_sample, sf_index, nch, 0, sblimit);
+}
+
 INLINE double mod (double a)
 {
   return (a > 0) ? a : -a;
 }
 
-/* Combine L&R channels into a mono joint stereo channel */
+/* Combine L&R channels into a mono joint stereo channel,
+   for the subbands from jsbound to sblimit */
 void combine_LR_new (double sb_sample[2][3][SCALE_BLOCK][SBLIMIT],
-		     double joint_sample[3][SCALE_BLOCK][SBLIMIT], int sblimit) {
+		     double joint_sample[3][SCALE_BLOCK][SBLIMIT], int jsbound,
+		     int sblimit) {
   int sb, sample, gr;
 
-  for (sb = 0; sb < sblimit; ++sb)
+  for (sb = jsbound; sb < sblimit; ++sb)
     for (sample = 0; sample < SCALE_BLOCK; ++sample)
       for (gr = 0; gr < 3; ++gr)
 	joint_sample[gr][sample][sb] =
 	  .5 * (sb_sample[0][gr][sample][sb] + sb_sample[1][gr][sample][sb]);
 }
 
+/* Make the mono joint stereo channel and its scalefactors. Only
+   subband_quantization_new uses them, and only above the jsbound, so
+   call this after the bit allocation has chosen the bound.
+   Nothing is done if the frame ended up in plain stereo. */
+void joint_stereo_new (double sb_sample[2][3][SCALE_BLOCK][SBLIMIT],
+		       double joint_sample[][3][SCALE_BLOCK][SBLIMIT],
+		       unsigned int j_scale[][3][SBLIMIT], frame_info * frame)
+{
+  if (frame->nch != 2 || frame->jsbound >= frame->sblimit)
+    return;
+
+  combine_LR_new (sb_sample, joint_sample[0], frame->jsbound, frame->sblimit);
+  scalefactor_calc_range (joint_sample, j_scale, 1, frame->jsbound,
+			  frame->sblimit);
+}
+
 /* PURPOSE:For each subband, puts the smallest scalefactor of the 3
    associated with a frame into #max_sc#.  This is used
    used by Psychoacoustic Model I.
@@ -706,6 +742,51 @@ int bits_for_nonoise_new (double SMR[2][SBLIMIT],
 
 
 
+/************************************************************************
+*
+* vbr_limits_new
+*
+* PURPOSE: The range of bitrate indices a VBR stream can use with the
+* allocation table of #frame#.
+*
+************************************************************************/
+void vbr_limits_new (frame_info * frame, int *lower, int *upper)
+{
+  /* these are the tables which specify the limits within which the VBR can vary 
+     You can't vary outside these ranges, otherwise a new alloc table would have to 
+     be loaded in the middle of encoding. This VBR hack is dodgy - the standard
+     says that LayerII decoders don't have to support a variable bitrate, but Layer3
+     decoders must do so. Hence, it is unlikely that a compliant layer2 decoder would be 
+     written to dynmically change allocation tables. *BUT* a layer3 encoder might handle it
+     by default, meaning we could switch tables mid-encode and enjoy a wider range of bitrates
+     for the VBR encoding. 
+     None of this needs to be done for LSF, since there is only *one* possible alloc table in LSF 
+     MFC Feb 2003 */
+  static int vbrlimits[2][3][2] = {
+    /* MONO */
+    { /* 44 */ {6, 10},
+     /* 48 */ {3, 10},
+     /* 32 */ {6, 10}},
+    /* STEREO */
+    { /* 44 */ {10, 14},
+     /* 48 */ {7, 14},
+     /* 32 */ {10, 14}}
+  };
+  frame_header *header = frame->header;
+  int nch = 2;
+
+  if (header->version == 0) {
+    /* LSF: so can use any bitrate index from 1->15 */
+    *lower = 1;
+    *upper = 14;
+  } else {
+    if (frame->actual_mode == MPG_MD_MONO)
+      nch = 1;
+    *lower = vbrlimits[nch-1][header->sampling_frequency][0];
+    *upper = vbrlimits[nch-1][header->sampling_frequency][1];
+  }
+}
+
 /************************************************************************
 *
 * main_bit_allocation  (Layer II)
@@ -739,27 +820,6 @@ void main_bit_allocation_new (double SMR[2][SBLIMIT],
   int mode, mode_ext, lay;
   int rq_db;			/* av_db = *adb; Not Used MFC Nov 99 */
 
-  /* these are the tables which specify the limits within which the VBR can vary 
-     You can't vary outside these ranges, otherwise a new alloc table would have to 
-     be loaded in the middle of encoding. This VBR hack is dodgy - the standard
-     says that LayerII decoders don't have to support a variable bitrate, but Layer3
-     decoders must do so. Hence, it is unlikely that a compliant layer2 decoder would be 
-     written to dynmically change allocation tables. *BUT* a layer3 encoder might handle it
-     by default, meaning we could switch tables mid-encode and enjoy a wider range of bitrates
-     for the VBR encoding. 
-     None of this needs to be done for LSF, since there is only *one* possible alloc table in LSF 
-     MFC Feb 2003 */
-  int vbrlimits[2][3][2] = {
-    /* MONO */
-    { /* 44 */ {6, 10},
-     /* 48 */ {3, 10},
-     /* 32 */ {6, 10}},
-    /* STEREO */
-    { /* 44 */ {10, 14},
-     /* 48 */ {7, 14},
-     /* 32 */ {10, 14}}
-  };
-
   static int init = 0;
   static int lower = 10, upper = 10;
   static int bitrateindextobits[15] =
@@ -767,21 +827,8 @@ void main_bit_allocation_new (double SMR[2][SBLIMIT],
   int guessindex = 0;
 
   if (init == 0) {
-    int nch = 2;
-    int sfreq;
-    frame_header *header = frame->header;
     init++;
-    if (header->version == 0) {
-      /* LSF: so can use any bitrate index from 1->15 */
-      lower = 1;
-      upper = 14;
-    } else {
-      if (frame->actual_mode == MPG_MD_MONO)
-	nch = 1;
-      sfreq = header->sampling_frequency;
-      lower = vbrlimits[nch-1][sfreq][0];
-      upper = vbrlimits[nch-1][sfreq][1];
-    }
+    vbr_limits_new (frame, &lower, &upper);
     if (glopts->verbosity > 2)
       fprintf (stdout, "VBR bitrate index limits [%i -> %i]\n", lower, upper);
 
@@ -824,6 +871,10 @@ void main_bit_allocation_new (double SMR[2][SBLIMIT],
     noisy_sbs = a_bit_allocation_new (SMR, scfsi, bit_alloc, adb, frame);
   } else {			
     /* do the VBR bit allocation method */
+    /* the bits the caller kept back from the frame, for the DAB CRCs and
+       the PAD, are kept back at the bitrate chosen too */
+    int reserved = available_bits (frame->header, glopts) - *adb;
+
     frame->header->bitrate_index = lower;
     *adb = available_bits (frame->header, glopts);
     {
@@ -854,8 +905,12 @@ void main_bit_allocation_new (double SMR[2][SBLIMIT],
 	guessindex = upper;
     }
 
+    /* the second pass of two-pass VBR chose the bitrate in advance */
+    if (twopass_replaying ())
+      guessindex = twopass_next_index (guessindex);
+
     frame->header->bitrate_index = guessindex;
-    *adb = available_bits (frame->header, glopts);
+    *adb = available_bits (frame->header, glopts) - reserved;
 
     /* update the statistics */
     vbrstats_new[frame->header->bitrate_index]++;
@@ -885,6 +940,44 @@ void main_bit_allocation_new (double SMR[2][SBLIMIT],
   }
 }
 
+/************************************************************************
+*
+* silent_bit_allocation_new
+*
+* PURPOSE: No bits for any subband, for a frame of the silence fast
+* path (see silence.h). Takes the header, the CRC and the bit
+* allocation from the available bits, as a_bit_allocation_new() does.
+* A joint stereo frame is sent as plain stereo.
+*
+************************************************************************/
+void silent_bit_allocation_new (unsigned int scfsi[2][SBLIMIT],
+				unsigned int bit_alloc[2][SBLIMIT], int *adb,
+				frame_info * frame)
+{
+  int sb, ch;
+  int nch = frame->nch;
+  int sblimit = frame->sblimit;
+  int bbal = 0;
+
+  if (frame->actual_mode == MPG_MD_JOINT_STEREO) {
+    frame->header->mode = MPG_MD_STEREO;
+    frame->header->mode_ext = 0;
+    frame->jsbound = sblimit;
+  }
+
+  for (sb = 0; sb < frame->jsbound; sb++)
+    bbal += nch * nbal[ line[tablenum][sb] ];
+  for (sb = frame->jsbound; sb < sblimit; sb++)
+    bbal += nbal[ line[tablenum][sb] ];
+  *adb -= bbal + (frame->header->error_protection ? 16 : 0) + 32;
+
+  for (ch = 0; ch < 2; ch++)
+    for (sb = 0; sb < SBLIMIT; sb++) {
+      bit_alloc[ch][sb] = 0;
+      scfsi[ch][sb] = 0;
+    }
+}
+
 void VBR_maxmnr_new (double mnr[2][SBLIMIT], char used[2][SBLIMIT], int sblimit,
 		 int nch, int *min_sb, int *min_ch, options * glopts)
 {
@@ -1,4 +1,5 @@
 int encode_init(frame_info *frame);
+void encode_select_table (frame_info *frame);
 void scalefactor_calc_new (double sb_sample[][3][SCALE_BLOCK][SBLIMIT],
 			   unsigned int scalar[][3][SBLIMIT], int nch,
 			   int sblimit);
@@ -6,7 +7,12 @@ void scalefactor_calc_new (double sb_sample[][3][SCALE_BLOCK][SBLIMIT],
 INLINE double mod (double a);
 
 void combine_LR_new (double sb_sample[2][3][SCALE_BLOCK][SBLIMIT],
-		     double joint_sample[3][SCALE_BLOCK][SBLIMIT], int sblimit);
+		     double joint_sample[3][SCALE_BLOCK][SBLIMIT], int jsbound,
+		     int sblimit);
+
+void joint_stereo_new (double sb_sample[2][3][SCALE_BLOCK][SBLIMIT],
+		       double joint_sample[][3][SCALE_BLOCK][SBLIMIT],
+		       unsigned int j_scale[][3][SBLIMIT], frame_info * frame);
 
 void find_sf_max (unsigned int sf_index[2][3][SBLIMIT], frame_info * frame,
 		  double sf_max[2][SBLIMIT]);
@@ -44,6 +50,7 @@ void write_samples_new (unsigned int sbband[2][3][SCALE_BLOCK][SBLIMIT],
 int bits_for_nonoise_new (double SMR[2][SBLIMIT],
 			  unsigned int scfsi[2][SBLIMIT], frame_info * frame, float min_mnr,
 			  unsigned int bit_alloc[2][SBLIMIT]);
+void vbr_limits_new (frame_info * frame, int *lower, int *upper);
 void main_bit_allocation_new (double SMR[2][SBLIMIT],
 			  unsigned int scfsi[2][SBLIMIT],
 			  unsigned int bit_alloc[2][SBLIMIT], int *adb,
@@ -61,3 +68,7 @@ int a_bit_allocation_new (double SMR[2][SBLIMIT],
 		      unsigned int scfsi[2][SBLIMIT],
 		      unsigned int bit_alloc[2][SBLIMIT], int *adb,
 		      frame_info * frame);
+/* No bits for any subband, for a frame of silence. See silence.h */
+void silent_bit_allocation_new (unsigned int scfsi[2][SBLIMIT],
+		      unsigned int bit_alloc[2][SBLIMIT], int *adb,
+		      frame_info * frame);
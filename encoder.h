@@ -75,6 +75,17 @@ typedef struct
 }
 mask, *mask_ptr;
 
+/* Tonal or non-tonal maskers of one frame, in increasing frequency */
+typedef struct
+{
+  int n;
+  int line[HAN_SIZE / 2];	/* spectral line of the masker */
+  int map[HAN_SIZE / 2];	/* ltg entry the line belongs to */
+  double bark[HAN_SIZE / 2];
+  double x[HAN_SIZE / 2];	/* level in dB */
+}
+masker_list;
+
 /* Psychoacoustic Model 2 Type Definitions */
 
 typedef int ICB[CBANDS];
@@ -0,0 +1,202 @@
+/* CPU budget governor, see governor.h */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "governor.h"
+#include "quickmode.h"
+
+#define MAX_TIERS 4
+
+/* Threshold of the adaptive quick mode tier, in dB */
+#define QUICK_THRESHOLD 3.0
+
+/* The load is averaged with a weight of 1/LOAD_AVG per frame */
+#define LOAD_AVG 16
+
+/* Hold time before stepping up, in seconds, and its limit */
+#define HOLD_SECONDS 5
+#define MAX_HOLD_SECONDS 300
+
+struct gov_tier {
+    int model;
+    int quick;
+    int quick_age;
+    double quick_threshold;
+    uint64_t hold;      // frames under the low mark before stepping up to it
+    double exit_load;   // load when the governor stepped down from it
+    double cost;        // its load relative to the tier below, 0 if unknown
+};
+
+static struct gov_tier tiers[MAX_TIERS];
+static int num_tiers = 0;
+static int tier = 0;
+
+static int target = 0;
+static uint64_t frames_per_second = 42;
+static uint64_t budget_us = 24000;
+
+static double load = -1;
+static uint64_t frames_in_tier = 0;
+static uint64_t frames_under = 0;
+static int stepped_up = 0;
+
+static uint64_t steps_down = 0;
+static uint64_t steps_up = 0;
+
+static void add_tier(int model, int quick, int quick_age, double quick_threshold)
+{
+    tiers[num_tiers].model = model;
+    tiers[num_tiers].quick = quick;
+    tiers[num_tiers].quick_age = quick_age;
+    tiers[num_tiers].quick_threshold = quick_threshold;
+    tiers[num_tiers].hold = HOLD_SECONDS * frames_per_second;
+    tiers[num_tiers].exit_load = 0;
+    tiers[num_tiers].cost = 0;
+    num_tiers++;
+}
+
+void governor_init(long sample_rate, int target_pct, int model,
+        int quick, int quick_age, double quick_threshold)
+{
+    target = target_pct;
+    frames_per_second = sample_rate / 1152 + 1;
+    budget_us = 1152 * (uint64_t)1000000 / sample_rate;
+
+    num_tiers = 0;
+    tier = 0;
+    add_tier(model, quick, quick_age, quick_threshold);
+
+    /* psycho_1 is cheaper than models 2 and 4, and the ones comparing
+     * several models. Model 3 costs about the same */
+    if (model >= 2 && model != 3)
+        add_tier(1, quick, quick_age, quick_threshold);
+
+    if (model >= 1 && !quick)
+        add_tier(1, 1, quick_age,
+                quick_threshold > 0 ? quick_threshold : QUICK_THRESHOLD);
+
+    if (model >= 1)
+        add_tier(0, 0, 0, 0);
+}
+
+int governor_enabled(void)
+{
+    return target > 0 && num_tiers > 1;
+}
+
+void governor_tier(int *model, int *quick)
+{
+    *model = tiers[tier].model;
+    *quick = tiers[tier].quick;
+}
+
+static void switch_tier(int to, double input_fill)
+{
+    const struct gov_tier *from_t = &tiers[tier];
+    const struct gov_tier *to_t = &tiers[to];
+
+    fprintf(stderr, "Governor: load %.1f%% of the frame budget", load * 100);
+    if (input_fill >= 0)
+        fprintf(stderr, ", input buffer %.0f%% full", input_fill * 100);
+    fprintf(stderr, ", psy model %d%s -> %d%s\n",
+            from_t->model, from_t->quick ? " quick" : "",
+            to_t->model, to_t->quick ? " quick" : "");
+
+    if (to > tier) {
+        tiers[tier].exit_load = load;
+        steps_down++;
+    }
+    else {
+        steps_up++;
+    }
+
+    stepped_up = to < tier;
+    tier = to;
+    frames_in_tier = 0;
+    frames_under = 0;
+
+    /* Start the quick mode from a fresh run of the new model */
+    if (to_t->quick)
+        quickmode_init(to_t->quick_age, to_t->quick_threshold);
+}
+
+void governor_frame(uint64_t encode_us, double input_fill)
+{
+    double frame_load;
+
+    if (!governor_enabled())
+        return;
+
+    frame_load = (double)encode_us / budget_us;
+    if (load < 0)
+        load = frame_load;
+    else
+        load += (frame_load - load) / LOAD_AVG;
+
+    frames_in_tier++;
+
+    /* The tier we stepped up to held on */
+    if (stepped_up && frames_in_tier >= tiers[tier].hold) {
+        tiers[tier].hold = HOLD_SECONDS * frames_per_second;
+        stepped_up = 0;
+    }
+
+    /* Give the average time to follow the previous switch */
+    if (frames_in_tier < frames_per_second / 2)
+        return;
+
+    /* Once settled after a step down, compare the load to the one of
+     * the tier above */
+    if (!stepped_up && tier > 0 && frames_in_tier == frames_per_second &&
+            load > 0)
+        tiers[tier - 1].cost = tiers[tier - 1].exit_load / load;
+
+    if (load * 100 > target || input_fill * 100 > target) {
+        if (tier + 1 < num_tiers) {
+            /* Leaving a tier we just stepped up to: wait longer before
+             * trying it again */
+            if (stepped_up &&
+                    tiers[tier].hold < MAX_HOLD_SECONDS * frames_per_second)
+                tiers[tier].hold *= 2;
+            switch_tier(tier + 1, input_fill);
+        }
+        return;
+    }
+
+    if (tier > 0 && input_fill * 200 < target &&
+            (tiers[tier - 1].cost > 0 ?
+             load * tiers[tier - 1].cost * 100 < target * 0.9 :
+             load * 200 < target)) {
+        if (++frames_under >= tiers[tier - 1].hold)
+            switch_tier(tier - 1, input_fill);
+    }
+    else {
+        frames_under = 0;
+    }
+}
+
+uint64_t governor_steps_down(void)
+{
+    return steps_down;
+}
+
+uint64_t governor_steps_up(void)
+{
+    return steps_up;
+}
+
+int governor_current_tier(void)
+{
+    return tier;
+}
+
+void governor_report(FILE *fd)
+{
+    if (!governor_enabled())
+        return;
+
+    fprintf(fd, "Governor: %llu steps down, %llu steps up, "
+            "ending with psy model %d%s\n",
+            (unsigned long long)steps_down, (unsigned long long)steps_up,
+            tiers[tier].model, tiers[tier].quick ? " quick" : "");
+}
@@ -0,0 +1,58 @@
+#ifndef _GOVERNOR_H_
+#define _GOVERNOR_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* CPU budget governor
+ *
+ * A live encoder has to encode every frame in less time than it takes to
+ * play it. When the host is overloaded, the governor steps the psy model
+ * down to cheaper tiers, and back up once the load allows it:
+ *
+ *   the configured model, e.g. psycho_4
+ *   psycho_1
+ *   psycho_1 in adaptive quick mode
+ *   psycho_0
+ *
+ * Tiers that would not be cheaper than the configured model are left out.
+ *
+ * The load is the encode time of a frame relative to its duration,
+ * averaged over about half a second. The governor steps down when the
+ * load or the fill of the input buffer exceeds the target percentage.
+ *
+ * A second after a step down, the ratio of the loads of the two tiers is
+ * noted. The governor steps back up once the load expected from that
+ * ratio has stayed under 90% of the target for a hold time, and the input
+ * buffer under half of it. If the upper tier then turns out too slow
+ * again, its hold time is doubled, so that the governor does not keep
+ * switching.
+ */
+
+/* Setup the governor for the configured psy model and quick mode, see
+ * quickmode.h. The quick mode tier added by the governor is adaptive,
+ * with quick_threshold if it is set, or 3dB. A target_pct of 0 disables
+ * the governor */
+void governor_init(long sample_rate, int target_pct, int model,
+        int quick, int quick_age, double quick_threshold);
+
+/* Psy model and quick mode to use for the next frame */
+void governor_tier(int *model, int *quick);
+
+/* Account a frame, with its encode time and the fill of the input buffer
+ * from 0 to 1, or a negative value if it is unknown */
+void governor_frame(uint64_t encode_us, double input_fill);
+
+/* Number of steps down and up, and current tier, 0 being the configured
+ * model */
+uint64_t governor_steps_down(void);
+uint64_t governor_steps_up(void);
+int governor_current_tier(void);
+
+/* Tell whether the governor is enabled */
+int governor_enabled(void);
+
+/* Print the counters */
+void governor_report(FILE *fd);
+
+#endif
@@ -0,0 +1,118 @@
+/* Bitrate ladder, see ladder.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "options.h"
+#include "bitstream.h"
+#include "ladder.h"
+
+static struct ladder_output outputs[LADDER_MAX];
+static int num_outputs = 0;
+
+int ladder_add(char *spec)
+{
+    struct ladder_output *out;
+    char *sep = strchr(spec, ':');
+    char *end;
+    long brate;
+
+    if (num_outputs == LADDER_MAX) {
+        fprintf(stderr, "At most %d ladder outputs can be given\n",
+                LADDER_MAX);
+        return -1;
+    }
+
+    if (sep == NULL || sep[1] == '\0')
+        return -1;
+
+    brate = strtol(spec, &end, 10);
+    if (end != sep || brate <= 0)
+        return -1;
+
+    out = &outputs[num_outputs++];
+    memset(out, 0, sizeof(*out));
+    out->brate = brate;
+    out->path = sep + 1;
+    return 0;
+}
+
+int ladder_open(const frame_header *primary, const options *opts)
+{
+    int i;
+
+    if (num_outputs > 0 && opts->vbr) {
+        fprintf(stderr, "The bitrate ladder cannot be used with VBR\n");
+        return -1;
+    }
+
+    for (i = 0; i < num_outputs; i++) {
+        struct ladder_output *out = &outputs[i];
+        double slots;
+        int index;
+
+        for (index = 1; index < 15; index++)
+            if (bitrate[primary->version][index] == out->brate)
+                break;
+        if (index == 15) {
+            fprintf(stderr, "%d kbps is not a legal bitrate for %s\n",
+                    out->brate, version_names[primary->version]);
+            return -1;
+        }
+
+        /* available_bits() keeps a single padding state */
+        slots = 1152.0 / s_freq[primary->version][primary->sampling_frequency]
+            * out->brate / 8;
+        if (opts->usepadbit && slots != (int)slots) {
+            fprintf(stderr, "%d kbps needs padding at this sample rate, "
+                    "which the bitrate ladder does not support\n", out->brate);
+            return -1;
+        }
+
+        out->header = *primary;
+        out->header.bitrate_index = index;
+        if (out->header.dab_extension)
+            out->header.dab_extension = dab_scf_crc_count(&out->header);
+
+        out->frame.header = &out->header;
+        out->frame.tab_num = -1;
+        out->frame.alloc = NULL;
+        hdr_to_frps(&out->frame);
+
+        out->bs.frame_size = 3 * out->brate;
+        open_bit_stream_w(&out->bs, out->path, BUFFER_SIZE);
+    }
+
+    return 0;
+}
+
+int ladder_count(void)
+{
+    return num_outputs;
+}
+
+struct ladder_output *ladder_get(int i)
+{
+    return &outputs[i];
+}
+
+frame_info *ladder_analysis_frame(frame_info *primary)
+{
+    frame_info *widest = primary;
+    int i;
+
+    for (i = 0; i < num_outputs; i++)
+        if (outputs[i].frame.sblimit > widest->sblimit)
+            widest = &outputs[i].frame;
+
+    return widest;
+}
+
+void ladder_close(void)
+{
+    int i;
+
+    for (i = 0; i < num_outputs; i++)
+        close_bit_stream_w(&outputs[i].bs);
+}
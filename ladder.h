@@ -0,0 +1,60 @@
+#ifndef _LADDER_H_
+#define _LADDER_H_
+
+#include "common.h"
+#include "options.h"
+
+/* Bitrate ladder: encode the programme at several bitrates at once
+ *
+ * Every -B kbps:output adds an output to the one given on the command
+ * line. The filterbank, the scalefactors and the psy model run once per
+ * frame, for the output with the largest sblimit. Only the bit
+ * allocation, the quantization and the packing are done for every
+ * output, each with its own allocation table and bit stream, which can
+ * be a file or a list of ZMQ endpoints.
+ *
+ * The psy model sees the bitrate and sblimit of that one output. For
+ * psy models 1 and 3, which lower the threshold in quiet at high
+ * bitrates, the other outputs can therefore differ slightly from a
+ * separate encoding at their bitrate.
+ */
+
+#define LADDER_MAX 8
+
+struct ladder_output {
+    frame_header header;
+    frame_info frame;
+    Bit_stream_struc bs;
+    unsigned int bit_alloc[2][SBLIMIT];
+    unsigned int scfsi[2][SBLIMIT];
+    unsigned long sent_bits;
+    int brate;
+    char *path;
+};
+
+/* Add an output given as kbps:output. The string must stay valid.
+ * returns 0  on success
+ *         -1 on a malformed specification or too many outputs
+ */
+int ladder_add(char *spec);
+
+/* Set up the outputs as copies of the primary header at their own
+ * bitrate, and open their bit streams.
+ * returns 0  on success
+ *         -1 if one of the bitrates cannot be used
+ */
+int ladder_open(const frame_header *primary, const options *opts);
+
+/* Number of outputs added with ladder_add() */
+int ladder_count(void);
+
+struct ladder_output *ladder_get(int i);
+
+/* The frame, out of the primary one and the outputs, that the analysis
+ * runs for: the one with the largest sblimit */
+frame_info *ladder_analysis_frame(frame_info *primary);
+
+/* Flush and close the bit streams */
+void ladder_close(void);
+
+#endif
@@ -0,0 +1,860 @@
+/* libtoolame, see libtoolame.h and libtoolame_priv.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "encoder.h"
+#include "options.h"
+#include "audio_read.h"
+#include "bitstream.h"
+#include "mem.h"
+#include "crc.h"
+#include "psycho_n1.h"
+#include "psycho_0.h"
+#include "psycho_1.h"
+#include "psycho_2.h"
+#include "psycho_3.h"
+#include "psycho_4.h"
+#include "encode.h"
+#include "availbits.h"
+#include "subband.h"
+#include "encode_new.h"
+#include "timing.h"
+#include "stats.h"
+#include "zmqoutput.h"
+#include "pcm_ring.h"
+#include "deadline.h"
+#include "quickmode.h"
+#include "silence.h"
+#include "psycache.h"
+#include "loopback.h"
+#include "governor.h"
+#include "ladder.h"
+#include "twopass.h"
+#include "sink.h"
+#include "libtoolame.h"
+#include "libtoolame_priv.h"
+
+#include <assert.h>
+
+const int FPAD_LENGTH=2;
+
+typedef double SBS[2][3][SCALE_BLOCK][SBLIMIT];
+typedef double JSBS[3][SCALE_BLOCK][SBLIMIT];
+typedef unsigned int SUB[2][3][SCALE_BLOCK][SBLIMIT];
+
+void global_init (void)
+{
+    glopts.usepsy = TRUE;
+    glopts.usepadbit = TRUE;
+    glopts.quickmode = FALSE;
+    glopts.quickcount = 10;
+    glopts.quickthreshold = 0;
+    glopts.downmix = FALSE;
+    glopts.byteswap = FALSE;
+    glopts.channelswap = FALSE;
+    glopts.vbr = FALSE;
+    glopts.vbrlevel = 0;
+    glopts.athlevel = 0;
+    glopts.verbosity = 2;
+    glopts.input_select = 0;
+    glopts.deadline_headroom = -1;
+    glopts.governor_target = 0;
+    glopts.stats_target = NULL;
+    glopts.stats_format = STATS_FORMAT_JSON;
+    glopts.zmq_queue_depth = ZMQ_QUEUE_DEFAULT;
+    glopts.silence_threshold = 0;
+    glopts.psy_cache_mb = 0;
+    glopts.loopback_interval = 0;
+    glopts.twopass = 0;
+    glopts.twopass_file = NULL;
+    glopts.zmq_drop_newest = FALSE;
+}
+
+/* The stream being encoded, see toolame_start() */
+static frame_info *primary;
+static frame_info *analysis;
+static Bit_stream_struc *stream;
+static int model;
+static unsigned long sent_bits = 0;
+static int frames = 0;
+
+static SBS *sb_sample;
+static JSBS *j_sample;
+static SUB *subband;
+#ifdef REFERENCECODE
+typedef double IN[2][HAN_SIZE];
+static IN *win_que;
+static short buffer[2][1152];
+static short **win_buf;
+#endif
+static unsigned int bit_alloc[2][SBLIMIT], scfsi[2][SBLIMIT];
+static unsigned int scalar[2][3][SBLIMIT], j_scale[3][SBLIMIT];
+static double smr[2][SBLIMIT], max_sc[2][SBLIMIT];
+
+/* Used to keep the SNR values for the fast/quick psy models */
+static FLOAT smrdef[2][32];
+
+/************************************************************************
+ *
+ * encode_output
+ *
+ * PURPOSE:  Steps 5. to 8. for one output: allocate the bits from the
+ * SMR and scalefactors of the frame, and write the frame to the bit
+ * stream of the output, with its X-PAD and DAB CRCs.
+ * A #silent# frame gets no bits, see silence.h.
+ * Returns 0, or -1 if the frame did not come out in whole bytes.
+ *
+ ************************************************************************/
+
+static int encode_output (frame_info * frame, Bit_stream_struc * bs,
+        unsigned int bit_alloc[2][SBLIMIT], unsigned int scfsi[2][SBLIMIT],
+        unsigned long *sent_bits, double smr[2][SBLIMIT],
+        unsigned int frame_scalar[2][3][SBLIMIT], SBS * sb_sample,
+        JSBS * j_sample, unsigned int j_scale[][3][SBLIMIT], SUB * subband,
+        uint8_t * xpad_data, int xpad_len, int silent)
+{
+    frame_header *header = frame->header;
+    int error_protection = header->error_protection;
+    /* the transmission pattern changes the scalefactors it does not send,
+       so every output works on its own copy */
+    static unsigned int scalar[2][3][SBLIMIT];
+    unsigned int crc;
+    unsigned long frameBits;
+    int adb, lg_frame, i;
+
+    memcpy (scalar, frame_scalar, sizeof (scalar));
+
+    adb = available_bits (header, &glopts);
+    lg_frame = adb / 8;
+    if (header->dab_extension) {
+        /* You must have one frame in memory if you are in DAB mode                 */
+        /* in conformity of the norme ETS 300 401 http://www.etsi.org               */
+        /* see bitstream.c            */
+        /* frameNum is only counted with -t 2 and more, and without this
+           the CRCs of the frames that were already out were lost */
+        if (bs->minimum == MINIMUM)
+            bs->minimum = lg_frame + MINIMUM;
+        adb -= header->dab_extension * 8 + (xpad_len ? xpad_len : FPAD_LENGTH) * 8;
+    }
+
+#ifdef NEWENCODE
+    /* the outputs of the ladder each have their own allocation table */
+    encode_select_table (frame);
+    TIMING_START(t_alloc);
+    if (silent)
+        silent_bit_allocation_new (scfsi, bit_alloc, &adb, frame);
+    else {
+        sf_transmission_pattern (scalar, scfsi, frame);
+        main_bit_allocation_new (smr, scfsi, bit_alloc, &adb, frame, &glopts);
+        //main_bit_allocation (smr, scfsi, bit_alloc, &adb, frame, &glopts);
+    }
+    TIMING_STOP(TIMING_BIT_ALLOC, t_alloc);
+
+    if (glopts.vbr) {
+        /* the bit allocation chose the bitrate of the frame, and the
+           buffer must keep the largest frame for the DAB CRCs */
+        lg_frame = available_bits (header, &glopts) / 8;
+        if (header->dab_extension && bs->minimum < lg_frame + MINIMUM)
+            bs->minimum = lg_frame + MINIMUM;
+    }
+
+    if (frame->actual_mode == MPG_MD_JOINT_STEREO && !silent) {
+        /* the mono channel is only needed above the jsbound */
+        TIMING_START(t_js);
+        joint_stereo_new (*sb_sample, j_sample, j_scale, frame);
+        TIMING_STOP(TIMING_SCALEFACTOR, t_js);
+    }
+
+    TIMING_START(t_crc);
+    if (error_protection)
+        CRC_calc (frame, bit_alloc, scfsi, &crc);
+    TIMING_STOP(TIMING_CRC, t_crc);
+
+    TIMING_START(t_pack);
+    write_header (frame, bs);
+    //encode_info (frame, bs);
+    if (error_protection)
+        putbits (bs, crc, 16);
+    write_bit_alloc (bit_alloc, frame, bs);
+    //encode_bit_alloc (bit_alloc, frame, bs);
+    if (!silent) {
+        write_scalefactors(bit_alloc, scfsi, scalar, frame, bs);
+        //encode_scale (bit_alloc, scfsi, scalar, frame, bs);
+        subband_quantization_new (scalar, *sb_sample, *j_scale, *j_sample, bit_alloc,
+                *subband, frame);
+        //subband_quantization (scalar, *sb_sample, *j_scale, *j_sample, bit_alloc,
+        //	  *subband, frame);
+        write_samples_new(*subband, bit_alloc, frame, bs);
+        //sample_encoding (*subband, bit_alloc, frame, bs);
+    }
+#else
+    transmission_pattern (scalar, scfsi, frame);
+    main_bit_allocation (smr, scfsi, bit_alloc, &adb, frame, &glopts);
+    if (error_protection)
+        CRC_calc (frame, bit_alloc, scfsi, &crc);
+    TIMING_START(t_pack);
+    encode_info (frame, bs);
+    if (error_protection)
+        encode_CRC (crc, bs);
+    encode_bit_alloc (bit_alloc, frame, bs);
+    encode_scale (bit_alloc, scfsi, scalar, frame, bs);
+    subband_quantization (scalar, *sb_sample, *j_scale, *j_sample, bit_alloc,
+            *subband, frame);
+    sample_encoding (*subband, bit_alloc, frame, bs);
+#endif
+
+
+    /* If not all the bits were used, write out a stack of zeros */
+    for (i = 0; i < adb; i++)
+        put1bit (bs, 0);
+
+
+    if (xpad_len) {
+        assert(xpad_len > 2);
+
+        // insert available X-PAD
+        for (i = header->dab_length - xpad_len; i < header->dab_length - FPAD_LENGTH; i++)
+            putbits (bs, xpad_data[i], 8);
+    }
+
+
+    for (i = header->dab_extension - 1; i >= 0; i--) {
+        TIMING_START(t_crc_dab);
+        CRC_calcDAB (frame, bit_alloc, scfsi, scalar, &crc, i);
+        TIMING_STOP(TIMING_CRC, t_crc_dab);
+        /* this crc is for the previous frame in DAB mode  */
+        if (bs->buf_byte_idx + lg_frame < bs->buf_size)
+            bs->buf[bs->buf_byte_idx + lg_frame] = crc;
+        /* reserved 2 bytes for F-PAD in DAB mode  */
+        putbits (bs, crc, 8);
+    }
+
+    if (xpad_len) {
+        /* The F-PAD is also given us by mot-encoder */
+        putbits (bs, xpad_data[header->dab_length - 2], 8);
+        putbits (bs, xpad_data[header->dab_length - 1], 8);
+    }
+    else {
+        putbits (bs, 0, 16); // FPAD is all-zero
+    }
+    TIMING_STOP(TIMING_BIT_PACKING, t_pack);
+
+    frameBits = sstell (bs) - *sent_bits;
+
+    if (frameBits % 8) {	/* a program failure */
+        fprintf (stderr, "Sent %ld bits = %ld slots plus %ld\n", frameBits,
+                frameBits / 8, frameBits % 8);
+        fprintf (stderr, "If you are reading this, the program is broken\n");
+        fprintf (stderr, "Please report a bug.\n");
+        return -1;
+    }
+
+    *sent_bits += frameBits;
+    return 0;
+}
+int toolame_start (frame_info * frame, Bit_stream_struc * bs, int psy)
+{
+    frame_header *header = frame->header;
+
+    primary = frame;
+    stream = bs;
+    model = psy;
+
+    sb_sample = (SBS *) mem_alloc (sizeof (SBS), "sb_sample");
+    j_sample = (JSBS *) mem_alloc (sizeof (JSBS), "j_sample");
+#ifdef REFERENCECODE
+    win_que = (IN *) mem_alloc (sizeof (IN), "Win_que");
+    win_buf = (short **) mem_alloc (sizeof (short *) * 2, "win_buf");
+#endif
+    subband = (SUB *) mem_alloc (sizeof (SUB), "subband");
+
+    /* the filterbank, scalefactors and psy model run once for all outputs */
+    analysis = ladder_analysis_frame (frame);
+
+    if (pcm_ring_init() != 0)
+        return -1;
+
+    if (glopts.quickmode)
+        quickmode_init(glopts.quickcount, glopts.quickthreshold);
+
+    if (psycache_init(glopts.psy_cache_mb, model) != 0)
+        return -1;
+
+    if (loopback_init(glopts.loopback_interval, frame) != 0)
+        return -1;
+    bs->loopback = loopback_enabled();
+
+    if (twopass_init(glopts.twopass, glopts.twopass_file, frame) != 0)
+        return -1;
+
+#ifdef NEWENCODE
+    /* VBR chooses the bitrate from the bit allocation */
+    if (!glopts.vbr)
+        silence_init(glopts.silence_threshold);
+#endif
+
+    governor_init(s_freq[header->version][header->sampling_frequency] * 1000,
+            glopts.governor_target, model, glopts.quickmode,
+            glopts.quickcount, glopts.quickthreshold);
+
+    return 0;
+}
+
+/************************************************************************
+ *
+ * toolame_encode_frame
+ *
+ * PURPOSE:  MPEG II Encoder with
+ * psychoacoustic models 1 (MUSICAM) and 2 (AT&T)
+ *
+ * SEMANTICS:  One overlapping frame of audio of up to 2 channels are
+ * processed at a time in the following order:
+ * (associated routines are in parentheses)
+ *
+ * 1.  Filter sliding window of data to get 32 subband
+ * samples per channel.
+ * (window_subband,filter_subband)
+ *
+ * 2.  If joint stereo mode, combine left and right channels
+ * for subbands above #jsbound#.
+ * (combine_LR)
+ *
+ * 3.  Calculate scalefactors for the frame, and 
+ * also calculate scalefactor select information.
+ * (*_scale_factor_calc)
+ *
+ * 4.  Calculate psychoacoustic masking levels using selected
+ * psychoacoustic model.
+ * (psycho_i, psycho_ii)
+ *
+ * 5.  Perform iterative bit allocation for subbands with low
+ * mask_to_noise ratios using masking levels from step 4.
+ * (*_main_bit_allocation)
+ *
+ * 6.  If error protection flag is active, add redundancy for
+ * error protection.
+ * (*_CRC_calc)
+ *
+ * 7.  Pack bit allocation, scalefactors, and scalefactor select
+ *headerrmation onto bitstream.
+ * (*_encode_bit_alloc,*_encode_scale,transmission_pattern)
+ *
+ * 8.  Quantize subbands and pack them into bitstream
+ * (*_subband_quantization, *_sample_encoding)
+ *
+ ************************************************************************/
+
+int toolame_encode_frame (struct audio_levels *levels, uint8_t * xpad_data,
+        int xpad_len)
+{
+    frame_header *header = primary->header;
+    int nch = primary->nch;
+    /* the current frame in the sample ring, see pcm_ring.h */
+    double *samples[2];
+    unsigned long frame_start;
+    int silent;
+    int sb, ch, i;
+
+    frames++;
+
+    /* digital silence takes the fast path, see silence.h */
+    silent = silence_frame(levels, nch);
+
+    samples[0] = pcm_ring_frame(0);
+    samples[1] = pcm_ring_frame(1);
+
+    if (!silent) {
+        int gr, bl, ch;
+        TIMING_START(t_filter);
+        /* New polyphase filter
+           Combines windowing and filtering. Ricardo Feb'03 */
+        for( gr = 0; gr < 3; gr++ )
+            for ( bl = 0; bl < 12; bl++ )
+                for ( ch = 0; ch < nch; ch++ )
+                    WindowFilterSubband( &samples[ch][gr * 12 * 32 + 32 * bl], ch,
+                            &(*sb_sample)[ch][gr][bl][0], analysis->sblimit );
+        TIMING_STOP(TIMING_FILTERBANK, t_filter);
+    }
+
+#ifdef REFERENCECODE
+    {
+        /* Old code. left here for reference */
+        int gr, bl, ch;
+        for (ch = 0; ch < nch; ch++)
+            for (i = 0; i < 1152; i++)
+                buffer[ch][i] = samples[ch][i] * SCALE;
+        win_buf[0] = &buffer[0][0];
+        win_buf[1] = &buffer[1][0];
+        for (gr = 0; gr < 3; gr++)
+            for (bl = 0; bl < SCALE_BLOCK; bl++)
+                for (ch = 0; ch < nch; ch++) {
+                    window_subband (&win_buf[ch], &(*win_que)[ch][0], ch);
+                    filter_subband (&(*win_que)[ch][0], &(*sb_sample)[ch][gr][bl][0]);
+                }
+    }
+#endif
+
+
+    TIMING_START(t_scf);
+#ifdef NEWENCODE
+    if (!silent) {
+        scalefactor_calc_new(*sb_sample, scalar, nch, analysis->sblimit);
+        find_sf_max (scalar, analysis, max_sc);
+    }
+    /* the joint stereo channel is made after the bit allocation */
+#else
+    scale_factor_calc (*sb_sample, scalar, nch, analysis->sblimit);
+    pick_scale (scalar, analysis, max_sc);
+    if (analysis->actual_mode == MPG_MD_JOINT_STEREO) {
+        /* this way we calculate more mono than we need */
+        /* but it is cheap */
+        combine_LR (*sb_sample, *j_sample, analysis->sblimit);
+        scale_factor_calc (j_sample, &j_scale, 1, analysis->sblimit);
+    }
+#endif
+    TIMING_STOP(TIMING_SCALEFACTOR, t_scf);
+
+
+
+    TIMING_START(t_psy);
+    /* The governor may choose a cheaper model than the configured one */
+    int psy_model = model;
+    int quick = glopts.quickmode;
+    if (governor_enabled())
+        governor_tier(&psy_model, &quick);
+
+    if (silent) {
+        /* no bits are allocated, the SMR is not needed */
+    } else if (quick &&
+            !quickmode_need_psy(scalar, levels, nch, analysis->sblimit)) {
+        /* We're using quick mode, and the model does not need to be
+           calculated for this frame. Just copy the old ones across */
+        for (ch = 0; ch < nch; ch++) {
+            for (sb = 0; sb < SBLIMIT; sb++)
+                smr[ch][sb] = smrdef[ch][sb];
+        }
+    } else {
+        uint64_t psy_start = deadline_now_us();
+
+        /* calculate the psymodel, unless the same audio was seen
+           before, see psycache.h */
+        if (!psycache_lookup(psy_model, samples, max_sc, analysis,
+                    &glopts, smr)) {
+            switch (psy_model) {
+                case -1:
+                    psycho_n1 (smr, nch);
+                    break;
+                case 0:	/* Psy Model A */
+                    psycho_0 (smr, nch, scalar, (FLOAT) s_freq[header->version][header->sampling_frequency] * 1000);	
+                    break;
+                case 1:
+                    psycho_1 (samples, max_sc, smr, analysis);
+                    break;
+                case 2:
+                    for (ch = 0; ch < nch; ch++) {
+                        psycho_2 (samples[ch], ch, &smr[ch][0], //snr32,
+                                (FLOAT) s_freq[header->version][header->sampling_frequency] *
+                                1000, &glopts);
+                    }
+                    break;
+                case 3:
+                    /* Modified psy model 1 */
+                    psycho_3 (samples, max_sc, smr, analysis, &glopts);
+                    break;
+                case 4:
+                    /* Modified Psycho Model 2 */
+                    for (ch = 0; ch < nch; ch++) {
+                        psycho_4 (samples[ch], ch, &smr[ch][0], // snr32,
+                                (FLOAT) s_freq[header->version][header->sampling_frequency] *
+                                1000, &glopts);
+                    }
+                    break;	
+                case 5:
+                    /* Model 5 comparse model 1 and 3 */
+                    psycho_1 (samples, max_sc, smr, analysis);
+                    fprintf(stdout,"1 ");
+                    smr_dump(smr,nch);
+                    psycho_3 (samples, max_sc, smr, analysis, &glopts);
+                    fprintf(stdout,"3 ");
+                    smr_dump(smr,nch);
+                    break;
+                case 6:
+                    /* Model 6 compares model 2 and 4 */
+                    for (ch = 0; ch < nch; ch++) 
+                        psycho_2 (samples[ch], ch, &smr[ch][0], //snr32,
+                                (FLOAT) s_freq[header->version][header->sampling_frequency] *
+                                1000, &glopts);
+                    fprintf(stdout,"2 ");
+                    smr_dump(smr,nch);
+                    for (ch = 0; ch < nch; ch++) 
+                        psycho_4 (samples[ch], ch, &smr[ch][0], // snr32,
+                                (FLOAT) s_freq[header->version][header->sampling_frequency] *
+                                1000, &glopts);
+                    fprintf(stdout,"4 ");
+                    smr_dump(smr,nch);
+                    break;
+                case 7:
+                    fprintf(stdout,"Frame: %i\n",frames);
+                    /* Dump the SMRs for all models */	
+                    psycho_1 (samples, max_sc, smr, analysis);
+                    fprintf(stdout,"1");
+                    smr_dump(smr, nch);
+                    psycho_3 (samples, max_sc, smr, analysis, &glopts);
+                    fprintf(stdout,"3");
+                    smr_dump(smr,nch);
+                    for (ch = 0; ch < nch; ch++) 
+                        psycho_2 (samples[ch], ch, &smr[ch][0], //snr32,
+                                (FLOAT) s_freq[header->version][header->sampling_frequency] *
+                                1000, &glopts);
+                    fprintf(stdout,"2");
+                    smr_dump(smr,nch);
+                    for (ch = 0; ch < nch; ch++) 
+                        psycho_4 (samples[ch], ch, &smr[ch][0], // snr32,
+                                (FLOAT) s_freq[header->version][header->sampling_frequency] *
+                                1000, &glopts);
+                    fprintf(stdout,"4");
+                    smr_dump(smr,nch);
+                    break;
+                case 8:
+                    /* Compare 0 and 4 */	
+                    psycho_n1 (smr, nch);
+                    fprintf(stdout,"0");
+                    smr_dump(smr,nch);
+
+                    for (ch = 0; ch < nch; ch++) 
+                        psycho_4 (samples[ch], ch, &smr[ch][0], // snr32,
+                                (FLOAT) s_freq[header->version][header->sampling_frequency] *
+                                1000, &glopts);
+                    fprintf(stdout,"4");
+                    smr_dump(smr,nch);
+                    break;
+                default:
+                    fprintf (stderr, "Invalid psy model specification: %i\n", psy_model);
+                    return -1;
+            }
+            psycache_store(smr);
+        }
+
+        if (quick) {
+            /* copy the smr values and reuse them later */
+            for (ch = 0; ch < nch; ch++) {
+                for (sb = 0; sb < SBLIMIT; sb++)
+                    smrdef[ch][sb] = smr[ch][sb];
+            }
+            quickmode_psy_done(scalar, levels, nch, analysis->sblimit,
+                    deadline_now_us() - psy_start);
+        }
+
+        if (glopts.verbosity > 4) 
+            smr_dump(smr, nch);
+
+
+
+
+    }
+    TIMING_STOP(TIMING_PSY, t_psy);
+
+    /* the first pass of two-pass VBR only needs the psy model */
+    if (twopass_recording()) {
+        twopass_record(smr, scalar, primary);
+        return 0;
+    }
+
+    frame_start = sent_bits;
+    if (encode_output (primary, stream, bit_alloc, scfsi, &sent_bits, smr,
+                scalar, sb_sample, j_sample, &j_scale, subband, xpad_data,
+                xpad_len, silent) != 0)
+        return -1;
+    loopback_frame (*sb_sample, smr, silent, frame_start, sent_bits);
+
+    /* and the same frame at the other bitrates of the ladder */
+    for (i = 0; i < ladder_count (); i++) {
+        struct ladder_output *out = ladder_get (i);
+
+        if (encode_output (&out->frame, &out->bs, out->bit_alloc, out->scfsi,
+                    &out->sent_bits, smr, scalar, sb_sample, j_sample,
+                    &j_scale, subband, xpad_data, xpad_len, silent) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+unsigned long toolame_sent_bits (void)
+{
+    return sent_bits;
+}
+
+void smr_dump(double smr[2][SBLIMIT], int nch) {
+    int ch, sb;
+
+    fprintf(stdout,"SMR:");
+    for (ch = 0;ch<nch; ch++) {
+        if (ch==1)
+            fprintf(stdout,"    ");
+        for (sb=0;sb<SBLIMIT;sb++)
+            fprintf(stdout,"%3.0f ",smr[ch][sb]);
+        fprintf(stdout,"\n");
+    }
+}
+
+/************************************************************************
+ *
+ * The streaming interface, see libtoolame.h
+ *
+ ************************************************************************/
+
+struct toolame {
+    frame_info frame;
+    frame_header header;
+    Bit_stream_struc bs;
+    struct sink *output;    // the frames to pull
+
+    toolame_xpad_cb xpad;
+    void *xpad_ctx;
+    uint8_t *xpad_data;
+
+    /* the samples of the next frame, interleaved */
+    int in_nch;
+    short *pcm;
+    int pcm_count;          // per channel
+
+    int flushed;
+    int failed;             // an encoding error, nothing more is encoded
+};
+
+/* The encoder state is global and is not reset by toolame_close() */
+enum { NEVER_OPENED, OPEN, CLOSED };
+static int opened = NEVER_OPENED;
+
+void toolame_config_init (struct toolame_config *config)
+{
+    memset (config, 0, sizeof (*config));
+    config->sample_rate = 1000 * DFLT_SFQ;
+    config->channels = 2;
+    config->bitrate = 192;
+    config->mode = DFLT_MOD;
+    config->psy_model = DFLT_PSY;
+    config->verbosity = 0;
+}
+
+struct toolame *toolame_open (const struct toolame_config *config)
+{
+    struct toolame *enc;
+    frame_header *header;
+
+    if (opened == OPEN) {
+        fprintf (stderr, "The encoder is already open\n");
+        return NULL;
+    }
+    if (opened == CLOSED) {
+        fprintf (stderr, "The encoder cannot be opened again once closed, "
+                "its state is global to the process\n");
+        return NULL;
+    }
+
+    enc = calloc (1, sizeof (*enc));
+    if (enc == NULL) {
+        fprintf (stderr, "Unable to allocate the encoder\n");
+        return NULL;
+    }
+    header = &enc->header;
+    enc->frame.header = header;
+    enc->frame.tab_num = -1;	/* no table loaded */
+    enc->frame.alloc = NULL;
+
+    global_init ();
+    glopts.verbosity = config->verbosity;
+    glopts.input_select = INPUT_SELECT_WAV;
+    glopts.dab = TRUE;
+
+    header->lay = DFLT_LAY;
+    if ((header->sampling_frequency =
+                SmpFrqIndex (config->sample_rate, &header->version)) < 0) {
+        fprintf (stderr, "Invalid sampling rate %d Hz\n", config->sample_rate);
+        goto fail;
+    }
+
+    switch (config->mode) {
+        case 's':
+            header->mode = MPG_MD_STEREO;
+            break;
+        case 'd':
+            header->mode = MPG_MD_DUAL_CHANNEL;
+            break;
+        case 'j':
+            header->mode = MPG_MD_JOINT_STEREO;
+            header->mode_ext = 2;
+            break;
+        case 'm':
+            header->mode = MPG_MD_MONO;
+            break;
+        default:
+            fprintf (stderr, "Invalid mode %c\n", config->mode);
+            goto fail;
+    }
+
+    if (config->channels == 2 && config->mode == 'm')
+        glopts.downmix = TRUE;
+    else if (config->channels != (config->mode == 'm' ? 1 : 2)) {
+        fprintf (stderr, "Mode %c cannot be encoded from %d channels\n",
+                config->mode, config->channels);
+        goto fail;
+    }
+    enc->in_nch = config->channels;
+
+    if ((header->bitrate_index =
+                BitrateIndex (config->bitrate, header->version)) < 0) {
+        fprintf (stderr, "Invalid bitrate %d kbps\n", config->bitrate);
+        goto fail;
+    }
+
+    if (config->psy_model < -1 || config->psy_model > 4) {
+        fprintf (stderr, "Invalid psy model %d\n", config->psy_model);
+        goto fail;
+    }
+
+    if (config->xpad && config->pad_length <= FPAD_LENGTH) {
+        fprintf (stderr, "Invalid XPAD length specified\n");
+        goto fail;
+    }
+    header->dab_length = config->pad_length;
+    enc->xpad = config->xpad;
+    enc->xpad_ctx = config->xpad_ctx;
+
+    /* Always DAB, as toolame-dab */
+    header->error_protection = TRUE;
+    header->dab_extension = dab_scf_crc_count (header);
+    header->padding = 0;
+
+    hdr_to_frps (&enc->frame);
+
+    enc->pcm = calloc (PCM_RING_FRAME * enc->in_nch, sizeof (short));
+    if (enc->xpad)
+        enc->xpad_data = calloc (header->dab_length, 1);
+    if (enc->pcm == NULL || (enc->xpad && enc->xpad_data == NULL)) {
+        fprintf (stderr, "Unable to allocate the encoder\n");
+        goto fail;
+    }
+
+    /* 24ms of audio, the unit of the outputs */
+    enc->bs.frame_size = 3 * config->bitrate;
+    open_bit_stream_w (&enc->bs, NULL, BUFFER_SIZE);
+    if ((enc->output = sink_open_pull (enc->bs.frame_size)) == NULL) {
+        desalloc_buffer (&enc->bs);
+        goto fail;
+    }
+    enc->bs.sinks[enc->bs.num_sinks++] = enc->output;
+
+    opened = OPEN;
+    if (toolame_start (&enc->frame, &enc->bs, config->psy_model) != 0) {
+        close_bit_stream_w (&enc->bs);
+        opened = CLOSED;
+        goto fail;
+    }
+
+    return enc;
+
+fail:
+    free (enc->xpad_data);
+    free (enc->pcm);
+    free (enc);
+    return NULL;
+}
+
+int toolame_frame_size (const struct toolame *enc)
+{
+    return enc->bs.frame_size;
+}
+
+/* Encode the frame of samples that was pushed.
+ * returns 0  on success
+ *         -1 on failure
+ */
+static int encode_pcm (struct toolame *enc)
+{
+    struct audio_levels levels;
+    double *fbuffer[2];
+    int xpad_len = 0;
+
+    pcm_ring_advance ();
+    fbuffer[0] = pcm_ring_frame (0);
+    fbuffer[1] = pcm_ring_frame (1);
+    condition_audio (enc->pcm, enc->in_nch, enc->frame.nch, 0, fbuffer,
+            &levels);
+    pcm_ring_commit ();
+    enc->pcm_count = 0;
+
+    if (enc->xpad) {
+        xpad_len = enc->xpad (enc->xpad_ctx, enc->xpad_data,
+                enc->header.dab_length);
+        if (xpad_len != 0 &&
+                (xpad_len <= FPAD_LENGTH || xpad_len > enc->header.dab_length)) {
+            fprintf (stderr, "xpad length=%d\n", xpad_len);
+            xpad_len = 0;
+        }
+    }
+
+    if (toolame_encode_frame (&levels, enc->xpad_data, xpad_len) != 0) {
+        enc->failed = 1;
+        return -1;
+    }
+
+    /* the frame before is complete, now that its CRCs are written */
+    drain_bit_stream_w (&enc->bs, enc->bs.minimum);
+    return 0;
+}
+
+int toolame_push (struct toolame *enc, const int16_t * pcm, int num_samples)
+{
+    if (enc->flushed || enc->failed || num_samples < 0)
+        return -1;
+
+    while (num_samples > 0) {
+        int n = PCM_RING_FRAME - enc->pcm_count;
+
+        if (n > num_samples)
+            n = num_samples;
+        memcpy (enc->pcm + enc->pcm_count * enc->in_nch, pcm,
+                n * enc->in_nch * sizeof (short));
+        enc->pcm_count += n;
+        pcm += n * enc->in_nch;
+        num_samples -= n;
+
+        if (enc->pcm_count == PCM_RING_FRAME && encode_pcm (enc) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+int toolame_pull (struct toolame *enc, uint8_t * buf, int size)
+{
+    return sink_pull (enc->output, buf, size);
+}
+
+void toolame_flush (struct toolame *enc)
+{
+    if (enc->flushed)
+        return;
+
+    if (enc->pcm_count > 0 && !enc->failed) {
+        memset (enc->pcm + enc->pcm_count * enc->in_nch, 0,
+                (PCM_RING_FRAME - enc->pcm_count) * enc->in_nch *
+                sizeof (short));
+        encode_pcm (enc);
+    }
+
+    drain_bit_stream_w (&enc->bs, 0);
+    enc->flushed = 1;
+}
+
+void toolame_close (struct toolame *enc)
+{
+    opened = CLOSED;
+    close_bit_stream_w (&enc->bs);
+    free (enc->xpad_data);
+    free (enc->pcm);
+    free (enc);
+}
@@ -0,0 +1,90 @@
+#ifndef _LIBTOOLAME_H_
+#define _LIBTOOLAME_H_
+
+#include <stdint.h>
+
+/* libtoolame - the toolame-dab encoder as a library
+ *
+ * A streaming interface for applications that have their own audio and
+ * their own transport, and want the DAB MPEG Layer II frames without
+ * running toolame-dab as a separate process:
+ *  - configure the encoder and open it;
+ *  - push any number of samples at a time. A frame is encoded every
+ *    1152 samples per channel;
+ *  - pull the frames that are complete, zero or more after every push;
+ *  - flush at the end of the stream, pull the last frames, and close.
+ *
+ * The frames are pulled in the units of the toolame-dab outputs: 24 ms
+ * of stream, of 3 bytes per kbps of the bitrate. At 48 kHz this is one
+ * Layer II frame, at 24 kHz one half of it. A frame is complete once the
+ * frame after it has been encoded, as the DAB scalefactor CRCs of every
+ * frame travel at the end of the frame before.
+ *
+ * The PAD of every frame is asked from a callback, if one is set, the
+ * same way toolame-dab reads it from the FIFO of the mot-encoder (-P).
+ *
+ * The encoder keeps its state in global variables, as toolame-dab does:
+ * a process can open it only once, and not again after toolame_close().
+ * An application that encodes several streams runs an encoder in a
+ * process for each, as toolame-bench -l does. The options that are not
+ * in the configuration keep the defaults of toolame-dab, the output is
+ * the same as that of toolame-dab with the same options.
+ */
+
+/* Fill pad with the pad_length bytes of PAD of the next frame, the X-PAD
+ * at the end followed by the two bytes of F-PAD, as the mot-encoder
+ * writes them. Return the number of bytes of PAD used at the end,
+ * F-PAD included, or 0 when there is no PAD for the frame */
+typedef int (*toolame_xpad_cb)(void *ctx, uint8_t *pad, int pad_length);
+
+struct toolame_config {
+    int sample_rate;    // Hz, 48000 or 24000 for DAB
+    int channels;       // of the samples pushed, 1 or 2
+    int bitrate;        // kbps
+    char mode;          // 's'tereo, 'd'ual channel, 'j'oint stereo or 'm'ono,
+                        // stereo samples are mixed down for 'm'
+    int psy_model;      // -1 to 4, like -y
+    int pad_length;     // bytes of PAD of every frame, like -p
+    toolame_xpad_cb xpad;   // NULL for none
+    void *xpad_ctx;
+    int verbosity;      // like -t, the messages on stderr. 0 for none
+};
+
+struct toolame;
+
+/* Set the configuration to the defaults of toolame-dab: 48 kHz, joint
+ * stereo, 192 kbps, psy model 1, no PAD. Only errors are printed */
+void toolame_config_init(struct toolame_config *config);
+
+/* Open the encoder.
+ * returns NULL on failure, or if it was opened before, closed or not */
+struct toolame *toolame_open(const struct toolame_config *config);
+
+/* Bytes of the frames pulled, except the last one which can be shorter */
+int toolame_frame_size(const struct toolame *enc);
+
+/* Encode num_samples samples per channel, interleaved, in the byte order
+ * of the machine. Samples that do not make up a whole frame are kept for
+ * the next push.
+ * returns 0  on success
+ *         -1 on failure, after an encoding error, or after toolame_flush()
+ */
+int toolame_push(struct toolame *enc, const int16_t *pcm, int num_samples);
+
+/* Copy the next complete frame to buf.
+ * returns the length of the frame
+ *         0  if no frame is complete
+ *         -1 if size is too small for the frame, which is kept
+ */
+int toolame_pull(struct toolame *enc, uint8_t *buf, int size);
+
+/* End the stream: the samples that were kept are padded with silence to
+ * a whole frame and encoded, and all frames are completed. Pull them
+ * before closing, nothing can be pushed any more */
+void toolame_flush(struct toolame *enc);
+
+/* Release the encoder, with the frames that were not pulled. It cannot
+ * be opened again */
+void toolame_close(struct toolame *enc);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef _LIBTOOLAME_PRIV_H_
+#define _LIBTOOLAME_PRIV_H_
+
+#include <stdint.h>
+#include "common.h"
+
+struct audio_levels;
+
+/* The frame loop of libtoolame, as toolame-dab drives it
+ *
+ * toolame-dab owns the options, the input, the outputs and the reports,
+ * and hands every frame to the same code as the streaming interface of
+ * libtoolame.h. The options are read from glopts.
+ */
+
+/* Bytes of F-PAD at the end of every frame */
+extern const int FPAD_LENGTH;
+
+/* Set the options to their defaults */
+void global_init (void);
+
+/* Set up the frame loop, once hdr_to_frps() has been called on frame:
+ * the sample ring, quick mode, the psy model cache, the loopback check,
+ * the silence fast path and the governor. The frames are written to bs,
+ * and to the outputs of the ladder.
+ * returns 0  on success
+ *         -1 on failure
+ */
+int toolame_start (frame_info * frame, Bit_stream_struc * bs, int model);
+
+/* Encode the frame that was just written to the sample ring, with the
+ * levels condition_audio() measured on it, and xpad_len bytes of PAD
+ * read from the mot-encoder (0 for none).
+ * returns 0  on success
+ *         -1 on an invalid psy model, or a frame that is not whole bytes
+ */
+int toolame_encode_frame (struct audio_levels *levels, uint8_t * xpad_data,
+        int xpad_len);
+
+/* Bits written to the bit stream so far */
+unsigned long toolame_sent_bits (void);
+
+void smr_dump (double smr[2][SBLIMIT], int nch);
+
+#endif
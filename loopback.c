@@ -0,0 +1,741 @@
+/* Loopback check of the encoded stream, see loopback.h */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "common.h"
+#include "mem.h"
+#include "tables.h"
+#include "crc.h"
+#include "subband.h"
+#include "pcm_ring.h"
+#include "sink.h"
+#include "loopback.h"
+
+#define LOAD(p)       __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE(p, v)   __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/* Frames being checked at the same time */
+#define LOOPBACK_JOBS 4
+
+/* Bytes of the stream kept for the decoder, several of the largest
+ * frames */
+#define LOOPBACK_WINDOW 16384
+
+/* Delay of the analysis and synthesis filterbanks in samples: the
+ * 512 taps of the windows, less the 32 samples of one subband block,
+ * plus one */
+#define LOOPBACK_DELAY 481
+
+/* A frame to check, and the one before */
+struct job {
+    unsigned long prev_start;   // bytes, first byte of the frame before
+    unsigned long start, end;   // bytes of the frame
+    int silent;
+    double pcm[2][2 * PCM_RING_FRAME];
+    double sb_sample[2][3][SCALE_BLOCK][SBLIMIT];
+    double smr[2][SBLIMIT];
+};
+
+struct chunk {
+    struct sink_frame *frame;
+    unsigned long offset;
+};
+
+static int interval = 0;
+static int nch;
+static int dab_extension;
+static int version;
+
+static pthread_t thread;
+static sem_t ready;
+static int stop = 0;
+
+/* Both rings are written by the encoder at head and read by the
+ * decoder at tail */
+static struct job *jobs;
+static uint64_t job_head = 0, job_tail = 0;
+static int preparing = 0;       // the job at job_head has its frame before
+static unsigned long frame_count = 0;
+
+static struct chunk chunks[LOOPBACK_QUEUE];
+static uint64_t chunk_head = 0, chunk_tail = 0;
+static unsigned long fed = 0;   // bytes of the stream seen by the encoder
+
+/* Only written by the decoder */
+static struct loopback_stats stats;
+
+static void *decoder_thread(void *arg);
+
+int loopback_init(int frames, frame_info *frame)
+{
+    if (frames <= 0)
+        return 0;
+
+    nch = frame->nch;
+    dab_extension = frame->header->dab_extension;
+    version = frame->header->version;
+
+    jobs = calloc(LOOPBACK_JOBS, sizeof(*jobs));
+    if (jobs == NULL) {
+        fprintf(stderr, "Unable to allocate the loopback check\n");
+        return -1;
+    }
+
+    stats.snr_min = DBL_MAX;
+    stats.nmr_max = -DBL_MAX;
+
+    sem_init(&ready, 0, 0);
+    if (pthread_create(&thread, NULL, decoder_thread, NULL) != 0) {
+        fprintf(stderr, "Unable to start the loopback check thread\n");
+        sem_destroy(&ready);
+        free(jobs);
+        jobs = NULL;
+        return -1;
+    }
+
+    interval = frames;
+    return 0;
+}
+
+int loopback_enabled(void)
+{
+    return interval > 0;
+}
+
+void loopback_frame(double sb_sample[2][3][SCALE_BLOCK][SBLIMIT],
+        double smr[2][SBLIMIT], int silent, unsigned long start_bits,
+        unsigned long end_bits)
+{
+    unsigned long n = frame_count++;
+    struct job *job;
+    int ch;
+
+    if (interval == 0)
+        return;
+
+    /* this is the frame to check of the job started with the frame
+     * before */
+    if (preparing && n % interval == 0) {
+        job = &jobs[job_head % LOOPBACK_JOBS];
+        for (ch = 0; ch < nch; ch++)
+            memcpy(&job->pcm[ch][PCM_RING_FRAME], pcm_ring_frame(ch),
+                    PCM_RING_FRAME * sizeof(double));
+        memcpy(job->sb_sample, sb_sample, sizeof(job->sb_sample));
+        memcpy(job->smr, smr, sizeof(job->smr));
+        job->silent = silent;
+        job->start = start_bits / 8;
+        job->end = end_bits / 8;
+        STORE(&job_head, job_head + 1);
+        preparing = 0;
+        sem_post(&ready);
+    }
+
+    /* and this is the frame before the next one to check */
+    if ((n + 1) % interval == 0) {
+        if (job_head - LOAD(&job_tail) >= LOOPBACK_JOBS) {
+            __atomic_add_fetch(&stats.skipped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        job = &jobs[job_head % LOOPBACK_JOBS];
+        for (ch = 0; ch < nch; ch++)
+            memcpy(job->pcm[ch], pcm_ring_frame(ch),
+                    PCM_RING_FRAME * sizeof(double));
+        job->prev_start = start_bits / 8;
+        preparing = 1;
+    }
+}
+
+void loopback_bytes(struct sink_frame *frame)
+{
+    struct chunk *c;
+
+    if (chunk_head - LOAD(&chunk_tail) >= LOOPBACK_QUEUE) {
+        /* the decoder sees the gap in the offsets */
+        fed += frame->len;
+        return;
+    }
+
+    sink_frame_ref(frame);
+    c = &chunks[chunk_head % LOOPBACK_QUEUE];
+    c->frame = frame;
+    c->offset = fed;
+    fed += frame->len;
+    STORE(&chunk_head, chunk_head + 1);
+    sem_post(&ready);
+}
+
+/* Bit reader over one frame */
+struct reader {
+    const unsigned char *data;
+    int len;
+    int pos;        // bits
+};
+
+static unsigned int get_bits(struct reader *r, int n)
+{
+    unsigned int val = 0;
+
+    while (n-- > 0) {
+        int bit = 0;
+
+        if (r->pos < r->len * 8)
+            bit = (r->data[r->pos >> 3] >> (7 - (r->pos & 7))) & 1;
+        val = (val << 1) | bit;
+        r->pos++;
+    }
+    return val;
+}
+
+/* One decoded frame */
+struct decoded {
+    frame_header header;
+    frame_info frame;
+    unsigned int bit_alloc[2][SBLIMIT];
+    unsigned int scfsi[2][SBLIMIT];
+    unsigned int scalar[2][3][SBLIMIT];
+    double sample[2][3][SCALE_BLOCK][SBLIMIT];
+};
+
+/* ISO 11172-3 2.4.3.3.4: requantize a sample of a quantizer of steps
+ * steps, coded on k bits */
+static double requantize(unsigned int code, unsigned int steps)
+{
+    int k;
+    unsigned int levels;
+    double fraction;
+
+    for (k = 0, levels = 1; levels < steps; levels <<= 1, k++);
+
+    /* invert the MSB, and read as a two's complement fraction */
+    fraction = ((code >> (k - 1)) & 1) ? 0.0 : -1.0;
+    fraction += (double)(code & ((1 << (k - 1)) - 1)) / (1 << (k - 1));
+
+    return (double)levels / steps *
+        (fraction + (double)(levels - steps + 1) / levels);
+}
+
+/* Decode the Layer II frame of len bytes at data into d, and check its
+ * header CRC. The allocation table is only loaded again when the frame
+ * needs another one.
+ * returns 0  on success
+ *         -1 if the frame does not start with a Layer II header
+ */
+static int decode_frame(const unsigned char *data, int len,
+        struct decoded *d, int *crc_error)
+{
+    struct reader r = { data, len, 0 };
+    frame_header *header = &d->header;
+    frame_info *frame = &d->frame;
+    al_table *alloc;
+    unsigned int crc = 0, crc_read = 0;
+    int protection, sblimit, jsbound, dnch;
+    int sb, ch, gr, j, k, x;
+
+    if (get_bits(&r, 12) != 0xfff)
+        return -1;
+    header->version = get_bits(&r, 1);
+    header->lay = 4 - get_bits(&r, 2);
+    protection = !get_bits(&r, 1);
+    header->bitrate_index = get_bits(&r, 4);
+    header->sampling_frequency = get_bits(&r, 2);
+    header->padding = get_bits(&r, 1);
+    header->extension = get_bits(&r, 1);
+    header->mode = get_bits(&r, 2);
+    header->mode_ext = get_bits(&r, 2);
+    header->copyright = get_bits(&r, 1);
+    header->original = get_bits(&r, 1);
+    header->emphasis = get_bits(&r, 2);
+
+    if (header->version != version || header->lay != 2 ||
+            header->bitrate_index == 0 || header->bitrate_index == 15 ||
+            header->sampling_frequency == 3)
+        return -1;
+
+    frame->header = header;
+    frame->actual_mode = header->mode;
+    frame->nch = dnch = (header->mode == MPG_MD_MONO) ? 1 : 2;
+    frame->sblimit = sblimit = pick_table(frame);
+    frame->jsbound = jsbound = (header->mode == MPG_MD_JOINT_STEREO) ?
+        js_bound(header->mode_ext) : sblimit;
+    alloc = frame->alloc;
+
+    if (protection)
+        crc_read = get_bits(&r, 16);
+
+    memset(d->bit_alloc, 0, sizeof(d->bit_alloc));
+    memset(d->scfsi, 0, sizeof(d->scfsi));
+    memset(d->scalar, 0, sizeof(d->scalar));
+    memset(d->sample, 0, sizeof(d->sample));
+
+    for (sb = 0; sb < sblimit; sb++) {
+        int nbal = (*alloc)[sb][0].bits;
+
+        if (sb < jsbound)
+            for (ch = 0; ch < dnch; ch++)
+                d->bit_alloc[ch][sb] = get_bits(&r, nbal);
+        else
+            d->bit_alloc[0][sb] = d->bit_alloc[1][sb] = get_bits(&r, nbal);
+    }
+
+    for (sb = 0; sb < sblimit; sb++)
+        for (ch = 0; ch < dnch; ch++)
+            if (d->bit_alloc[ch][sb])
+                d->scfsi[ch][sb] = get_bits(&r, 2);
+
+    *crc_error = 0;
+    if (protection) {
+        CRC_calc(frame, d->bit_alloc, d->scfsi, &crc);
+        *crc_error = (crc != crc_read);
+    }
+
+    for (sb = 0; sb < sblimit; sb++)
+        for (ch = 0; ch < dnch; ch++)
+            if (d->bit_alloc[ch][sb]) {
+                unsigned int *s = d->scalar[ch][0] + sb;
+
+                switch (d->scfsi[ch][sb]) {
+                    case 0:
+                        s[0] = get_bits(&r, 6);
+                        s[SBLIMIT] = get_bits(&r, 6);
+                        s[2 * SBLIMIT] = get_bits(&r, 6);
+                        break;
+                    case 1:
+                        s[0] = s[SBLIMIT] = get_bits(&r, 6);
+                        s[2 * SBLIMIT] = get_bits(&r, 6);
+                        break;
+                    case 3:
+                        s[0] = get_bits(&r, 6);
+                        s[SBLIMIT] = s[2 * SBLIMIT] = get_bits(&r, 6);
+                        break;
+                    case 2:
+                        s[0] = s[SBLIMIT] = s[2 * SBLIMIT] = get_bits(&r, 6);
+                        break;
+                }
+            }
+
+    for (gr = 0; gr < 3; gr++)
+        for (j = 0; j < SCALE_BLOCK; j += 3)
+            for (sb = 0; sb < sblimit; sb++)
+                for (ch = 0; ch < ((sb < jsbound) ? dnch : 1); ch++) {
+                    unsigned int ba = d->bit_alloc[ch][sb];
+                    unsigned int code[3];
+                    double value[3];
+                    sb_alloc *q;
+
+                    if (ba == 0)
+                        continue;
+
+                    q = &(*alloc)[sb][ba];
+                    if (q->group == 3) {
+                        for (x = 0; x < 3; x++)
+                            code[x] = get_bits(&r, q->bits);
+                    }
+                    else {
+                        /* three samples in one codeword */
+                        unsigned int c = get_bits(&r, q->bits);
+
+                        for (x = 0; x < 3; x++) {
+                            code[x] = c % q->steps;
+                            c /= q->steps;
+                        }
+                    }
+
+                    for (x = 0; x < 3; x++)
+                        value[x] = requantize(code[x], q->steps);
+
+                    /* above jsbound, both channels share the samples */
+                    for (k = ch; k < ((sb < jsbound) ? ch + 1 : dnch); k++)
+                        for (x = 0; x < 3; x++)
+                            d->sample[k][gr][j + x][sb] = value[x] *
+                                multiple[d->scalar[k][gr][sb]];
+                }
+
+    return 0;
+}
+
+/* Check the DAB scalefactor CRCs of d, which were sent at the end of
+ * the frame before it, of len bytes at prev */
+static int check_scf_crc(struct decoded *d, const unsigned char *prev,
+        int len)
+{
+    unsigned int crc;
+    int i, errors = 0;
+
+    /* the CRCs come last, before the 2 bytes of F-PAD */
+    for (i = dab_extension - 1; i >= 0; i--) {
+        int pos = len - 2 - 1 - i;
+
+        CRC_calcDAB(&d->frame, d->bit_alloc, d->scfsi, d->scalar, &crc, i);
+        if (pos < 0 || prev[pos] != crc)
+            errors++;
+    }
+    return errors;
+}
+
+/* ISO 11172-3 2.4.3.3.5 and Figure A.2: the synthesis subband filter */
+struct synthesis {
+    double v[2][1024];
+    int off[2];
+};
+
+/* The frame to check and the one before */
+static struct decoded prev, cur;
+
+static double n_matrix[64][SBLIMIT];
+static double d_window[512];
+
+static void synthesis_init(void)
+{
+    int i, k;
+
+    for (i = 0; i < 64; i++)
+        for (k = 0; k < SBLIMIT; k++)
+            n_matrix[i][k] = cos((16 + i) * (2 * k + 1) * PI / 64);
+
+    /* the synthesis window is 32 times the analysis window */
+    for (i = 0; i < 512; i++)
+        d_window[i] = 32 * enwindow[i];
+
+    /* no allocation table loaded */
+    prev.frame.tab_num = -1;
+    cur.frame.tab_num = -1;
+}
+
+static void synthesis(struct synthesis *s, int ch, const double sample[SBLIMIT],
+        double out[32])
+{
+    double *v;
+    int i, j, k;
+
+    s->off[ch] = (s->off[ch] + 1024 - 64) % 1024;
+    v = s->v[ch];
+
+    for (i = 0; i < 64; i++) {
+        double sum = 0;
+
+        for (k = 0; k < SBLIMIT; k++)
+            sum += n_matrix[i][k] * sample[k];
+        v[(s->off[ch] + i) % 1024] = sum;
+    }
+
+    for (j = 0; j < 32; j++) {
+        double sum = 0;
+
+        for (i = 0; i < 8; i++) {
+            sum += d_window[i * 64 + j] *
+                v[(s->off[ch] + i * 128 + j) % 1024];
+            sum += d_window[i * 64 + 32 + j] *
+                v[(s->off[ch] + i * 128 + 96 + j) % 1024];
+        }
+        out[j] = sum;
+    }
+}
+
+static void synthesize_frame(struct synthesis *s, struct decoded *d,
+        int ch, double *out)
+{
+    int gr, j;
+
+    for (gr = 0; gr < 3; gr++)
+        for (j = 0; j < SCALE_BLOCK; j++) {
+            synthesis(s, ch, d->sample[ch][gr][j], out);
+            out += 32;
+        }
+}
+
+static double to_db(double signal, double noise)
+{
+    if (noise < 1e-30)
+        noise = 1e-30;
+    return 10 * log10(signal / noise);
+}
+
+static void add_measurement(double snr, double nmr_avg, double nmr_max)
+{
+    uint64_t n = stats.measured;
+    double v;
+
+    v = (stats.snr_avg * n + snr) / (n + 1);
+    __atomic_store(&stats.snr_avg, &v, __ATOMIC_RELAXED);
+    v = (stats.nmr_avg * n + nmr_avg) / (n + 1);
+    __atomic_store(&stats.nmr_avg, &v, __ATOMIC_RELAXED);
+    if (snr < stats.snr_min)
+        __atomic_store(&stats.snr_min, &snr, __ATOMIC_RELAXED);
+    if (nmr_max > stats.nmr_max)
+        __atomic_store(&stats.nmr_max, &nmr_max, __ATOMIC_RELAXED);
+    STORE(&stats.measured, n + 1);
+}
+
+/* Decode the frame of job and the one before, of the window at data */
+static void check_job(struct job *job, const unsigned char *data)
+{
+    static struct synthesis syn;
+    static double out[2][2 * PCM_RING_FRAME];
+    int prev_len = job->start - job->prev_start;
+    int crc_error = 0, scf_errors;
+    double signal, noise, snr;
+    double nmr, nmr_sum = 0, nmr_max = -DBL_MAX;
+    int nmr_count = 0;
+    int ch, sb, gr, j, i;
+
+    if (decode_frame(data, prev_len, &prev, &crc_error) != 0 ||
+            decode_frame(data + prev_len, job->end - job->start, &cur,
+                &crc_error) != 0) {
+        __atomic_add_fetch(&stats.header_errors, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    STORE(&stats.frames, stats.frames + 1);
+    if (crc_error)
+        __atomic_add_fetch(&stats.crc_errors, 1, __ATOMIC_RELAXED);
+    scf_errors = check_scf_crc(&cur, data, prev_len);
+    if (scf_errors)
+        __atomic_add_fetch(&stats.scf_crc_errors, scf_errors,
+                __ATOMIC_RELAXED);
+
+    if (job->silent || cur.frame.nch != nch)
+        return;
+
+    /* the synthesis starts from silence, and has settled after the
+     * frame before */
+    memset(&syn, 0, sizeof(syn));
+    for (ch = 0; ch < nch; ch++) {
+        synthesize_frame(&syn, &prev, ch, out[ch]);
+        synthesize_frame(&syn, &cur, ch, out[ch] + PCM_RING_FRAME);
+    }
+
+    signal = noise = 0;
+    for (ch = 0; ch < nch; ch++)
+        for (i = PCM_RING_FRAME; i < 2 * PCM_RING_FRAME; i++) {
+            double x = job->pcm[ch][i - LOOPBACK_DELAY];
+            double e = x - out[ch][i];
+
+            signal += x * x;
+            noise += e * e;
+        }
+
+    /* leave out frames with nothing above -100 dBFS */
+    if (signal < nch * PCM_RING_FRAME * 1e-10)
+        return;
+    snr = to_db(signal, noise);
+
+    /* the noise of every subband, against the threshold the psy model
+     * set below its signal */
+    for (ch = 0; ch < nch; ch++)
+        for (sb = 0; sb < cur.frame.sblimit; sb++) {
+            signal = noise = 0;
+            for (gr = 0; gr < 3; gr++)
+                for (j = 0; j < SCALE_BLOCK; j++) {
+                    double x = job->sb_sample[ch][gr][j][sb];
+                    double e = x - cur.sample[ch][gr][j][sb];
+
+                    signal += x * x;
+                    noise += e * e;
+                }
+            if (signal < 3 * SCALE_BLOCK * 1e-10)
+                continue;
+
+            nmr = job->smr[ch][sb] - to_db(signal, noise);
+            nmr_sum += nmr;
+            nmr_count++;
+            if (nmr > nmr_max)
+                nmr_max = nmr;
+        }
+
+    if (nmr_count == 0)
+        return;
+    add_measurement(snr, nmr_sum / nmr_count, nmr_max);
+}
+
+long loopback_decode(const unsigned char *data, long len, int dab,
+        double *pcm[2], long max_samples, struct loopback_stats *st)
+{
+    static struct synthesis syn;
+    static double out[PCM_RING_FRAME];
+    long pos = 0, prev_pos = -1, written = -LOOPBACK_DELAY;
+    int crc_error, ch, i;
+
+    memset(st, 0, sizeof(*st));
+    if (len < 4)
+        return 0;
+
+    synthesis_init();
+    memset(&syn, 0, sizeof(syn));
+    version = (data[1] >> 3) & 1;
+
+    while (pos + 4 <= len) {
+        frame_header *header = &cur.header;
+        long frame_len;
+
+        if (decode_frame(data + pos, len - pos, &cur, &crc_error) != 0) {
+            st->header_errors++;
+            break;
+        }
+        frame_len = (long)(144 * bitrate[header->version][header->bitrate_index] /
+                s_freq[header->version][header->sampling_frequency]) +
+            header->padding;
+        if (pos + frame_len > len)
+            break;
+
+        st->frames++;
+        if (crc_error)
+            st->crc_errors++;
+        if (dab && prev_pos >= 0) {
+            dab_extension = dab_scf_crc_count(header);
+            st->scf_crc_errors += check_scf_crc(&cur, data + prev_pos,
+                    pos - prev_pos);
+        }
+
+        for (ch = 0; ch < cur.frame.nch; ch++) {
+            synthesize_frame(&syn, &cur, ch, out);
+            for (i = 0; i < PCM_RING_FRAME; i++)
+                if (written + i >= 0 && written + i < max_samples)
+                    pcm[ch][written + i] = out[i];
+        }
+        written += PCM_RING_FRAME;
+
+        prev_pos = pos;
+        pos += frame_len;
+    }
+
+    mem_free((void **) &cur.frame.alloc);
+    if (written < 0)
+        written = 0;
+    return written < max_samples ? written : max_samples;
+}
+
+static void *decoder_thread(void *arg)
+{
+    static unsigned char window[LOOPBACK_WINDOW];
+    unsigned long win_start = 0;
+    int win_len = 0;
+    struct sched_param param;
+
+    (void)arg;
+
+    /* only run on time the encoder leaves */
+    memset(&param, 0, sizeof(param));
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0)
+        setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+
+    synthesis_init();
+
+    for (;;) {
+        uint64_t tail;
+        int stopping;
+
+        sem_wait(&ready);
+
+        /* the encoder queued all its bytes before it set stop */
+        stopping = LOAD(&stop);
+
+        /* take the bytes that came out */
+        while ((tail = chunk_tail) != LOAD(&chunk_head)) {
+            struct chunk *c = &chunks[tail % LOOPBACK_QUEUE];
+            struct sink_frame *frame = c->frame;
+            int len = frame->len;
+
+            if (c->offset != win_start + win_len || len > LOOPBACK_WINDOW) {
+                /* some were dropped */
+                win_start = c->offset;
+                win_len = 0;
+            }
+            if (len <= LOOPBACK_WINDOW) {
+                if (win_len + len > LOOPBACK_WINDOW) {
+                    int drop = win_len + len - LOOPBACK_WINDOW;
+
+                    memmove(window, window + drop, win_len - drop);
+                    win_start += drop;
+                    win_len -= drop;
+                }
+                memcpy(window + win_len, frame->data, len);
+                win_len += len;
+            }
+
+            sink_frame_unref(frame);
+            STORE(&chunk_tail, tail + 1);
+        }
+
+        /* and check the frames that are complete */
+        while ((tail = job_tail) != LOAD(&job_head)) {
+            struct job *job = &jobs[tail % LOOPBACK_JOBS];
+
+            if (job->end > win_start + win_len &&
+                    job->prev_start >= win_start && !stopping)
+                break;
+
+            if (job->prev_start >= win_start &&
+                    job->end <= win_start + win_len)
+                check_job(job, window + (job->prev_start - win_start));
+            else
+                __atomic_add_fetch(&stats.skipped, 1, __ATOMIC_RELAXED);
+
+            STORE(&job_tail, tail + 1);
+        }
+
+        if (stopping && job_tail == LOAD(&job_head))
+            break;
+    }
+
+    return NULL;
+}
+
+void loopback_close(void)
+{
+    if (interval == 0)
+        return;
+
+    STORE(&stop, 1);
+    sem_post(&ready);
+    pthread_join(thread, NULL);
+    sem_destroy(&ready);
+    mem_free((void **) &prev.frame.alloc);
+    mem_free((void **) &cur.frame.alloc);
+    free(jobs);
+    jobs = NULL;
+    interval = 0;
+}
+
+void loopback_get_stats(struct loopback_stats *st)
+{
+    st->frames = LOAD(&stats.frames);
+    st->skipped = LOAD(&stats.skipped);
+    st->header_errors = LOAD(&stats.header_errors);
+    st->crc_errors = LOAD(&stats.crc_errors);
+    st->scf_crc_errors = LOAD(&stats.scf_crc_errors);
+    st->measured = LOAD(&stats.measured);
+    __atomic_load(&stats.snr_avg, &st->snr_avg, __ATOMIC_RELAXED);
+    __atomic_load(&stats.snr_min, &st->snr_min, __ATOMIC_RELAXED);
+    __atomic_load(&stats.nmr_avg, &st->nmr_avg, __ATOMIC_RELAXED);
+    __atomic_load(&stats.nmr_max, &st->nmr_max, __ATOMIC_RELAXED);
+    if (st->measured == 0)
+        st->snr_avg = st->snr_min = st->nmr_avg = st->nmr_max = 0;
+}
+
+void loopback_report(FILE *fd)
+{
+    struct loopback_stats st;
+
+    loopback_get_stats(&st);
+    fprintf(fd, "Loopback check: %llu frames decoded, %llu skipped, "
+            "%llu header errors, %llu CRC errors, %llu ScF-CRC errors\n",
+            (unsigned long long)st.frames, (unsigned long long)st.skipped,
+            (unsigned long long)st.header_errors,
+            (unsigned long long)st.crc_errors,
+            (unsigned long long)st.scf_crc_errors);
+    if (st.measured > 0)
+        fprintf(fd, "Loopback check: SNR %.1f dB (min %.1f), "
+                "NMR %.1f dB (max %.1f) over %llu frames\n",
+                st.snr_avg, st.snr_min, st.nmr_avg, st.nmr_max,
+                (unsigned long long)st.measured);
+}
@@ -0,0 +1,81 @@
+#ifndef _LOOPBACK_H_
+#define _LOOPBACK_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "common.h"
+
+struct sink_frame;
+
+/* Loopback check of the encoded stream
+ *
+ * Every Nth frame is decoded again from the bytes handed to the outputs,
+ * by a Layer II decoder and synthesis filterbank of its own, which only
+ * shares the allocation tables and the CRC routines with the encoder:
+ *  - the header is checked, and its CRC when the stream has one (-e);
+ *  - the DAB scalefactor CRCs, which travel at the end of the frame
+ *    before, are checked against the scalefactors that were decoded;
+ *  - the decoded audio is compared with the input, which gives the SNR
+ *    of the frame, and the decoded subband samples with the ones of the
+ *    encoder, which with the SMR of the psy model gives the noise to
+ *    mask ratio (NMR) of every subband. Frames sent as silence have none.
+ *
+ * The frame before is decoded too, so that the synthesis filterbank has
+ * settled. The decoder runs on a thread of the lowest priority. The
+ * encoder only copies the input and the subband samples of the frames
+ * to check, and takes a reference to the output frames: it never waits
+ * for the decoder. A frame the decoder had no time for is skipped.
+ */
+
+/* Frames the decoder can be behind the encoder */
+#define LOOPBACK_QUEUE 64
+
+struct loopback_stats {
+    uint64_t frames;        // frames decoded
+    uint64_t skipped;       // frames to check the decoder had no time for
+    uint64_t header_errors; // no valid Layer II header where a frame starts
+    uint64_t crc_errors;    // header CRC
+    uint64_t scf_crc_errors;// DAB scalefactor CRC
+    uint64_t measured;      // frames with an SNR and NMR, not silence
+    double snr_avg, snr_min;// dB
+    double nmr_avg, nmr_max;// dB, average and worst subband
+};
+
+/* Check every interval frames of the stream of frame. 0 disables it.
+ * returns 0  on success
+ *         -1 on failure
+ */
+int loopback_init(int interval, frame_info *frame);
+
+int loopback_enabled(void);
+
+/* Call after the frame has been written to the bit stream, with the
+ * bits that were sent before it and after it. The input is taken from
+ * the sample ring */
+void loopback_frame(double sb_sample[2][3][SCALE_BLOCK][SBLIMIT],
+        double smr[2][SBLIMIT], int silent, unsigned long start_bits,
+        unsigned long end_bits);
+
+/* Hand every output frame of the stream to the decoder, in order */
+void loopback_bytes(struct sink_frame *frame);
+
+/* Check what is still queued, once the stream is closed, and stop */
+void loopback_close(void);
+
+void loopback_get_stats(struct loopback_stats *stats);
+
+/* Print the results */
+void loopback_report(FILE *fd);
+
+/* Decode a whole Layer II stream of len bytes at data on the calling
+ * thread, for the golden tests of toolame-bench. Not while the check
+ * runs, the decoder is the same. The ScF-CRCs are checked if dab is
+ * set. The channels go to pcm[0] and pcm[1], max_samples of each at
+ * most, as the input of the encoder: 1.0 is full scale, and the delay
+ * of the filterbanks is taken out. The frames and errors are counted in
+ * st, which gets no SNR nor NMR.
+ * Returns the number of samples of every channel */
+long loopback_decode(const unsigned char *data, long len, int dab,
+        double *pcm[2], long max_samples, struct loopback_stats *st);
+
+#endif
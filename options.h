@@ -4,6 +4,7 @@
 #define INPUT_SELECT_JACK 1
 #define INPUT_SELECT_WAV 2
 #define INPUT_SELECT_VLC 3
+#define INPUT_SELECT_SHM 4
 
 typedef struct
 {
@@ -11,6 +12,8 @@ typedef struct
   int usepadbit;		/* TRUE   by default, use a padding bit */
   int quickmode;		/* FALSE  calculate psy model for every frame */
   int quickcount;		/* 10     when quickmode = TRUE, calculate psymodel every 10th frame */
+  float quickthreshold;		/* 0      when > 0, also calculate psymodel when the signal changed
+				          by more than this many dB, see quickmode.h */
   int downmix;			/* FALSE  downmix from stereo to mono */
   int byteswap;			/* FALSE  swap the bytes */
   int channelswap;		/* FALSE  swap the channels */
@@ -20,8 +23,19 @@ typedef struct
   float athlevel;                 /* 0      extra argument to the ATH equation - 
 				          used for VBR in LAME */
   int verbosity;                /* 2 by default. 0 is no output at all */
-  int input_select; /* 1=use JACK input, 2=use wav input, 3=use VLC input */
+  int input_select; /* 1=use JACK input, 2=use wav input, 3=use VLC input, 4=use shared memory */
   int show_level; /* 1=show the sox-like audio level measurement */
+  int deadline_headroom; /* -1 by default: 10 for live inputs, 0 (no alarms) otherwise */
+  int governor_target; /* 0 by default: lower the psy model above this load in %, see governor.h */
+  const char *stats_target; /* NULL   file or unix:socket to write the statistics to */
+  int stats_format;  /* 0=JSON, 1=Prometheus text, see stats.h */
+  int zmq_queue_depth; /* 16     frames each ZMQ sender thread can hold, see zmqoutput.h */
+  int zmq_drop_newest; /* FALSE  drop the oldest frame when a ZMQ queue is full */
+  int silence_threshold; /* 0    largest constant sample value sent as silence, -1 never, see silence.h */
+  int psy_cache_mb; /* 0      megabytes of psy model results to keep for repeated audio, see psycache.h */
+  int loopback_interval; /* 0  decode every nth frame again to check it, see loopback.h */
+  int twopass;       /* 0      pass of two-pass VBR, 1 or 2, see twopass.h */
+  const char *twopass_file; /* NULL  statistics of two-pass VBR */
 }
 options;
 
@@ -0,0 +1,136 @@
+/* Ring buffer of the normalized input samples, see pcm_ring.h */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "pcm_ring.h"
+
+#define RING_BYTES (PCM_RING_SIZE * sizeof(double))
+
+static double *ring[2] = { NULL, NULL };
+
+/* Index of the first sample of the current frame. It stays in
+ * [PCM_RING_HISTORY, PCM_RING_HISTORY + PCM_RING_SIZE) so that the
+ * history before it and the frame itself are inside the two copies */
+static int pos = PCM_RING_HISTORY;
+static int started = 0;
+
+/* Set when the ring is not mapped twice and has to be mirrored by hand */
+static int copy_mirror = 0;
+
+/* Map the same pages twice in a row, returns NULL if not possible */
+static double *map_ring(void)
+{
+#ifdef MFD_CLOEXEC
+    long page = sysconf(_SC_PAGESIZE);
+    unsigned char *base;
+    int fd;
+
+    if (page <= 0 || RING_BYTES % page != 0)
+        return NULL;
+
+    fd = memfd_create("toolame-pcm-ring", MFD_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+
+    if (ftruncate(fd, RING_BYTES) == -1) {
+        close(fd);
+        return NULL;
+    }
+
+    /* reserve the address space for both copies, then map over it */
+    base = mmap(NULL, 2 * RING_BYTES, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    if (mmap(base, RING_BYTES, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+            mmap(base + RING_BYTES, RING_BYTES, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, 2 * RING_BYTES);
+        close(fd);
+        return NULL;
+    }
+
+    /* the mappings keep the memory alive */
+    close(fd);
+    return (double *)base;
+#else
+    return NULL;
+#endif
+}
+
+int pcm_ring_init(void)
+{
+    int ch;
+
+    for (ch = 0; ch < 2; ch++) {
+        ring[ch] = map_ring();
+        if (ring[ch] == NULL) {
+            void *buf;
+
+            if (posix_memalign(&buf, 64, 2 * RING_BYTES) != 0) {
+                fprintf(stderr, "Could not allocate the sample ring\n");
+                return -1;
+            }
+            memset(buf, 0, 2 * RING_BYTES);
+            ring[ch] = buf;
+            copy_mirror = 1;
+        }
+    }
+
+    pos = PCM_RING_HISTORY;
+    started = 0;
+    return 0;
+}
+
+void pcm_ring_advance(void)
+{
+    if (!started) {
+        started = 1;
+        return;
+    }
+
+    pos += PCM_RING_FRAME;
+    if (pos >= PCM_RING_HISTORY + PCM_RING_SIZE)
+        pos -= PCM_RING_SIZE;
+}
+
+double *pcm_ring_frame(int ch)
+{
+    return ring[ch] + pos;
+}
+
+void pcm_ring_commit(void)
+{
+    int ch;
+
+    if (!copy_mirror)
+        return;
+
+    /* copy the frame to the other half of the buffer */
+    for (ch = 0; ch < 2; ch++) {
+        double *r = ring[ch];
+        int end = pos + PCM_RING_FRAME;
+
+        if (end <= PCM_RING_SIZE) {
+            memcpy(r + pos + PCM_RING_SIZE, r + pos,
+                    PCM_RING_FRAME * sizeof(double));
+        }
+        else if (pos >= PCM_RING_SIZE) {
+            memcpy(r + pos - PCM_RING_SIZE, r + pos,
+                    PCM_RING_FRAME * sizeof(double));
+        }
+        else {
+            memcpy(r + pos + PCM_RING_SIZE, r + pos,
+                    (PCM_RING_SIZE - pos) * sizeof(double));
+            memcpy(r, r + PCM_RING_SIZE, (end - PCM_RING_SIZE) * sizeof(double));
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef _PCM_RING_H_
+#define _PCM_RING_H_
+
+/* Ring buffer of the normalized input samples
+ *
+ * Every channel has one ring of PCM_RING_SIZE samples in the [-1, 1)
+ * range, written by condition_audio() and read by the filterbank and
+ * by all psy models. The ring is mapped twice in a row in memory, so
+ * that every window of up to PCM_RING_SIZE samples is contiguous: the
+ * readers get a pointer to the current frame, and can look up to
+ * PCM_RING_HISTORY samples back from it without any wrap-around.
+ *
+ * If the system cannot map the same memory twice, the ring is a plain
+ * buffer and every frame is copied to its mirror after it is written.
+ */
+
+#define PCM_RING_SIZE    2048
+#define PCM_RING_FRAME   1152
+
+/* Number of samples before the current frame that can be read.
+ * Psy models 2 and 4 need the most, their first FFT window starts
+ * 480 samples before the frame */
+#define PCM_RING_HISTORY 480
+
+/* Allocate the rings, which start filled with silence.
+ * returns 0  on success
+ *         -1 on failure
+ */
+int pcm_ring_init(void);
+
+/* Move on to the next frame */
+void pcm_ring_advance(void);
+
+/* First sample of the current frame of the channel. The pointer is valid
+ * from PCM_RING_HISTORY samples before up to the end of the frame */
+double *pcm_ring_frame(int ch);
+
+/* Call once the current frame has been written */
+void pcm_ring_commit(void);
+
+#endif
@@ -0,0 +1,323 @@
+/* Psy model result cache, see psycache.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "common.h"
+#include "options.h"
+#include "encoder.h"
+#include "psycho_2.h"
+#include "psycho_4.h"
+#include "psycache.h"
+
+#define MAX_MODEL 4
+
+struct psykey {
+    uint64_t a, b;
+};
+
+struct entry {
+    struct psykey key;
+    double smr[2][SBLIMIT];
+    int prev, next;     // in the LRU list, most recent first
+    int chain;          // next entry of the hash bucket
+};
+
+static struct entry *entries = NULL;
+static FLOAT *states = NULL;    // models 2 and 4, both channels of every entry
+static int num_entries = 0;
+static int used = 0;
+static int state_size = 0;
+static int *buckets = NULL;
+static unsigned int bucket_mask = 0;
+static int lru_head = -1, lru_tail = -1;
+
+/* The key of the frame being looked up, until it is stored */
+static int pending = 0;
+static struct psykey pending_key;
+static int pending_model, pending_nch, pending_nsb;
+
+/* For models 2 and 4, the hash of the windows of the last frame they
+ * ran on, which their state is made of */
+static struct psykey last_windows[MAX_MODEL + 1];
+
+static uint64_t hits = 0;
+static uint64_t misses = 0;
+static uint64_t evictions = 0;
+
+int psycache_init(int size_mb, int model)
+{
+    size_t entry_size;
+    int i;
+
+    if (size_mb <= 0)
+        return 0;
+
+    /* the governor only steps down to models 1 and 0 */
+    if (model == 2 || model == 4)
+        state_size = 2 * PSYCHO_STATE_SIZE;
+
+    entry_size = sizeof(struct entry) + state_size * sizeof(FLOAT);
+    num_entries = (size_t)size_mb * 1024 * 1024 / entry_size;
+    if (num_entries < 1)
+        num_entries = 1;
+
+    for (bucket_mask = 1; bucket_mask < (unsigned int)num_entries * 2;
+            bucket_mask <<= 1);
+
+    entries = calloc(num_entries, sizeof(*entries));
+    buckets = malloc(bucket_mask * sizeof(*buckets));
+    if (state_size)
+        states = malloc((size_t)num_entries * state_size * sizeof(FLOAT));
+    if (entries == NULL || buckets == NULL || (state_size && states == NULL)) {
+        fprintf(stderr, "Unable to allocate %d MB for the psy model cache\n",
+                size_mb);
+        free(entries);
+        free(buckets);
+        free(states);
+        entries = NULL;
+        return -1;
+    }
+
+    for (i = 0; i < (int)bucket_mask; i++)
+        buckets[i] = -1;
+    bucket_mask--;
+
+    return 0;
+}
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/* Two independent lanes over the 64-bit words of data */
+static void hash(struct psykey *h, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    uint64_t a = h->a, b = h->b;
+    size_t i;
+
+    for (i = 0; i < size; i += 8) {
+        uint64_t v;
+
+        memcpy(&v, p + i, 8);
+        a = rotl(a ^ (v * 0x87c37b91114253d5ULL), 31) * 0x9e3779b97f4a7c15ULL;
+        b = rotl(b + v, 27) * 0x4cf5ad432745937fULL + 0x52dce729;
+    }
+
+    h->a = a;
+    h->b = b;
+}
+
+static FLOAT *entry_state(int i, int ch)
+{
+    return states + (size_t)i * state_size + ch * PSYCHO_STATE_SIZE;
+}
+
+static int key_equal(const struct psykey *x, const struct psykey *y)
+{
+    return x->a == y->a && x->b == y->b;
+}
+
+static void lru_unlink(int i)
+{
+    struct entry *e = &entries[i];
+
+    if (e->prev >= 0)
+        entries[e->prev].next = e->next;
+    else
+        lru_head = e->next;
+    if (e->next >= 0)
+        entries[e->next].prev = e->prev;
+    else
+        lru_tail = e->prev;
+}
+
+static void lru_push(int i)
+{
+    struct entry *e = &entries[i];
+
+    e->prev = -1;
+    e->next = lru_head;
+    if (lru_head >= 0)
+        entries[lru_head].prev = i;
+    lru_head = i;
+    if (lru_tail < 0)
+        lru_tail = i;
+}
+
+static void bucket_remove(int i)
+{
+    int *p = &buckets[entries[i].key.a & bucket_mask];
+
+    while (*p != i)
+        p = &entries[*p].chain;
+    *p = entries[i].chain;
+}
+
+static int find(const struct psykey *key)
+{
+    int i;
+
+    for (i = buckets[key->a & bucket_mask]; i >= 0; i = entries[i].chain)
+        if (key_equal(&entries[i].key, key))
+            return i;
+    return -1;
+}
+
+int psycache_lookup(int model, double *samples[2],
+        double max_sc[2][SBLIMIT], frame_info *frame, options *glopts,
+        double smr[2][SBLIMIT])
+{
+    frame_header *header = frame->header;
+    int nch = frame->nch;
+    struct psykey key = { 0x736d72636163686eULL, 0x70737963686f6d6fULL };
+    int64_t params[7];
+    int stateful = (model == 2 || model == 4);
+    int ch, sb, i;
+
+    pending = 0;
+    if (entries == NULL || model < 1 || model > MAX_MODEL ||
+            (stateful && state_size == 0))
+        return 0;
+
+    params[0] = model;
+    params[1] = nch;
+    params[2] = frame->sblimit;
+    params[3] = header->version;
+    params[4] = header->sampling_frequency;
+    params[5] = header->bitrate_index;
+    params[6] = 0;
+    memcpy(&params[6], &glopts->athlevel, sizeof(glopts->athlevel));
+    hash(&key, params, sizeof(params));
+
+    for (ch = 0; ch < nch; ch++) {
+        if (stateful) {
+            /* the two FFT windows, see psycho_2() */
+            hash(&key, samples[ch] - 480, (576 + BLKSIZE) * sizeof(double));
+        }
+        else {
+            /* the FFT window, see psycho_1() */
+            hash(&key, samples[ch] - 192, BLKSIZE * sizeof(double));
+            hash(&key, max_sc[ch], SBLIMIT * sizeof(double));
+        }
+    }
+
+    if (stateful) {
+        struct psykey windows = key;
+
+        hash(&key, &last_windows[model], sizeof(last_windows[model]));
+        last_windows[model] = windows;
+    }
+
+    key.a = fmix(key.a);
+    key.b = fmix(key.b ^ key.a);
+
+    i = find(&key);
+    if (i >= 0) {
+        struct entry *e = &entries[i];
+
+        /* model 1 leaves the subbands above sblimit alone */
+        for (ch = 0; ch < nch; ch++)
+            for (sb = 0; sb < (model == 1 ? frame->sblimit : SBLIMIT); sb++)
+                smr[ch][sb] = e->smr[ch][sb];
+
+        for (ch = 0; ch < nch && stateful; ch++) {
+            if (model == 2)
+                psycho_2_set_state(ch, entry_state(i, ch));
+            else
+                psycho_4_set_state(ch, entry_state(i, ch));
+        }
+
+        lru_unlink(i);
+        lru_push(i);
+        hits++;
+        return 1;
+    }
+
+    misses++;
+    pending = 1;
+    pending_key = key;
+    pending_model = model;
+    pending_nch = nch;
+    pending_nsb = model == 1 ? frame->sblimit : SBLIMIT;
+    return 0;
+}
+
+void psycache_store(double smr[2][SBLIMIT])
+{
+    struct entry *e;
+    int ch, sb, i;
+
+    if (!pending)
+        return;
+    pending = 0;
+
+    if (used < num_entries) {
+        i = used++;
+    }
+    else {
+        i = lru_tail;
+        lru_unlink(i);
+        bucket_remove(i);
+        evictions++;
+    }
+
+    e = &entries[i];
+    e->key = pending_key;
+    for (ch = 0; ch < pending_nch; ch++)
+        for (sb = 0; sb < pending_nsb; sb++)
+            e->smr[ch][sb] = smr[ch][sb];
+
+    for (ch = 0; ch < pending_nch; ch++) {
+        if (pending_model == 2)
+            psycho_2_get_state(ch, entry_state(i, ch));
+        else if (pending_model == 4)
+            psycho_4_get_state(ch, entry_state(i, ch));
+    }
+
+    e->chain = buckets[e->key.a & bucket_mask];
+    buckets[e->key.a & bucket_mask] = i;
+    lru_push(i);
+}
+
+uint64_t psycache_hits(void)
+{
+    return hits;
+}
+
+uint64_t psycache_misses(void)
+{
+    return misses;
+}
+
+uint64_t psycache_evictions(void)
+{
+    return evictions;
+}
+
+void psycache_report(FILE *fd)
+{
+    uint64_t lookups = hits + misses;
+
+    if (lookups == 0)
+        return;
+
+    fprintf(fd, "Psy model cache: %llu hits in %llu lookups (%.1f%%), "
+            "%d entries, %llu evicted\n",
+            (unsigned long long)hits, (unsigned long long)lookups,
+            100.0 * hits / lookups, num_entries,
+            (unsigned long long)evictions);
+}
@@ -0,0 +1,57 @@
+#ifndef _PSYCACHE_H_
+#define _PSYCACHE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "common.h"
+#include "options.h"
+
+/* Psy model result cache
+ *
+ * Stations play the same jingles, idents and adverts many times a day,
+ * and the psy model then computes the same SMR again. With the cache,
+ * the SMR of psy models 1 to 4 is kept for every frame, under a hash of
+ * everything the model reads:
+ *  - the FFT windows of every channel, taken from the sample ring;
+ *  - for models 1 and 3, the largest scalefactors of the subbands;
+ *  - the model, the sampling frequency, the bitrate, the number of
+ *    channels, sblimit and the ATH level.
+ * A frame that hashes the same gets the stored SMR instead of running
+ * the model, which makes the output identical to a run without cache.
+ *
+ * Models 2 and 4 also predict every spectrum from the two of the frame
+ * before. Their key includes the hash of the windows of the frame they
+ * last ran on, which the prediction state is made of, and the entry
+ * carries the state the model was left in, which a hit restores. The
+ * first frame of a repeated item is a miss for them.
+ *
+ * The key is 128 bits long, so that two different frames in the cache
+ * are not expected to ever collide. The memory is bounded, the least
+ * recently used entry is evicted to make room for a new one.
+ */
+
+/* Setup the cache to use up to size_mb megabytes, for the configured
+ * psy model. A size of 0 disables it.
+ * returns 0  on success
+ *         -1 on failure
+ */
+int psycache_init(int size_mb, int model);
+
+/* Look up the SMR of the frame before running the psy model on it.
+ * On a hit, smr and the state of the model are set, and 1 is returned.
+ * Otherwise, run the model, and give its result to psycache_store() */
+int psycache_lookup(int model, double *samples[2],
+        double max_sc[2][SBLIMIT], frame_info *frame, options *glopts,
+        double smr[2][SBLIMIT]);
+void psycache_store(double smr[2][SBLIMIT]);
+
+/* Number of lookups that were found and not found, and of entries
+ * evicted to make room */
+uint64_t psycache_hits(void);
+uint64_t psycache_misses(void);
+uint64_t psycache_evictions(void);
+
+/* Print the counters */
+void psycache_report(FILE *fd);
+
+#endif
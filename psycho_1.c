@@ -19,25 +19,22 @@ double dbtable[DBTAB];
 
 **********************************************************************/
 
-void psycho_1 (short buffer[2][1152], double scale[2][SBLIMIT],
+void psycho_1 (double *samples[2], double scale[2][SBLIMIT],
 	       double ltmin[2][SBLIMIT], frame_info * frame)
 {
   frame_header *header = frame->header;
   int nch = frame->nch;
   int sblimit = frame->sblimit;
-  int k, i, tone = 0, noise = 0;
+  int k, tone = 0, noise = 0;
   static char init = 0;
-  static int off[2] = { 256, 256 };
-  double sample[FFT_SIZE];
+  static masker_list tonal, nontonal;
   double spike[2][SBLIMIT];
-  static D1408 *fft_buf;
   static mask_ptr power;
   static g_ptr ltg;
   FLOAT energy[FFT_SIZE];
 
   /* call functions for critical boundaries, freq. */
   if (!init) {			/* bands, bark values, and mapping */
-    fft_buf = (D1408 *) mem_alloc ((long) sizeof (D1408) * 2, "fft_buf");
     power = (mask_ptr) mem_alloc (sizeof (mask) * HAN_SIZE, "power");
     if (header->version == MPEG_AUDIO_ID) {
       psycho_1_read_cbound (header->lay, header->sampling_frequency);
@@ -47,39 +44,24 @@ void psycho_1 (short buffer[2][1152], double scale[2][SBLIMIT],
       psycho_1_read_freq_band (&ltg, header->lay, header->sampling_frequency + 4);
     }
     psycho_1_make_map (power, ltg);
-    for (i = 0; i < 1408; i++)
-      fft_buf[0][i] = fft_buf[1][i] = 0;
+    psycho_1_init_spread (ltg);
 
     psycho_1_init_add_db ();		/* create the add_db table */
 
     init = 1;
   }
   for (k = 0; k < nch; k++) {
-    /* check pcm input for 3 blocks of 384 samples */
-    /* sami's speedup, added in 02j
-       saves about 4% overall during an encode */
-    int ok = off[k] % 1408;
-    for (i = 0; i < 1152; i++) {
-      fft_buf[k][ok++] = (double) buffer[k][i] / SCALE;
-      if (ok >= 1408)
-	ok = 0;
-    }
-    ok = (off[k] + 1216) % 1408;
-    for (i = 0; i < FFT_SIZE; i++) {
-      sample[i] = fft_buf[k][ok++];
-      if (ok >= 1408)
-	ok = 0;
-    }
-    off[k] += 1152;
-    off[k] %= 1408;
-
-    psycho_1_hann_fft_pickmax (sample, power, &spike[k][0], energy);
+    /* The FFT window starts 192 samples before the frame, and is taken
+       straight from the sample ring, see pcm_ring.h */
+    psycho_1_hann_fft_pickmax (samples[k] - 192, power, &spike[k][0], energy);
     psycho_1_tonal_label (power, &tone);
     psycho_1_noise_label (power, &noise, ltg, energy);
-    //psycho_1_dump(power, &tone, &noise) ;
-    psycho_1_subsampling (power, ltg, &tone, &noise);
-    psycho_1_threshold (power, ltg, &tone, &noise,
-	       bitrate[header->version][header->bitrate_index] / nch);
+    psycho_1_collect (power, ltg, tone, &tonal);
+    psycho_1_collect (power, ltg, noise, &nontonal);
+    //psycho_1_dump(&tonal, &nontonal) ;
+    psycho_1_subsampling (ltg, &tonal, &nontonal);
+    psycho_1_threshold (ltg, &tonal, &nontonal,
+	       bitrate[header->version][header->bitrate_index] / nch, sblimit);
     psycho_1_minimum_mask (ltg, &ltmin[k][0], sblimit);
     psycho_1_smr (&ltmin[k][0], &spike[k][0], &scale[k][0], sblimit);
   }
@@ -399,6 +381,48 @@ void psycho_1_noise_label (mask * power, int *noise, g_thres * ltg,
   }
 }
 
+/****************************************************************
+*
+*        This function copies a linked list of tonal or non-tonal
+* components out of the power spectrum into a masker list.
+*
+****************************************************************/
+
+void psycho_1_collect (mask power[HAN_SIZE], g_thres * ltg, int first,
+		       masker_list * list)
+{
+  int i, n = 0;
+
+  for (i = first; (i != LAST) && (i != STOP) && n < HAN_SIZE / 2;
+       i = power[i].next) {
+    list->line[n] = i;
+    list->map[n] = power[i].map;
+    list->bark[n] = ltg[power[i].map].bark;
+    list->x[n] = power[i].x;
+    n++;
+  }
+  list->n = n;
+}
+
+static void masker_move (masker_list * list, int to, int from)
+{
+  list->line[to] = list->line[from];
+  list->map[to] = list->map[from];
+  list->bark[to] = list->bark[from];
+  list->x[to] = list->x[from];
+}
+
+/* drop the components below the threshold in quiet */
+static void remove_inaudible (g_thres * ltg, masker_list * list)
+{
+  int i, n = 0;
+
+  for (i = 0; i < list->n; i++)
+    if (list->x[i] >= ltg[list->map[i]].hear)
+      masker_move (list, n++, i);
+  list->n = n;
+}
+
 /****************************************************************
 *
 *        This function reduces the number of noise and tonal
@@ -406,67 +430,31 @@ void psycho_1_noise_label (mask * power, int *noise, g_thres * ltg,
 *
 ****************************************************************/
 
-void psycho_1_subsampling (mask power[HAN_SIZE], g_thres * ltg, int *tone, int *noise)
+void psycho_1_subsampling (g_thres * ltg, masker_list * tone, masker_list * noise)
 {
-  int i, old;
-
-  i = *tone;
-  old = STOP;			/* calculate tonal components for */
-
-  while ((i != LAST) && (i != STOP))
-  {				/* reduction of spectral lines    */
-    if (power[i].x < ltg[power[i].map].hear) {
-      power[i].type = FALSE;
-      power[i].x = DBMIN;
-      if (old == STOP)
-	*tone = power[i].next;
-      else
-	power[old].next = power[i].next;
-    } else
-      old = i;
-    i = power[i].next;
-  }
-  i = *noise;
-  old = STOP;			/* calculate non-tonal components for */
-  while ((i != LAST) && (i != STOP)) {	/* reduction of spectral lines        */
-    if (power[i].x < ltg[power[i].map].hear) {
-      power[i].type = FALSE;
-      power[i].x = DBMIN;
-      if (old == STOP)
-	*noise = power[i].next;
-      else
-	power[old].next = power[i].next;
-    } else
-      old = i;
-    i = power[i].next;
-  }
-  i = *tone;
-  old = STOP;
-  while ((i != LAST) && (i != STOP))
-  {				/* if more than one */
-    if (power[i].next == LAST)
-      break;			/* tonal component  */
-    if (ltg[power[power[i].next].map].bark -	/* is less than .5  */
-	ltg[power[i].map].bark < 0.5) {	/* bark, take the   */
-      if (power[power[i].next].x > power[i].x) {	/* maximum          */
-	if (old == STOP)
-	  *tone = power[i].next;
-	else
-	  power[old].next = power[i].next;
-	power[i].type = FALSE;
-	power[i].x = DBMIN;
-	i = power[i].next;
-      } else {
-	power[power[i].next].type = FALSE;
-	power[power[i].next].x = DBMIN;
-	power[i].next = power[power[i].next].next;
-	old = i;
-      }
+  int i, cur, n;
+
+  remove_inaudible (ltg, tone);		/* calculate tonal and non-tonal */
+  remove_inaudible (ltg, noise);	/* components for reduction of   */
+					/* spectral lines                */
+  if (tone->n < 2)
+    return;
+
+  /* if more than one tonal component is less than .5 bark, take the
+     maximum. The survivor is then compared with the next one */
+  cur = 0;
+  n = 0;
+  for (i = 1; i < tone->n; i++) {
+    if (tone->bark[i] - tone->bark[cur] < 0.5) {
+      if (tone->x[i] > tone->x[cur])
+	cur = i;
     } else {
-      old = i;
-      i = power[i].next;
+      masker_move (tone, n++, cur);
+      cur = i;
     }
   }
+  masker_move (tone, n++, cur);
+  tone->n = n;
 }
 
 /****************************************************************
@@ -476,59 +464,100 @@ void psycho_1_subsampling (mask power[HAN_SIZE], g_thres * ltg, int *tone, int *
 *
 ****************************************************************/
 
+/* The masking function of a component at ltg entry i is made of four
+   linear pieces, for a distance dz in [-3,-1), [-1,0), [0,1) and [1,8)
+   bark. The bark values of ltg increase with the line, so every piece
+   covers a contiguous range of ltg entries: spread_range[i][p] is the
+   first entry of piece p, and spread_range[i][4] is one past the last.
+   The lines above the last entry of ltg keep map 0, so their components
+   are spread from entry 0, at bark 0, as the original loop did.
+   line_bark is a contiguous copy of the bark values of ltg */
+static int (*spread_range)[5];
+static double *line_bark;
+
+void psycho_1_init_spread (g_thres * ltg)
+{
+  static const double edge[5] = { -3.0, -1.0, 0.0, 1.0, 8.0 };
+  int i, p, k;
+
+  spread_range = (int (*)[5]) mem_alloc (sizeof (int) * 5 * sub_size,
+					 "spread_range");
+  line_bark = (double *) mem_alloc (sizeof (double) * sub_size, "line_bark");
+
+  for (k = 0; k < sub_size; k++)
+    line_bark[k] = ltg[k].bark;
+
+  for (i = 0; i < sub_size; i++)
+    for (p = 0, k = 1; p < 5; p++) {
+      while (k < sub_size && ltg[k].bark - ltg[i].bark < edge[p])
+	k++;
+      spread_range[i][p] = k;
+    }
+}
+
+/* Add the individual masking thresholds of the components in the list to
+   the ltg entries below end. Every piece of the masking function is a
+   branch-free loop over its range of entries, which the compiler can
+   vectorize. The thresholds are then added to ltg in the same order as
+   the component lists, so that the result does not change */
+static void psycho_1_spread (g_thres * ltg, masker_list * list,
+			     double slope, double offset, int end)
+{
+  double level[HAN_SIZE];
+  int m, k;
+
+  for (m = 0; m < list->n; m++) {
+    const int *range = spread_range[list->map[m]];
+    double bark = list->bark[m];
+    double x = list->x[m];
+    double tmps = -1.525 - slope * bark - offset + x;
+    double lower = 0.4 * x + 6;
+    double upper = 17 - 0.15 * x;
+    int r1 = MIN (range[1], end);
+    int r2 = MIN (range[2], end);
+    int r3 = MIN (range[3], end);
+    int r4 = MIN (range[4], end);
+
+    /* masking function for lower & upper slopes */
+    for (k = range[0]; k < r1; k++)
+      level[k] = tmps + (17 * (line_bark[k] - bark + 1) - lower);
+    for (; k < r2; k++)
+      level[k] = tmps + lower * (line_bark[k] - bark);
+    for (; k < r3; k++)
+      level[k] = tmps + (-17 * (line_bark[k] - bark));
+    for (; k < r4; k++)
+      level[k] = tmps + (-(line_bark[k] - bark - 1) * upper - 17);
+
+    for (k = range[0]; k < r4; k++)
+      ltg[k].x = add_db (ltg[k].x, level[k]);
+  }
+}
+
 /* mainly just changed the way range checking was done MFC Nov 1999 */
-void psycho_1_threshold (mask power[HAN_SIZE], g_thres * ltg, int *tone, int *noise,
-		int bit_rate)
+/* The threshold is only needed up to the first line at or above the
+   sblimit, which psycho_1_minimum_mask still looks at */
+void psycho_1_threshold (g_thres * ltg, masker_list * tone, masker_list * noise,
+		int bit_rate, int sblimit)
 {
-  int k, t;
-  double dz, tmps, vf;
+  int k, end;
 
-  for (k = 1; k < sub_size; k++) {
+  for (end = 1; end < sub_size - 1 && ltg[end].line >> 4 < sblimit; end++);
+  end++;
+
+  for (k = 1; k < end; k++)
     ltg[k].x = DBMIN;
-    t = *tone;			/* calculate individual masking threshold for */
-    while ((t != LAST) && (t != STOP))
-    {				/* components in order to find the global     */
-      dz = ltg[k].bark - ltg[power[t].map].bark;	/* distance of bark value */
-      if (dz >= -3.0 && dz < 8.0) {
-	tmps = -1.525 - 0.275 * ltg[power[t].map].bark - 4.5 + power[t].x;
-	/* masking function for lower & upper slopes */
-	if (dz < -1)
-	  vf = 17 * (dz + 1) - (0.4 * power[t].x + 6);
-	else if (dz < 0)
-	  vf = (0.4 * power[t].x + 6) * dz;
-	else if (dz < 1)
-	  vf = (-17 * dz);
-	else
-	  vf = -(dz - 1) * (17 - 0.15 * power[t].x) - 17;
-	ltg[k].x = add_db (ltg[k].x, tmps + vf);
-      }
-      t = power[t].next;
-    }
 
-    t = *noise;			/* calculate individual masking threshold  */
-    while ((t != LAST) && (t != STOP)) {	/* for non-tonal components to find LTG    */
-      dz = ltg[k].bark - ltg[power[t].map].bark;	/* distance of bark value */
-      if (dz >= -3.0 && dz < 8.0) {
-	tmps = -1.525 - 0.175 * ltg[power[t].map].bark - 0.5 + power[t].x;
-	/* masking function for lower & upper slopes */
-	if (dz < -1)
-	  vf = 17 * (dz + 1) - (0.4 * power[t].x + 6);
-	else if (dz < 0)
-	  vf = (0.4 * power[t].x + 6) * dz;
-	else if (dz < 1)
-	  vf = (-17 * dz);
-	else
-	  vf = -(dz - 1) * (17 - 0.15 * power[t].x) - 17;
-	ltg[k].x = add_db (ltg[k].x, tmps + vf);
-      }
-      t = power[t].next;
-    }
+  /* calculate individual masking threshold for tonal and non-tonal
+     components in order to find the global threshold (LTG) */
+  psycho_1_spread (ltg, tone, 0.275, 4.5, end);
+  psycho_1_spread (ltg, noise, 0.175, 0.5, end);
+
+  for (k = 1; k < end; k++) {
     if (bit_rate < 96)
       ltg[k].x = add_db (ltg[k].hear, ltg[k].x);
     else
       ltg[k].x = add_db (ltg[k].hear - 12.0, ltg[k].x);
   }
-
 }
 
 /****************************************************************
@@ -580,22 +609,16 @@ void psycho_1_smr (double ltmin[SBLIMIT], double spike[SBLIMIT], double scale[SB
   }
 }
 
-void psycho_1_dump(mask power[HAN_SIZE], int *tone, int *noise) {
+void psycho_1_dump(masker_list *tone, masker_list *noise) {
   int t;
 
   fprintf(stdout,"1 Ton: ");
-  t=*tone;
-  while (t!=LAST && t!=STOP) {
-    fprintf(stdout,"[%i] %3.0f ",t, power[t].x);
-    t = power[t].next;
-  }
+  for (t = 0; t < tone->n; t++)
+    fprintf(stdout,"[%i] %3.0f ",tone->line[t], tone->x[t]);
   fprintf(stdout,"\n");  
   
   fprintf(stdout,"1 Nos: ");
-  t=*noise;
-  while (t!=LAST && t!=STOP) {
-    fprintf(stdout,"[%i] %3.0f ",t, power[t].x);
-    t = power[t].next;
-  }
+  for (t = 0; t < noise->n; t++)
+    fprintf(stdout,"[%i] %3.0f ",noise->line[t], noise->x[t]);
   fprintf(stdout,"\n");
 }
@@ -1,2 +1,2 @@
 
-void psycho_1 (short[2][1152], double[2][SBLIMIT], double[2][SBLIMIT], frame_info *);
+void psycho_1 (double *[2], double[2][SBLIMIT], double[2][SBLIMIT], frame_info *);
@@ -12,11 +12,13 @@ void psycho_1_make_map (mask[HAN_SIZE], g_thres *);
 void psycho_1_hann_fft_pickmax (double sample[FFT_SIZE], mask power[HAN_SIZE], double spike[SBLIMIT], FLOAT energy[FFT_SIZE]);
 void psycho_1_tonal_label (mask power[HAN_SIZE], int *tone);
 void psycho_1_noise_label (mask *power, int *noise, g_thres *, FLOAT[FFT_SIZE]);
-void psycho_1_subsampling (mask[HAN_SIZE], g_thres *, int *, int *);
-void psycho_1_threshold (mask power[HAN_SIZE], g_thres *, int *, int *, int);
+void psycho_1_collect (mask power[HAN_SIZE], g_thres *, int, masker_list *);
+void psycho_1_subsampling (g_thres *, masker_list *, masker_list *);
+void psycho_1_init_spread (g_thres *);
+void psycho_1_threshold (g_thres *, masker_list *, masker_list *, int, int);
 void psycho_1_minimum_mask (g_thres *, double[SBLIMIT], int);
 void psycho_1_smr (double[SBLIMIT], double[SBLIMIT], double[SBLIMIT], int);
 
 
 
-void psycho_1_dump(mask power[HAN_SIZE], int *tone, int *noise);
+void psycho_1_dump(masker_list *tone, masker_list *noise);
@@ -49,7 +49,7 @@ static F2HBLK *r, *phi_sav;
 
 void psycho_2_init (double sfreq);
 
-void psycho_2 (short int *buffer, short int savebuf[1056], int chn,
+void psycho_2 (double *samples, int chn,
 		double *smr, double sfreq, options *glopts)
 /* to match prototype : FLOAT args are always double */
 {
@@ -74,18 +74,13 @@ void psycho_2 (short int *buffer, short int savebuf[1056], int chn,
            syncsize = 1056;
            sync_flush = syncsize - flush;   480
            BLKSIZE = 1024
+       * The window is taken straight from the sample ring, see pcm_ring.h      *
        *****************************************************************************/
-
-    for (j = 0; j < 480; j++) {
-      savebuf[j] = savebuf[j + flush];
-      wsamp_r[j] = window[j] * ((FLOAT) savebuf[j]);
-    }
-    for (; j < 1024; j++) {
-      savebuf[j] = *buffer++;
-      wsamp_r[j] = window[j] * ((FLOAT) savebuf[j]);
+    {
+      double *win = samples - sync_flush + i * flush;
+      for (j = 0; j < BLKSIZE; j++)
+	wsamp_r[j] = window[j] * ((FLOAT) (win[j] * SCALE));
     }
-    for (; j < 1056; j++)
-      savebuf[j] = *buffer++;
 
       /**Compute FFT****************************************************************/
     psycho_2_fft (wsamp_r, energy, phi);
@@ -436,3 +431,18 @@ void psycho_2_read_absthr (absthr, table)
   }
   return;
 }
+
+/********************************
+ * state of the unpredictability measure, for the psy model cache
+ ********************************/
+void psycho_2_get_state (int chn, FLOAT *state)
+{
+  memcpy (state, r[chn], sizeof (F2HBLK));
+  memcpy (state + 2 * HBLKSIZE, phi_sav[chn], sizeof (F2HBLK));
+}
+
+void psycho_2_set_state (int chn, const FLOAT *state)
+{
+  memcpy (r[chn], state, sizeof (F2HBLK));
+  memcpy (phi_sav[chn], state + 2 * HBLKSIZE, sizeof (F2HBLK));
+}
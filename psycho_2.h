@@ -1,2 +1,8 @@
 void psycho_2_read_absthr (FLOAT *, int);
-void psycho_2 (short int *, short int[1056], int, double *snr32, double sfreq, options *glopts);
+void psycho_2 (double *, int, double *snr32, double sfreq, options *glopts);
+
+/* Psy models 2 and 4 predict every spectrum from the two before. These
+   are the PSYCHO_STATE_SIZE values of a channel they keep for it */
+#define PSYCHO_STATE_SIZE (4 * HBLKSIZE)
+void psycho_2_get_state (int chn, FLOAT *state);
+void psycho_2_set_state (int chn, const FLOAT *state);
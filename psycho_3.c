@@ -36,7 +36,35 @@ FLOAT bark[HBLKSIZE], ath[HBLKSIZE];
 int *numlines;
 FLOAT *cbval;
 int partition[HBLKSIZE];
-static D1408 *fft_buf;
+
+/* Spreading function of the individual masking thresholds in the power
+   domain, 10^(vf/10), by masker level in dB and by bark distance.
+   The level goes by 1 dB, the distance from -3 to 8 bark by
+   1/SPREAD_STEPS bark */
+#define SPREAD_STEPS 32
+#define SPREAD_WIDTH (11 * SPREAD_STEPS + 2)
+#define SPREAD_LMIN -20
+#define SPREAD_LMAX 130
+static FLOAT spread_table[SPREAD_LMAX - SPREAD_LMIN + 1][SPREAD_WIDTH];
+
+/* Bark value of every subsampled line. The maskers at spectral line k
+   reach the subsampled lines sub_lo[k] to sub_hi[k] - 1 */
+static FLOAT sub_bark[SUBSIZE];
+static int sub_lo[HBLKSIZE], sub_hi[HBLKSIZE];
+
+/* ATH of the subsampled lines in the power domain, for bitrates below
+   and above 96 kbps per channel */
+static FLOAT ath_pow[2][SUBSIZE];
+
+/* Row of spread_table for a masker of level X dB */
+static const FLOAT *psycho_3_spread_row(FLOAT X) {
+  int level = (int)floor(X + 0.5);
+  if (level < SPREAD_LMIN)
+    level = SPREAD_LMIN;
+  else if (level > SPREAD_LMAX)
+    level = SPREAD_LMAX;
+  return spread_table[level - SPREAD_LMIN];
+}
 
 frame_header *header;
 
@@ -68,15 +96,13 @@ INLINE double psycho_3_add_db (double a, double b)
   return (b + dbtable[-idiff]);
 }
 
-void psycho_3 (short buffer[2][1152], double scale[2][SBLIMIT],
+void psycho_3 (double *samples[2], double scale[2][SBLIMIT],
 	       double ltmin[2][SBLIMIT], frame_info * frame, options *glopts)
 {
   int nch = frame->nch;
   int sblimit = frame->sblimit;
-  int k, i;
+  int k;
   static char init = 0;
-  static int off[2] = { 256, 256 };
-  FLOAT sample[BLKSIZE];
 
   FLOAT energy[BLKSIZE];
   FLOAT power[HBLKSIZE];
@@ -94,23 +120,9 @@ void psycho_3 (short buffer[2][1152], double scale[2][SBLIMIT],
   
 
   for (k = 0; k < nch; k++) {
-    int ok = off[k] % 1408;
-    for (i = 0; i < 1152; i++) {
-      fft_buf[k][ok++] = (FLOAT) buffer[k][i] / SCALE;
-      if (ok >= 1408)
-	ok = 0;
-    }
-    ok = (off[k] + 1216) % 1408;
-    for (i = 0; i < BLKSIZE; i++) {
-      sample[i] = fft_buf[k][ok++];
-      if (ok >= 1408)
-	ok = 0;
-    }
-
-    off[k] += 1152;
-    off[k] %= 1408;
-
-    psycho_3_fft(sample, energy);
+    /* The FFT window starts 192 samples before the frame, and is taken
+       straight from the sample ring, see pcm_ring.h */
+    psycho_3_fft(samples[k] - 192, energy);
     psycho_3_powerdensityspectrum(energy, power);    
     psycho_3_spl(Lsb, power, &scale[k][0]);
     psycho_3_tonal_label (power, tonelabel, Xtm);
@@ -118,14 +130,14 @@ void psycho_3 (short buffer[2][1152], double scale[2][SBLIMIT],
     if (glopts->verbosity > 20)
       psycho_3_dump(tonelabel, Xtm, noiselabel, Xnm);
     psycho_3_decimation(ath, tonelabel, Xtm, noiselabel, Xnm, bark);
-    psycho_3_threshold(LTg, tonelabel, Xtm, noiselabel, Xnm, bark, ath, bitrate[header->version][header->bitrate_index] / nch, freq_subset);
+    psycho_3_threshold(LTg, tonelabel, Xtm, noiselabel, Xnm, bark, bitrate[header->version][header->bitrate_index] / nch, freq_subset, sblimit);
     psycho_3_minimummasking(LTg, &ltmin[k][0], freq_subset);
     psycho_3_smr(&ltmin[k][0], Lsb);
   }
 }
 
 /* ISO11172 Sec D.1 Step 1 - Window with HANN and then perform the FFT */
-void psycho_3_fft(FLOAT sample[BLKSIZE], FLOAT energy[BLKSIZE])
+void psycho_3_fft(double *sample, FLOAT energy[BLKSIZE])
 {
   FLOAT x_real[BLKSIZE];
   int i;
@@ -143,7 +155,7 @@ void psycho_3_fft(FLOAT sample[BLKSIZE], FLOAT energy[BLKSIZE])
 
   /* convolve the samples with the hann window */
   for (i = 0; i < BLKSIZE; i++)
-    x_real[i] = (FLOAT) (sample[i] * window[i]);
+    x_real[i] = (FLOAT) ((FLOAT) sample[i] * window[i]);
   /* do the FFT */
   psycho_1_fft (x_real, energy, BLKSIZE);
 }
@@ -167,8 +179,9 @@ void psycho_3_spl(double *Lsb, FLOAT *power, double *scale) {
   for (i=0;i<SBLIMIT;i++) {
     Xmax[i] = DBMIN;
   }
-  /* Find the maximum SPL in the power spectrum */
-  for (i=1;i<HBLKSIZE;i++) {
+  /* Find the maximum SPL in the power spectrum. The last line is at
+     the Nyquist frequency, above the subbands */
+  for (i=1;i<HBLKSIZE-1;i++) {
     int index = i>>4;
     if (Xmax[index] < power[i])
       Xmax[index] = power[i];
@@ -273,6 +286,7 @@ void psycho_3_noise_label (FLOAT power[HBLKSIZE], FLOAT energy[BLKSIZE], int *to
     int centre;
     for (j=cbandindex[i]; j<cbandindex[i+1]; j++) {
       Xnm[j] = DBMIN;
+      noiselabel[j] = 0;
       /* go through all the spectral lines within the critical band, 
 	 adding the energies. The tone energies have already been removed */
       if (power[j] != DBMIN) {
@@ -290,9 +304,10 @@ void psycho_3_noise_label (FLOAT power[HBLKSIZE], FLOAT energy[BLKSIZE], int *to
       }
     }
 
-    if (sum<=DBMIN) 
+    if (sum<=DBMIN || esum<=0) 
       /* If the energy sum is really small, just pretend the noise occurs 
-	 in the centre frequency line */
+	 in the centre frequency line. On digital silence the power of every
+	 line is clamped above DBMIN while the energies are all zero */
       centre = (cbandindex[i] + cbandindex[i+1])/2;
     else
       /* Otherwise, work out the mean position of the noise, and put it there. */
@@ -335,74 +350,58 @@ void psycho_3_decimation(FLOAT *ath, int *tonelabel, FLOAT *Xtm, int *noiselabel
    Work out how each of the tones&noises maskes other frequencies 
    NOTE: Only a subset of other frequencies is checked. According to the 
    standard different subbands are subsampled to different amounts.
-   See psycho_3_init and freq_subset */
-void psycho_3_threshold(FLOAT *LTg, int *tonelabel, FLOAT *Xtm, int *noiselabel, FLOAT *Xnm, FLOAT *bark, FLOAT *ath, int bit_rate, int *freq_subset) {
-  int i,j,k;
-  FLOAT LTtm[SUBSIZE];
-  FLOAT LTnm[SUBSIZE];
-
-  for (i=0;i<SUBSIZE;i++) {
-    LTtm[i] = DBMIN;
-    LTnm[i] = DBMIN;
+   See psycho_3_init and freq_subset
+   Only the lines in the subbands below sblimit are computed, the SMR of
+   the others is never used.
+
+   The thresholds are summed in the power domain. Every masker adds
+   10^(av/10) * 10^(vf/10) to the lines it reaches, where the spreading
+   function 10^(vf/10) comes from spread_table (see psycho_3_init_spread).
+   The loop over the lines of one masker has no branches and no
+   dependency between the lines, so the compiler can vectorize it. */
+static void psycho_3_spread(FLOAT *LT, FLOAT X, FLOAT av, int k, int nsub) {
+  const FLOAT *spread = psycho_3_spread_row(X);
+  FLOAT gain = pow(10.0, 0.1 * av);
+  FLOAT dz0 = (3.0 - bark[k]) * SPREAD_STEPS + 0.5;
+  int hi = MIN(sub_hi[k], nsub);
+  int j;
+
+  for (j=sub_lo[k];j<hi;j++) {
+    int dz = (int)(sub_bark[j] * SPREAD_STEPS + dz0);
+    LT[j] += gain * spread[dz];
   }
+}
+
+void psycho_3_threshold(FLOAT *LTg, int *tonelabel, FLOAT *Xtm, int *noiselabel, FLOAT *Xnm, FLOAT *bark, int bit_rate, int *freq_subset, int sblimit) {
+  int i,k;
+  int nsub = 0;
+  FLOAT LT[SUBSIZE];
+  FLOAT *athpow = ath_pow[bit_rate < 96 ? 0 : 1];
+
+  for (i=0;i<SUBSIZE;i++)
+    LT[i] = 0;
+  while (nsub < SUBSIZE && (freq_subset[nsub] >> 4) < sblimit)
+    nsub++;
+
   /* Loop over the entire spectrum and find every noise and tone 
      And then with each noise/tone work out how it masks 
      the spectral lines around it */
   for (k=1;k<HBLKSIZE;k++) {
-    /* Find every tone */
-    if (tonelabel[k]==TONE) {
-      for (j=0;j<SUBSIZE;j++) {
-	/* figure out how it masks the levels around it */  
-	FLOAT dz = bark[freq_subset[j]] - bark[k];     
-	if (dz >= -3.0 && dz < 8.0) {
-	  FLOAT vf;
-	  FLOAT av = -1.525 - 0.275 * bark[k] - 4.5 + Xtm[k];
-	  /* masking function for lower & upper slopes */
-	  if (dz < -1)
-	    vf = 17 * (dz + 1) - (0.4 * Xtm[k] + 6);
-	  else if (dz < 0)
-	    vf = (0.4 * Xtm[k] + 6) * dz;
-	  else if (dz < 1)
-	    vf = (-17 * dz);
-	  else
-	    vf = -(dz - 1) * (17 - 0.15 * Xtm[k]) - 17;
-	  LTtm[j] = psycho_3_add_db (LTtm[j], av + vf);
-	}    
-      }
-    }
+    /* Maskers more than 3 bark above the highest line mask nothing */
+    if (sub_lo[k] >= nsub)
+      break;
 
-    /* find every noise label */
-    if (noiselabel[k]==NOISE) {
-      for (j=0;j<SUBSIZE;j++) {
-	/* figure out how it masks the levels around it */  
-	FLOAT dz = bark[freq_subset[j]] - bark[k];     
-	if (dz >= -3.0 && dz < 8.0) {
-	  FLOAT vf;
-	  FLOAT av = -1.525 - 0.175 * bark[k] - 0.5 + Xnm[k]; 
-	  /* masking function for lower & upper slopes */
-	  if (dz < -1)
-	    vf = 17 * (dz + 1) - (0.4 * Xnm[k] + 6);
-	  else if (dz < 0)
-	    vf = (0.4 * Xnm[k] + 6) * dz;
-	  else if (dz < 1)
-	    vf = (-17 * dz);
-	  else
-	    vf = -(dz - 1) * (17 - 0.15 * Xnm[k]) - 17;
-	  LTnm[j] = psycho_3_add_db (LTnm[j], av + vf);
-	}    
-      }
-    }
+    if (tonelabel[k]==TONE)
+      psycho_3_spread(LT, Xtm[k], -1.525 - 0.275 * bark[k] - 4.5 + Xtm[k], k, nsub);
+
+    if (noiselabel[k]==NOISE)
+      psycho_3_spread(LT, Xnm[k], -1.525 - 0.175 * bark[k] - 0.5 + Xnm[k], k, nsub);
   }
 
   /* ISO11172 D.1 Step 7
      Calculate the global masking threhold */
-  for (i=0;i<SUBSIZE;i++) {
-    LTg[i] = psycho_3_add_db(LTnm[i], LTtm[i]);
-    if (bit_rate < 96)
-      LTg[i] = psycho_3_add_db(ath[freq_subset[i]], LTg[i]);
-    else
-      LTg[i] = psycho_3_add_db(ath[freq_subset[i]]-12.0, LTg[i]);
-  }
+  for (i=0;i<SUBSIZE;i++)
+    LTg[i] = 10 * log10(LT[i] + athpow[i]);
 }
 
   /* Find the minimum LTg for each subband. ISO11172 Sec D.1 Step 8 */
@@ -435,8 +434,6 @@ void psycho_3_init(options *glopts) {
   int i;
   int cbase = 0; /* current base index for the bark range calculation */
 
-  fft_buf = (D1408 *) mem_alloc ((long) sizeof (D1408) * 2, "fft_buf");
-  
   /* Initialise the tables for the adding dB */
   psycho_3_init_add_db();
   
@@ -511,6 +508,8 @@ void psycho_3_init(options *glopts) {
       freq_subset[freq_index++] = i;
   }
 
+  psycho_3_init_spread();
+
   if (glopts->verbosity > 4) {
     fprintf(stdout,"%i critical bands\n",cbands);
     for (i=0;i<cbands;i++)
@@ -521,6 +520,43 @@ void psycho_3_init(options *glopts) {
   }
 }
 
+/* Fill the spreading function table, and the subsampled line tables */
+void psycho_3_init_spread(void) {
+  int i,j,k;
+
+  for (i=0;i<=SPREAD_LMAX-SPREAD_LMIN;i++) {
+    FLOAT X = i + SPREAD_LMIN;
+    for (j=0;j<SPREAD_WIDTH;j++) {
+      FLOAT dz = (FLOAT)j / SPREAD_STEPS - 3.0;
+      FLOAT vf;
+      /* masking function for lower & upper slopes */
+      if (dz < -1)
+	vf = 17 * (dz + 1) - (0.4 * X + 6);
+      else if (dz < 0)
+	vf = (0.4 * X + 6) * dz;
+      else if (dz < 1)
+	vf = (-17 * dz);
+      else
+	vf = -(dz - 1) * (17 - 0.15 * X) - 17;
+      spread_table[i][j] = pow(10.0, 0.1 * vf);
+    }
+  }
+
+  for (j=0;j<SUBSIZE;j++) {
+    sub_bark[j] = bark[freq_subset[j]];
+    ath_pow[0][j] = pow(10.0, 0.1 * ath[freq_subset[j]]);
+    ath_pow[1][j] = pow(10.0, 0.1 * (ath[freq_subset[j]] - 12.0));
+  }
+
+  /* The maskers reach from 3 bark below to 8 bark above */
+  for (k=1;k<HBLKSIZE;k++) {
+    for (j=0;j<SUBSIZE && sub_bark[j] - bark[k] < -3.0;j++);
+    sub_lo[k] = j;
+    for (;j<SUBSIZE && sub_bark[j] - bark[k] < 8.0;j++);
+    sub_hi[k] = j;
+  }
+}
+
 void psycho_3_dump(int *tonelabel, FLOAT *Xtm, int *noiselabel, FLOAT *Xnm) {
   int i;
   fprintf(stdout,"3 Ton:");
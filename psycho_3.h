@@ -1,4 +1,4 @@
-void psycho_3 (short[2][1152], double[2][SBLIMIT],
+void psycho_3 (double *[2], double[2][SBLIMIT],
 		      double[2][SBLIMIT], frame_info *, options *glopts);
 
 void psycho_3_init(options *glopts);
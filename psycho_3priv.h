@@ -1,4 +1,4 @@
-void psycho_3_fft(FLOAT *sample, FLOAT *energy);
+void psycho_3_fft(double *sample, FLOAT *energy);
 void psycho_3_powerdensityspectrum(FLOAT *energy, FLOAT *power);
 
 void psycho_3_tonal_label (FLOAT *power, int *tonelabel, FLOAT *Xtm);
@@ -11,7 +11,8 @@ INLINE double psycho_3_add_db (double a, double b);
 void psycho_3_noise_label (FLOAT *power, FLOAT *energy, int *tonelabel, int *noiselabel, FLOAT *Xnm);
 void psycho_3_decimation(FLOAT *ath, int *tonelabel, FLOAT *Xtm, int *noiselabel, FLOAT *Xnm, FLOAT *bark);
 
-void psycho_3_threshold(FLOAT *LTg, int *tonelabel, FLOAT *Xtm, int *noiselabel, FLOAT *Xnm, FLOAT *bark, FLOAT *ath, int bit_rate, int *freq_subset);
+void psycho_3_init_spread(void);
+void psycho_3_threshold(FLOAT *LTg, int *tonelabel, FLOAT *Xtm, int *noiselabel, FLOAT *Xnm, FLOAT *bark, int bit_rate, int *freq_subset, int sblimit);
 
 void psycho_3_minimummasking(FLOAT *LTg, double *LTmin, int *freq_subset);
 
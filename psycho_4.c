@@ -121,7 +121,7 @@ INLINE FLOAT psycho_4_sin(FLOAT phi) {
 }
 
 
-void psycho_4 (short int *buffer, short int savebuf[1056], int chn,
+void psycho_4 (double *samples, int chn,
 		double *smr, double sfreq, options *glopts)
 /* to match prototype : FLOAT args are always double */
 {
@@ -143,17 +143,13 @@ void psycho_4 (short int *buffer, short int savebuf[1056], int chn,
        flush = 384*3.0/2.0;  = 576
        syncsize = 1056;
        sync_flush = syncsize - flush;   480
-       BLKSIZE = 1024                                              */
-    for (j = 0; j < 480; j++) {
-      savebuf[j] = savebuf[j + 576];
-      wsamp_r[j] = window[j] * ((FLOAT) savebuf[j]);
-    }
-    for (; j < 1024; j++) {
-      savebuf[j] = *buffer++;
-      wsamp_r[j] = window[j] * ((FLOAT) savebuf[j]);
+       BLKSIZE = 1024
+       The window is taken straight from the sample ring, see pcm_ring.h */
+    {
+      double *win = samples - 480 + run * 576;
+      for (j = 0; j < BLKSIZE; j++)
+	wsamp_r[j] = window[j] * ((FLOAT) (win[j] * SCALE));
     }
-    for (; j < 1056; j++)
-      savebuf[j] = *buffer++;
 
 
     /* Compute FFT */
@@ -505,3 +501,16 @@ void psycho_4_allocmem() {
 
 
 
+
+/* The state of the unpredictability measure, for the psy model cache */
+void psycho_4_get_state (int chn, FLOAT *state)
+{
+  memcpy (state, r[chn], sizeof (F2HBLK));
+  memcpy (state + 2 * HBLKSIZE, phi_sav[chn], sizeof (F2HBLK));
+}
+
+void psycho_4_set_state (int chn, const FLOAT *state)
+{
+  memcpy (r[chn], state, sizeof (F2HBLK));
+  memcpy (phi_sav[chn], state + 2 * HBLKSIZE, sizeof (F2HBLK));
+}
@@ -0,0 +1,149 @@
+/* Psy model quick mode, see quickmode.h */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include "common.h"
+#include "audio_read.h"
+#include "quickmode.h"
+
+/* Every step of the scalefactor index is 2dB */
+#define DB_PER_SCF 2.0
+
+static int max_age = 10;
+static double threshold = 0;
+
+/* Level of every subband, as the index of its largest scalefactor, and
+ * peak levels of the frame the psy model last ran on */
+static int ref_valid = 0;
+static unsigned int ref_scf[2][SBLIMIT];
+static int ref_peak[2];
+static int age = 0;
+
+static uint64_t runs = 0;
+static uint64_t skips = 0;
+static uint64_t psy_time_us = 0;
+
+void quickmode_init(int age_limit, double threshold_db)
+{
+    max_age = age_limit;
+    threshold = threshold_db;
+    ref_valid = 0;
+    age = 0;
+}
+
+static unsigned int subband_level(unsigned int scalar[3][SBLIMIT], int sb)
+{
+    unsigned int scf = scalar[0][sb];
+
+    if (scalar[1][sb] < scf)
+        scf = scalar[1][sb];
+    if (scalar[2][sb] < scf)
+        scf = scalar[2][sb];
+    return scf;
+}
+
+/* Difference in dB between the frame and the reference */
+static double signal_change(unsigned int scalar[2][3][SBLIMIT],
+        const struct audio_levels *levels, int nch, int sblimit)
+{
+    int ch, sb;
+    int sum = 0, largest = 0;
+    double change;
+
+    for (ch = 0; ch < nch; ch++) {
+        for (sb = 0; sb < sblimit; sb++) {
+            int d = (int)subband_level(scalar[ch], sb) - (int)ref_scf[ch][sb];
+            if (d < 0)
+                d = -d;
+            sum += d;
+            if (d > largest)
+                largest = d;
+        }
+    }
+
+    change = DB_PER_SCF * sum / (nch * sblimit);
+
+    /* A transient in a few subbands hardly moves the mean, so the
+     * largest change of one subband counts with half its weight */
+    if (DB_PER_SCF * largest / 2 > change)
+        change = DB_PER_SCF * largest / 2;
+
+    for (ch = 0; ch < nch; ch++) {
+        double d = fabs(20 * log10((levels->peak[ch] + 1.0) / (ref_peak[ch] + 1.0)));
+        if (d > change)
+            change = d;
+    }
+
+    return change;
+}
+
+int quickmode_need_psy(unsigned int scalar[2][3][SBLIMIT],
+        const struct audio_levels *levels, int nch, int sblimit)
+{
+    int need;
+
+    age++;
+
+    if (threshold <= 0) {
+        /* blind mode */
+        need = max_age > 0 && age >= max_age;
+    }
+    else {
+        need = !ref_valid ||
+            (max_age > 0 && age >= max_age) ||
+            signal_change(scalar, levels, nch, sblimit) > threshold;
+    }
+
+    if (!need)
+        skips++;
+    return need;
+}
+
+void quickmode_psy_done(unsigned int scalar[2][3][SBLIMIT],
+        const struct audio_levels *levels, int nch, int sblimit,
+        uint64_t duration_us)
+{
+    int ch, sb;
+
+    for (ch = 0; ch < nch; ch++) {
+        for (sb = 0; sb < sblimit; sb++)
+            ref_scf[ch][sb] = subband_level(scalar[ch], sb);
+        ref_peak[ch] = levels->peak[ch];
+    }
+    ref_valid = 1;
+    age = 0;
+
+    runs++;
+    psy_time_us += duration_us;
+}
+
+uint64_t quickmode_runs(void)
+{
+    return runs;
+}
+
+uint64_t quickmode_skips(void)
+{
+    return skips;
+}
+
+uint64_t quickmode_saved_us(void)
+{
+    if (runs == 0)
+        return 0;
+    return skips * psy_time_us / runs;
+}
+
+void quickmode_report(FILE *fd)
+{
+    uint64_t frames = runs + skips;
+
+    if (frames == 0)
+        return;
+
+    fprintf(fd, "Quick mode: psy model ran for %llu of %llu frames, "
+            "%.1f%% skipped, saved about %.1fms of CPU time\n",
+            (unsigned long long)runs, (unsigned long long)frames,
+            100.0 * skips / frames, quickmode_saved_us() / 1000.0);
+}
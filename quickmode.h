@@ -0,0 +1,52 @@
+#ifndef _QUICKMODE_H_
+#define _QUICKMODE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "common.h"
+
+/* Quick mode: run the psy model only on some frames
+ *
+ * The other frames reuse the SMR of the last frame the model ran on.
+ * In the blind mode, the model runs every max_age frames. In the
+ * adaptive mode, it runs as soon as the signal differs from the one it
+ * last ran on by more than a threshold in dB, or when its result is
+ * max_age frames old.
+ *
+ * The difference is made of features the encoder already has:
+ *  - the mean change of the level of the subbands below sblimit, taken
+ *    from the largest scalefactor of every subband;
+ *  - the largest change of level within one subband, which catches
+ *    a transient confined to a few subbands;
+ *  - the change of the peak level of the channels.
+ * The largest of the three is compared to the threshold.
+ */
+
+struct audio_levels;
+
+/* Setup quick mode. A max_age of 0 means no limit: in blind mode the
+ * model then never runs. A threshold of 0 selects the blind mode */
+void quickmode_init(int max_age, double threshold_db);
+
+/* Tell whether the psy model has to run for the current frame */
+int quickmode_need_psy(unsigned int scalar[2][3][SBLIMIT],
+        const struct audio_levels *levels, int nch, int sblimit);
+
+/* Call after the psy model ran on the current frame, with the time it
+ * took. The frame becomes the reference for the next decisions */
+void quickmode_psy_done(unsigned int scalar[2][3][SBLIMIT],
+        const struct audio_levels *levels, int nch, int sblimit,
+        uint64_t duration_us);
+
+/* Number of frames the psy model ran on and was skipped for */
+uint64_t quickmode_runs(void);
+uint64_t quickmode_skips(void);
+
+/* Estimate of the CPU time saved by the skipped frames, in microseconds,
+ * taken from the mean duration of the psy model */
+uint64_t quickmode_saved_us(void);
+
+/* Print the counters */
+void quickmode_report(FILE *fd);
+
+#endif
@@ -0,0 +1,86 @@
+/* Shared-memory PCM input, see shm_input.h */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "common.h"
+#include "options.h"
+#include "audio_read.h"
+#include "shmring.h"
+#include "shm_input.h"
+
+static struct shmring *ring = NULL;
+static int frame_bytes = 0;
+static int in_channels = 2;
+static uint64_t gaps = 0;
+
+int shm_in_prepare(const char *name, int in_nch)
+{
+    ring = shmring_open(name);
+    if (ring == NULL)
+        return -1;
+
+    in_channels = in_nch;
+    frame_bytes = 1152 * in_nch * sizeof(short);
+    if (shmring_record_size(ring) < frame_bytes) {
+        fprintf(stderr, "Shared memory %s holds records of %d bytes, "
+                "a frame is %d bytes\n", name, shmring_record_size(ring),
+                frame_bytes);
+        shmring_close(ring);
+        ring = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+unsigned long shm_in_read(int nch, int swap, double *fbuffer[2],
+        struct audio_levels *levels)
+{
+    const unsigned char *record;
+    uint64_t time_us, missed = 0;
+    int len;
+
+    for (;;) {
+        len = shmring_peek(ring, &record, 1000, &time_us, &missed);
+        if (len == 0)
+            continue;
+        if (len < 0) {
+            fprintf(stderr, "Shared memory input closed\n");
+            return 0;
+        }
+        if (len != frame_bytes) {
+            fprintf(stderr, "Shared memory input: frame of %d bytes, "
+                    "expected %d\n", len, frame_bytes);
+            return 0;
+        }
+
+        condition_audio((const short *)record, in_channels, nch, swap,
+                fbuffer, levels);
+        if (shmring_release(ring) == 0)
+            break;
+
+        /* overwritten while it was converted, take the next one */
+        missed++;
+    }
+
+    if (missed > 0) {
+        gaps += missed;
+        if (glopts.verbosity > 0)
+            fprintf(stderr, "Shared memory input: %llu frames missing\n",
+                    (unsigned long long)missed);
+    }
+
+    return 1152 * in_channels;
+}
+
+void shm_in_buffer_fill(unsigned long *fill, unsigned long *capacity)
+{
+    shmring_fill(ring, fill, capacity);
+    *fill *= 1152;
+    *capacity *= 1152;
+}
+
+unsigned long shm_in_gaps(void)
+{
+    return gaps;
+}
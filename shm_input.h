@@ -0,0 +1,37 @@
+#ifndef _SHM_INPUT_H_
+#define _SHM_INPUT_H_
+
+struct audio_levels;
+
+/* Shared-memory PCM input
+ *
+ * An input given as shm://name reads the audio from the shared memory
+ * ring /name of a capture process on the same host, see shmring.h.
+ * Every record of the ring holds one frame of 1152 interleaved 16-bit
+ * little-endian samples per channel, stereo unless the encoder runs in
+ * mono (-m m) without downmix. The sample rate is the one given with -s.
+ *
+ * The frames are converted straight from the ring into the sample ring
+ * of the encoder. As long as the encoder keeps up, reading a frame
+ * needs no system call. Frames that were overwritten before they could
+ * be read, or that the writer skipped, are counted as gaps.
+ */
+
+/* Attach to the ring, which the writer must have created.
+ * returns 0  on success
+ *         -1 on failure
+ */
+int shm_in_prepare(const char *name, int in_nch);
+
+/* Wait for the next frame and condition it into fbuffer, as get_audio()
+ * does. Returns the number of samples read, 0 once the writer exited */
+unsigned long shm_in_read(int nch, int swap, double *fbuffer[2],
+        struct audio_levels *levels);
+
+/* Frames waiting in the ring, and its size, in samples per channel */
+void shm_in_buffer_fill(unsigned long *fill, unsigned long *capacity);
+
+/* Number of frames missing from the input */
+unsigned long shm_in_gaps(void);
+
+#endif
@@ -0,0 +1,242 @@
+/*
+ * toolame-shmcat - reference reader of the shared-memory output
+ *
+ * Reads the frames that toolame-dab writes to an output given as
+ * shm://name, and writes them to stdout without the zmq_frame_header,
+ * which gives the same bit stream as a file output:
+ *
+ *   toolame-shmcat [-s] [-x] name > out.mp2
+ *
+ * It keeps reading when the encoder is restarted, unless -x is given:
+ * it then exits once the encoder it read frames from exits.
+ *
+ * With -s, a line of statistics is written to stderr every second: the
+ * frames read and missed, the audio levels of the last frame and the
+ * latency from the write to the read.
+ *
+ * With -b count, it instead benchmarks the ring on its own: a child
+ * process writes count frames of 384 bytes, paced at -r frames per
+ * second (default 0, as fast as possible). The throughput of the writer
+ * is printed, then the frames the reader missed and its latency
+ * percentiles. Without pacing the writer does not wait for the reader,
+ * which misses most frames.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "zmqoutput.h"
+#include "shmring.h"
+
+#define BENCH_FRAME_SIZE 384
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-s] [-x] name\n", name);
+    fprintf(stderr, "       %s -b count [-r rate]\n", name);
+    fprintf(stderr, "\t-s        print statistics every second to stderr\n");
+    fprintf(stderr, "\t-x        exit when the encoder exits\n");
+    fprintf(stderr, "\t-b count  benchmark the ring with count frames\n");
+    fprintf(stderr, "\t-r rate   frames per second in the benchmark (dflt 0, no pacing)\n");
+    exit(1);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int cat(const char *name, int show_stats, int exit_on_close)
+{
+    struct shmring *ring = shmring_open(name);
+    unsigned char *buf;
+    uint64_t missed = 0, frames = 0, latency_max = 0;
+    uint64_t last_report;
+    int size, closed = 0;
+
+    if (ring == NULL)
+        return 1;
+
+    size = shmring_record_size(ring);
+    buf = malloc(size);
+    last_report = shmring_now_us();
+
+    for (;;) {
+        struct zmq_frame_header *header = (struct zmq_frame_header *)buf;
+        uint64_t time_us, now;
+        int len = shmring_read(ring, buf, size, 1000, &time_us, &missed);
+
+        if (len < 0) {
+            if (exit_on_close && frames > 0)
+                break;
+            if (!closed)
+                fprintf(stderr, "Waiting for the encoder\n");
+            closed = 1;
+            usleep(100000);
+            continue;
+        }
+        closed = 0;
+
+        now = shmring_now_us();
+        if (len > 0) {
+            fwrite(buf + sizeof(*header), 1, header->datasize, stdout);
+            fflush(stdout);
+            frames++;
+            if (now - time_us > latency_max)
+                latency_max = now - time_us;
+        }
+
+        if (show_stats && now - last_report >= 1000000) {
+            fprintf(stderr, "frames %llu missed %llu level %d/%d "
+                    "latency max %llu us\n",
+                    (unsigned long long)frames, (unsigned long long)missed,
+                    len > 0 ? header->audiolevel_left : 0,
+                    len > 0 ? header->audiolevel_right : 0,
+                    (unsigned long long)latency_max);
+            latency_max = 0;
+            last_report = now;
+        }
+    }
+
+    free(buf);
+    shmring_close(ring);
+    return 0;
+}
+
+static int bench(long count, long rate)
+{
+    char name[64];
+    unsigned char frame[BENCH_FRAME_SIZE];
+    struct shmring *writer, *reader;
+    unsigned char *buf;
+    uint64_t *latencies;
+    uint64_t missed = 0, time_us, written_us[2];
+    long frames = 0, i;
+    pid_t pid;
+    int size, fds[2];
+
+    snprintf(name, sizeof(name), "toolame-shmcat-%d", (int)getpid());
+    writer = shmring_create(name,
+            sizeof(struct zmq_frame_header) + BENCH_FRAME_SIZE);
+    if (writer == NULL)
+        return 1;
+    reader = shmring_open(name);
+    if (reader == NULL)
+        return 1;
+
+    size = shmring_record_size(reader);
+    buf = malloc(size);
+    latencies = malloc(count * sizeof(*latencies));
+    memset(frame, 0x55, sizeof(frame));
+
+    /* the writer sends the time it took back */
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return 1;
+    }
+
+    pid = fork();
+    if (pid == 0) {
+        uint64_t t0 = shmring_now_us();
+
+        for (i = 0; i < count; i++) {
+            if (rate > 0) {
+                uint64_t due = t0 + (uint64_t)i * 1000000 / rate;
+                uint64_t now = shmring_now_us();
+                if (due > now)
+                    usleep(due - now);
+            }
+            unsigned char *record = shmring_begin(writer);
+            struct zmq_frame_header *header =
+                (struct zmq_frame_header *)record;
+
+            header->version = 1;
+            header->encoder = ZMQ_ENCODER_TOOLAME;
+            header->datasize = sizeof(frame);
+            header->audiolevel_left = 0;
+            header->audiolevel_right = 0;
+            memcpy(record + sizeof(*header), frame, sizeof(frame));
+            shmring_commit(writer, sizeof(*header) + sizeof(frame));
+        }
+        written_us[0] = t0;
+        written_us[1] = shmring_now_us();
+        if (write(fds[1], written_us, sizeof(written_us)) !=
+                sizeof(written_us))
+            _exit(1);
+        shmring_close(writer);
+        _exit(0);
+    }
+    close(fds[1]);
+
+    while (shmring_read(reader, buf, size, 5000, &time_us, &missed) > 0)
+        latencies[frames++] = shmring_now_us() - time_us;
+    if (read(fds[0], written_us, sizeof(written_us)) != sizeof(written_us))
+        written_us[0] = written_us[1] = 0;
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+
+    shmring_close(reader);
+    shmring_close(writer);
+    shmring_remove(name);
+
+    if (frames == 0) {
+        fprintf(stderr, "No frame was read\n");
+        return 1;
+    }
+
+    qsort(latencies, frames, sizeof(*latencies), compare_u64);
+    if (written_us[1] > written_us[0])
+        printf("written %ld frames in %.1f ms, %.0f frames/s, %.1f MB/s\n",
+                count, (written_us[1] - written_us[0]) / 1e3,
+                count * 1e6 / (written_us[1] - written_us[0]),
+                count * (double)size / (written_us[1] - written_us[0]));
+    printf("read %ld frames, missed %ld (%.2f%%)\n", frames, count - frames,
+            100.0 * (count - frames) / count);
+    printf("latency us p50 %llu p99 %llu p99.9 %llu max %llu\n",
+            (unsigned long long)latencies[frames / 2],
+            (unsigned long long)latencies[frames * 99 / 100],
+            (unsigned long long)latencies[frames * 999 / 1000],
+            (unsigned long long)latencies[frames - 1]);
+
+    free(latencies);
+    free(buf);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    long count = 0, rate = 0;
+    int show_stats = 0, exit_on_close = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "sxb:r:h")) != -1) {
+        switch (opt) {
+            case 's':
+                show_stats = 1;
+                break;
+            case 'x':
+                exit_on_close = 1;
+                break;
+            case 'b':
+                count = atol(optarg);
+                break;
+            case 'r':
+                rate = atol(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (count > 0)
+        return bench(count, rate);
+
+    if (optind != argc - 1)
+        usage(argv[0]);
+
+    return cat(argv[optind], show_stats, exit_on_close);
+}
@@ -0,0 +1,351 @@
+/* Shared-memory frame ring, see shmring.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shmring.h"
+
+struct shmring {
+    struct shmring_header *hdr;
+    size_t size;
+    int writer;
+    uint64_t next;      // reader: the next record to read
+    uint64_t seq;       // reader: sequence number of the peeked record
+};
+
+uint64_t shmring_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int futex(uint32_t *addr, int op, uint32_t val,
+        const struct timespec *timeout)
+{
+    return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+static struct shmring_slot *slot_at(struct shmring *ring, uint64_t n)
+{
+    struct shmring_header *hdr = ring->hdr;
+
+    return (struct shmring_slot *)((unsigned char *)(hdr + 1) +
+            (size_t)(n % hdr->num_slots) * hdr->slot_size);
+}
+
+static void shm_path(char *path, size_t size, const char *name)
+{
+    snprintf(path, size, "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+static void wake_readers(struct shmring_header *hdr)
+{
+    __atomic_add_fetch(&hdr->futex, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&hdr->waiters, __ATOMIC_SEQ_CST) > 0)
+        futex(&hdr->futex, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+/* Map the object open on fd, which must be size bytes */
+static struct shmring *map_ring(int fd, size_t size, int writer)
+{
+    struct shmring *ring = calloc(1, sizeof(*ring));
+    void *addr;
+
+    if (ring == NULL)
+        return NULL;
+
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->hdr = addr;
+    ring->size = size;
+    ring->writer = writer;
+    return ring;
+}
+
+struct shmring *shmring_create(const char *name, int record_size)
+{
+    struct shmring *ring;
+    struct shmring_header *hdr;
+    struct stat st;
+    char path[NAME_MAX];
+    uint32_t slot_size;
+    size_t size;
+    int fd;
+
+    slot_size = sizeof(struct shmring_slot) + record_size;
+    slot_size = (slot_size + 7) & ~7;
+    size = sizeof(struct shmring_header) + (size_t)SHMRING_SLOTS * slot_size;
+
+    shm_path(path, sizeof(path), name);
+    fd = shm_open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        fprintf(stderr, "Could not open shared memory %s: %s\n", path,
+                strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return NULL;
+    }
+
+    if (st.st_size != 0 && (size_t)st.st_size != size) {
+        /* Left by a writer of other records. Tell its readers, and
+         * start over with a new object */
+        if ((size_t)st.st_size >= sizeof(struct shmring_header) &&
+                (ring = map_ring(fd, sizeof(struct shmring_header), 1))) {
+            __atomic_store_n(&ring->hdr->closed, 1, __ATOMIC_SEQ_CST);
+            wake_readers(ring->hdr);
+            munmap(ring->hdr, ring->size);
+            free(ring);
+        }
+        close(fd);
+        shm_unlink(path);
+        fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd == -1) {
+            fprintf(stderr, "Could not create shared memory %s: %s\n", path,
+                    strerror(errno));
+            return NULL;
+        }
+        st.st_size = 0;
+    }
+
+    if (st.st_size == 0 && ftruncate(fd, size) == -1) {
+        fprintf(stderr, "Could not size shared memory %s: %s\n", path,
+                strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    ring = map_ring(fd, size, 1);
+    close(fd);
+    if (ring == NULL) {
+        fprintf(stderr, "Could not map shared memory %s: %s\n", path,
+                strerror(errno));
+        return NULL;
+    }
+
+    hdr = ring->hdr;
+    if (hdr->magic != SHMRING_MAGIC || hdr->version != SHMRING_VERSION ||
+            hdr->num_slots != SHMRING_SLOTS || hdr->slot_size != slot_size) {
+        memset(hdr, 0, size);
+        hdr->version = SHMRING_VERSION;
+        hdr->num_slots = SHMRING_SLOTS;
+        hdr->slot_size = slot_size;
+        __atomic_store_n(&hdr->magic, SHMRING_MAGIC, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&hdr->closed, 0, __ATOMIC_SEQ_CST);
+
+    return ring;
+}
+
+unsigned char *shmring_begin(struct shmring *ring)
+{
+    struct shmring_slot *slot = slot_at(ring, ring->hdr->written);
+
+    /* a reader of the old record sees the sequence number change */
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    return slot->record;
+}
+
+void shmring_commit(struct shmring *ring, int len)
+{
+    struct shmring_header *hdr = ring->hdr;
+    uint64_t n = hdr->written;
+    struct shmring_slot *slot = slot_at(ring, n);
+
+    slot->len = len;
+    slot->time_us = shmring_now_us();
+
+    __atomic_store_n(&slot->seq, n + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&hdr->written, n + 1, __ATOMIC_SEQ_CST);
+    wake_readers(hdr);
+}
+
+void shmring_skip(struct shmring *ring, int count)
+{
+    struct shmring_header *hdr = ring->hdr;
+
+    __atomic_store_n(&hdr->written, hdr->written + count, __ATOMIC_SEQ_CST);
+    wake_readers(hdr);
+}
+
+struct shmring *shmring_open(const char *name)
+{
+    struct shmring *ring;
+    struct shmring_header *hdr;
+    struct stat st;
+    char path[NAME_MAX];
+    int fd;
+
+    shm_path(path, sizeof(path), name);
+    fd = shm_open(path, O_RDWR, 0);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        fprintf(stderr, "Could not open shared memory %s: %s\n", path,
+                strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return NULL;
+    }
+
+    if ((size_t)st.st_size < sizeof(struct shmring_header) ||
+            (ring = map_ring(fd, st.st_size, 0)) == NULL) {
+        fprintf(stderr, "Shared memory %s is not ready\n", path);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    hdr = ring->hdr;
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != SHMRING_MAGIC ||
+            hdr->version != SHMRING_VERSION ||
+            sizeof(struct shmring_header) +
+            (size_t)hdr->num_slots * hdr->slot_size > ring->size) {
+        fprintf(stderr, "Shared memory %s is not a toolame ring\n", path);
+        munmap(ring->hdr, ring->size);
+        free(ring);
+        return NULL;
+    }
+
+    ring->next = __atomic_load_n(&hdr->written, __ATOMIC_ACQUIRE);
+    return ring;
+}
+
+int shmring_record_size(const struct shmring *ring)
+{
+    return ring->hdr->slot_size - sizeof(struct shmring_slot);
+}
+
+void shmring_fill(const struct shmring *ring, unsigned long *waiting,
+        unsigned long *capacity)
+{
+    uint64_t written = __atomic_load_n(&ring->hdr->written, __ATOMIC_ACQUIRE);
+
+    *waiting = written > ring->next ? written - ring->next : 0;
+    *capacity = ring->hdr->num_slots;
+}
+
+int shmring_peek(struct shmring *ring, const unsigned char **record,
+        int timeout_ms, uint64_t *time_us, uint64_t *missed)
+{
+    struct shmring_header *hdr = ring->hdr;
+    int max = shmring_record_size(ring);
+    uint64_t deadline = 0;
+
+    for (;;) {
+        uint64_t written = __atomic_load_n(&hdr->written, __ATOMIC_ACQUIRE);
+
+        if (written < ring->next) {
+            /* the writer started over */
+            ring->next = written;
+        }
+
+        if (written - ring->next >= hdr->num_slots) {
+            /* leave one slot, the writer may be at it already */
+            *missed += written - ring->next - (hdr->num_slots - 1);
+            ring->next = written - (hdr->num_slots - 1);
+        }
+
+        if (ring->next < written) {
+            struct shmring_slot *slot = slot_at(ring, ring->next);
+            uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+            int len = slot->len;
+
+            if (seq == ring->next + 1 && len >= 0 && len <= max) {
+                ring->seq = seq;
+                *record = slot->record;
+                *time_us = slot->time_us;
+                return len;
+            }
+
+            /* overwritten before it could be read, or skipped by the
+             * writer */
+            ring->next++;
+            (*missed)++;
+            continue;
+        }
+
+        if (__atomic_load_n(&hdr->closed, __ATOMIC_SEQ_CST))
+            return -1;
+
+        /* only look at the clock when there is nothing to read */
+        uint64_t now = shmring_now_us();
+        if (deadline == 0)
+            deadline = now + (uint64_t)timeout_ms * 1000;
+        if (now >= deadline)
+            return 0;
+
+        struct timespec timeout;
+        timeout.tv_sec = (deadline - now) / 1000000;
+        timeout.tv_nsec = (deadline - now) % 1000000 * 1000;
+
+        uint32_t val = __atomic_load_n(&hdr->futex, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&hdr->waiters, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&hdr->written, __ATOMIC_SEQ_CST) == ring->next &&
+                !__atomic_load_n(&hdr->closed, __ATOMIC_SEQ_CST))
+            futex(&hdr->futex, FUTEX_WAIT, val, &timeout);
+        __atomic_sub_fetch(&hdr->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+int shmring_release(struct shmring *ring)
+{
+    struct shmring_slot *slot = slot_at(ring, ring->next);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    ring->next++;
+    return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == ring->seq ? 0 : -1;
+}
+
+int shmring_read(struct shmring *ring, unsigned char *buf, int size,
+        int timeout_ms, uint64_t *time_us, uint64_t *missed)
+{
+    const unsigned char *record;
+    int len;
+
+    for (;;) {
+        len = shmring_peek(ring, &record, timeout_ms, time_us, missed);
+        if (len <= 0)
+            return len;
+        if (len > size)
+            return -1;
+
+        memcpy(buf, record, len);
+        if (shmring_release(ring) == 0)
+            return len;
+
+        /* overwritten while it was copied */
+        (*missed)++;
+    }
+}
+
+void shmring_remove(const char *name)
+{
+    char path[NAME_MAX];
+
+    shm_path(path, sizeof(path), name);
+    shm_unlink(path);
+}
+
+void shmring_close(struct shmring *ring)
+{
+    if (ring->writer) {
+        __atomic_store_n(&ring->hdr->closed, 1, __ATOMIC_SEQ_CST);
+        wake_readers(ring->hdr);
+    }
+    munmap(ring->hdr, ring->size);
+    free(ring);
+}
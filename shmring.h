@@ -0,0 +1,106 @@
+#ifndef _SHMRING_H_
+#define _SHMRING_H_
+
+#include <stdint.h>
+
+/* Ring of records in POSIX shared memory, between processes on one host
+ *
+ * The ring lives in the shared memory object /name (/dev/shm/name on
+ * Linux), and holds SHMRING_SLOTS slots of one record each. It carries
+ *  - the output given as shm://name: every record is one frame of 24 ms
+ *    in the same format as a ZMQ message, a struct zmq_frame_header
+ *    followed by the frame, for a multiplexer on the same host;
+ *  - the input given as shm://name: every record is one frame of 1152
+ *    interleaved 16-bit little-endian samples per channel, from a
+ *    capture process, see shm_input.h.
+ *
+ * There is one writer, which never waits for the readers. Every slot
+ * carries the sequence number of its record, and is cleared while it is
+ * written, so that a reader detects the records it missed, the ones the
+ * writer skipped and the ones overwritten while it read them. Readers
+ * sleep on a futex in the shared header, which the writer wakes only
+ * while somebody waits; a reader that keeps up never makes a system call.
+ *
+ * The object is not removed when the writer exits, so that a reader can
+ * stay attached across a restart: a writer that finds an object of the
+ * same geometry continues its sequence numbers.
+ */
+
+#define SHMRING_MAGIC   0x53444d54  // "TMDS"
+#define SHMRING_VERSION 1
+#define SHMRING_SLOTS   64
+
+struct shmring_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_slots;
+    uint32_t slot_size;     // bytes per slot, struct shmring_slot included
+    uint64_t written;       // frames written, the next goes to written % num_slots
+    uint32_t futex;         // incremented with every frame
+    uint32_t waiters;       // readers sleeping on futex
+    uint32_t closed;        // set when the writer exits
+    uint32_t reserved;
+};
+
+struct shmring_slot {
+    uint64_t seq;           // written + 1 of the frame, 0 while being written
+    uint64_t time_us;       // CLOCK_MONOTONIC when it was written
+    uint32_t len;           // length of the record
+    uint32_t reserved;
+    unsigned char record[]; // struct zmq_frame_header and the frame
+};
+
+struct shmring;
+
+/* Create or reuse the shared memory object for records of up to
+ * record_size bytes. Returns NULL on failure */
+struct shmring *shmring_create(const char *name, int record_size);
+
+/* Get the slot of the next record, of shmring_record_size() bytes. Fill
+ * it in place, then publish it with shmring_commit(), which wakes the
+ * readers */
+unsigned char *shmring_begin(struct shmring *ring);
+void shmring_commit(struct shmring *ring, int len);
+
+/* Leave out count records, for example audio the writer lost: the
+ * readers count them as missed */
+void shmring_skip(struct shmring *ring, int count);
+
+/* Attach to the object of a writer. The first record read is the next
+ * one written. Returns NULL on failure */
+struct shmring *shmring_open(const char *name);
+
+/* Get the next record in place, waiting up to timeout_ms for it.
+ * returns the length of the record
+ *         0  on timeout
+ *         -1 if the writer exited
+ * The records that were overwritten or skipped before they could be
+ * read are added to *missed. time_us receives the time the record was
+ * written. The record can be overwritten while it is used:
+ * shmring_release() then returns -1, and its content must be discarded */
+int shmring_peek(struct shmring *ring, const unsigned char **record,
+        int timeout_ms, uint64_t *time_us, uint64_t *missed);
+int shmring_release(struct shmring *ring);
+
+/* Copy the next record to buf, as shmring_peek() does.
+ * Also returns -1 if the record does not fit in size */
+int shmring_read(struct shmring *ring, unsigned char *buf, int size,
+        int timeout_ms, uint64_t *time_us, uint64_t *missed);
+
+/* Records a reader has not read yet, and the number of slots */
+void shmring_fill(const struct shmring *ring, unsigned long *waiting,
+        unsigned long *capacity);
+
+/* Largest record of the ring */
+int shmring_record_size(const struct shmring *ring);
+
+/* Mark the ring closed when writing, and unmap it */
+void shmring_close(struct shmring *ring);
+
+/* Remove the shared memory object. The rings that map it stay valid */
+void shmring_remove(const char *name);
+
+/* The monotonic clock of time_us */
+uint64_t shmring_now_us(void);
+
+#endif
@@ -0,0 +1,69 @@
+/* Silence fast path, see silence.h */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "common.h"
+#include "audio_read.h"
+#include "silence.h"
+
+static int threshold = -1;
+
+/* Values of the previous frame, if it was constant. The history of
+ * the filterbank starts with zeros */
+static int prev_constant = 1;
+static int prev_value[2] = { 0, 0 };
+
+static uint64_t frames = 0;
+static uint64_t total = 0;
+
+void silence_init(int threshold_lsb)
+{
+    threshold = threshold_lsb;
+    prev_constant = 1;
+    prev_value[0] = prev_value[1] = 0;
+}
+
+int silence_frame(const struct audio_levels *levels, int nch)
+{
+    int ch, settled, quiet;
+
+    total++;
+    if (threshold < 0)
+        return 0;
+
+    settled = levels->constant && prev_constant;
+    quiet = levels->constant;
+    for (ch = 0; ch < nch; ch++) {
+        int v = levels->value[ch];
+
+        if (v != prev_value[ch])
+            settled = 0;
+        if (v > threshold || v < -threshold)
+            quiet = 0;
+    }
+
+    prev_constant = levels->constant;
+    prev_value[0] = levels->value[0];
+    prev_value[1] = levels->value[1];
+
+    if (!(settled && quiet))
+        return 0;
+
+    frames++;
+    return 1;
+}
+
+uint64_t silence_frames(void)
+{
+    return frames;
+}
+
+void silence_report(FILE *fd)
+{
+    if (total == 0)
+        return;
+
+    fprintf(fd, "Silence: %llu of %llu frames took the fast path (%.1f%%)\n",
+            (unsigned long long)frames, (unsigned long long)total,
+            100.0 * frames / total);
+}
@@ -0,0 +1,37 @@
+#ifndef _SILENCE_H_
+#define _SILENCE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+struct audio_levels;
+
+/* Silence fast path
+ *
+ * A frame in which every sample of a channel has the same value, at most
+ * threshold away from zero, is digital silence or an inaudible DC offset.
+ * Such a frame is sent with no bits allocated to any subband: the header,
+ * the CRC and the empty bit allocation, followed by padding, the X-PAD,
+ * the DAB CRCs and the F-PAD. The filterbank, the scalefactors, the psy
+ * model, the bit allocation and the quantization do not run for it.
+ *
+ * The fast path is only taken once the previous frame had the same
+ * constant values: the 512 samples of history of the filterbank then
+ * hold nothing but that value, and skipping the filterbank leaves its
+ * state as it would have been. The first frame after the signal
+ * changes is encoded in full, as is a frame that starts the silence.
+ */
+
+/* Setup the fast path. A threshold below 0 disables it */
+void silence_init(int threshold);
+
+/* Tell whether the current frame takes the fast path */
+int silence_frame(const struct audio_levels *levels, int nch);
+
+/* Number of frames that took the fast path */
+uint64_t silence_frames(void);
+
+/* Print the counter */
+void silence_report(FILE *fd);
+
+#endif
@@ -0,0 +1,428 @@
+/* Destinations of the bit stream, see sink.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "zmqoutput.h"
+#include "shmring.h"
+#include "archive.h"
+#include "sink.h"
+
+enum sink_type {
+    SINK_FILE,
+    SINK_FIFO,
+    SINK_ZMQ,
+    SINK_SHM,
+    SINK_ARCHIVE,
+    SINK_PULL
+};
+
+struct sink {
+    enum sink_type type;
+    char *dest;
+    int frame_size;
+
+    FILE *file;     // SINK_FILE
+    int fd;         // SINK_FIFO, -1 while no reader has opened it
+    int std_out;    // SINK_FIFO, the pipe is stdout and cannot be reopened
+    int fd_flags;   // SINK_FIFO on stdout, its flags to restore
+    struct zmq_output *zmq; // SINK_ZMQ
+    struct shmring *shm;    // SINK_SHM
+    struct archive *archive; // SINK_ARCHIVE
+
+    /* SINK_PULL, all frames that were not pulled yet */
+    struct sink_frame **pulled;
+    int pulled_head;
+    int pulled_count;
+    int pulled_size;
+
+    /* Frames waiting to be written. The first one may have been
+     * written partly, up to offset */
+    struct sink_frame *queue[SINK_QUEUE];
+    int head;
+    int count;
+    int offset;
+
+    unsigned long drops;
+};
+
+static unsigned long total_drops = 0;
+static int live = 0;
+
+void sink_set_live(int live_input)
+{
+    live = live_input;
+}
+
+struct sink_frame *sink_frame_new(int size)
+{
+    struct sink_frame *frame = malloc(sizeof(*frame) + size);
+
+    if (frame == NULL) {
+        fprintf(stderr, "Unable to allocate an output frame\n");
+        exit(1);
+    }
+    frame->refs = 1;
+    frame->len = 0;
+    return frame;
+}
+
+/* The ZMQ sender threads release frames too */
+void sink_frame_ref(struct sink_frame *frame)
+{
+    __atomic_add_fetch(&frame->refs, 1, __ATOMIC_RELAXED);
+}
+
+void sink_frame_unref(struct sink_frame *frame)
+{
+    if (__atomic_sub_fetch(&frame->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(frame);
+}
+
+struct sink *sink_open(const char *dest, int frame_size)
+{
+    struct sink *sink = calloc(1, sizeof(*sink));
+    struct stat st;
+
+    if (sink == NULL) {
+        fprintf(stderr, "Unable to allocate an output\n");
+        return NULL;
+    }
+    sink->dest = strdup(dest);
+    sink->frame_size = frame_size;
+    sink->fd = -1;
+
+    if (dest[0] == '-' && live &&
+            fstat(STDOUT_FILENO, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        /* written like a named pipe, but there is nothing to reopen */
+        sink->type = SINK_FIFO;
+        sink->fd = STDOUT_FILENO;
+        sink->std_out = 1;
+        sink->fd_flags = fcntl(STDOUT_FILENO, F_GETFL);
+        fcntl(STDOUT_FILENO, F_SETFL, sink->fd_flags | O_NONBLOCK);
+        signal(SIGPIPE, SIG_IGN);
+    }
+    else if (dest[0] == '-') {
+        sink->type = SINK_FILE;
+        sink->file = stdout;
+    }
+    else if (strncmp(dest, "tcp://", 6) == 0) {
+        sink->type = SINK_ZMQ;
+        sink->zmq = zmqoutput_open(dest);
+        if (sink->zmq == NULL) {
+            fprintf(stderr, "Could not initialise ZMQ\n");
+            goto fail;
+        }
+    }
+    else if (strncmp(dest, "shm://", 6) == 0) {
+        sink->type = SINK_SHM;
+        sink->shm = shmring_create(dest + 6,
+                sizeof(struct zmq_frame_header) + frame_size);
+        if (sink->shm == NULL)
+            goto fail;
+    }
+    else if (strncmp(dest, "archive://", 10) == 0) {
+        sink->type = SINK_ARCHIVE;
+        sink->archive = archive_open(dest + 10);
+        if (sink->archive == NULL)
+            goto fail;
+    }
+    else if (stat(dest, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        sink->type = SINK_FIFO;
+        /* a reader that goes away must not kill the encoder */
+        signal(SIGPIPE, SIG_IGN);
+    }
+    else {
+        sink->type = SINK_FILE;
+        if ((sink->file = fopen(dest, "wb")) == NULL) {
+            fprintf(stderr, "Could not create \"%s\".\n", dest);
+            goto fail;
+        }
+    }
+
+    return sink;
+
+fail:
+    free(sink->dest);
+    free(sink);
+    return NULL;
+}
+
+struct sink *sink_open_pull(int frame_size)
+{
+    struct sink *sink = calloc(1, sizeof(*sink));
+
+    if (sink == NULL) {
+        fprintf(stderr, "Unable to allocate an output\n");
+        return NULL;
+    }
+    sink->type = SINK_PULL;
+    sink->dest = strdup("libtoolame");
+    sink->frame_size = frame_size;
+    sink->fd = -1;
+    return sink;
+}
+
+static void drop_first(struct sink *sink)
+{
+    sink_frame_unref(sink->queue[sink->head]);
+    sink->head = (sink->head + 1) % SINK_QUEUE;
+    sink->count--;
+    sink->offset = 0;
+}
+
+/* Make room in a full queue. A frame that was written partly is
+ * finished first, the reader would lose its sync otherwise */
+static void drop_oldest(struct sink *sink)
+{
+    int next;
+
+    if (sink->offset == 0) {
+        drop_first(sink);
+        return;
+    }
+
+    next = (sink->head + 1) % SINK_QUEUE;
+    sink_frame_unref(sink->queue[next]);
+    sink->queue[next] = sink->queue[sink->head];
+    sink->head = next;
+    sink->count--;
+}
+
+/* Write the first frame of the queue, or what the destination accepts.
+ * Returns 0 once the frame has been written, -1 if it has to wait */
+static int write_first(struct sink *sink)
+{
+    struct sink_frame *frame = sink->queue[sink->head];
+    ssize_t ret;
+
+    switch (sink->type) {
+        case SINK_FILE:
+            if (sink->file == NULL)
+                return 0;
+            if (fwrite(frame->data, 1, frame->len, sink->file) !=
+                    (size_t)frame->len) {
+                fprintf(stderr, "Could not write to \"%s\": %s\n",
+                        sink->dest, strerror(errno));
+                if (sink->file != stdout)
+                    fclose(sink->file);
+                sink->file = NULL;
+                return 0;
+            }
+            fflush(sink->file);
+            return 0;
+
+        case SINK_FIFO:
+            if (sink->fd == -1) {
+                /* fails with ENXIO as long as nobody reads the pipe */
+                if (!sink->std_out)
+                    sink->fd = open(sink->dest, O_WRONLY | O_NONBLOCK);
+                if (sink->fd == -1) {
+                    sink->drops++;
+                    total_drops++;
+                    return 0;
+                }
+            }
+
+            ret = write(sink->fd, frame->data + sink->offset,
+                    frame->len - sink->offset);
+            if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+                return -1;
+            if (ret < 0) {
+                /* the reader went away, start over with the next one.
+                   The rest of this frame is lost */
+                if (!sink->std_out)
+                    close(sink->fd);
+                sink->fd = -1;
+                sink->drops++;
+                total_drops++;
+                return 0;
+            }
+            sink->offset += ret;
+            return sink->offset < frame->len ? -1 : 0;
+
+        case SINK_ZMQ:
+            /* The sender thread has its own queue, and counts what it
+               cannot send. Only whole frames are sent */
+            if (frame->len == sink->frame_size)
+                zmqoutput_queue(sink->zmq, frame);
+            return 0;
+
+        case SINK_SHM:
+            /* The ring never blocks, slow readers miss frames. The
+               record is the same as a ZMQ message */
+            if (frame->len == sink->frame_size) {
+                unsigned char *record = shmring_begin(sink->shm);
+                struct zmq_frame_header *header =
+                    (struct zmq_frame_header *)record;
+                int peak_left, peak_right;
+
+                zmqoutput_get_peaks(&peak_left, &peak_right);
+                header->version          = 1;
+                header->encoder          = ZMQ_ENCODER_TOOLAME;
+                header->datasize         = frame->len;
+                header->audiolevel_left  = peak_left;
+                header->audiolevel_right = peak_right;
+                memcpy(record + sizeof(*header), frame->data, frame->len);
+                shmring_commit(sink->shm, sizeof(*header) + frame->len);
+            }
+            return 0;
+
+        case SINK_ARCHIVE:
+            /* The writer thread has its own buffers, and the frames
+               that do not fit any more are dropped */
+            if (archive_write(sink->archive, frame->data, frame->len) != 0) {
+                sink->drops++;
+                total_drops++;
+            }
+            return 0;
+
+        case SINK_PULL:
+            /* never queued, see sink_write() */
+            return 0;
+    }
+
+    return 0;
+}
+
+static void flush_queue(struct sink *sink)
+{
+    while (sink->count > 0 && write_first(sink) == 0)
+        drop_first(sink);
+}
+
+/* The frames are kept until they are pulled, however many there are */
+static void pull_queue(struct sink *sink, struct sink_frame *frame)
+{
+    if (sink->pulled_head + sink->pulled_count == sink->pulled_size) {
+        if (sink->pulled_head > 0) {
+            memmove(sink->pulled, sink->pulled + sink->pulled_head,
+                    sink->pulled_count * sizeof(*sink->pulled));
+            sink->pulled_head = 0;
+        }
+        else {
+            int size = sink->pulled_size ? 2 * sink->pulled_size : SINK_QUEUE;
+            struct sink_frame **pulled =
+                realloc(sink->pulled, size * sizeof(*pulled));
+
+            if (pulled == NULL) {
+                fprintf(stderr, "Unable to allocate an output frame\n");
+                exit(1);
+            }
+            sink->pulled = pulled;
+            sink->pulled_size = size;
+        }
+    }
+
+    sink_frame_ref(frame);
+    sink->pulled[sink->pulled_head + sink->pulled_count] = frame;
+    sink->pulled_count++;
+}
+
+void sink_write(struct sink *sink, struct sink_frame *frame)
+{
+    if (sink->type == SINK_PULL) {
+        pull_queue(sink, frame);
+        return;
+    }
+
+    if (sink->count == SINK_QUEUE) {
+        drop_oldest(sink);
+        sink->drops++;
+        total_drops++;
+    }
+
+    sink_frame_ref(frame);
+    sink->queue[(sink->head + sink->count) % SINK_QUEUE] = frame;
+    sink->count++;
+
+    flush_queue(sink);
+}
+
+int sink_pull(struct sink *sink, unsigned char *buf, int size)
+{
+    struct sink_frame *frame;
+    int len;
+
+    if (sink->pulled_count == 0)
+        return 0;
+
+    frame = sink->pulled[sink->pulled_head];
+    if (frame->len > size)
+        return -1;
+
+    len = frame->len;
+    memcpy(buf, frame->data, len);
+    sink_frame_unref(frame);
+    sink->pulled_head++;
+    sink->pulled_count--;
+    return len;
+}
+
+void sink_close(struct sink *sink)
+{
+    flush_queue(sink);
+
+    if (sink->pulled_count > 0) {
+        sink->drops += sink->pulled_count;
+        total_drops += sink->pulled_count;
+        while (sink->pulled_count > 0) {
+            sink_frame_unref(sink->pulled[sink->pulled_head++]);
+            sink->pulled_count--;
+        }
+    }
+
+    if (sink->count > 0) {
+        sink->drops += sink->count;
+        total_drops += sink->count;
+        while (sink->count > 0)
+            drop_first(sink);
+    }
+
+    if (sink->drops > 0)
+        fprintf(stderr, "Output \"%s\" dropped %lu frames\n",
+                sink->dest, sink->drops);
+
+    switch (sink->type) {
+        case SINK_FILE:
+            if (sink->file && sink->file != stdout)
+                fclose(sink->file);
+            break;
+        case SINK_FIFO:
+            if (sink->std_out)
+                fcntl(STDOUT_FILENO, F_SETFL, sink->fd_flags);
+            else if (sink->fd != -1)
+                close(sink->fd);
+            break;
+        case SINK_ZMQ:
+            zmqoutput_close(sink->zmq);
+            break;
+        case SINK_SHM:
+            shmring_close(sink->shm);
+            break;
+        case SINK_ARCHIVE:
+            archive_close(sink->archive);
+            break;
+        case SINK_PULL:
+            free(sink->pulled);
+            break;
+    }
+
+    free(sink->dest);
+    free(sink);
+}
+
+const char *sink_name(const struct sink *sink)
+{
+    return sink->dest;
+}
+
+unsigned long sink_drops(void)
+{
+    return total_drops;
+}
@@ -0,0 +1,81 @@
+#ifndef _SINK_H_
+#define _SINK_H_
+
+/* Destinations of an encoded bit stream
+ *
+ * The bit stream is cut into frames of 24 ms. Every frame is held in
+ * one reference-counted buffer, which all the sinks of the stream share:
+ * it is neither encoded nor copied once per sink.
+ *
+ * A sink is one of:
+ *  - a file, or stdout given as -;
+ *  - a named pipe (FIFO), for example for a monitoring tool. It is
+ *    written without blocking, and frames are discarded while nobody
+ *    reads the pipe. So is a pipe on stdout when the input is live,
+ *    see sink_set_live();
+ *  - a list of ZMQ endpoints given as tcp://..., see zmqoutput.h;
+ *  - a shared memory ring given as shm://name, see shmring.h;
+ *  - a rolling archive of segment files and their index given as
+ *    archive://prefix, see archive.h;
+ *  - the frames of libtoolame, which the application pulls.
+ *
+ * A sink that cannot take a frame right away keeps a reference to it,
+ * and tries again with the next one. When SINK_QUEUE frames are waiting,
+ * the oldest is dropped, or the one after it if the oldest was written
+ * partly. A stalled sink therefore never holds up the encoder, nor the
+ * other sinks. The frames of libtoolame are all kept until they are
+ * pulled.
+ */
+
+/* Frames a sink can hold back, about 1.5 s */
+#define SINK_QUEUE 64
+
+struct sink_frame {
+    int refs;
+    int len;
+    unsigned char data[];
+};
+
+/* Allocate a frame of up to size bytes, with one reference */
+struct sink_frame *sink_frame_new(int size);
+
+void sink_frame_ref(struct sink_frame *frame);
+
+/* Release a reference, and free the frame with the last one */
+void sink_frame_unref(struct sink_frame *frame);
+
+struct sink;
+
+/* With a live input, a pipe given as - is written without blocking, as
+ * a named pipe is. Otherwise the encoder waits for its reader, and no
+ * frame is lost. Set before sink_open() */
+void sink_set_live(int live_input);
+
+/* Open the destination, which receives frames of frame_size bytes.
+ * Returns NULL on failure */
+struct sink *sink_open(const char *dest, int frame_size);
+
+/* Open a sink which keeps the frames for sink_pull().
+ * Returns NULL on failure */
+struct sink *sink_open_pull(int frame_size);
+
+/* Hand a frame to the sink, which takes its own reference */
+void sink_write(struct sink *sink, struct sink_frame *frame);
+
+/* Copy the oldest frame of a sink_open_pull() sink to buf, and release it.
+ * returns the length of the frame
+ *         0  if there is none
+ *         -1 if size is too small for it
+ */
+int sink_pull(struct sink *sink, unsigned char *buf, int size);
+
+/* Write what can still be written, and release the sink */
+void sink_close(struct sink *sink);
+
+/* The destination as it was given */
+const char *sink_name(const struct sink *sink);
+
+/* Number of frames dropped by all sinks */
+unsigned long sink_drops(void);
+
+#endif
@@ -0,0 +1,555 @@
+/* Machine-readable encoder statistics, see stats.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "common.h"
+#include "stats.h"
+#include "deadline.h"
+#include "zmqoutput.h"
+#include "sink.h"
+#include "audio_read.h"
+#include "shm_input.h"
+#include "quickmode.h"
+#include "silence.h"
+#include "psycache.h"
+#include "loopback.h"
+#include "governor.h"
+
+#define STATS_BUF_SIZE 16384
+#define UNIX_PREFIX "unix:"
+
+extern int vbrstats_new[15];
+
+static enum stats_format stats_format;
+static const char *stats_path = NULL;
+static int stats_listen_fd = -1;
+static int stats_vbr;
+static int stats_version;
+
+static unsigned long frames_per_second;
+static unsigned long long frames = 0;
+static unsigned long long xpad_frames = 0;
+static unsigned long frames_since_write = 0;
+
+/* Peaks and RMS over the current and over the last complete interval */
+static int peak_left = 0, peak_right = 0;
+static int last_peak_left = 0, last_peak_right = 0;
+static double sum_sq_left = 0, sum_sq_right = 0;
+static double last_rms_left = 0, last_rms_right = 0;
+
+static char snapshot[STATS_BUF_SIZE];
+static size_t snapshot_len = 0;
+
+int stats_parse_format(const char *name)
+{
+    if (strcmp(name, "json") == 0)
+        return STATS_FORMAT_JSON;
+    else if (strcmp(name, "prometheus") == 0 || strcmp(name, "prom") == 0)
+        return STATS_FORMAT_PROMETHEUS;
+    return -1;
+}
+
+static void append(const char *fmt, ...)
+{
+    va_list ap;
+    int ret;
+
+    if (snapshot_len >= STATS_BUF_SIZE)
+        return;
+
+    va_start(ap, fmt);
+    ret = vsnprintf(snapshot + snapshot_len, STATS_BUF_SIZE - snapshot_len,
+            fmt, ap);
+    va_end(ap);
+
+    if (ret > 0)
+        snapshot_len += ret;
+    if (snapshot_len >= STATS_BUF_SIZE)
+        snapshot_len = STATS_BUF_SIZE - 1;
+}
+
+static const double quantiles[] = { 50, 90, 99, 99.9 };
+#define NUM_QUANTILES (sizeof(quantiles) / sizeof(quantiles[0]))
+
+static void render_json(void)
+{
+    struct zmqoutput_stats zs;
+    size_t q;
+    int i;
+
+    append("{\"frames\":%llu,", frames);
+
+    append("\"encode_time_us\":{");
+    for (q = 0; q < NUM_QUANTILES; q++) {
+        append("\"p%g\":%llu,", quantiles[q],
+                (unsigned long long)deadline_percentile(DEADLINE_ENCODE, quantiles[q]));
+    }
+    append("\"max\":%llu},",
+            (unsigned long long)deadline_worst(DEADLINE_ENCODE));
+
+    append("\"deadline_overruns\":%llu,\"deadline_alarms\":%llu,",
+            (unsigned long long)deadline_overruns(),
+            (unsigned long long)deadline_alarms());
+
+    if (stats_vbr) {
+        append("\"vbr_bitrates\":{");
+        for (i = 1; i < 15; i++) {
+            append("%s\"%d\":%d", i == 1 ? "" : ",",
+                    bitrate[stats_version][i], vbrstats_new[i]);
+        }
+        append("},");
+    }
+
+    append("\"xpad_frames\":%llu,", xpad_frames);
+    append("\"zmq_drops\":%lu,", zmqoutput_get_drops());
+    if (zmqoutput_count() > 0) {
+        append("\"zmq_outputs\":[");
+        for (i = 0; i < zmqoutput_count(); i++) {
+            zmqoutput_get_stats(i, &zs);
+            append("%s{\"uri\":\"%s\",\"queue\":%llu,\"queue_max\":%llu,"
+                    "\"sent\":%llu,\"drops\":%llu,\"latency_avg_us\":%llu,"
+                    "\"latency_max_us\":%llu}", i == 0 ? "" : ",", zs.uris,
+                    (unsigned long long)zs.queued,
+                    (unsigned long long)zs.queued_max,
+                    (unsigned long long)zs.sent,
+                    (unsigned long long)zs.drops,
+                    (unsigned long long)(zs.sent ?
+                        zs.latency_sum_us / zs.sent : 0),
+                    (unsigned long long)zs.latency_max_us);
+        }
+        append("],");
+    }
+    append("\"output_drops\":%lu,", sink_drops());
+    append("\"input_underruns\":%llu,",
+            (unsigned long long)deadline_underruns());
+    append("\"input_dropped_samples\":%lu,", input_dropped_samples());
+    append("\"input_gaps\":%lu,", shm_in_gaps());
+    append("\"silence_frames\":%llu,",
+            (unsigned long long)silence_frames());
+    if (quickmode_runs() + quickmode_skips() > 0) {
+        append("\"psy_runs\":%llu,\"psy_skips\":%llu,\"psy_saved_us\":%llu,",
+                (unsigned long long)quickmode_runs(),
+                (unsigned long long)quickmode_skips(),
+                (unsigned long long)quickmode_saved_us());
+    }
+    if (psycache_hits() + psycache_misses() > 0) {
+        append("\"psy_cache_hits\":%llu,\"psy_cache_misses\":%llu,"
+                "\"psy_cache_evictions\":%llu,",
+                (unsigned long long)psycache_hits(),
+                (unsigned long long)psycache_misses(),
+                (unsigned long long)psycache_evictions());
+    }
+    if (loopback_enabled()) {
+        struct loopback_stats ls;
+
+        loopback_get_stats(&ls);
+        append("\"loopback_frames\":%llu,\"loopback_skipped\":%llu,"
+                "\"loopback_header_errors\":%llu,\"loopback_crc_errors\":%llu,"
+                "\"loopback_scf_crc_errors\":%llu,",
+                (unsigned long long)ls.frames,
+                (unsigned long long)ls.skipped,
+                (unsigned long long)ls.header_errors,
+                (unsigned long long)ls.crc_errors,
+                (unsigned long long)ls.scf_crc_errors);
+        append("\"loopback_snr_db\":%.1f,\"loopback_snr_min_db\":%.1f,"
+                "\"loopback_nmr_db\":%.1f,\"loopback_nmr_max_db\":%.1f,",
+                ls.snr_avg, ls.snr_min, ls.nmr_avg, ls.nmr_max);
+    }
+    if (governor_enabled()) {
+        append("\"governor_tier\":%d,\"governor_steps_down\":%llu,"
+                "\"governor_steps_up\":%llu,",
+                governor_current_tier(),
+                (unsigned long long)governor_steps_down(),
+                (unsigned long long)governor_steps_up());
+    }
+    append("\"peak_left\":%d,\"peak_right\":%d,",
+            last_peak_left, last_peak_right);
+    append("\"rms_left\":%.1f,\"rms_right\":%.1f}\n",
+            last_rms_left, last_rms_right);
+}
+
+static void prom_metric(const char *name, const char *type, const char *help)
+{
+    append("# HELP toolame_%s %s\n", name, help);
+    append("# TYPE toolame_%s %s\n", name, type);
+}
+
+enum zmq_field {
+    ZMQ_QUEUED, ZMQ_QUEUED_MAX, ZMQ_SENT, ZMQ_DROPS,
+    ZMQ_LATENCY_SUM, ZMQ_LATENCY_MAX
+};
+
+/* One line per ZMQ output of a metric labeled with the endpoints */
+static void prom_zmq_outputs(const char *name, const char *type,
+        const char *help, enum zmq_field field)
+{
+    struct zmqoutput_stats zs;
+    int i;
+
+    prom_metric(name, type, help);
+    for (i = 0; i < zmqoutput_count(); i++) {
+        zmqoutput_get_stats(i, &zs);
+        append("toolame_%s{uri=\"%s\"} ", name, zs.uris);
+        switch (field) {
+            case ZMQ_QUEUED:
+                append("%llu\n", (unsigned long long)zs.queued);
+                break;
+            case ZMQ_QUEUED_MAX:
+                append("%llu\n", (unsigned long long)zs.queued_max);
+                break;
+            case ZMQ_SENT:
+                append("%llu\n", (unsigned long long)zs.sent);
+                break;
+            case ZMQ_DROPS:
+                append("%llu\n", (unsigned long long)zs.drops);
+                break;
+            case ZMQ_LATENCY_SUM:
+                append("%g\n", zs.latency_sum_us / 1e6);
+                break;
+            case ZMQ_LATENCY_MAX:
+                append("%g\n", zs.latency_max_us / 1e6);
+                break;
+        }
+    }
+}
+
+static void render_prometheus(void)
+{
+    size_t q;
+    int i;
+
+    prom_metric("frames_total", "counter", "Encoded frames");
+    append("toolame_frames_total %llu\n", frames);
+
+    prom_metric("encode_time_seconds", "summary", "Encode time per frame");
+    for (q = 0; q < NUM_QUANTILES; q++) {
+        append("toolame_encode_time_seconds{quantile=\"%g\"} %g\n",
+                quantiles[q] / 100.0,
+                deadline_percentile(DEADLINE_ENCODE, quantiles[q]) / 1e6);
+    }
+    append("toolame_encode_time_seconds{quantile=\"1\"} %g\n",
+            deadline_worst(DEADLINE_ENCODE) / 1e6);
+
+    prom_metric("deadline_overruns_total", "counter",
+            "Frames that took longer to encode than to play");
+    append("toolame_deadline_overruns_total %llu\n",
+            (unsigned long long)deadline_overruns());
+
+    prom_metric("deadline_alarms_total", "counter",
+            "Frames that left less than the configured headroom");
+    append("toolame_deadline_alarms_total %llu\n",
+            (unsigned long long)deadline_alarms());
+
+    if (stats_vbr) {
+        prom_metric("vbr_frames_total", "counter", "Frames per VBR bitrate");
+        for (i = 1; i < 15; i++) {
+            append("toolame_vbr_frames_total{bitrate=\"%d\"} %d\n",
+                    bitrate[stats_version][i], vbrstats_new[i]);
+        }
+    }
+
+    prom_metric("xpad_frames_total", "counter", "Frames with X-PAD inserted");
+    append("toolame_xpad_frames_total %llu\n", xpad_frames);
+
+    prom_metric("zmq_drops_total", "counter", "Frames ZMQ failed to send");
+    append("toolame_zmq_drops_total %lu\n", zmqoutput_get_drops());
+
+    if (zmqoutput_count() > 0) {
+        prom_zmq_outputs("zmq_output_queue_frames", "gauge",
+                "Frames waiting for the ZMQ sender thread", ZMQ_QUEUED);
+        prom_zmq_outputs("zmq_output_queue_max_frames", "gauge",
+                "Most frames that waited for the ZMQ sender thread",
+                ZMQ_QUEUED_MAX);
+        prom_zmq_outputs("zmq_output_sent_total", "counter",
+                "Frames sent over ZMQ", ZMQ_SENT);
+        prom_zmq_outputs("zmq_output_drops_total", "counter",
+                "Frames dropped by the ZMQ output", ZMQ_DROPS);
+        prom_zmq_outputs("zmq_output_latency_seconds_sum", "counter",
+                "Time from encoding to sending, summed over the sent frames",
+                ZMQ_LATENCY_SUM);
+        prom_zmq_outputs("zmq_output_latency_seconds_count", "counter",
+                "Frames the latency was measured for", ZMQ_SENT);
+        prom_zmq_outputs("zmq_output_latency_max_seconds", "gauge",
+                "Longest time from encoding to sending", ZMQ_LATENCY_MAX);
+    }
+
+    prom_metric("output_drops_total", "counter",
+            "Frames dropped by outputs that could not keep up");
+    append("toolame_output_drops_total %lu\n", sink_drops());
+
+    prom_metric("input_underruns_total", "counter",
+            "Times the input delivered audio late");
+    append("toolame_input_underruns_total %llu\n",
+            (unsigned long long)deadline_underruns());
+
+    prom_metric("input_dropped_samples_total", "counter",
+            "Samples dropped because the input buffer was full");
+    append("toolame_input_dropped_samples_total %lu\n",
+            input_dropped_samples());
+
+    prom_metric("input_gaps_total", "counter",
+            "Frames missing from the shared-memory input");
+    append("toolame_input_gaps_total %lu\n", shm_in_gaps());
+
+    prom_metric("silence_frames_total", "counter",
+            "Frames sent as silence without running the encoder");
+    append("toolame_silence_frames_total %llu\n",
+            (unsigned long long)silence_frames());
+
+    if (quickmode_runs() + quickmode_skips() > 0) {
+        prom_metric("psy_runs_total", "counter",
+                "Frames the psy model was calculated for");
+        append("toolame_psy_runs_total %llu\n",
+                (unsigned long long)quickmode_runs());
+
+        prom_metric("psy_skips_total", "counter",
+                "Frames that reused the previous psy model result in quick mode");
+        append("toolame_psy_skips_total %llu\n",
+                (unsigned long long)quickmode_skips());
+
+        prom_metric("psy_saved_seconds_total", "counter",
+                "Estimated CPU time saved by quick mode");
+        append("toolame_psy_saved_seconds_total %g\n",
+                quickmode_saved_us() / 1e6);
+    }
+
+    if (psycache_hits() + psycache_misses() > 0) {
+        prom_metric("psy_cache_hits_total", "counter",
+                "Frames that took their psy model result from the cache");
+        append("toolame_psy_cache_hits_total %llu\n",
+                (unsigned long long)psycache_hits());
+
+        prom_metric("psy_cache_misses_total", "counter",
+                "Frames the psy model ran for with the cache enabled");
+        append("toolame_psy_cache_misses_total %llu\n",
+                (unsigned long long)psycache_misses());
+
+        prom_metric("psy_cache_evictions_total", "counter",
+                "Psy model results evicted from the cache");
+        append("toolame_psy_cache_evictions_total %llu\n",
+                (unsigned long long)psycache_evictions());
+    }
+
+    if (loopback_enabled()) {
+        struct loopback_stats ls;
+
+        loopback_get_stats(&ls);
+        prom_metric("loopback_frames_total", "counter",
+                "Frames decoded again by the loopback check");
+        append("toolame_loopback_frames_total %llu\n",
+                (unsigned long long)ls.frames);
+
+        prom_metric("loopback_skipped_total", "counter",
+                "Frames the loopback check had no time for");
+        append("toolame_loopback_skipped_total %llu\n",
+                (unsigned long long)ls.skipped);
+
+        prom_metric("loopback_errors_total", "counter",
+                "Errors found by the loopback check");
+        append("toolame_loopback_errors_total{check=\"header\"} %llu\n",
+                (unsigned long long)ls.header_errors);
+        append("toolame_loopback_errors_total{check=\"crc\"} %llu\n",
+                (unsigned long long)ls.crc_errors);
+        append("toolame_loopback_errors_total{check=\"scf_crc\"} %llu\n",
+                (unsigned long long)ls.scf_crc_errors);
+
+        prom_metric("loopback_snr_db", "gauge",
+                "Average SNR of the decoded frames against the input");
+        append("toolame_loopback_snr_db %.1f\n", ls.snr_avg);
+
+        prom_metric("loopback_snr_min_db", "gauge",
+                "Lowest SNR of a decoded frame");
+        append("toolame_loopback_snr_min_db %.1f\n", ls.snr_min);
+
+        prom_metric("loopback_nmr_db", "gauge",
+                "Average noise to mask ratio of the subbands of the decoded frames");
+        append("toolame_loopback_nmr_db %.1f\n", ls.nmr_avg);
+
+        prom_metric("loopback_nmr_max_db", "gauge",
+                "Highest noise to mask ratio of a subband of a decoded frame");
+        append("toolame_loopback_nmr_max_db %.1f\n", ls.nmr_max);
+    }
+
+    if (governor_enabled()) {
+        prom_metric("governor_tier", "gauge",
+                "Psy model tier chosen by the governor, 0 is the configured model");
+        append("toolame_governor_tier %d\n", governor_current_tier());
+
+        prom_metric("governor_steps_total", "counter",
+                "Governor switches to a cheaper or to a better psy model");
+        append("toolame_governor_steps_total{direction=\"down\"} %llu\n",
+                (unsigned long long)governor_steps_down());
+        append("toolame_governor_steps_total{direction=\"up\"} %llu\n",
+                (unsigned long long)governor_steps_up());
+    }
+
+    prom_metric("peak_level", "gauge", "Peak level over the last second, linear 0-32767");
+    append("toolame_peak_level{channel=\"left\"} %d\n", last_peak_left);
+    append("toolame_peak_level{channel=\"right\"} %d\n", last_peak_right);
+
+    prom_metric("rms_level", "gauge", "RMS level over the last second, linear 0-32767");
+    append("toolame_rms_level{channel=\"left\"} %.1f\n", last_rms_left);
+    append("toolame_rms_level{channel=\"right\"} %.1f\n", last_rms_right);
+}
+
+static void write_file(void)
+{
+    char tmp_path[MAX_NAME_SIZE + 8];
+    FILE *fd;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", stats_path);
+
+    fd = fopen(tmp_path, "w");
+    if (fd == NULL) {
+        fprintf(stderr, "Could not write stats to \"%s\": %s\n",
+                tmp_path, strerror(errno));
+        return;
+    }
+
+    fwrite(snapshot, 1, snapshot_len, fd);
+    fclose(fd);
+
+    if (rename(tmp_path, stats_path) != 0) {
+        fprintf(stderr, "Could not rename stats file to \"%s\": %s\n",
+                stats_path, strerror(errno));
+    }
+}
+
+/* Give the latest snapshot to all clients waiting on the socket */
+static void serve_clients(void)
+{
+    int client;
+
+    while ((client = accept(stats_listen_fd, NULL, NULL)) != -1) {
+        /* Never block the encoder on a slow client */
+        fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+        if (send(client, snapshot, snapshot_len, MSG_NOSIGNAL) == -1) {
+            fprintf(stderr, "Could not send stats: %s\n", strerror(errno));
+        }
+        close(client);
+    }
+}
+
+static void update_snapshot(void)
+{
+    snapshot_len = 0;
+
+    if (stats_format == STATS_FORMAT_PROMETHEUS)
+        render_prometheus();
+    else
+        render_json();
+
+    if (stats_listen_fd == -1)
+        write_file();
+}
+
+int stats_init(const char *target, enum stats_format format,
+        long sample_rate, int mpeg_version, int vbr)
+{
+    stats_format = format;
+    stats_vbr = vbr;
+    stats_version = mpeg_version;
+    frames_per_second = sample_rate / 1152;
+
+    if (strncmp(target, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0) {
+        struct sockaddr_un addr;
+
+        stats_path = target + strlen(UNIX_PREFIX);
+        if (strlen(stats_path) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "Stats socket path too long\n");
+            return -1;
+        }
+
+        stats_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (stats_listen_fd == -1) {
+            perror("Stats socket");
+            return -1;
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, stats_path);
+
+        unlink(stats_path);
+        if (bind(stats_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+                listen(stats_listen_fd, 8) == -1) {
+            fprintf(stderr, "Could not listen on stats socket \"%s\": %s\n",
+                    stats_path, strerror(errno));
+            close(stats_listen_fd);
+            stats_listen_fd = -1;
+            return -1;
+        }
+    }
+    else {
+        if (strlen(target) >= MAX_NAME_SIZE) {
+            fprintf(stderr, "Stats file path too long\n");
+            return -1;
+        }
+        stats_path = target;
+    }
+
+    update_snapshot();
+    return 0;
+}
+
+void stats_frame(const struct audio_levels *levels, int xpad_inserted)
+{
+    if (stats_path == NULL)
+        return;
+
+    frames++;
+    if (xpad_inserted)
+        xpad_frames++;
+
+    if (levels->peak[0] > peak_left)
+        peak_left = levels->peak[0];
+    if (levels->peak[1] > peak_right)
+        peak_right = levels->peak[1];
+
+    /* All frames have the same length, so the mean square of the
+     * interval is the mean of the squared RMS of its frames */
+    sum_sq_left += levels->rms[0] * levels->rms[0];
+    sum_sq_right += levels->rms[1] * levels->rms[1];
+
+    if (++frames_since_write >= frames_per_second) {
+        last_peak_left = peak_left;
+        last_peak_right = peak_right;
+        last_rms_left = sqrt(sum_sq_left / frames_since_write);
+        last_rms_right = sqrt(sum_sq_right / frames_since_write);
+        peak_left = 0;
+        peak_right = 0;
+        sum_sq_left = 0;
+        sum_sq_right = 0;
+        frames_since_write = 0;
+
+        update_snapshot();
+    }
+
+    if (stats_listen_fd != -1)
+        serve_clients();
+}
+
+void stats_close(void)
+{
+    if (stats_path == NULL)
+        return;
+
+    update_snapshot();
+
+    if (stats_listen_fd != -1) {
+        serve_clients();
+        close(stats_listen_fd);
+        unlink(stats_path);
+        stats_listen_fd = -1;
+    }
+
+    stats_path = NULL;
+}
@@ -0,0 +1,50 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+/* Machine-readable encoder statistics
+ *
+ * Once per second of audio, a snapshot of the encoder statistics is
+ * rendered as JSON or in the Prometheus text exposition format, and
+ * written either to a file or to a unix socket:
+ *
+ *  - a plain path names a file. It is replaced atomically using a
+ *    temporary file and rename(), so that readers never see a partial
+ *    snapshot.
+ *  - unix:/path creates a listening unix stream socket. Every client
+ *    that connects receives the latest snapshot, and the connection is
+ *    then closed.
+ *
+ * The snapshot contains the number of encoded frames, encode time
+ * percentiles, the VBR bitrate histogram, the number of frames with
+ * X-PAD, ZMQ drops, the queue, drops and latency of every ZMQ output,
+ * frames dropped by stalled outputs, input underruns, dropped samples
+ * and the gaps of the shared-memory input, the psy model runs and skips
+ * in quick mode, the governor tier and steps, and the peak and RMS
+ * levels of the last second.
+ */
+
+enum stats_format {
+    STATS_FORMAT_JSON = 0,
+    STATS_FORMAT_PROMETHEUS
+};
+
+/* Parse the format name given on the command line.
+ * Returns -1 if it is unknown */
+int stats_parse_format(const char *name);
+
+/* Open the stats output.
+ * returns 0  on success
+ *         -1 on failure
+ */
+int stats_init(const char *target, enum stats_format format,
+        long sample_rate, int mpeg_version, int vbr);
+
+struct audio_levels;
+
+/* Account one frame, and write the snapshot when it is due */
+void stats_frame(const struct audio_levels *levels, int xpad_inserted);
+
+/* Write a last snapshot and release the output */
+void stats_close(void);
+
+#endif
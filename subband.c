@@ -198,7 +198,11 @@ void window_subband12 (short **buffer, int ch)
 //____________________________________________________________________________
 //____ WindowFilterSubband() _________________________________________
 //____ RS&A - Feb 2003 _______________________________________________________
-void WindowFilterSubband (short *pBuffer, int ch, double s[SBLIMIT])
+/* pBuffer holds samples in the [-1, 1) range, see condition_audio().
+   Only the subbands below sblimit are computed, the others are set to 0.
+   Row i of the DCT matrix gives both subband i and 31-i, so this only
+   saves work for the low bitrate tables with sblimit <= 16 */
+void WindowFilterSubband (double *pBuffer, int ch, double s[SBLIMIT], int sblimit)
 {
   register int i, j;
   int pa, pb, pc, pd, pe, pf, pg, ph;
@@ -230,7 +234,7 @@ void WindowFilterSubband (short *pBuffer, int ch, double s[SBLIMIT])
 
   /* replace 32 oldest samples with 32 new samples */
   for (i = 0; i < 32; i++)
-    dp[(31 - i) * 8] = (double) pBuffer[i] / SCALE;
+    dp[(31 - i) * 8] = pBuffer[i];
 
   // looks like "school example" but does faster ...
   dp = (x[ch] + half[ch] * 256);
@@ -290,18 +294,36 @@ void WindowFilterSubband (short *pBuffer, int ch, double s[SBLIMIT])
   for (i = 17; i < 32; i++)
     yprime[i] = y[i + 16] - y[80 - i];
 
-  for (i = 15; i >= 0; i--) {
-    register double s0 = 0.0, s1 = 0.0;
-    register double *mp = m[i];
-    register double *xinp = yprime;
-    for (j = 0; j < 8; j++) {
-      s0 += *mp++ * *xinp++;
-      s1 += *mp++ * *xinp++;
-      s0 += *mp++ * *xinp++;
-      s1 += *mp++ * *xinp++;
+  if (sblimit > 16) {
+    for (i = 15; i >= 0; i--) {
+      register double s0 = 0.0, s1 = 0.0;
+      register double *mp = m[i];
+      register double *xinp = yprime;
+      for (j = 0; j < 8; j++) {
+        s0 += *mp++ * *xinp++;
+        s1 += *mp++ * *xinp++;
+        s0 += *mp++ * *xinp++;
+        s1 += *mp++ * *xinp++;
+      }
+      s[i] = s0 + s1;
+      s[31 - i] = s0 - s1;
     }
-    s[i] = s0 + s1;
-    s[31 - i] = s0 - s1;
+  } else {
+    /* pruned DCT: the upper half of the subbands is not needed */
+    for (i = sblimit - 1; i >= 0; i--) {
+      register double s0 = 0.0, s1 = 0.0;
+      register double *mp = m[i];
+      register double *xinp = yprime;
+      for (j = 0; j < 8; j++) {
+        s0 += *mp++ * *xinp++;
+        s1 += *mp++ * *xinp++;
+        s0 += *mp++ * *xinp++;
+        s1 += *mp++ * *xinp++;
+      }
+      s[i] = s0 + s1;
+    }
+    for (i = sblimit; i < SBLIMIT; i++)
+      s[i] = 0.0;
   }
 
   half[ch] = (half[ch] + 1) & 1;
@@ -1,6 +1,9 @@
 
 
-void  WindowFilterSubband( short *pBuffer, int ch, double s[SBLIMIT] );
+/* The analysis window of ISO 11172-3 Table C.1, see enwindow.h */
+extern double enwindow[512];
+
+void  WindowFilterSubband( double *pBuffer, int ch, double s[SBLIMIT], int sblimit );
 void create_dct_matrix (double filter[16][32]);
 
 #ifdef REFERENCECODE
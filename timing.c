@@ -0,0 +1,189 @@
+/* Per-stage timing instrumentation, see timing.h */
+
+#if defined(TIMING_PROFILE)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+#include "timing.h"
+
+#if defined(TIMING_RDTSC) && (defined(__x86_64__) || defined(__i386__))
+#  include <x86intrin.h>
+#  define TIMING_UNIT "cycles"
+#else
+#  undef TIMING_RDTSC
+#  define TIMING_UNIT "ns"
+#endif
+
+/* Bucket i holds the durations d with 2^(i-1) <= d < 2^i */
+#define TIMING_BUCKETS 48
+
+struct timing_stats {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t hist[TIMING_BUCKETS];
+};
+
+static const char *stage_names[TIMING_NUM_STAGES] = {
+    "get_audio",
+    "filterbank",
+    "scalefactor",
+    "psy",
+    "bit_alloc",
+    "crc",
+    "bit_packing",
+    "output",
+};
+
+static struct timing_stats stats[TIMING_NUM_STAGES];
+
+/* Sum of all measured durations, used to exclude nested stages
+ * from the enclosing one */
+static uint64_t nested_total = 0;
+
+static volatile sig_atomic_t dump_requested = 0;
+
+static inline uint64_t timing_now(void)
+{
+#if defined(TIMING_RDTSC)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static int bucket_of(uint64_t d)
+{
+    int b = 0;
+    while (d && b < TIMING_BUCKETS - 1) {
+        d >>= 1;
+        b++;
+    }
+    return b;
+}
+
+/* Upper bound of the bucket that contains the given percentile */
+static uint64_t percentile(const struct timing_stats *s, int pct)
+{
+    uint64_t target = (s->count * pct + 99) / 100;
+    uint64_t seen = 0;
+    int b;
+
+    for (b = 0; b < TIMING_BUCKETS; b++) {
+        seen += s->hist[b];
+        if (seen >= target && seen > 0) {
+            return b == 0 ? 0 : (1ULL << b) - 1;
+        }
+    }
+    return s->max;
+}
+
+static void sigusr1_handler(int sig)
+{
+    (void)sig;
+    dump_requested = 1;
+}
+
+static void timing_atexit(void)
+{
+    timing_dump(stderr);
+}
+
+void timing_init(void)
+{
+    int i;
+    for (i = 0; i < TIMING_NUM_STAGES; i++) {
+        stats[i].min = UINT64_MAX;
+    }
+
+    signal(SIGUSR1, sigusr1_handler);
+    atexit(timing_atexit);
+}
+
+void timing_start(struct timing_mark *mark)
+{
+    mark->nested = nested_total;
+    mark->start = timing_now();
+}
+
+void timing_stop(enum timing_stage stage, struct timing_mark *mark)
+{
+    uint64_t elapsed = timing_now() - mark->start;
+    uint64_t nested = nested_total - mark->nested;
+    uint64_t d = elapsed > nested ? elapsed - nested : 0;
+    struct timing_stats *s = &stats[stage];
+
+    nested_total += d;
+
+    s->count++;
+    s->sum += d;
+    if (d < s->min) s->min = d;
+    if (d > s->max) s->max = d;
+    s->hist[bucket_of(d)]++;
+}
+
+void timing_poll(void)
+{
+    if (dump_requested) {
+        dump_requested = 0;
+        timing_dump(stderr);
+    }
+}
+
+void timing_dump(FILE *fd)
+{
+    int i, b;
+    uint64_t total = 0;
+
+    for (i = 0; i < TIMING_NUM_STAGES; i++) {
+        total += stats[i].sum;
+    }
+
+    fprintf(fd, "\nTiming statistics (" TIMING_UNIT ")\n");
+    fprintf(fd, "%-12s %10s %12s %10s %10s %10s %10s %6s\n",
+            "stage", "count", "mean", "min", "max", "p50<=", "p99<=", "share");
+
+    for (i = 0; i < TIMING_NUM_STAGES; i++) {
+        const struct timing_stats *s = &stats[i];
+        if (s->count == 0) {
+            fprintf(fd, "%-12s %10d\n", stage_names[i], 0);
+            continue;
+        }
+
+        fprintf(fd, "%-12s %10llu %12.1f %10llu %10llu %10llu %10llu %5.1f%%\n",
+                stage_names[i],
+                (unsigned long long)s->count,
+                (double)s->sum / s->count,
+                (unsigned long long)s->min,
+                (unsigned long long)s->max,
+                (unsigned long long)percentile(s, 50),
+                (unsigned long long)percentile(s, 99),
+                total ? 100.0 * s->sum / total : 0.0);
+    }
+
+    fprintf(fd, "Histograms, bucket upper bound (" TIMING_UNIT "): count\n");
+    for (i = 0; i < TIMING_NUM_STAGES; i++) {
+        const struct timing_stats *s = &stats[i];
+        if (s->count == 0)
+            continue;
+
+        fprintf(fd, "%-12s", stage_names[i]);
+        for (b = 0; b < TIMING_BUCKETS; b++) {
+            if (s->hist[b]) {
+                fprintf(fd, " <%llu:%llu",
+                        (unsigned long long)(1ULL << b),
+                        (unsigned long long)s->hist[b]);
+            }
+        }
+        fprintf(fd, "\n");
+    }
+    fflush(fd);
+}
+
+#endif // defined(TIMING_PROFILE)
@@ -0,0 +1,71 @@
+#ifndef _TIMING_H_
+#define _TIMING_H_
+
+/* Per-stage timing instrumentation of the encoder main loop.
+ *
+ * The instrumentation is only compiled in when TIMING_PROFILE is defined
+ * (cmake -DENABLE_TIMING=ON, or ENABLE_TIMING=1 in the Makefile). Otherwise
+ * all TIMING_* macros expand to nothing and there is no runtime cost.
+ *
+ * Every stage keeps a count, sum, min, max and a log2 histogram of its
+ * durations. The time of a stage that is measured while another stage
+ * is running (e.g. the output inside the bit packing) is subtracted from
+ * the enclosing stage, so the stages add up to the total loop time.
+ *
+ * The statistics are printed to stderr when the encoder exits, and
+ * whenever the process receives SIGUSR1.
+ *
+ * Durations are in nanoseconds from clock_gettime(CLOCK_MONOTONIC), or
+ * in TSC cycles if TIMING_RDTSC is also defined on x86.
+ */
+
+enum timing_stage {
+    TIMING_GET_AUDIO = 0,
+    TIMING_FILTERBANK,
+    TIMING_SCALEFACTOR,
+    TIMING_PSY,
+    TIMING_BIT_ALLOC,
+    TIMING_CRC,
+    TIMING_BIT_PACKING,
+    TIMING_OUTPUT,
+    TIMING_NUM_STAGES
+};
+
+#if defined(TIMING_PROFILE)
+
+#include <stdint.h>
+#include <stdio.h>
+
+struct timing_mark {
+    uint64_t start;
+    uint64_t nested;
+};
+
+/* Install the SIGUSR1 handler and the exit hook */
+void timing_init(void);
+
+void timing_start(struct timing_mark *mark);
+
+/* Account the time elapsed since timing_start() to the given stage */
+void timing_stop(enum timing_stage stage, struct timing_mark *mark);
+
+/* Dump the statistics if a SIGUSR1 was received since the last call */
+void timing_poll(void);
+
+void timing_dump(FILE *fd);
+
+#  define TIMING_INIT()           timing_init()
+#  define TIMING_START(m)         struct timing_mark m; timing_start(&m)
+#  define TIMING_STOP(stage, m)   timing_stop(stage, &m)
+#  define TIMING_POLL()           timing_poll()
+
+#else
+
+#  define TIMING_INIT()
+#  define TIMING_START(m)
+#  define TIMING_STOP(stage, m)
+#  define TIMING_POLL()
+
+#endif // defined(TIMING_PROFILE)
+
+#endif
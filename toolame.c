@@ -11,23 +11,25 @@
 #include "options.h"
 #include "audio_read.h"
 #include "bitstream.h"
-#include "mem.h"
-#include "crc.h"
-#include "psycho_n1.h"
-#include "psycho_0.h"
-#include "psycho_1.h"
-#include "psycho_2.h"
-#include "psycho_3.h"
-#include "psycho_4.h"
-#include "encode.h"
-#include "availbits.h"
-#include "subband.h"
-#include "encode_new.h"
 #include "toolame.h"
+#include "libtoolame_priv.h"
 #include "xpad.h"
 #include "utils.h"
 #include "vlc_input.h"
+#include "shm_input.h"
 #include "zmqoutput.h"
+#include "timing.h"
+#include "deadline.h"
+#include "stats.h"
+#include "quickmode.h"
+#include "silence.h"
+#include "psycache.h"
+#include "loopback.h"
+#include "twopass.h"
+#include "archive.h"
+#include "governor.h"
+#include "ladder.h"
+#include "sink.h"
 
 #include <assert.h>
 
@@ -36,65 +38,12 @@ Bit_stream_struc bs;
 char *programName;
 char toolameversion[] = "0.2l-ODR-" GIT_VERSION;
 
-const int FPAD_LENGTH=2;
-
-void global_init (void)
-{
-    glopts.usepsy = TRUE;
-    glopts.usepadbit = TRUE;
-    glopts.quickmode = FALSE;
-    glopts.quickcount = 10;
-    glopts.downmix = FALSE;
-    glopts.byteswap = FALSE;
-    glopts.channelswap = FALSE;
-    glopts.vbr = FALSE;
-    glopts.vbrlevel = 0;
-    glopts.athlevel = 0;
-    glopts.verbosity = 2;
-    glopts.input_select = 0;
-}
-
 /************************************************************************
  *
  * main
  *
- * PURPOSE:  MPEG II Encoder with
- * psychoacoustic models 1 (MUSICAM) and 2 (AT&T)
- *
- * SEMANTICS:  One overlapping frame of audio of up to 2 channels are
- * processed at a time in the following order:
- * (associated routines are in parentheses)
- *
- * 1.  Filter sliding window of data to get 32 subband
- * samples per channel.
- * (window_subband,filter_subband)
- *
- * 2.  If joint stereo mode, combine left and right channels
- * for subbands above #jsbound#.
- * (combine_LR)
- *
- * 3.  Calculate scalefactors for the frame, and 
- * also calculate scalefactor select information.
- * (*_scale_factor_calc)
- *
- * 4.  Calculate psychoacoustic masking levels using selected
- * psychoacoustic model.
- * (psycho_i, psycho_ii)
- *
- * 5.  Perform iterative bit allocation for subbands with low
- * mask_to_noise ratios using masking levels from step 4.
- * (*_main_bit_allocation)
- *
- * 6.  If error protection flag is active, add redundancy for
- * error protection.
- * (*_CRC_calc)
- *
- * 7.  Pack bit allocation, scalefactors, and scalefactor select
- *headerrmation onto bitstream.
- * (*_encode_bit_alloc,*_encode_scale,transmission_pattern)
- *
- * 8.  Quantize subbands and pack them into bitstream
- * (*_subband_quantization, *_sample_encoding)
+ * PURPOSE:  Reads the options and the input audio, and hands every frame
+ * to toolame_encode_frame(), see libtoolame.c for the steps.
  *
  ************************************************************************/
 
@@ -102,34 +51,13 @@ int frameNum = 0;
 
 int main (int argc, char **argv)
 {
-    typedef double SBS[2][3][SCALE_BLOCK][SBLIMIT];
-    SBS *sb_sample;
-    typedef double JSBS[3][SCALE_BLOCK][SBLIMIT];
-    JSBS *j_sample;
-#ifdef REFERENCECODE
-    typedef double IN[2][HAN_SIZE];
-    IN *win_que;
-#endif
-    typedef unsigned int SUB[2][3][SCALE_BLOCK][SBLIMIT];
-    SUB *subband;
-
     frame_info frame;
     frame_header header;
     char original_file_name[MAX_NAME_SIZE];
     char encoded_file_name[MAX_NAME_SIZE];
-    short **win_buf;
-    static short buffer[2][1152];
-    static unsigned int bit_alloc[2][SBLIMIT], scfsi[2][SBLIMIT];
-    static unsigned int scalar[2][3][SBLIMIT], j_scale[3][SBLIMIT];
-    static double smr[2][SBLIMIT], lgmin[2][SBLIMIT], max_sc[2][SBLIMIT];
-    // FLOAT snr32[32];
-    short sam[2][1344];		/* was [1056]; */
-    int model, nch, error_protection;
-    static unsigned int crc;
-    int sb, ch, adb;
-    unsigned long frameBits, sentBits = 0;
-    unsigned long num_samples;
-    int lg_frame;
+    struct audio_levels levels;
+    int model, nch;
+    uint64_t num_samples;
     int i;
 
     /* Keep track of peaks */
@@ -139,32 +67,6 @@ int main (int argc, char **argv)
     char* mot_file = NULL;
     char* icy_file = NULL;
 
-    /* Used to keep the SNR values for the fast/quick psy models */
-    static FLOAT smrdef[2][32];
-
-    static int psycount = 0;
-    extern int minimum;
-
-    sb_sample = (SBS *) mem_alloc (sizeof (SBS), "sb_sample");
-    j_sample = (JSBS *) mem_alloc (sizeof (JSBS), "j_sample");
-#ifdef REFERENCECODE
-    win_que = (IN *) mem_alloc (sizeof (IN), "Win_que");
-#endif
-    subband = (SUB *) mem_alloc (sizeof (SUB), "subband");
-    win_buf = (short **) mem_alloc (sizeof (short *) * 2, "win_buf");
-
-    /* clear buffers */
-    memset ((char *) buffer, 0, sizeof (buffer));
-    memset ((char *) bit_alloc, 0, sizeof (bit_alloc));
-    memset ((char *) scalar, 0, sizeof (scalar));
-    memset ((char *) j_scale, 0, sizeof (j_scale));
-    memset ((char *) scfsi, 0, sizeof (scfsi));
-    memset ((char *) smr, 0, sizeof (smr));
-    memset ((char *) lgmin, 0, sizeof (lgmin));
-    memset ((char *) max_sc, 0, sizeof (max_sc));
-    //memset ((char *) snr32, 0, sizeof (snr32));
-    memset ((char *) sam, 0, sizeof (sam));
-
     global_init ();
 
     header.extension = 0;
@@ -200,10 +102,42 @@ int main (int argc, char **argv)
     /* this will load the alloc tables and do some other stuff */
     hdr_to_frps (&frame);
     nch = frame.nch;
-    error_protection = header.error_protection;
+
+    TIMING_INIT();
+
+    int live_input = (glopts.input_select == INPUT_SELECT_JACK ||
+                      glopts.input_select == INPUT_SELECT_VLC ||
+                      glopts.input_select == INPUT_SELECT_SHM);
+    if (glopts.deadline_headroom == -1)
+        glopts.deadline_headroom = live_input ? 10 : 0;
+    deadline_init(s_freq[header.version][header.sampling_frequency] * 1000,
+            glopts.deadline_headroom);
+
+    if (glopts.stats_target) {
+        if (stats_init(glopts.stats_target, glopts.stats_format,
+                    s_freq[header.version][header.sampling_frequency] * 1000,
+                    header.version, glopts.vbr) != 0) {
+            fprintf(stderr, "Stats output initialisation failed\n");
+            return 1;
+        }
+    }
+
+    if (toolame_start (&frame, &bs, model) != 0)
+        return 1;
 
     unsigned long samps_read;
-    while ((samps_read = get_audio(&musicin, buffer, num_samples, nch, &header)) > 0) {
+    while ((samps_read = get_audio(&musicin, &levels, num_samples, nch, &header)) > 0) {
+        TIMING_POLL();
+        deadline_frame_start();
+
+        unsigned long input_fill, input_capacity;
+        double input_fill_ratio = -1;
+        if (input_buffer_fill(&input_fill, &input_capacity) == 0) {
+            deadline_input_fill(input_fill, input_capacity);
+            if (input_capacity > 0)
+                input_fill_ratio = (double)input_fill / input_capacity;
+        }
+
         /* Check if we have new PAD data
          */
         int xpad_len = 0;
@@ -235,18 +169,15 @@ int main (int argc, char **argv)
             }
         }
 
-        unsigned long j;
-        for (j = 0; j < 1152; j++) {
-            peak_left  = MAX(peak_left,  buffer[0][j]);
-        }
-        for (j = 0; j < 1152; j++) {
-            peak_right = MAX(peak_right, buffer[1][j]);
-        }
+        peak_left = levels.peak[0];
+        peak_right = levels.peak[1];
 
         // We can always set the zmq peaks, even if the output is not
         // used, it just writes some variables
         zmqoutput_set_peaks(peak_left, peak_right);
 
+        stats_frame(&levels, xpad_len > 0);
+
         if (glopts.verbosity > 1)
             if (++frameNum % 10 == 0) {
 
@@ -271,283 +202,53 @@ int main (int argc, char **argv)
             }
 
         fflush(stderr);
-        win_buf[0] = &buffer[0][0];
-        win_buf[1] = &buffer[1][0];
-
-        adb = available_bits (&header, &glopts);
-        lg_frame = adb / 8;
-        if (header.dab_extension) {
-            /* You must have one frame in memory if you are in DAB mode                 */
-            /* in conformity of the norme ETS 300 401 http://www.etsi.org               */
-            /* see bitstream.c            */
-            if (frameNum == 1)
-                minimum = lg_frame + MINIMUM;
-            adb -= header.dab_extension * 8 + (xpad_len ? xpad_len : FPAD_LENGTH) * 8;
-        }
-
-        {
-            int gr, bl, ch;
-            /* New polyphase filter
-               Combines windowing and filtering. Ricardo Feb'03 */
-            for( gr = 0; gr < 3; gr++ )
-                for ( bl = 0; bl < 12; bl++ )
-                    for ( ch = 0; ch < nch; ch++ )
-                        WindowFilterSubband( &buffer[ch][gr * 12 * 32 + 32 * bl], ch,
-                                &(*sb_sample)[ch][gr][bl][0] );
-        }
-
-#ifdef REFERENCECODE
-        {
-            /* Old code. left here for reference */
-            int gr, bl, ch;
-            for (gr = 0; gr < 3; gr++)
-                for (bl = 0; bl < SCALE_BLOCK; bl++)
-                    for (ch = 0; ch < nch; ch++) {
-                        window_subband (&win_buf[ch], &(*win_que)[ch][0], ch);
-                        filter_subband (&(*win_que)[ch][0], &(*sb_sample)[ch][gr][bl][0]);
-                    }
-        }
-#endif
-
-
-#ifdef NEWENCODE
-        scalefactor_calc_new(*sb_sample, scalar, nch, frame.sblimit);
-        find_sf_max (scalar, &frame, max_sc);
-        if (frame.actual_mode == MPG_MD_JOINT_STEREO) {
-            /* this way we calculate more mono than we need */
-            /* but it is cheap */
-            combine_LR_new (*sb_sample, *j_sample, frame.sblimit);
-            scalefactor_calc_new (j_sample, &j_scale, 1, frame.sblimit);
-        }
-#else
-        scale_factor_calc (*sb_sample, scalar, nch, frame.sblimit);
-        pick_scale (scalar, &frame, max_sc);
-        if (frame.actual_mode == MPG_MD_JOINT_STEREO) {
-            /* this way we calculate more mono than we need */
-            /* but it is cheap */
-            combine_LR (*sb_sample, *j_sample, frame.sblimit);
-            scale_factor_calc (j_sample, &j_scale, 1, frame.sblimit);
-        }
-#endif
-
-
-
-        if ((glopts.quickmode == TRUE) && (++psycount % glopts.quickcount != 0)) {
-            /* We're using quick mode, so we're only calculating the model every
-               'quickcount' frames. Otherwise, just copy the old ones across */
-            for (ch = 0; ch < nch; ch++) {
-                for (sb = 0; sb < SBLIMIT; sb++)
-                    smr[ch][sb] = smrdef[ch][sb];
-            }
-        } else {
-            /* calculate the psymodel */
-            switch (model) {
-                case -1:
-                    psycho_n1 (smr, nch);
-                    break;
-                case 0:	/* Psy Model A */
-                    psycho_0 (smr, nch, scalar, (FLOAT) s_freq[header.version][header.sampling_frequency] * 1000);	
-                    break;
-                case 1:
-                    psycho_1 (buffer, max_sc, smr, &frame);
-                    break;
-                case 2:
-                    for (ch = 0; ch < nch; ch++) {
-                        psycho_2 (&buffer[ch][0], &sam[ch][0], ch, &smr[ch][0], //snr32,
-                                (FLOAT) s_freq[header.version][header.sampling_frequency] *
-                                1000, &glopts);
-                    }
-                    break;
-                case 3:
-                    /* Modified psy model 1 */
-                    psycho_3 (buffer, max_sc, smr, &frame, &glopts);
-                    break;
-                case 4:
-                    /* Modified Psycho Model 2 */
-                    for (ch = 0; ch < nch; ch++) {
-                        psycho_4 (&buffer[ch][0], &sam[ch][0], ch, &smr[ch][0], // snr32,
-                                (FLOAT) s_freq[header.version][header.sampling_frequency] *
-                                1000, &glopts);
-                    }
-                    break;	
-                case 5:
-                    /* Model 5 comparse model 1 and 3 */
-                    psycho_1 (buffer, max_sc, smr, &frame);
-                    fprintf(stdout,"1 ");
-                    smr_dump(smr,nch);
-                    psycho_3 (buffer, max_sc, smr, &frame, &glopts);
-                    fprintf(stdout,"3 ");
-                    smr_dump(smr,nch);
-                    break;
-                case 6:
-                    /* Model 6 compares model 2 and 4 */
-                    for (ch = 0; ch < nch; ch++) 
-                        psycho_2 (&buffer[ch][0], &sam[ch][0], ch, &smr[ch][0], //snr32,
-                                (FLOAT) s_freq[header.version][header.sampling_frequency] *
-                                1000, &glopts);
-                    fprintf(stdout,"2 ");
-                    smr_dump(smr,nch);
-                    for (ch = 0; ch < nch; ch++) 
-                        psycho_4 (&buffer[ch][0], &sam[ch][0], ch, &smr[ch][0], // snr32,
-                                (FLOAT) s_freq[header.version][header.sampling_frequency] *
-                                1000, &glopts);
-                    fprintf(stdout,"4 ");
-                    smr_dump(smr,nch);
-                    break;
-                case 7:
-                    fprintf(stdout,"Frame: %i\n",frameNum);
-                    /* Dump the SMRs for all models */	
-                    psycho_1 (buffer, max_sc, smr, &frame);
-                    fprintf(stdout,"1");
-                    smr_dump(smr, nch);
-                    psycho_3 (buffer, max_sc, smr, &frame, &glopts);
-                    fprintf(stdout,"3");
-                    smr_dump(smr,nch);
-                    for (ch = 0; ch < nch; ch++) 
-                        psycho_2 (&buffer[ch][0], &sam[ch][0], ch, &smr[ch][0], //snr32,
-                                (FLOAT) s_freq[header.version][header.sampling_frequency] *
-                                1000, &glopts);
-                    fprintf(stdout,"2");
-                    smr_dump(smr,nch);
-                    for (ch = 0; ch < nch; ch++) 
-                        psycho_4 (&buffer[ch][0], &sam[ch][0], ch, &smr[ch][0], // snr32,
-                                (FLOAT) s_freq[header.version][header.sampling_frequency] *
-                                1000, &glopts);
-                    fprintf(stdout,"4");
-                    smr_dump(smr,nch);
-                    break;
-                case 8:
-                    /* Compare 0 and 4 */	
-                    psycho_n1 (smr, nch);
-                    fprintf(stdout,"0");
-                    smr_dump(smr,nch);
-
-                    for (ch = 0; ch < nch; ch++) 
-                        psycho_4 (&buffer[ch][0], &sam[ch][0], ch, &smr[ch][0], // snr32,
-                                (FLOAT) s_freq[header.version][header.sampling_frequency] *
-                                1000, &glopts);
-                    fprintf(stdout,"4");
-                    smr_dump(smr,nch);
-                    break;
-                default:
-                    fprintf (stderr, "Invalid psy model specification: %i\n", model);
-                    exit (0);
-            }
-
-            if (glopts.quickmode == TRUE)
-                /* copy the smr values and reuse them later */
-                for (ch = 0; ch < nch; ch++) {
-                    for (sb = 0; sb < SBLIMIT; sb++)
-                        smrdef[ch][sb] = smr[ch][sb];
-                }
-
-            if (glopts.verbosity > 4) 
-                smr_dump(smr, nch);
-
-
 
+        if (toolame_encode_frame (&levels, xpad_data, xpad_len) != 0)
+            exit (1);
 
+#if defined(VLC_INPUT)
+        if (glopts.input_select == INPUT_SELECT_VLC) {
+            vlc_in_write_icy();
         }
-
-#ifdef NEWENCODE
-        sf_transmission_pattern (scalar, scfsi, &frame);
-        main_bit_allocation_new (smr, scfsi, bit_alloc, &adb, &frame, &glopts);
-        //main_bit_allocation (smr, scfsi, bit_alloc, &adb, &frame, &glopts);
-
-        if (error_protection)
-            CRC_calc (&frame, bit_alloc, scfsi, &crc);
-
-        write_header (&frame, &bs);
-        //encode_info (&frame, &bs);
-        if (error_protection)
-            putbits (&bs, crc, 16);
-        write_bit_alloc (bit_alloc, &frame, &bs);
-        //encode_bit_alloc (bit_alloc, &frame, &bs);
-        write_scalefactors(bit_alloc, scfsi, scalar, &frame, &bs);
-        //encode_scale (bit_alloc, scfsi, scalar, &frame, &bs);
-        subband_quantization_new (scalar, *sb_sample, j_scale, *j_sample, bit_alloc,
-                *subband, &frame);
-        //subband_quantization (scalar, *sb_sample, j_scale, *j_sample, bit_alloc,
-        //	  *subband, &frame);
-        write_samples_new(*subband, bit_alloc, &frame, &bs);
-        //sample_encoding (*subband, bit_alloc, &frame, &bs);
-#else
-        transmission_pattern (scalar, scfsi, &frame);
-        main_bit_allocation (smr, scfsi, bit_alloc, &adb, &frame, &glopts);
-        if (error_protection)
-            CRC_calc (&frame, bit_alloc, scfsi, &crc);
-        encode_info (&frame, &bs);
-        if (error_protection)
-            encode_CRC (crc, &bs);
-        encode_bit_alloc (bit_alloc, &frame, &bs);
-        encode_scale (bit_alloc, scfsi, scalar, &frame, &bs);
-        subband_quantization (scalar, *sb_sample, j_scale, *j_sample, bit_alloc,
-                *subband, &frame);
-        sample_encoding (*subband, bit_alloc, &frame, &bs);
 #endif
 
 
-        /* If not all the bits were used, write out a stack of zeros */
-        for (i = 0; i < adb; i++)
-            put1bit (&bs, 0);
-
-
-        if (xpad_len) {
-            assert(xpad_len > 2);
-
-            // insert available X-PAD
-            for (i = header.dab_length - xpad_len; i < header.dab_length - FPAD_LENGTH; i++)
-                putbits (&bs, xpad_data[i], 8);
-        }
-
+        governor_frame(deadline_frame_end(), input_fill_ratio);
+    }
 
-        for (i = header.dab_extension - 1; i >= 0; i--) {
-            CRC_calcDAB (&frame, bit_alloc, scfsi, scalar, &crc, i);
-            /* this crc is for the previous frame in DAB mode  */
-            if (bs.buf_byte_idx + lg_frame < bs.buf_size)
-                bs.buf[bs.buf_byte_idx + lg_frame] = crc;
-            /* reserved 2 bytes for F-PAD in DAB mode  */
-            putbits (&bs, crc, 8);
-        }
+    fprintf(stdout, "Main loop has quit with samps_read = %zu\n", samps_read);
 
-        if (xpad_len) {
-            /* The F-PAD is also given us by mot-encoder */
-            putbits (&bs, xpad_data[header.dab_length - 2], 8);
-            putbits (&bs, xpad_data[header.dab_length - 1], 8);
-        }
-        else {
-            putbits (&bs, 0, 16); // FPAD is all-zero
-        }
+    if (glopts.verbosity > 1 && (live_input || glopts.deadline_headroom > 0))
+        deadline_report(stderr);
 
-#if defined(VLC_INPUT)
-        if (glopts.input_select == INPUT_SELECT_VLC) {
-            vlc_in_write_icy();
-        }
-#endif
+    if (glopts.verbosity > 1 && glopts.quickmode)
+        quickmode_report(stderr);
 
+    if (glopts.verbosity > 1 && silence_frames() > 0)
+        silence_report(stderr);
 
-        frameBits = sstell (&bs) - sentBits;
+    if (glopts.verbosity > 1 && glopts.psy_cache_mb > 0)
+        psycache_report(stderr);
 
-        if (frameBits % 8) {	/* a program failure */
-            fprintf (stderr, "Sent %ld bits = %ld slots plus %ld\n", frameBits,
-                    frameBits / 8, frameBits % 8);
-            fprintf (stderr, "If you are reading this, the program is broken\n");
-            fprintf (stderr, "Please report a bug.\n");
-            exit(1);
-        }
+    if (glopts.verbosity > 1)
+        governor_report(stderr);
 
-        sentBits += frameBits;
+    stats_close();
 
-        // Reset peak measurement
-        peak_left = 0;
-        peak_right = 0;
-    }
+    close_bit_stream_w (&bs);
+    ladder_close ();
 
-    fprintf(stdout, "Main loop has quit with samps_read = %zu\n", samps_read);
+    /* the decoder gets the last frames when the stream is closed */
+    loopback_close ();
+    if (glopts.verbosity > 1 && glopts.loopback_interval > 0)
+        loopback_report (stderr);
 
-    close_bit_stream_w (&bs);
+    twopass_close ();
+    if (glopts.verbosity > 1 && glopts.twopass)
+        twopass_report (stderr);
 
-    if ((glopts.verbosity > 1) && (glopts.vbr == TRUE)) {
+    if ((glopts.verbosity > 1) && (glopts.vbr == TRUE) &&
+            !twopass_recording ()) {
         int i;
 #ifdef NEWENCODE
         extern int vbrstats_new[15];
@@ -567,12 +268,21 @@ int main (int argc, char **argv)
         fprintf (stdout, "\n");
     }
 
-    fprintf (stderr,
-            "Avg slots/frame = %.3f; b/smp = %.2f; bitrate = %.3f kbps\n",
-            (FLOAT) sentBits / (frameNum * 8),
-            (FLOAT) sentBits / (frameNum * 1152),
-            (FLOAT) sentBits / (frameNum * 1152) *
-            s_freq[header.version][header.sampling_frequency]);
+    if (!twopass_recording ())
+        fprintf (stderr,
+                "Avg slots/frame = %.3f; b/smp = %.2f; bitrate = %.3f kbps\n",
+                (FLOAT) toolame_sent_bits () / (frameNum * 8),
+                (FLOAT) toolame_sent_bits () / (frameNum * 1152),
+                (FLOAT) toolame_sent_bits () / (frameNum * 1152) *
+                s_freq[header.version][header.sampling_frequency]);
+
+    for (i = 0; i < ladder_count (); i++) {
+        struct ladder_output *out = ladder_get (i);
+
+        fprintf (stderr, "Ladder output '%s': bitrate = %.3f kbps\n", out->path,
+                (FLOAT) out->sent_bits / (frameNum * 1152) *
+                s_freq[header.version][header.sampling_frequency]);
+    }
 
     if (glopts.input_select == INPUT_SELECT_WAV) {
         if ( fclose (musicin.wav_input) != 0) {
@@ -597,6 +307,7 @@ void print_config (frame_info * frame, int *psy, char *inPath,
         char *outPath)
 {
     frame_header *header = frame->header;
+    int i;
 
     if (glopts.verbosity == 0)
         return;
@@ -615,9 +326,25 @@ void print_config (frame_info * frame, int *psy, char *inPath,
         fprintf (stderr, "Input VLC\n");
         fprintf (stderr, "      URI %s\n", inPath);
     }
+    else if (glopts.input_select == INPUT_SELECT_SHM) {
+        fprintf (stderr, "Input shared memory\n");
+        fprintf (stderr, "      name %s   %.1f kHz\n", inPath + 6,
+                s_freq[header->version][header->sampling_frequency]);
+    }
 
-    fprintf (stderr, "Output File: '%s'\n",
-            (strcmp (outPath, "-") ? outPath : "stdout"));
+    if (glopts.twopass == 1)
+        fprintf (stderr, "Output File: none, first pass of two-pass VBR\n");
+    else
+        fprintf (stderr, "Output File: '%s'\n",
+                (strcmp (outPath, "-") ? outPath : "stdout"));
+    for (i = 1; i < bs.num_sinks; i++)
+        fprintf (stderr, "      and  '%s'\n", sink_name (bs.sinks[i]));
+    for (i = 0; i < ladder_count (); i++) {
+        struct ladder_output *out = ladder_get (i);
+
+        fprintf (stderr, "      and  '%s' at %d kbps\n",
+                (strcmp (out->path, "-") ? out->path : "stdout"), out->brate);
+    }
     fprintf (stderr, "%d kbps ", bitrate[header->version][header->bitrate_index]);
     fprintf (stderr, "%s ", version_names[header->version]);
     if (header->mode != MPG_MD_JOINT_STEREO)
@@ -687,19 +414,51 @@ void usage (void)
 
     fprintf (stdout, "\t-W file  when using libvlc input, write the ICY-Text to file\n");
     fprintf (stdout, "\t-L       enable audio level display\n");
+    fprintf (stdout, "\t-D pct   alarm when less than pct %% of the real-time budget\n");
+    fprintf (stdout, "\t         is left after encoding a frame (dflt 10 for live inputs)\n");
+    fprintf (stdout, "\t-G pct   step down to cheaper psy models when encoding takes more\n");
+    fprintf (stdout, "\t         than pct %% of the real-time budget, and back up when\n");
+    fprintf (stdout, "\t         the upper model is expected to fit in it again\n");
     fprintf (stdout, "Output\n");
     fprintf (stdout, "\t-m mode  channel mode : s/d/j/m   (dflt %4c)\n",
             DFLT_MOD);
     fprintf (stdout, "\t-y psy   psychoacoustic model 0/1/2/3 (dflt %4u)\n",
             DFLT_PSY);
     fprintf (stdout, "\t-b br    total bitrate in kbps    (dflt 192)\n");
+    fprintf (stdout, "\t-O output\n");
+    fprintf (stdout, "\t         also write the encoded audio to output (file, named pipe,\n");
+    fprintf (stdout, "\t         tcp://, shm:// or archive://). Can be given up to %d times\n",
+            MAX_SINKS - 1);
+    fprintf (stdout, "\t-B br:output\n");
+    fprintf (stdout, "\t         also encode at bitrate br to output, sharing the\n");
+    fprintf (stdout, "\t         filterbank and psy model. Can be given up to %d times\n",
+            LADDER_MAX);
     fprintf (stdout, "\t-v lev   vbr mode\n");
+    fprintf (stdout, "\t-1 file  first pass of two-pass vbr: write the statistics\n");
+    fprintf (stdout, "\t         of the input to file, and no audio\n");
+    fprintf (stdout, "\t-2 file  second pass: vbr at an average of -b br, from file\n");
     fprintf (stdout, "\t-l lev   ATH level (dflt 0)\n");
     fprintf (stdout, "Operation\n");
     // fprintf (stdout, "\t-f       fast mode (turns off psy model)\n");
     // deprecate the -f switch. use "-y 0" instead.
     fprintf (stdout,
             "\t-q num   quick mode. only calculate psy model every num frames\n");
+    fprintf (stdout,
+            "\t-Q dB    adaptive quick mode. calculate psy model when the signal\n");
+    fprintf (stdout,
+            "\t         changed by more than dB, or every -q num frames (dflt 10)\n");
+    fprintf (stdout,
+            "\t-C mb    keep up to mb megabytes of psy model results, and reuse\n");
+    fprintf (stdout,
+            "\t         them when the same audio is encoded again (dflt 0, off)\n");
+    fprintf (stdout,
+            "\t-z lsb   send frames of a constant value up to lsb as silence,\n");
+    fprintf (stdout,
+            "\t         without running the encoder (dflt 0, -1 disables)\n");
+    fprintf (stdout,
+            "\t-k num   decode every num frames again, and check their CRCs,\n");
+    fprintf (stdout,
+            "\t         SNR and NMR on a low priority thread (dflt 0, off)\n");
     fprintf (stdout, "Misc\n");
     fprintf (stdout, "\t-d emp   de-emphasis n/5/c        (dflt %4c)\n",
             DFLT_EMP);
@@ -712,13 +471,25 @@ void usage (void)
     fprintf (stdout, "\t-P file  "
             "read X-PAD data from mot-encoder from the specified file\n");
     fprintf (stdout, "\t-t       talkativity 0=no messages (dflt 2)\n");
+    fprintf (stdout, "\t-S dest  write statistics every second to a file,\n");
+    fprintf (stdout, "\t         or to a unix socket given as unix:/path\n");
+    fprintf (stdout, "\t-F fmt   statistics format json/prometheus (dflt json)\n");
+    fprintf (stdout, "\t-Z n[:drop]\n");
+    fprintf (stdout, "\t         frames queued for each ZMQ sender thread (dflt %d),\n",
+            ZMQ_QUEUE_DEFAULT);
+    fprintf (stdout, "\t         dropping the oldest or newest when full (dflt oldest)\n");
     fprintf (stdout, "Files\n");
     fprintf (stdout,
             "\tinput    input sound file. (WAV,AIFF,PCM or use '/dev/stdin')\n");
+    fprintf (stdout, "\t         prefix with shm:// to read PCM from shared memory\n");
     fprintf (stdout, "\toutput   output bit stream of encoded audio\n");
     fprintf (stdout, "\t         prefix with tcp:// to use a ZMQ output\n");
     fprintf (stdout, "\t         Several ZMQ destinations can be given,\n");
     fprintf (stdout, "\t         separated by semicolons.\n");
+    fprintf (stdout, "\t         prefix with shm:// to write to shared memory\n");
+    fprintf (stdout, "\t         archive://prefix[:seconds[:mb]] writes segments of seconds\n");
+    fprintf (stdout, "\t         (dflt %d) or mb megabytes, with an index of the frames\n",
+            ARCHIVE_SECONDS);
     fprintf (stdout,
             "\n\tAllowable bitrates for 16, 22.05 and 24kHz sample input\n");
     fprintf (stdout,
@@ -773,12 +544,20 @@ void short_usage (void)
  * -y  is followed by the psychoacoustic model number
  * -s  is followed by the sampling rate
  * -b  is followed by the total bitrate, irrespective of the mode
+ * -B  is followed by kbps:output, an additional output at another bitrate
+ * -O  is followed by another destination for the output
+ * -Z  is followed by the ZMQ queue depth, and :oldest or :newest
  * -d  is followed by the emphasis flag
  * -c  is followed by the copyright/no_copyright flag
  * -o  is followed by the original/not_original flag
  * -e  is followed by the error_protection on/off flag
  * -f  turns off psy model (fast mode)
  * -q <i>  only calculate psy model every ith frame
+ * -C  is followed by the size of the psy model cache in MB
+ * -z  is followed by the largest constant value sent as silence, or -1
+ * -k  is followed by the interval of the frames to decode again
+ * -1  is followed by the statistics file of the first pass of two-pass VBR
+ * -2  is followed by the statistics file of the second pass
  * -a  downmix from stereo to mono 
  * -r  turn off padding bits in frames.
  * -x  force byte swapping of input
@@ -793,7 +572,7 @@ void short_usage (void)
  ************************************************************************/
 
 void parse_args (int argc, char **argv, frame_info * frame, int *psy,
-        unsigned long *num_samples, char inPath[MAX_NAME_SIZE],
+        uint64_t *num_samples, char inPath[MAX_NAME_SIZE],
         char outPath[MAX_NAME_SIZE], char **mot_file, char **icy_file)
 {
     FLOAT srate;
@@ -801,6 +580,10 @@ void parse_args (int argc, char **argv, frame_info * frame, int *psy,
     frame_header *header = frame->header;
     int err = 0, i = 0;
     long samplerate = 0;
+    /* the additional outputs given with -O */
+    char *sinks[MAX_SINKS - 1];
+    int num_sinks = 0, s;
+    char *end;
 
     /* preset defaults */
     inPath[0] = '\0';
@@ -911,6 +694,28 @@ void parse_args (int argc, char **argv, frame_info * frame, int *psy,
                         glopts.show_level = 1;
                         break;
 
+                    case 'D':
+                        argUsed = 1;
+                        glopts.deadline_headroom = atoi (arg);
+                        if (glopts.deadline_headroom < 0 ||
+                                glopts.deadline_headroom >= 100) {
+                            fprintf (stderr, "%s: -D headroom must be 0..99 not %s\n",
+                                    programName, arg);
+                            err = 1;
+                        }
+                        break;
+
+                    case 'G':
+                        argUsed = 1;
+                        glopts.governor_target = atoi (arg);
+                        if (glopts.governor_target <= 0 ||
+                                glopts.governor_target > 100) {
+                            fprintf (stderr, "%s: -G load must be 1..100 not %s\n",
+                                    programName, arg);
+                            err = 1;
+                        }
+                        break;
+
                     case 's':
                         argUsed = 1;
                         srate = atof (arg);
@@ -929,6 +734,40 @@ void parse_args (int argc, char **argv, frame_info * frame, int *psy,
                         argUsed = 1;
                         brate = atoi (arg);
                         break;
+                    case 'O':
+                        argUsed = 1;
+                        if (num_sinks == MAX_SINKS - 1) {
+                            fprintf (stderr, "%s: -O can be given at most %d times\n",
+                                    programName, MAX_SINKS - 1);
+                            err = 1;
+                        }
+                        else
+                            sinks[num_sinks++] = arg;
+                        break;
+                    case 'Z':
+                        argUsed = 1;
+                        glopts.zmq_queue_depth = strtol (arg, &end, 10);
+                        if (*end == ':' && strcmp (end + 1, "newest") == 0)
+                            glopts.zmq_drop_newest = TRUE;
+                        else if (*end == ':' && strcmp (end + 1, "oldest") == 0)
+                            glopts.zmq_drop_newest = FALSE;
+                        else if (*end != '\0')
+                            glopts.zmq_queue_depth = 0;
+                        if (glopts.zmq_queue_depth < 1 ||
+                                glopts.zmq_queue_depth > 1024) {
+                            fprintf (stderr, "%s: -Z must be 1..1024[:oldest|:newest] not %s\n",
+                                    programName, arg);
+                            err = 1;
+                        }
+                        break;
+                    case 'B':
+                        argUsed = 1;
+                        if (ladder_add (arg) != 0) {
+                            fprintf (stderr, "%s: -B must be kbps:output not %s\n",
+                                    programName, arg);
+                            err = 1;
+                        }
+                        break;
                     case 'd':
                         argUsed = 1;
                         if (*arg == 'n')
@@ -975,6 +814,46 @@ void parse_args (int argc, char **argv, frame_info * frame, int *psy,
                             glopts.quickcount = FALSE;
                         }
                         break;
+                    case 'Q':
+                        argUsed = 1;
+                        glopts.quickmode = TRUE;
+                        glopts.usepsy = TRUE;
+                        glopts.quickthreshold = atof (arg);
+                        if (glopts.quickthreshold <= 0) {
+                            fprintf (stderr, "%s: -Q threshold must be positive not %s\n",
+                                    programName, arg);
+                            err = 1;
+                        }
+                        break;
+                    case 'C':
+                        argUsed = 1;
+                        glopts.psy_cache_mb = strtol (arg, &end, 10);
+                        if (*end != '\0' || glopts.psy_cache_mb < 0 ||
+                                glopts.psy_cache_mb > 65536) {
+                            fprintf (stderr, "%s: -C must be 0..65536 MB not %s\n",
+                                    programName, arg);
+                            err = 1;
+                        }
+                        break;
+                    case 'z':
+                        argUsed = 1;
+                        glopts.silence_threshold = strtol (arg, &end, 10);
+                        if (*end != '\0' || glopts.silence_threshold < -1 ||
+                                glopts.silence_threshold > 32767) {
+                            fprintf (stderr, "%s: -z must be -1..32767 not %s\n",
+                                    programName, arg);
+                            err = 1;
+                        }
+                        break;
+                    case 'k':
+                        argUsed = 1;
+                        glopts.loopback_interval = strtol (arg, &end, 10);
+                        if (*end != '\0' || glopts.loopback_interval < 0) {
+                            fprintf (stderr, "%s: -k must be 0 or more frames not %s\n",
+                                    programName, arg);
+                            err = 1;
+                        }
+                        break;
                     case 'a':
                         glopts.downmix = TRUE;
                         header->mode = MPG_MD_MONO;
@@ -995,6 +874,18 @@ void parse_args (int argc, char **argv, frame_info * frame, int *psy,
                         header->mode = MPG_MD_STEREO; /* force stereo mode */
                         header->mode_ext = 0;
                         break;
+                    case '1':
+                    case '2':
+                        argUsed = 1;
+                        glopts.twopass = c - '0';
+                        glopts.twopass_file = arg;
+                        glopts.vbr = TRUE;
+                        glopts.usepadbit = FALSE;
+                        header->padding = 0;
+                        /* as for -v */
+                        header->mode = MPG_MD_STEREO;
+                        header->mode_ext = 0;
+                        break;
                     case 'V':
                         glopts.input_select = INPUT_SELECT_VLC;
                         break;
@@ -1016,6 +907,19 @@ void parse_args (int argc, char **argv, frame_info * frame, int *psy,
                         argUsed = 1;
                         glopts.verbosity = atoi (arg);
                         break;
+                    case 'S':
+                        argUsed = 1;
+                        glopts.stats_target = arg;
+                        break;
+                    case 'F':
+                        argUsed = 1;
+                        glopts.stats_format = stats_parse_format (arg);
+                        if (glopts.stats_format == -1) {
+                            fprintf (stderr, "%s: -F format must be json/prometheus not %s\n",
+                                    programName, arg);
+                            err = 1;
+                        }
+                        break;
                     default:
                         fprintf (stderr, "%s: unrec option %c\n", programName, c);
                         err = 1;
@@ -1054,6 +958,10 @@ void parse_args (int argc, char **argv, frame_info * frame, int *psy,
     if (glopts.input_select != INPUT_SELECT_JACK && inPath[0] == '\0')
         usage ();			/* If not in jack-mode and no file specified, then call usage() */
 
+    if (glopts.input_select == INPUT_SELECT_WAV &&
+            strncmp (inPath, "shm://", 6) == 0)
+        glopts.input_select = INPUT_SELECT_SHM;
+
     if (outPath[0] == '\0') {
         /* replace old extension with new one, 1992-08-19, 1995-06-12 shn */
         new_ext (inPath, DFLT_EXT, outPath);
@@ -1062,7 +970,7 @@ void parse_args (int argc, char **argv, frame_info * frame, int *psy,
     if (glopts.input_select == INPUT_SELECT_JACK) {
 #if defined(JACK_INPUT)
         musicin.jack_name = inPath;
-        *num_samples = MAX_U_32_NUM;
+        *num_samples = MAX_U_64_NUM;
 
         setup_jack(header, musicin.jack_name);
 #else
@@ -1073,7 +981,8 @@ void parse_args (int argc, char **argv, frame_info * frame, int *psy,
     else if (glopts.input_select == INPUT_SELECT_WAV) {
         if (!strcmp (inPath, "-")) {
             musicin.wav_input = stdin;		/* read from stdin */
-            *num_samples = MAX_U_32_NUM;
+            setvbuf (stdin, NULL, _IOFBF, INPUT_READ_SIZE);
+            *num_samples = MAX_U_64_NUM;
         } else {
             if ((musicin.wav_input = fopen (inPath, "rb")) == NULL) {
                 fprintf (stderr, "Could not find \"%s\".\n", inPath);
@@ -1087,7 +996,7 @@ void parse_args (int argc, char **argv, frame_info * frame, int *psy,
             fprintf (stderr, "Samplerate not specified\n");
             exit (1);
         }
-        *num_samples = MAX_U_32_NUM;
+        *num_samples = MAX_U_64_NUM;
         int channels = (header->mode == MPG_MD_MONO) ? 1 : 2;
 #if defined(VLC_INPUT)
         if (vlc_in_prepare(glopts.verbosity, samplerate, inPath, channels, *icy_file) != 0) {
@@ -1099,6 +1008,15 @@ void parse_args (int argc, char **argv, frame_info * frame, int *psy,
         exit(1);
 #endif
     }
+    else if (glopts.input_select == INPUT_SELECT_SHM) {
+        int in_nch = (header->mode != MPG_MD_MONO || glopts.downmix) ? 2 : 1;
+
+        *num_samples = MAX_U_64_NUM;
+        if (shm_in_prepare (inPath + 6, in_nch) != 0) {
+            fprintf (stderr, "Shared memory input initialisation failed\n");
+            exit (1);
+        }
+    }
     else {
         fprintf(stderr, "INVALID INPUT\n");
         exit(1);
@@ -1113,33 +1031,29 @@ void parse_args (int argc, char **argv, frame_info * frame, int *psy,
     if ((header->bitrate_index = BitrateIndex (brate, header->version)) < 0)
         err = 1;
 
-    if (header->dab_extension) {
-        /* in 48 kHz (= MPEG-1) */
-        /* if the bit rate per channel is less then 56 kbit/s, we have 2 scf-crc */
-        /* else we have 4 scf-crc */
-        /* in 24 kHz (= MPEG-2), we have 4 scf-crc */
-        if (header->version == MPEG_AUDIO_ID && (brate / (header->mode == MPG_MD_MONO ? 1 : 2) < 56))
-            header->dab_extension = 2;
-    }
+    if (header->dab_extension)
+        header->dab_extension = dab_scf_crc_count (header);
+
+    /* 24ms of audio, the unit of the ZMQ output */
+    bs.frame_size = 3 * brate;
 
-    bs.zmq_framesize = 3 * brate;
+    zmqoutput_set_queue (glopts.zmq_queue_depth, glopts.zmq_drop_newest);
+    sink_set_live (glopts.input_select == INPUT_SELECT_JACK ||
+                   glopts.input_select == INPUT_SELECT_VLC ||
+                   glopts.input_select == INPUT_SELECT_SHM);
 
     /* All options are hunky dory, open the input audio file and
        return to the main drag */
-    open_bit_stream_w (&bs, outPath, BUFFER_SIZE);
-}
-
+    if (glopts.twopass == 1) {
+        /* the first pass of two-pass VBR writes no audio */
+        open_bit_stream_w (&bs, NULL, BUFFER_SIZE);
+        return;
+    }
 
-void smr_dump(double smr[2][SBLIMIT], int nch) {
-    int ch, sb;
+    open_bit_stream_w (&bs, outPath, BUFFER_SIZE);
+    for (s = 0; s < num_sinks; s++)
+        add_bit_stream_sink (&bs, sinks[s]);
 
-    fprintf(stdout,"SMR:");
-    for (ch = 0;ch<nch; ch++) {
-        if (ch==1)
-            fprintf(stdout,"    ");
-        for (sb=0;sb<SBLIMIT;sb++)
-            fprintf(stdout,"%3.0f ",smr[ch][sb]);
-        fprintf(stdout,"\n");
-    }
+    if (ladder_open (header, &glopts) != 0)
+        exit (1);
 }
-
@@ -0,0 +1,319 @@
+/* Two-pass VBR, see twopass.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include "common.h"
+#include "options.h"
+#include "availbits.h"
+#include "encode_new.h"
+#include "libtoolame_priv.h"
+#include "twopass.h"
+
+/* The statistics file is a header of HEADER_SIZE bytes, followed by the
+ * bits of every level of every frame, 16-bit little-endian:
+ *   0  "TL2P"
+ *   4  format version
+ *   5  channels
+ *   6  MPEG version
+ *   7  sampling frequency index
+ *   8  bitrate index, which sets the allocation table
+ *   9  number of levels
+ *   10 MNR of the first level in dB, signed
+ *   11 dB between levels
+ */
+#define HEADER_SIZE 12
+#define FORMAT_VERSION 1
+
+/* Prices of the bits searched, and the steps of the bisection */
+#define PRICE_MIN 1e-12
+#define PRICE_MAX 1e3
+#define PRICE_STEPS 100
+
+static int pass = 0;
+static FILE *file = NULL;
+static const char *file_path;
+
+/* second pass: the bitrate index of every frame */
+static unsigned char *indices = NULL;
+static long num_frames = 0;
+static long next_frame = 0;
+static double target_kbps, chosen_kbps;
+
+/* first pass */
+static long recorded = 0;
+
+static void make_header(unsigned char *h, frame_info *frame)
+{
+    frame_header *header = frame->header;
+
+    memcpy(h, "TL2P", 4);
+    h[4] = FORMAT_VERSION;
+    h[5] = frame->nch;
+    h[6] = header->version;
+    h[7] = header->sampling_frequency;
+    h[8] = header->bitrate_index;
+    h[9] = TWOPASS_LEVELS;
+    h[10] = (unsigned char)(signed char)TWOPASS_MNR_MIN;
+    h[11] = TWOPASS_MNR_STEP;
+}
+
+/* Bits of a frame at bitrate index, as encode_output() gives them to the
+ * bit allocation */
+static int frame_bits(frame_header *header, int index)
+{
+    frame_header h = *header;
+
+    h.bitrate_index = index;
+    return available_bits(&h, &glopts) -
+        (header->dab_extension + FPAD_LENGTH) * 8;
+}
+
+/* Noise of the frame with bits to spend, from the bits each level needs */
+static double frame_noise(const uint16_t *need, int bits)
+{
+    int level;
+
+    for (level = TWOPASS_LEVELS - 1; level >= 0; level--)
+        if (need[level] <= bits)
+            break;
+
+    /* below the lowest level, the frame counts as one level under it */
+    return pow(10.0, -(TWOPASS_MNR_MIN + level * TWOPASS_MNR_STEP) / 10.0);
+}
+
+/* Choose the bitrate of every frame for a price of the bits, and return
+ * the bits of the whole stream */
+static double choose(double noise[][15], const int *bits, int lower,
+        int upper, double price)
+{
+    double total = 0;
+    long f;
+    int i;
+
+    for (f = 0; f < num_frames; f++) {
+        int best = lower;
+        double best_cost = noise[f][lower] + price * bits[lower];
+
+        for (i = lower + 1; i <= upper; i++) {
+            double cost = noise[f][i] + price * bits[i];
+
+            if (cost < best_cost) {
+                best = i;
+                best_cost = cost;
+            }
+        }
+        indices[f] = best;
+        total += bits[best];
+    }
+    return total;
+}
+
+/* Choose the bitrate of every frame from the bits they need */
+static int plan(frame_info *frame, const uint16_t *need)
+{
+    frame_header *header = frame->header;
+    double (*noise)[15];
+    int bits[15];
+    int lower, upper, i;
+    double low, high, target;
+    long f;
+    int step;
+
+    vbr_limits_new(frame, &lower, &upper);
+    if (header->bitrate_index < lower || header->bitrate_index > upper) {
+        fprintf(stderr, "Two-pass VBR: the bitrate must be between %d and "
+                "%d kbps\n", bitrate[header->version][lower],
+                bitrate[header->version][upper]);
+        return -1;
+    }
+
+    for (i = lower; i <= upper; i++)
+        bits[i] = frame_bits(header, i);
+
+    noise = malloc(num_frames * sizeof(*noise));
+    indices = malloc(num_frames);
+    if (noise == NULL || indices == NULL) {
+        fprintf(stderr, "Unable to allocate the two-pass VBR plan\n");
+        free(noise);
+        return -1;
+    }
+    for (f = 0; f < num_frames; f++)
+        for (i = lower; i <= upper; i++)
+            noise[f][i] = frame_noise(need + f * TWOPASS_LEVELS, bits[i]);
+
+    /* the bits of the frames at the bitrate asked for */
+    target = (double)num_frames * bits[header->bitrate_index];
+
+    /* the lowest price that fits, on a log scale */
+    low = log(PRICE_MIN);
+    high = log(PRICE_MAX);
+    if (choose(noise, bits, lower, upper, PRICE_MIN) > target) {
+        for (step = 0; step < PRICE_STEPS; step++) {
+            double mid = (low + high) / 2;
+
+            if (choose(noise, bits, lower, upper, exp(mid)) > target)
+                low = mid;
+            else
+                high = mid;
+        }
+        choose(noise, bits, lower, upper, exp(high));
+    }
+
+    free(noise);
+
+    target_kbps = bitrate[header->version][header->bitrate_index];
+    chosen_kbps = 0;
+    for (f = 0; f < num_frames; f++)
+        chosen_kbps += bitrate[header->version][indices[f]];
+    if (num_frames > 0)
+        chosen_kbps /= num_frames;
+    return 0;
+}
+
+static int read_stats(frame_info *frame)
+{
+    unsigned char header[HEADER_SIZE], expected[HEADER_SIZE];
+    unsigned char raw[2 * TWOPASS_LEVELS];
+    uint16_t *need = NULL;
+    long size = 0, f;
+    int level, ret;
+
+    if (fread(header, 1, HEADER_SIZE, file) != HEADER_SIZE ||
+            memcmp(header, "TL2P", 4) != 0 || header[4] != FORMAT_VERSION) {
+        fprintf(stderr, "\"%s\" is not from a first pass (-1)\n", file_path);
+        return -1;
+    }
+    make_header(expected, frame);
+    if (memcmp(header, expected, HEADER_SIZE) != 0) {
+        fprintf(stderr, "\"%s\" is from a first pass with another "
+                "sampling rate, bitrate or mode\n", file_path);
+        return -1;
+    }
+
+    for (f = 0; fread(raw, 1, sizeof(raw), file) == sizeof(raw); f++) {
+        if (f == size) {
+            uint16_t *grown;
+
+            size = size ? 2 * size : 4096;
+            grown = realloc(need, size * sizeof(raw));
+            if (grown == NULL) {
+                fprintf(stderr, "Unable to allocate the two-pass VBR plan\n");
+                free(need);
+                return -1;
+            }
+            need = grown;
+        }
+        for (level = 0; level < TWOPASS_LEVELS; level++)
+            need[f * TWOPASS_LEVELS + level] =
+                raw[2 * level] | (raw[2 * level + 1] << 8);
+    }
+    num_frames = f;
+
+    ret = plan(frame, need);
+    free(need);
+    return ret;
+}
+
+int twopass_init(int pass_num, const char *path, frame_info *frame)
+{
+    pass = pass_num;
+    file_path = path;
+
+    if (pass == 1) {
+        unsigned char header[HEADER_SIZE];
+
+        if ((file = fopen(path, "wb")) == NULL) {
+            fprintf(stderr, "Could not create \"%s\": %s\n", path,
+                    strerror(errno));
+            return -1;
+        }
+        make_header(header, frame);
+        fwrite(header, 1, HEADER_SIZE, file);
+    }
+    else if (pass == 2) {
+        int ret;
+
+        if ((file = fopen(path, "rb")) == NULL) {
+            fprintf(stderr, "Could not open \"%s\": %s\n", path,
+                    strerror(errno));
+            return -1;
+        }
+        ret = read_stats(frame);
+        fclose(file);
+        file = NULL;
+        return ret;
+    }
+
+    return 0;
+}
+
+int twopass_recording(void)
+{
+    return pass == 1;
+}
+
+void twopass_record(double smr[2][SBLIMIT], unsigned int scalar[2][3][SBLIMIT],
+        frame_info *frame)
+{
+    static unsigned int scfsi[2][SBLIMIT], bit_alloc[2][SBLIMIT];
+    unsigned char raw[2 * TWOPASS_LEVELS];
+    int level;
+
+    encode_select_table(frame);
+    sf_transmission_pattern(scalar, scfsi, frame);
+
+    for (level = 0; level < TWOPASS_LEVELS; level++) {
+        int need = bits_for_nonoise_new(smr, scfsi, frame,
+                TWOPASS_MNR_MIN + level * TWOPASS_MNR_STEP, bit_alloc);
+
+        if (need > 0xffff)
+            need = 0xffff;
+        raw[2 * level] = need & 0xff;
+        raw[2 * level + 1] = need >> 8;
+    }
+
+    fwrite(raw, 1, sizeof(raw), file);
+    recorded++;
+}
+
+int twopass_replaying(void)
+{
+    return pass == 2;
+}
+
+int twopass_next_index(int guess)
+{
+    if (next_frame < num_frames)
+        guess = indices[next_frame];
+    next_frame++;
+    return guess;
+}
+
+void twopass_close(void)
+{
+    if (file == NULL)
+        return;
+
+    if (fclose(file) != 0)
+        fprintf(stderr, "Could not write \"%s\": %s\n", file_path,
+                strerror(errno));
+    file = NULL;
+}
+
+void twopass_report(FILE *fd)
+{
+    if (pass == 1)
+        fprintf(fd, "Two-pass VBR: %ld frames recorded to \"%s\"\n",
+                recorded, file_path);
+    else if (pass == 2) {
+        fprintf(fd, "Two-pass VBR: %ld frames planned at %.1f kbps for "
+                "%.0f kbps\n", num_frames, chosen_kbps, target_kbps);
+        if (next_frame != num_frames)
+            fprintf(fd, "Two-pass VBR: %ld frames were encoded, the input "
+                    "is not the one of the first pass\n", next_frame);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef _TWOPASS_H_
+#define _TWOPASS_H_
+
+#include <stdio.h>
+#include "common.h"
+
+/* Two-pass VBR for file encoding
+ *
+ * VBR (-v) gives every frame the lowest bitrate at which all of its
+ * subbands reach the MNR asked for, as bits_for_nonoise_new() counts
+ * them, within the bitrates the allocation table allows. Loud passages
+ * end up at the upper limit, and the size of the file is only known
+ * once it is encoded.
+ *
+ * The first pass (-1 file) runs the filterbank and the psy model only.
+ * For every frame, it records the bits that bits_for_nonoise_new() asks
+ * for to reach each MNR of a ladder of TWOPASS_LEVELS levels, from
+ * TWOPASS_MNR_MIN dB in steps of TWOPASS_MNR_STEP dB. No audio is
+ * encoded, and the outputs are not opened. The filterbank and the psy
+ * model take most of the time of an encode, so the pass is only about
+ * 1.5 times faster; quick mode (-q) skips most runs of the psy model.
+ *
+ * The second pass (-2 file) reads them back, and chooses the bitrate of
+ * every frame so that the average does not exceed the bitrate given
+ * with -b, with the lowest total noise. The noise of a frame at a
+ * bitrate is the noise to mask ratio of the highest level its bits
+ * reach. For a price of the bits, every frame takes the bitrate at which
+ * its noise plus the price of its bits is the lowest, and the price is
+ * searched for by bisection. The bits are then allocated as for -v.
+ *
+ * Both passes must be given the same input, bitrate and mode.
+ */
+
+#define TWOPASS_LEVELS   16
+#define TWOPASS_MNR_MIN  -12
+#define TWOPASS_MNR_STEP 3
+
+/* Setup the pass (1 or 2) for the stream of frame, with the statistics
+ * in path. A pass of 0 disables two-pass VBR.
+ * returns 0  on success
+ *         -1 on failure
+ */
+int twopass_init(int pass, const char *path, frame_info *frame);
+
+/* Tell whether this is the first pass, which only records the frames */
+int twopass_recording(void);
+
+/* Record the bits the frame needs. scalar is changed */
+void twopass_record(double smr[2][SBLIMIT], unsigned int scalar[2][3][SBLIMIT],
+        frame_info *frame);
+
+/* Tell whether this is the second pass */
+int twopass_replaying(void);
+
+/* The bitrate index of the next frame of the second pass. Past the
+ * frames of the first pass, guess is returned */
+int twopass_next_index(int guess);
+
+/* Write out the statistics of the first pass */
+void twopass_close(void);
+
+/* Print what the pass did */
+void twopass_report(FILE *fd);
+
+#endif
@@ -41,6 +41,9 @@ struct icywriter_task_data icy_task_data;
 
 pthread_mutex_t buffer_lock = PTHREAD_MUTEX_INITIALIZER;
 
+// The limit handleStream applies to the length of the buffer list
+size_t vlc_buffer_max_length = 0;
+
 struct vlc_buffer* vlc_buffer_new()
 {
     struct vlc_buffer* node;
@@ -108,6 +111,8 @@ void handleStream_size_t(
     for (;;) {
         pthread_mutex_lock(&buffer_lock);
 
+        vlc_buffer_max_length = max_length;
+
         if (vlc_buffer_totalsize(head_buffer) < max_length) {
             struct vlc_buffer* newbuf = vlc_buffer_new();
 
@@ -323,6 +328,17 @@ ssize_t vlc_in_read(void *buf, size_t len)
     abort();
 }
 
+void vlc_in_buffer_fill(size_t *fill, size_t *capacity)
+{
+    pthread_mutex_lock(&buffer_lock);
+    *fill = vlc_buffer_totalsize(head_buffer);
+    *capacity = vlc_buffer_max_length;
+    pthread_mutex_unlock(&buffer_lock);
+
+    *fill /= sizeof(int16_t) * vlc_channels;
+    *capacity /= sizeof(int16_t) * vlc_channels;
+}
+
 // This task is run in a separate thread
 void* vlc_in_write_icy_task(void* arg)
 {
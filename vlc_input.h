@@ -29,6 +29,10 @@ ssize_t vlc_in_read(void *buf, size_t len);
 
 void vlc_in_write_icy(void);
 
+// Get the number of samples per channel waiting in the buffer list,
+// and the maximum the list will hold
+void vlc_in_buffer_fill(size_t *fill, size_t *capacity);
+
 #  endif // VLC_INPUT
 #endif // __VLC_INPUT_H_
 
@@ -2,37 +2,206 @@
 #include <zmq.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include "common.h"
+#include "deadline.h"
+#include "sink.h"
 
+#define LOAD(p)       __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE(p, v)   __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define ADD(p, v)     __atomic_add_fetch((p), (v), __ATOMIC_RELAXED)
+
+/* One queued frame. The fields are accessed atomically, because the
+ * encoder may read a slot to drop it while the sender thread reads it */
+struct zmq_slot {
+    struct sink_frame *frame;
+    int peak_left;
+    int peak_right;
+    uint64_t queued_us;
+};
+
+struct zmq_output {
+    void *sock;
+    char *uris;
+    pthread_t thread;
+
+    /* The encoder writes at head, the sender thread reads at tail.
+     * Both count up forever. To drop the oldest frame, the encoder
+     * moves tail too, which is why tail is only moved by compare
+     * and swap */
+    struct zmq_slot *slots;
+    uint64_t depth;
+    uint64_t head;
+    uint64_t tail;
+    int drop_newest;
+    sem_t ready;
+    int stop;
+
+    uint64_t queued_max;
+    uint64_t sent;
+    uint64_t drops;
+    uint64_t latency_sum_us;
+    uint64_t latency_max_us;
+
+    struct zmq_output *next;
+};
+
+// One context for all the outputs, and the number of sockets using it
 static void *zmq_context;
+static int zmq_sockets = 0;
 
-// Buffer containing at maximum one frame
-unsigned char* zmqbuf;
+static struct zmq_output *outputs = NULL;
 
-// The current data length (smaller than allocated
-// buffer size)
-size_t zmqbuf_len;
+static int queue_depth = ZMQ_QUEUE_DEFAULT;
+static int queue_drop_newest = 0;
 
 static int zmq_peak_left = 0;
 static int zmq_peak_right = 0;
 
+static unsigned long zmq_drops = 0;
+
+unsigned long zmqoutput_get_drops(void)
+{
+    return LOAD(&zmq_drops);
+}
+
 void zmqoutput_set_peaks(int left, int right)
 {
     zmq_peak_left = left;
     zmq_peak_right = right;
 }
 
-int zmqoutput_open(Bit_stream_struc *bs, const char* uri_list)
+void zmqoutput_get_peaks(int *left, int *right)
+{
+    *left = zmq_peak_left;
+    *right = zmq_peak_right;
+}
+
+void zmqoutput_set_queue(int depth, int drop_newest)
+{
+    queue_depth = depth;
+    queue_drop_newest = drop_newest;
+}
+
+static void count_drop(struct zmq_output *out)
+{
+    ADD(&out->drops, 1);
+    ADD(&zmq_drops, 1);
+}
+
+/* Take the frame at tail, if tail did not move in the meantime */
+static int take_slot(struct zmq_output *out, uint64_t tail,
+        struct zmq_slot *slot)
+{
+    struct zmq_slot *s = &out->slots[tail % out->depth];
+
+    slot->frame = LOAD(&s->frame);
+    slot->peak_left = LOAD(&s->peak_left);
+    slot->peak_right = LOAD(&s->peak_right);
+    slot->queued_us = LOAD(&s->queued_us);
+
+    return __atomic_compare_exchange_n(&out->tail, &tail, tail + 1, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static int send_slot(struct zmq_output *out, const struct zmq_slot *slot)
+{
+    struct sink_frame *frame = slot->frame;
+    int frame_length = sizeof(struct zmq_frame_header) + frame->len;
+
+    struct zmq_frame_header* header =
+        malloc(frame_length);
+
+    uint8_t* txframe = ((uint8_t*)header) + sizeof(struct zmq_frame_header);
+
+    header->version          = 1;
+    header->encoder          = ZMQ_ENCODER_TOOLAME;
+    header->datasize         = frame->len;
+    header->audiolevel_left  = slot->peak_left;
+    header->audiolevel_right = slot->peak_right;
+
+    memcpy(txframe, frame->data, frame->len);
+
+    int send_error = zmq_send(out->sock, header, frame_length,
+            ZMQ_DONTWAIT);
+
+    free(header);
+    header = NULL;
+
+    if (send_error < 0) {
+        /* Only the first failure is logged, the others are counted */
+        if (LOAD(&out->drops) == 0)
+            fprintf(stderr, "ZeroMQ send to %s failed! %s\n", out->uris,
+                    zmq_strerror(errno));
+        count_drop(out);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void *sender_thread(void *arg)
+{
+    struct zmq_output *out = arg;
+
+    for (;;) {
+        struct zmq_slot slot;
+        uint64_t tail;
+        int taken = 0;
+
+        sem_wait(&out->ready);
+
+        /* the semaphore also counts frames the encoder dropped since */
+        tail = LOAD(&out->tail);
+        while (tail != LOAD(&out->head)) {
+            if ((taken = take_slot(out, tail, &slot)))
+                break;
+            tail = LOAD(&out->tail);
+        }
+
+        if (!taken) {
+            if (LOAD(&out->stop))
+                break;
+            continue;
+        }
+
+        if (send_slot(out, &slot) == 0) {
+            uint64_t latency = deadline_now_us() - slot.queued_us;
+
+            ADD(&out->sent, 1);
+            ADD(&out->latency_sum_us, latency);
+            if (latency > LOAD(&out->latency_max_us))
+                STORE(&out->latency_max_us, latency);
+        }
+        sink_frame_unref(slot.frame);
+    }
+
+    return NULL;
+}
+
+struct zmq_output *zmqoutput_open(const char* uri_list)
 {
-    zmq_context = zmq_ctx_new();
-    bs->zmq_sock = zmq_socket(zmq_context, ZMQ_PUB);
-    if (bs->zmq_sock == NULL) {
+    struct zmq_output *out = calloc(1, sizeof(*out));
+    if (out == NULL) {
+        fprintf(stderr, "Unable to allocate the ZMQ output\n");
+        return NULL;
+    }
+
+    if (zmq_context == NULL)
+        zmq_context = zmq_ctx_new();
+    out->sock = zmq_socket(zmq_context, ZMQ_PUB);
+    if (out->sock == NULL) {
         fprintf(stderr, "Error occurred during zmq_socket: %s\n",
                 zmq_strerror(errno));
-        return -1;
+        free(out);
+        return NULL;
     }
+    zmq_sockets++;
 
-    char* uris = strdup(uri_list);
+    out->uris = strdup(uri_list);
+    char* uris_copy = strdup(uri_list);
+    char* uris = uris_copy;
     char* saveptr = NULL;
 
     for (; ; uris = NULL) {
@@ -41,11 +210,11 @@ int zmqoutput_open(Bit_stream_struc *bs, const char* uri_list)
 
         if (uri) {
             fprintf(stderr, "Connecting ZMQ to %s\n", uri);
-            if (zmq_connect(bs->zmq_sock, uri) != 0) {
+            if (zmq_connect(out->sock, uri) != 0) {
                 fprintf(stderr, "Error occurred during zmq_connect: %s\n",
                         zmq_strerror(errno));
-                free(uris);
-                return -1;
+                free(uris_copy);
+                goto fail;
             }
         }
         else {
@@ -53,68 +222,135 @@ int zmqoutput_open(Bit_stream_struc *bs, const char* uri_list)
         }
     }
 
-    free(uris);
+    free(uris_copy);
 
-    zmqbuf = (unsigned char*)malloc(bs->zmq_framesize);
-    if (zmqbuf == NULL) {
-        fprintf(stderr, "Unable to allocate ZMQ buffer\n");
-        exit(0);
+    out->depth = queue_depth;
+    out->drop_newest = queue_drop_newest;
+    out->slots = calloc(out->depth, sizeof(*out->slots));
+    if (out->slots == NULL) {
+        fprintf(stderr, "Unable to allocate the ZMQ queue\n");
+        goto fail;
     }
-    zmqbuf_len = 0;
-    return 0;
+
+    sem_init(&out->ready, 0, 0);
+    if (pthread_create(&out->thread, NULL, sender_thread, out) != 0) {
+        fprintf(stderr, "Unable to start the ZMQ sender thread\n");
+        sem_destroy(&out->ready);
+        goto fail;
+    }
+
+    out->next = outputs;
+    outputs = out;
+    return out;
+
+fail:
+    zmq_close(out->sock);
+    zmq_sockets--;
+    free(out->slots);
+    free(out->uris);
+    free(out);
+    return NULL;
 }
 
-int zmqoutput_write_byte(Bit_stream_struc *bs, unsigned char data)
+void zmqoutput_queue(struct zmq_output *out, struct sink_frame *frame)
 {
-    zmqbuf[zmqbuf_len++] = data;
+    uint64_t head = out->head;
+    uint64_t tail = LOAD(&out->tail);
+    struct zmq_slot *s;
 
-    if (zmqbuf_len == bs->zmq_framesize) {
+    while (head - tail >= out->depth) {
+        struct zmq_slot oldest;
 
-        int frame_length = sizeof(struct zmq_frame_header) + zmqbuf_len;
+        if (out->drop_newest) {
+            count_drop(out);
+            return;
+        }
 
-        struct zmq_frame_header* header =
-            malloc(frame_length);
+        if (take_slot(out, tail, &oldest)) {
+            sink_frame_unref(oldest.frame);
+            count_drop(out);
+            break;
+        }
+        tail = LOAD(&out->tail);
+    }
 
-        uint8_t* txframe = ((uint8_t*)header) + sizeof(struct zmq_frame_header);
+    sink_frame_ref(frame);
+    s = &out->slots[head % out->depth];
+    STORE(&s->frame, frame);
+    STORE(&s->peak_left, zmq_peak_left);
+    STORE(&s->peak_right, zmq_peak_right);
+    STORE(&s->queued_us, deadline_now_us());
+    STORE(&out->head, head + 1);
 
-        header->version          = 1;
-        header->encoder          = ZMQ_ENCODER_TOOLAME;
-        header->datasize         = zmqbuf_len;
-        header->audiolevel_left  = zmq_peak_left;
-        header->audiolevel_right = zmq_peak_right;
+    tail = LOAD(&out->tail);
+    if (head + 1 - tail > out->queued_max)
+        STORE(&out->queued_max, head + 1 - tail);
 
-        memcpy(txframe, zmqbuf, zmqbuf_len);
+    sem_post(&out->ready);
+}
 
-        int send_error = zmq_send(bs->zmq_sock, header, frame_length,
-                ZMQ_DONTWAIT);
+void zmqoutput_close(struct zmq_output *out)
+{
+    struct zmq_output **p;
 
-        free(header);
-        header = NULL;
+    STORE(&out->stop, 1);
+    sem_post(&out->ready);
+    pthread_join(out->thread, NULL);
+    sem_destroy(&out->ready);
 
-        if (send_error < 0) {
-            fprintf(stderr, "ZeroMQ send failed! %s\n", zmq_strerror(errno));
+    for (p = &outputs; *p; p = &(*p)->next) {
+        if (*p == out) {
+            *p = out->next;
+            break;
         }
+    }
+
+    if (out->drops > 0)
+        fprintf(stderr, "ZeroMQ output %s dropped %llu frames\n", out->uris,
+                (unsigned long long)out->drops);
 
-        zmqbuf_len = 0;
+    zmq_close(out->sock);
+    zmq_sockets--;
 
-        return bs->zmq_framesize;
+    if (zmq_context && zmq_sockets == 0) {
+        zmq_ctx_destroy(zmq_context);
+        zmq_context = NULL;
     }
 
-    return 0;
+    free(out->slots);
+    free(out->uris);
+    free(out);
+}
+
+int zmqoutput_count(void)
+{
+    struct zmq_output *out;
+    int n = 0;
 
+    for (out = outputs; out; out = out->next)
+        n++;
+    return n;
 }
 
-void zmqoutput_close(Bit_stream_struc *bs)
+void zmqoutput_get_stats(int i, struct zmqoutput_stats *stats)
 {
-    if (bs->zmq_sock)
-        zmq_close(bs->zmq_sock);
+    struct zmq_output *out = outputs;
+    uint64_t head, tail;
 
-    if (zmq_context)
-        zmq_ctx_destroy(zmq_context);
+    while (i-- > 0 && out)
+        out = out->next;
+    memset(stats, 0, sizeof(*stats));
+    if (out == NULL)
+        return;
 
-    if (zmqbuf) {
-        free(zmqbuf);
-        zmqbuf = NULL;
-    }
-}
+    head = LOAD(&out->head);
+    tail = LOAD(&out->tail);
 
+    stats->uris = out->uris;
+    stats->queued = head > tail ? head - tail : 0;
+    stats->queued_max = LOAD(&out->queued_max);
+    stats->sent = LOAD(&out->sent);
+    stats->drops = LOAD(&out->drops);
+    stats->latency_sum_us = LOAD(&out->latency_sum_us);
+    stats->latency_max_us = LOAD(&out->latency_max_us);
+}
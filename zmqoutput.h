@@ -22,16 +22,54 @@ struct zmq_frame_header
 } __attribute__ ((packed));
 
 
-/* Open the zmq socket and connect it to all URIs in the list.
- * The URIs are semicolon delimited
+/* The frames of a ZMQ output are sent by a thread of its own, so that
+ * libzmq never holds up the encoder. The encoder hands the finished
+ * frames to it through a lock-free queue of ZMQ_QUEUE_DEFAULT frames
+ * by default. When the queue is full, either the oldest queued frame
+ * or the new one is dropped.
  */
-int zmqoutput_open(Bit_stream_struc * bs, const char* uri_list);
+#define ZMQ_QUEUE_DEFAULT 16
 
-int zmqoutput_write_byte(Bit_stream_struc *bs, unsigned char data);
+struct sink_frame;
+struct zmq_output;
 
-void zmqoutput_close(Bit_stream_struc *bs);
+/* Size of the queues and drop policy of the outputs opened afterwards */
+void zmqoutput_set_queue(int depth, int drop_newest);
+
+/* Open a zmq socket, connect it to all URIs in the list and start its
+ * sender thread. The URIs are semicolon delimited. Returns NULL on failure
+ */
+struct zmq_output *zmqoutput_open(const char* uri_list);
+
+/* Queue a frame for sending. Takes its own reference, never blocks.
+ * The frame is sent with the peaks given last to zmqoutput_set_peaks */
+void zmqoutput_queue(struct zmq_output *out, struct sink_frame *frame);
+
+/* Send the queued frames, stop the thread and close the socket */
+void zmqoutput_close(struct zmq_output *out);
 
 void zmqoutput_set_peaks(int left, int right);
 
+/* The peaks given last, which the shared-memory output sends too */
+void zmqoutput_get_peaks(int *left, int *right);
+
+/* Number of frames that were dropped or could not be sent, all outputs */
+unsigned long zmqoutput_get_drops(void);
+
+struct zmqoutput_stats {
+    const char *uris;
+    uint64_t queued;        // frames in the queue now
+    uint64_t queued_max;    // most frames that were in the queue
+    uint64_t sent;
+    uint64_t drops;         // dropped from the queue, or failed to send
+    uint64_t latency_sum_us; // from queueing to the end of zmq_send
+    uint64_t latency_max_us;
+};
+
+/* Number of open outputs, and their metrics. Safe to call while the
+ * sender threads run */
+int zmqoutput_count(void);
+void zmqoutput_get_stats(int i, struct zmqoutput_stats *stats);
+
 #endif
 